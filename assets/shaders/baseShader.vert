@@ -2,9 +2,26 @@
 #version 410 core
 layout (location = 0) in vec3 aPos;
 
+struct DirectLight {
+    vec3 direction; // Light direction
+    vec3 ambientColor;     // Light color
+    vec3 diffuseColor;     // Light color
+    vec3 specularColor;     // Light color
+    float intensity; // Light intensity
+};
+
+// 每帧一次写入的共享数据 (binding point: FrameBlockBinding = 0)
+// 布局需要和 C++ 端的 FrameBlockData 保持一致
+layout (std140) uniform FrameBlock {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    bool enableDepthMode;
+    bool useLight;
+    DirectLight directLight;   // 先用一个光源吧
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 out vec3 vPos;
 
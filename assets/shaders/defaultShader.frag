@@ -1,5 +1,9 @@
 
 #version 410 core
+#ifdef MATERIAL_STORAGE_BUFFER
+// GL 4.3 的context上material表是大小不固定的storage buffer (见MaterialTable)
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
 
 struct PointLight {
     vec3 position;
@@ -28,36 +32,60 @@ struct DirectLight {
     float intensity; // Light intensity
 };
 
-// 暂且仅用diffuse和specular
-struct Material {
-    float shininess;
+// 每帧一次写入的共享数据 (binding point: FrameBlockBinding = 0)
+// 布局需要和 C++ 端的 FrameBlockData 保持一致
+layout (std140) uniform FrameBlock {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    bool enableDepthMode;
+    bool useLight;
+    DirectLight directLight;   // 先用一个光源吧
+};
 
+// 暂且仅用diffuse和specular, 贴图由每个mesh自己绑定
+struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
+};
 
+// material参数表，每个物体通过MaterialIndex索引
+// 布局需要和 C++ 端的 MaterialEntryData 保持一致 (std140和std430下都是48字节)
+struct MaterialData {
     vec3 ambientColor;
+    float shininess;
     vec3 diffuseColor;
+    float ambientOcclusion;
     vec3 specularColor;
+    float padding0;
+};
 
-    float ambientOcclusion;
+#ifdef MATERIAL_STORAGE_BUFFER
+// binding在link之后设置 (MaterialStorageBinding)
+layout (std430) readonly buffer MaterialBuffer {
+    MaterialData materials[];
 };
+#else
+// 4.1: 容量与 MaxMaterialCount 一致
+#define MAX_MATERIAL_COUNT 256
+layout (std140) uniform MaterialBlock {
+    MaterialData materials[MAX_MATERIAL_COUNT];
+};
+#endif
 
-uniform vec3 viewPos;
+// per-instance的标志位，和 C++ 端的 InstanceFlag 一致
+const int INSTANCE_MULTI_MESH = 1;
+const int INSTANCE_REFLECTION = 2;
+const int INSTANCE_REFRACTION = 4;
+const int INSTANCE_FRESNEL    = 8;
+const int INSTANCE_OUTLINE    = 16;
+const int INSTANCE_ALPHA_TEST = 32;
 
 uniform bool useDiffuseTexture;
 uniform bool useSpecularTexture;
-uniform bool useLight;
-uniform bool enableDepthMode;
-uniform bool enableOutline;
-uniform bool isMultiMeshModel;
-
-uniform bool isReflection;
-uniform bool isRefraction;
-uniform bool isFresnel;
 uniform samplerCube skybox;
 
 uniform Material material;
-uniform DirectLight directLight;   // 先用一个光源吧
 uniform PointLight pointLight;
 uniform SpotLight spotLight;
 
@@ -66,6 +94,8 @@ out vec4 FragColor;
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoord;
+flat in int MaterialIndex;
+flat in int InstanceFlags;
 
 
 // Compute Fresnel using Schlick's approximation
@@ -78,7 +108,7 @@ float fresnelSchlick(float cosTheta, float IOR) {
 vec3 getFresnel() {
     // Constants
     const float IOR = 1.5;  // Index of Refraction for glass
-    vec3 glassColor = material.diffuseColor;  // Assuming white clear glass
+    vec3 glassColor = materials[MaterialIndex].diffuseColor;  // Assuming white clear glass
     vec3 viewDir = normalize(viewPos - FragPos);
 
     float cosTheta = dot(normalize(viewDir), normalize(Normal));
@@ -100,6 +130,13 @@ vec3 getFresnel() {
 
 void main()
 {
+    MaterialData mat = materials[MaterialIndex];
+    bool isMultiMeshModel = (InstanceFlags & INSTANCE_MULTI_MESH) != 0;
+    bool isReflection = (InstanceFlags & INSTANCE_REFLECTION) != 0;
+    bool isRefraction = (InstanceFlags & INSTANCE_REFRACTION) != 0;
+    bool isFresnel = (InstanceFlags & INSTANCE_FRESNEL) != 0;
+    bool enableOutline = (InstanceFlags & INSTANCE_OUTLINE) != 0;
+
     // 环境光
     // 漫反射
     vec3 norm = normalize(Normal);
@@ -118,26 +155,29 @@ void main()
 
         if(!isMultiMeshModel) {
             resultAlpha = diffuseTexSampler.a;
+            // 镂空贴图留在opaque layer，透明的部分不能写入深度
+            if((InstanceFlags & INSTANCE_ALPHA_TEST) != 0 && !enableOutline && resultAlpha < 0.5)
+                discard;
         }
 
         ambient = directLight.ambientColor * vec3(diffuseTexSampler);
         diffuse = directLight.diffuseColor * diff * vec3(diffuseTexSampler);
     } else {
-        ambient = directLight.ambientColor * material.ambientColor;
-        diffuse = directLight.diffuseColor * diff * material.diffuseColor;
+        ambient = directLight.ambientColor * mat.ambientColor;
+        diffuse = directLight.diffuseColor * diff * mat.diffuseColor;
     }
 
     // 镜面光
     vec3 viewDir = normalize(viewPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess * 128);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), mat.shininess * 128);
 
     vec3 specular;
     if(useSpecularTexture) {
         specular = directLight.specularColor * spec *
             vec3(texture(material.texture_specular1, TexCoord));
     } else {
-        specular = directLight.specularColor * spec * material.specularColor;
+        specular = directLight.specularColor * spec * mat.specularColor;
     }
 
     vec3 result;
@@ -1,23 +1,62 @@
 
 #version 410 core
 
+// VertexFormat::Packed时: aPos是AABB内的unorm16，aNormal.xy是八面体编码的snorm16，aTexCoords是half
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+// per-instance数据 (divisor = 1), 布局和 C++ 端的 InstanceData 一致
+layout (location = 3) in mat4 aInstanceModel;   // 占用 location 3~6
+layout (location = 7) in ivec2 aInstanceData;   // x: material index, y: flags
+layout (location = 8) in vec3 aInstancePositionOffset;  // Float格式时是(0,0,0)
+layout (location = 9) in vec3 aInstancePositionScale;   // Float格式时是(1,1,1)
+
+const int INSTANCE_PACKED_NORMAL = 64;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
+flat out int MaterialIndex;
+flat out int InstanceFlags;
+
+struct DirectLight {
+    vec3 direction; // Light direction
+    vec3 ambientColor;     // Light color
+    vec3 diffuseColor;     // Light color
+    vec3 specularColor;     // Light color
+    float intensity; // Light intensity
+};
+
+// 每帧一次写入的共享数据 (binding point: FrameBlockBinding = 0)
+// 布局需要和 C++ 端的 FrameBlockData 保持一致
+layout (std140) uniform FrameBlock {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    bool enableDepthMode;
+    bool useLight;
+    DirectLight directLight;   // 先用一个光源吧
+};
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    mat4 model = aInstanceModel;
+    vec3 localPos = aInstancePositionOffset + aPos * aInstancePositionScale;
+    bool packedNormal = (aInstanceData.y & INSTANCE_PACKED_NORMAL) != 0;
+    vec3 localNormal = packedNormal ? decodeOctahedral(aNormal.xy) : aNormal;
+    FragPos = vec3(model * vec4(localPos, 1.0));
+    Normal = mat3(transpose(inverse(model))) * localNormal;
     TexCoord = aTexCoords;
+    MaterialIndex = aInstanceData.x;
+    InstanceFlags = aInstanceData.y;
 
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+
+#version 410 core
+
+// 每个texel保存下一级2x2 (奇数尺寸时边上是2x3/3x3) 中最远的深度，保证遮挡测试是保守的
+layout (location = 0) out float FragDepth;
+
+uniform sampler2D sourceDepth;
+uniform int sourceLevel;
+uniform bool copyLevel;     // level 0: 直接从depth texture 1:1复制
+
+float fetchDepth(ivec2 coord, ivec2 sourceSize) {
+    return texelFetch(sourceDepth, min(coord, sourceSize - 1), sourceLevel).r;
+}
+
+void main()
+{
+    ivec2 dst = ivec2(gl_FragCoord.xy);
+    ivec2 sourceSize = textureSize(sourceDepth, sourceLevel);
+    if(copyLevel) {
+        FragDepth = fetchDepth(dst, sourceSize);
+        return;
+    }
+
+    ivec2 src = dst * 2;
+    float depth = max(max(fetchDepth(src, sourceSize), fetchDepth(src + ivec2(1, 0), sourceSize)),
+                      max(fetchDepth(src + ivec2(0, 1), sourceSize), fetchDepth(src + ivec2(1, 1), sourceSize)));
+
+    // 奇数尺寸时最后一列/行还要多包含一个texel
+    ivec2 dstSize = max(sourceSize / 2, ivec2(1));
+    bool extraX = (sourceSize.x & 1) != 0 && dst.x == dstSize.x - 1;
+    bool extraY = (sourceSize.y & 1) != 0 && dst.y == dstSize.y - 1;
+    if(extraX)
+        depth = max(depth, max(fetchDepth(src + ivec2(2, 0), sourceSize), fetchDepth(src + ivec2(2, 1), sourceSize)));
+    if(extraY)
+        depth = max(depth, max(fetchDepth(src + ivec2(0, 2), sourceSize), fetchDepth(src + ivec2(1, 2), sourceSize)));
+    if(extraX && extraY)
+        depth = max(depth, fetchDepth(src + ivec2(2, 2), sourceSize));
+
+    FragDepth = depth;
+}
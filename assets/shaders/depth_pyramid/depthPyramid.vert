@@ -0,0 +1,8 @@
+
+#version 410 core
+
+// 不需要顶点数据，用gl_VertexID生成一个盖住整个viewport的三角形
+void main(){
+    vec2 pos = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID & 2) * 2.0 - 1.0);
+    gl_Position = vec4(pos, 0.0, 1.0);
+}
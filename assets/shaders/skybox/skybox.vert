@@ -3,13 +3,30 @@
 
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 view;
-uniform mat4 projection;
+struct DirectLight {
+    vec3 direction; // Light direction
+    vec3 ambientColor;     // Light color
+    vec3 diffuseColor;     // Light color
+    vec3 specularColor;     // Light color
+    float intensity; // Light intensity
+};
+
+// 每帧一次写入的共享数据 (binding point: FrameBlockBinding = 0)
+// 布局需要和 C++ 端的 FrameBlockData 保持一致
+layout (std140) uniform FrameBlock {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    bool enableDepthMode;
+    bool useLight;
+    DirectLight directLight;   // 先用一个光源吧
+};
 
 out vec3 TexCoords;
 
 void main(){
     TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0f);
+    // 去掉view的位移，使天空盒vertices的尺寸的改变，不再影响渲染效果
+    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0f);
     gl_Position = pos.xyww; // note: set depth to 1.0f
 }
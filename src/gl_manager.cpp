@@ -4,8 +4,14 @@
 
 #include "gl_manager.hpp"
 
+#include <algorithm>
+
 
 const QVector3D CAMERA_POSITION(0.0f, 0.5f, 3.0f);
+const GLfloat CAMERA_NEAR_PLANE = 0.1f;
+const GLfloat CAMERA_FAR_PLANE = 200.0f;
+const GLfloat MAX_DELTA_TIME = 0.5f;    // 单位与deltaTime一致 (100ms)
+const qint64 MODEL_UPLOAD_BUDGET_MS = 4;    // 每帧用于上传异步导入的mesh的时间
 
 GLManager::GLManager(QWidget* parent, int width, int height)
     : QOpenGLWidget(parent)
@@ -19,6 +25,7 @@ GLManager::~GLManager() = default;
 void GLManager::initializeGL() {
     initConfigureVariables();
     initOpenGLSettings();
+    ResourceManager::initRenderResources();
     initFrameBufferSettings();
     initSkyBoxSettings();   // must init before initShader
     initShaders();    // shader
@@ -31,6 +38,9 @@ void GLManager::initializeGL() {
     m_camera = std::make_unique<Camera>(CAMERA_POSITION, defaultCameraMoveSpeed);
     coordinate = std::make_unique<Coordinate>();
     coordinate->initCoordinate();
+    renderQueue = std::make_unique<RenderQueue>();
+    depthPyramid = std::make_unique<DepthPyramid>();
+    modelLoader = std::make_unique<ModelLoader>();
 
     // start timer
     eTimer.start();
@@ -47,6 +57,7 @@ void GLManager::resizeGL(int w, int h) {
     fbo = new QOpenGLFramebufferObject(QSize(w, h),
                                        QOpenGLFramebufferObject::CombinedDepthStencil,
                                        GL_TEXTURE_2D, GL_RGB);
+    projectionDirty = GL_TRUE;
 }
 
 void GLManager::paintGL() {
@@ -54,8 +65,13 @@ void GLManager::paintGL() {
     GLfloat currentFrame = (GLfloat)eTimer.elapsed() / 100;
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
+    // idle之后的第一帧deltaTime会很大，限制一下，避免相机瞬移
+    deltaTime = std::min(deltaTime, MAX_DELTA_TIME);
+    // 要在handleInput/updateRenderData清掉dirty标记之前判断
+    const GLboolean frameChanged = hasPendingChanges();
 
     this->handleInput(deltaTime);
+    this->processPendingLoads();
     this->updateRenderData();
 
     if(postProcessingType == PostProcessingType::NORMAL) {
@@ -63,6 +79,11 @@ void GLManager::paintGL() {
     } else {
         drawObjectsWithPostProcessing();
     }
+    if(frameChanged)
+        occlusionSettleBuild = depthPyramid->getBuildSerial();
+    ResourceManager::endUploadFrame();
+
+    lastSceneRevision = GameObject::getSceneRevision();
 }
 
 // for coordinate and stencil testing
@@ -70,6 +91,8 @@ void GLManager::initShaders() {
     ResourceManager::loadShader("defaultShader",
                                 ":/shaders/assets/shaders/defaultShader.vert",
                                 ":/shaders/assets/shaders/defaultShader.frag");
+    // 和GameObject共用同一个program，天空盒固定在31号纹理单元
+    ResourceManager::getShader("defaultShader")->use().setInteger(UniformId::Skybox, 31);
 
     // coordinate
     ResourceManager::loadShader("coordShader",
@@ -85,7 +108,7 @@ void GLManager::initShaders() {
     ResourceManager::loadShader("postProcessingShader",
                                 ":/shaders/assets/shaders/post_processing/postProcessing.vert",
                                 ":/shaders/assets/shaders/post_processing/postProcessing.frag");
-    ResourceManager::getShader("postProcessingShader")->use().setInteger("screenTexture", 0);
+    ResourceManager::getShader("postProcessingShader")->use().setInteger(UniformId::ScreenTexture, 0);
 
     // reflection & refraction
 //    ResourceManager::loadShader("reflectionShader",
@@ -104,57 +127,56 @@ void GLManager::initShaders() {
 void GLManager::initShaderValue() {
     initLightInfo();    // 要在shaderInit之前
 
-    // coordinate matrix configuration （因为坐标位置是不变的）
+    // coordinate matrix configuration （因为坐标位置是不变的，只需要设置一次）
     QMatrix4x4 model;
     model.setToIdentity();
-    model.scale(10.0f);
-    ResourceManager::getShader("coordShader")->use().setMatrix4f("model", model);
+    ResourceManager::getShader("coordShader")->use().setMatrix4f(UniformId::Model, model);
 }
 
+// 只上传改变了的数据: camera没动、配置没改的时候frame block不会重新上传
 void GLManager::updateRenderData() {
-    if(this->isLineMode)
-        glFunc->glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    else
-        glFunc->glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    if(renderConfigDirty) {
+        if(this->isLineMode)
+            glFunc->glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        else
+            glFunc->glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
 
+    // post processing 会改clear color，所以每帧都要设置
     glFunc->glClearColor(backGroundColor.x(),
                          backGroundColor.y(),
                          backGroundColor.z(), 1.0f);
     glFunc->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    projection.setToIdentity();
-    projection.perspective(m_camera->zoom, (GLfloat)width() / (GLfloat)height(), 0.1f, 200.f);
-    view = m_camera->getViewMatrix();
+    GLboolean frameDirty = GL_FALSE;
+    if(projectionDirty || m_camera->isDirty()) {
+        projection.setToIdentity();
+        projection.perspective(m_camera->zoom, (GLfloat)width() / (GLfloat)height(), CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+        view = m_camera->getViewMatrix();
+        frustum.update(projection * view);
+
+        // camera / render configure / light 写进frame block，所有shader共用
+        ResourceManager::updateFrameCamera(projection, view, m_camera->position);
+        m_camera->clearDirty();
+        projectionDirty = GL_FALSE;
+        frameDirty = GL_TRUE;
+    }
+
+    if(renderConfigDirty) {
+        ResourceManager::updateFrameRenderConfigure(depthMode);
+        // TODO：灯光管理太烂了。等后面来优化。光没准可以定义成全局变量
+        ResourceManager::updateFrameDirectLight(isLighting, directLight);
+        renderConfigDirty = GL_FALSE;
+        frameDirty = GL_TRUE;
+    }
 
-    ResourceManager::updateProjViewViewPosMatrixInShader(projection, view, m_camera->position);
-    ResourceManager::updateRenderConfigure(depthMode);
+    if(frameDirty)
+        ResourceManager::uploadFrameUniforms();
+    ResourceManager::uploadMaterials();    // 只有被修改过的material才会上传
 
-    // TODO：灯光管理太烂了。等后面来优化。光没准可以定义成全局变量
-    ResourceManager::updateDirectLightInShader(isLighting, directLight);
+    // skybox 的view在skybox.vert里去掉位移 (mat4(mat3(view)))
 
-    // coordinate
-    QMatrix4x4 tempM;
-    tempM.setToIdentity();
-    ResourceManager::getShader("coordShader")->use().setMatrix4f("model", tempM);
-
-    // skybox (这个要单独设置)
-    QMatrix4x4 skyboxView;
-    skyboxView.setRow(0, QVector4D(view(0, 0), view(0, 1), view(0, 2), 0.0f));
-    skyboxView.setRow(1, QVector4D(view(1, 0), view(1, 1), view(1, 2), 0.0f));
-    skyboxView.setRow(2, QVector4D(view(2, 0), view(2, 1), view(2, 2), 0.0f));
-    skyboxView.setRow(3, QVector4D(0.0f,0.0f, .0f, .0f)); //这个去掉位移的4x4矩阵，使天空盒vertices的尺寸的改变，不再影响渲染效果
-    ResourceManager::getShader("skybox")->use().setMatrix4f("view", skyboxView);
-    ResourceManager::getShader("skybox")->use().setMatrix4f("projection", projection);
-
-    // 为管理的objects设置model
-    for(auto & i : objectMap) {
-        auto& tempShader = ResourceManager::getShader(i.second->getShaderName())->use();
-        tempShader.setMatrix4f("model", i.second->getTransform());
-
-        // 为了cullMode change的一个bug
-        ResourceManager::updateMaterialInShader(i.second->getShaderName(), i.second->getMaterial());
-        tempShader.release();
-    }
+    // objects共用同一个program，model和material在GameObject::draw里设置
 }
 
 /********* Object Manager Functions *********/
@@ -163,7 +185,53 @@ void GLManager::drawObjects() {
     coordinate->drawCoordinate();
     ResourceManager::getShader("coordShader")->release();
 
+    // 收集视锥内物体的mesh，按状态和深度排序 (不透明从近到远，透明从远到近)
+    renderQueue->begin(m_camera->position, CAMERA_FAR_PLANE, projection(1, 1) * (GLfloat)height() * 0.5f);
+    renderQueue->setCullingFrustum(frustum);
+    if(renderQueue->isGpuCullingActive()) {
+        // opaque常驻在GPU上，只在场景结构变化时重新提交；物体没有变化的帧CPU不需要遍历场景
+        if(!renderQueue->isOpaqueResident() || residentRevision != GameObject::getStructureRevision()) {
+            renderQueue->beginResident();
+            perFrameObjects.clear();
+            for(auto& item : objectMap) {
+                item.second->collectResidentPackets(*renderQueue);
+                if(item.second->hasPerFramePackets())
+                    perFrameObjects.push_back(item.second.get());
+            }
+            renderQueue->endResident();
+            residentRevision = GameObject::getStructureRevision();
+        } else {
+            // 只是移动或者改了可见性的物体，更新它们在常驻场景里的那几段
+            for(GameObject* obj : GameObject::getInstanceDirtyObjects())
+                renderQueue->updateResident(obj);
+        }
+        for(GameObject* obj : perFrameObjects)
+            obj->collectDrawPackets(*renderQueue, frustum);
+    } else {
+        sceneBVH.queryFrustum(frustum, [&](int proxyID) {
+            auto obj = static_cast<GameObject*>(sceneBVH.getUserData(proxyID));
+            obj->collectDrawPackets(*renderQueue, frustum);
+            return true;
+        });
+    }
+    GameObject::clearInstanceDirtyObjects();
+    renderQueue->sort();
+
     // 先绘制不透明物体
+    renderQueue->drawLayer(RenderLayer::Opaque);
+
+    // 只用opaque的深度 (透明物体和outline不能当遮挡物)，下一帧的GPU剔除和CPU可见性查询都用它
+    const QMatrix4x4 cullViewProjection = depthPyramid->getViewProjection();   // 这一帧剔除用的是上一帧的pyramid
+    depthPyramid->build(projection * view);
+    occlusionStale = renderQueue->isGpuCullingActive() && cullViewProjection != depthPyramid->getViewProjection();
+#ifdef GL_CORE_4_3
+    if(GpuCulling* culling = renderQueue->getGpuCulling()) {
+        culling->setDepthPyramid(depthPyramid->getTexture(), depthPyramid->getWidth(), depthPyramid->getHeight(),
+                                 depthPyramid->getLevelCount(), depthPyramid->getViewProjection());
+    }
+#endif
+
+    // 天空盒放在不透明物体之后，被遮挡的部分可以直接被深度测试剔除
     if(enableSkybox == GL_TRUE) {
         glFunc->glDepthFunc(GL_LEQUAL);
         ResourceManager::getShader("skybox")->use();
@@ -171,30 +239,11 @@ void GLManager::drawObjects() {
         glFunc->glDepthFunc(GL_LESS);
     }
 
-    for(auto & i : objectMap) {
-        if(!i.second->containTransparencyTexture)
-            i.second->draw();
-    }
-
-    std::vector<std::pair<float, unsigned int>> distVec;
-    distVec.clear();
-    for(auto &i : objectMap) {
-        if(i.second->containTransparencyTexture) {
-            float dist = m_camera->position.distanceToPoint(i.second->getPosition());
-            distVec.emplace_back(dist, i.first);
-        }
-    }
-
-    // 从远到近排序
-    std::sort(distVec.begin(), distVec.end(),
-              [](const auto& lhs, const auto& rhs) {
-                  return lhs.first > rhs.first;
-              });
-
     // 从远到近绘制透明物体
-    for(auto & it : distVec) {
-        objectMap[it.second]->draw();
-    }
+    renderQueue->drawLayer(RenderLayer::Transparent);
+
+    // outline 最后画 (关闭深度测试，只画stencil之外的部分)
+    renderQueue->drawLayer(RenderLayer::Outline);
 }
 
 void GLManager::drawObjectsWithPostProcessing() {
@@ -214,29 +263,7 @@ void GLManager::drawObjectsWithPostProcessing() {
     glFunc->glClear(GL_COLOR_BUFFER_BIT);
 
     const Shader &tempShader = ResourceManager::getShader("postProcessingShader")->use();
-    switch (postProcessingType) {
-        case PostProcessingType::NORMAL:
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::NORMAL);
-            break;
-        case PostProcessingType::INVERSION :
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::INVERSION);
-            break;
-        case PostProcessingType::GRAY:
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::GRAY);
-            break;
-        case PostProcessingType::SHARPEN:
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::SHARPEN);
-            break;
-        case PostProcessingType::BLUR:
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::BLUR);
-            break;
-        case PostProcessingType::EDGE:
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::EDGE);
-            break;
-        case PostProcessingType::SCAN:
-            tempShader.setInteger("postProcessingType", (int)PostProcessingType::SCAN);
-            break;
-    }
+    tempShader.setInteger(UniformId::PostProcessingType, (int)postProcessingType);
 
     glFunc->glBindTexture(GL_TEXTURE_2D, fbo->texture()); //绑定fbo缓冲所生成的纹理ID
     postProcessingScreen->draw();
@@ -244,6 +271,9 @@ void GLManager::drawObjectsWithPostProcessing() {
 }
 
 void GLManager::clearObjects() {
+    for(auto& item : pendingModelLoads)
+        item.second->cancel();
+    pendingModelLoads.clear();
     objectMap.clear();
     qDebug() << "Clear ALL Objects";
 }
@@ -259,6 +289,7 @@ int GLManager::addObject(const QString& mPath) {
     std::shared_ptr<GameObject> tempPtr;
     tempPtr = std::make_shared<GameObject>(mPath);
     GLuint tempID = tempPtr->getObjectID();
+    tempPtr->attachSpatialIndex(&sceneBVH);
     objectMap[tempID] = tempPtr;
 
     qDebug() << "Add Model Object, Path: " << mPath;
@@ -267,6 +298,59 @@ int GLManager::addObject(const QString& mPath) {
     return (int)tempID;
 }
 
+int GLManager::addObjectAsync(const QString& mPath) {
+    if(mPath.isEmpty()) {
+        qDebug() << "Please Give Model Type a Model Path!";
+        return -1;
+    }
+
+    this->makeCurrent();
+    std::shared_ptr<GameObject> tempPtr = std::make_shared<GameObject>();
+    tempPtr->beginAsyncLoad(mPath);
+    GLuint tempID = tempPtr->getObjectID();
+    tempPtr->attachSpatialIndex(&sceneBVH);
+    objectMap[tempID] = tempPtr;
+
+    pendingModelLoads[tempID] = modelLoader->load(mPath);
+    this->doneCurrent();
+
+    qDebug() << "Add Model Object (async), Path: " << mPath;
+    return (int)tempID;
+}
+
+void GLManager::setModelLoadCallback(std::function<void(int, float)> callback) {
+    modelLoadCallback = std::move(callback);
+}
+
+// paintGL里调用，context已经是current
+void GLManager::processPendingLoads() {
+    if(pendingModelLoads.empty())
+        return;
+
+    modelLoader->pump(MODEL_UPLOAD_BUDGET_MS);
+
+    for(auto it = pendingModelLoads.begin(); it != pendingModelLoads.end();) {
+        GLuint id = it->first;
+        const std::shared_ptr<ModelLoadTask>& task = it->second;
+
+        auto obj = objectMap.find(id);
+        if(task->getState() == ModelLoadTask::State::Finished && obj != objectMap.end()) {
+            obj->second->setModelMeshes(task->getMeshes());
+            qDebug() << "Model Loaded, ID: " << id << ", Path: " << task->getPath();
+        } else if(task->getState() == ModelLoadTask::State::Failed && obj != objectMap.end()) {
+            objectMap.erase(obj);
+        }
+
+        if(modelLoadCallback)
+            modelLoadCallback((int)id, task->getProgress());
+
+        if(task->isDone())
+            it = pendingModelLoads.erase(it);
+        else
+            ++it;
+    }
+}
+
 int GLManager::addObject(ObjectType objType, float width, float height) {
     this->makeCurrent();
     if(objType == ObjectType::Model) {
@@ -278,6 +362,7 @@ int GLManager::addObject(ObjectType objType, float width, float height) {
     GLuint tempID = tempPtr->getObjectID();
 
     tempPtr->displayName = objectTypeToString(objType) + " - " + QString::number(tempID);
+    tempPtr->attachSpatialIndex(&sceneBVH);
     objectMap[tempID] = tempPtr;
 
     this->doneCurrent();
@@ -292,8 +377,12 @@ void GLManager::deleteObject(GLuint id) {
     }
 
     auto tempObj = objectMap[id];
-    ResourceManager::map_Shaders.erase("shader_" + QString::number(id));
     qDebug() << "Delete Object, ID: " << id << ", Name: " << tempObj->displayName;
+    auto pending = pendingModelLoads.find(id);
+    if(pending != pendingModelLoads.end()) {
+        pending->second->cancel();
+        pendingModelLoads.erase(pending);
+    }
     objectMap.erase(id);
     tempObj = nullptr;
 
@@ -304,6 +393,49 @@ const std::map<GLuint, std::shared_ptr<GameObject>>& GLManager::getAllGameObject
     return objectMap;
 }
 
+int GLManager::pickObject(const QPoint& pos) {
+    if(!m_camera)
+        return -1;
+
+    // 窗口坐标 -> NDC -> 世界空间的射线
+    float ndcX = 2.0f * (float)pos.x() / (float)width() - 1.0f;
+    float ndcY = 1.0f - 2.0f * (float)pos.y() / (float)height();
+
+    bool invertible = false;
+    QMatrix4x4 invViewProj = (projection * view).inverted(&invertible);
+    if(!invertible)
+        return -1;
+    QVector3D nearPoint = invViewProj.map(QVector3D(ndcX, ndcY, -1.0f));
+    QVector3D farPoint = invViewProj.map(QVector3D(ndcX, ndcY, 1.0f));
+    QVector3D direction = (farPoint - nearPoint).normalized();
+
+    int pickedID = -1;
+    sceneBVH.rayCast(nearPoint, direction, CAMERA_PICK_DISTANCE, [&](int proxyID, float maxDistance) {
+        auto obj = static_cast<GameObject*>(sceneBVH.getUserData(proxyID));
+        float t = maxDistance;
+        if(!obj->getVisible() || !obj->intersectRay(nearPoint, direction, maxDistance, t))
+            return maxDistance;
+        pickedID = (int)obj->getObjectID();
+        return t;
+    });
+
+    return pickedID;
+}
+
+int GLManager::findNearestObject(const QVector3D& point, float maxDistance) {
+    int proxyID = sceneBVH.queryNearest(point, maxDistance, [&](int proxy) {
+        auto obj = static_cast<GameObject*>(sceneBVH.getUserData(proxy));
+        return obj->distanceToPoint(point);
+    });
+    if(proxyID == DynamicBVH::NullNode)
+        return -1;
+    return (int)static_cast<GameObject*>(sceneBVH.getUserData(proxyID))->getObjectID();
+}
+
+void GLManager::setObjectPickedCallback(std::function<void(int)> callback) {
+    objectPickedCallback = std::move(callback);
+}
+
 std::shared_ptr<GameObject> GLManager::getTargetGameObject(GLuint id) {
     if(objectMap.find(id) == objectMap.end()) {
         qDebug() << "Not Found Object to Get, ID: " << id;
@@ -315,14 +447,17 @@ std::shared_ptr<GameObject> GLManager::getTargetGameObject(GLuint id) {
 
 void GLManager::setEnableLighting(GLboolean enableLighting) {
     isLighting = enableLighting;
+    renderConfigDirty = GL_TRUE;
 }
 
 void GLManager::setLineMode(GLboolean enableLineMode) {
     this->isLineMode = enableLineMode;
+    renderConfigDirty = GL_TRUE;
 }
 
 void GLManager::setDepthMode(GLboolean depMode) {
     this->depthMode = depMode;
+    renderConfigDirty = GL_TRUE;
 }
 
 void GLManager::setCullMode(CullModeType type) {
@@ -340,13 +475,16 @@ void GLManager::setCullMode(CullModeType type) {
         glFunc->glCullFace(GL_FRONT_AND_BACK);
     }
     doneCurrent();
+    renderConfigDirty = GL_TRUE;
 }
 
 void GLManager::setPostProcessingType(PostProcessingType type) {
     this->postProcessingType = type;
+    renderConfigDirty = GL_TRUE;
 }
 
 void GLManager::setSkyboxPath(SkyboxType type) {
+    renderConfigDirty = GL_TRUE;
     if(type == SkyboxType::Disable) {
         enableSkybox = GL_FALSE;
     } else if(type == SkyboxType::Mountain){    //山水
@@ -376,6 +514,37 @@ void GLManager::setSkyboxPath(SkyboxType type) {
     }
 }
 
+void GLManager::setIdleMode(GLboolean enable) {
+    isIdleMode = enable;
+}
+
+GLboolean GLManager::needsRepaint() const {
+    if(!isIdleMode || !m_camera)
+        return GL_TRUE;
+
+    // 视角变化的最后一帧是用旧的Hi-Z剔除的，要再画一帧；PBO读回也只在build的时候收集
+    const GLboolean occlusionPending = occlusionStale ||
+                                       (depthPyramid && depthPyramid->getReadbackSerial() < occlusionSettleBuild);
+    return hasPendingChanges() || occlusionPending;
+}
+
+GLboolean GLManager::hasPendingChanges() const {
+    return isMoveKeyDown() ||
+           m_camera->isDirty() ||
+           renderConfigDirty ||
+           projectionDirty ||
+           !pendingModelLoads.empty() ||
+           lastSceneRevision != GameObject::getSceneRevision();
+}
+
+GLuint64 GLManager::getSubmittedTriangleCount() const {
+    return renderQueue ? renderQueue->getTriangleCount() : 0;
+}
+
+const DepthPyramid* GLManager::getDepthPyramid() const {
+    return depthPyramid.get();
+}
+
 void GLManager::checkGLVersion() {
     QOpenGLContext* context = QOpenGLContext::currentContext();
     if (context) {
@@ -398,6 +567,15 @@ void GLManager::initConfigureVariables() {
     // post processing
     postProcessingType = PostProcessingType::NORMAL;
 
+    // 第一帧需要全部上传
+    isIdleMode = GL_TRUE;
+    renderConfigDirty = GL_TRUE;
+    projectionDirty = GL_TRUE;
+    lastSceneRevision = 0;
+    occlusionStale = GL_FALSE;
+    occlusionSettleBuild = 0;
+    residentRevision = 0;
+
     defaultCameraMoveSpeed = 0.2f;
     shiftDown = GL_FALSE;
     isFirstMouse = GL_TRUE;
@@ -478,7 +656,7 @@ void GLManager::initSkyBoxSettings() {
 
     ResourceManager::loadShader("skybox", ":/shaders/assets/shaders/skybox/skybox.vert",
                                 ":/shaders/assets/shaders/skybox/skybox.frag");
-    ResourceManager::getShader("skybox")->use().setInteger("skybox", 31);
+    ResourceManager::getShader("skybox")->use().setInteger(UniformId::Skybox, 31);
 }
 
 /********* Event Functions *********/
@@ -531,6 +709,10 @@ void GLManager::mousePressEvent(QMouseEvent *event) {
     if(event->button() == Qt::RightButton) {
         m_camera->movementSpeed *= 3.0f;
         isRightMousePress = GL_TRUE;;
+    } else if(event->button() == Qt::LeftButton) {
+        int id = pickObject(event->pos());
+        if(id != -1 && objectPickedCallback)
+            objectPickedCallback(id);
     }
 }
 
@@ -541,6 +723,12 @@ void GLManager::mouseReleaseEvent(QMouseEvent *event) {
     }
 }
 
+GLboolean GLManager::isMoveKeyDown() const {
+    return keys[Qt::Key_W] || keys[Qt::Key_S] ||
+           keys[Qt::Key_A] || keys[Qt::Key_D] ||
+           keys[Qt::Key_E] || keys[Qt::Key_Q];
+}
+
 void GLManager::handleInput(GLfloat dt) {
     if (keys[Qt::Key_W])
         m_camera->handleKeyboard(CameraMove::FORWARD, dt);
@@ -5,6 +5,7 @@
 #ifndef DATA_STRUCTURES_HPP
 #define DATA_STRUCTURES_HPP
 
+#include <cstddef>
 #include <QVector2D>
 #include <QVector3D>
 #include <QMatrix4x4>
@@ -27,6 +28,14 @@ struct Vertex {
         : position(pos), normal(nor), texCoord(tex) {}
 };
 
+// VertexFormat::Packed在GPU上的布局，由VertexPacking::pack生成，defaultShader.vert里还原
+struct PackedVertex {
+    quint16 position[4];    // unorm16，相对mesh AABB，第4个分量只是补齐
+    qint16 normal[2];       // snorm16，八面体编码
+    quint16 texCoord[2];    // half float
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex should be 16 bytes");
+
 struct DirectLight {
     QVector3D direction; // Light direction
     QVector3D ambientColor;     // Light color
@@ -126,6 +135,42 @@ struct Material {
           ambientOcclusion(0.25) {}
 };
 
+// std140布局的FrameBlock (见 defaultShader / baseShader / skybox)
+// 每帧由ResourceManager填好之后整块上传一次
+struct FrameBlockData {
+    GLfloat projection[16];
+    GLfloat view[16];
+    GLfloat viewPos[3];
+    GLint enableDepthMode;          // GLSL bool 在std140里占4字节
+    GLint useLight;
+    GLint padding0[3];              // struct需要按16字节对齐
+
+    GLfloat lightDirection[4];      // vec3 + padding
+    GLfloat lightAmbientColor[4];
+    GLfloat lightDiffuseColor[4];
+    GLfloat lightSpecularColor[3];
+    GLfloat lightIntensity;
+};
+static_assert(offsetof(FrameBlockData, view) == 64, "FrameBlock std140 layout mismatch");
+static_assert(offsetof(FrameBlockData, viewPos) == 128, "FrameBlock std140 layout mismatch");
+static_assert(offsetof(FrameBlockData, enableDepthMode) == 140, "FrameBlock std140 layout mismatch");
+static_assert(offsetof(FrameBlockData, useLight) == 144, "FrameBlock std140 layout mismatch");
+static_assert(offsetof(FrameBlockData, lightDirection) == 160, "FrameBlock std140 layout mismatch");
+static_assert(offsetof(FrameBlockData, lightSpecularColor) == 208, "FrameBlock std140 layout mismatch");
+static_assert(offsetof(FrameBlockData, lightIntensity) == 220, "FrameBlock std140 layout mismatch");
+static_assert(sizeof(FrameBlockData) == 224, "FrameBlock std140 layout mismatch");
+
+// MaterialBlock里的一项 (std140, vec3 + float 共用16字节)
+struct MaterialEntryData {
+    GLfloat ambientColor[3];
+    GLfloat shininess;
+    GLfloat diffuseColor[3];
+    GLfloat ambientOcclusion;
+    GLfloat specularColor[3];
+    GLfloat padding0;
+};
+static_assert(sizeof(MaterialEntryData) == 48, "MaterialBlock std140 layout mismatch");
+
 
 /*
 Name	Ambient	                Diffuse	                Specular	                Shininess
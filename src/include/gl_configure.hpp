@@ -9,9 +9,11 @@
 #if defined(Q_OS_MAC)
 #include <QOpenGLFunctions_4_1_Core>  // Mac-specific version
 using GLFunctions_Core = QOpenGLFunctions_4_1_Core;
-#elif defined(Q_OS_WIN)
-#include <QOpenGLFunctions_4_3_Core>  // Windows-specific version
+#elif defined(Q_OS_WIN) || defined(Q_OS_LINUX)
+#include <QOpenGLFunctions_4_3_Core>  // Windows / Linux (Mesa, 包括测试用的llvmpipe)
 using GLFunctions_Core = QOpenGLFunctions_4_3_Core;
+// 4.3才有的函数 (glInvalidateBufferSubData, compute shader, multi draw indirect...) 用这个宏包起来
+#define GL_CORE_4_3
 #endif
 
 
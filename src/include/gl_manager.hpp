@@ -5,6 +5,7 @@
 #ifndef GL_MANAGER_HPP
 #define GL_MANAGER_HPP
 
+#include <functional>
 #include <QElapsedTimer>
 #include <QOpenGLFramebufferObject>
 #include <QOpenGLWidget>
@@ -17,12 +18,19 @@
 #include "object/game_object.hpp"
 
 #include "utils/camera.hpp"
+#include "utils/dynamic_bvh.hpp"
+#include "utils/model_loader.hpp"
 #include "utils/resource_manager.hpp"
 
 #include "post_processing/post_process_screen.hpp"
+#include "render/depth_pyramid.hpp"
+#include "render/frustum.hpp"
+#include "render/render_queue.hpp"
 #include "skybox/sky_box.hpp"
 
 
+const GLfloat CAMERA_PICK_DISTANCE = 200.0f;
+
 class GLManager : public QOpenGLWidget {
    public:
     explicit GLManager(QWidget* parent = nullptr, int width = 500,
@@ -33,11 +41,21 @@ class GLManager : public QOpenGLWidget {
     void clearObjects();
     int addObject(const QString& mPath = "");
     int addObject(ObjectType objType, float width = 0.0f, float height = 0.0f);
+    // 异步导入模型: 立即返回占位物体的id，导入完成后物体才会出现在场景里
+    int addObjectAsync(const QString& mPath);
+    // 导入进度回调 (id, progress): progress为0~1，1表示完成，-1表示失败 (占位物体已被删除)
+    void setModelLoadCallback(std::function<void(int, float)> callback);
 
     void deleteObject(GLuint id);
     [[nodiscard]] const std::map<GLuint, std::shared_ptr<GameObject>>& getAllGameObjectMap() const;
     std::shared_ptr<GameObject> getTargetGameObject(GLuint id);
 
+    // picking: 窗口坐标 -> 最近的被射线击中的物体id，没有则返回-1
+    int pickObject(const QPoint& pos);
+    int findNearestObject(const QVector3D& point, float maxDistance = CAMERA_PICK_DISTANCE);
+    // 左键点击选中物体时回调 (MainWindow用来同步列表)
+    void setObjectPickedCallback(std::function<void(int)> callback);
+
     // configure setter
     void setEnableLighting(GLboolean enableLighting);
     void setLineMode(GLboolean enableLineMode);
@@ -47,6 +65,16 @@ class GLManager : public QOpenGLWidget {
 
     void setSkyboxPath(SkyboxType type);
 
+    // idle mode: 场景没有变化时跳过重绘 (MainWindow的timer先问needsRepaint)
+    // 停下来之后还会多画几帧，直到遮挡剔除和Hi-Z的读回都跟上最后一次变化
+    void setIdleMode(GLboolean enable);
+    [[nodiscard]] GLboolean needsRepaint() const;
+
+    // 上一帧实际提交的三角形数量 (按各mesh选中的LOD)，GPU剔除时opaque部分是几帧之前读回的
+    [[nodiscard]] GLuint64 getSubmittedTriangleCount() const;
+    // 最近一帧opaque深度的Hi-Z，isOccluded用异步读回的数据，不会等待GPU
+    [[nodiscard]] const DepthPyramid* getDepthPyramid() const;
+
    protected:
     void initializeGL() override;
     void resizeGL(int w, int h) override;
@@ -62,6 +90,9 @@ class GLManager : public QOpenGLWidget {
    private: // control functions...
     void handleInput(GLfloat dt);
     void updateRenderData();
+    void processPendingLoads();
+    [[nodiscard]] GLboolean isMoveKeyDown() const;
+    [[nodiscard]] GLboolean hasPendingChanges() const;     // 相机/配置/场景有没有变化
     static void checkGLVersion();
 
    private:  // functions
@@ -79,12 +110,21 @@ class GLManager : public QOpenGLWidget {
 
    private: // objects member variables
     const QString modelDirectory = "../assets/models";
+    // 场景物体的BVH，用于视锥剔除和picking (必须声明在objectMap之前，GameObject析构时会从里面移除自己)
+    DynamicBVH sceneBVH;
     std::map<GLuint, std::shared_ptr<GameObject>> objectMap;
+    std::function<void(int)> objectPickedCallback;
+
+    std::unique_ptr<ModelLoader> modelLoader;
+    std::map<GLuint, std::shared_ptr<ModelLoadTask>> pendingModelLoads;     // 占位物体id -> 导入任务
+    std::function<void(int, float)> modelLoadCallback;
 
    private:  // key variables
     GLFunctions_Core* glFunc = nullptr;
     std::unique_ptr<Camera> m_camera;
     std::unique_ptr<Coordinate> coordinate;
+    std::unique_ptr<RenderQueue> renderQueue;
+    std::unique_ptr<DepthPyramid> depthPyramid;     // 这一帧opaque的深度，下一帧用来做遮挡剔除
 
     // frameBuffer variables
     QOpenGLFramebufferObject *fbo;
@@ -109,6 +149,16 @@ class GLManager : public QOpenGLWidget {
 
     DirectLight directLight;
 
+   private:  // dirty tracking
+    GLboolean isIdleMode;
+    GLboolean renderConfigDirty;    // lighting / line mode / depth mode / skybox ...
+    GLboolean projectionDirty;      // resize
+    GLuint64 lastSceneRevision;
+    GLboolean occlusionStale;       // 这一帧的GPU剔除用的是旧视角的Hi-Z，新露出来的物体可能被剔除了
+    quint64 occlusionSettleBuild;   // 最后一次有变化的帧生成的pyramid，读回之前不能停下
+    GLuint64 residentRevision;      // 常驻的opaque场景对应的structure revision
+    std::vector<GameObject*> perFrameObjects;   // 有transparent或outline的物体，GPU剔除时每帧只收集这些
+
    private:  // control variables
     GLboolean keys[1024];
     GLboolean shiftDown;
@@ -124,6 +174,7 @@ class GLManager : public QOpenGLWidget {
 
     QMatrix4x4 projection;
     QMatrix4x4 view;
+    Frustum frustum;    // 随projection/view一起更新
 
    private: // for test
     // std::shared_ptr<GameObject> testGameObject;
@@ -56,6 +56,19 @@ enum class TextureType {
     UNKNOWN
 };
 
+// GPU上的顶点布局
+enum class VertexFormat {
+    Float,      // Vertex原样上传，32字节
+    Packed      // PackedVertex，16字节: 位置在AABB内量化到16位，法线八面体编码，uv半精度
+};
+
+// 贴图的alpha分类，加载时扫描一次
+enum class AlphaMode {
+    Opaque,     // alpha全是255
+    Masked,     // 只有0和255，用alpha test即可，不需要混合和排序
+    Blended     // 有半透明像素
+};
+
 enum class CullModeType {
     Disable,
     Front,
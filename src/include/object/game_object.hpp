@@ -11,6 +11,9 @@
 #include "util_algorithms.hpp"
 #include "resource_manager.hpp"
 #include "data_structures.hpp"
+#include "render/frustum.hpp"
+#include "render/render_queue.hpp"
+#include "utils/dynamic_bvh.hpp"
 
 
 class GameObject {
@@ -20,10 +23,29 @@ class GameObject {
     explicit GameObject(const QString& mPath, const QString& disName = "GameObject");
     ~GameObject();
 
-    void draw();
+    // 把可见的mesh提交到render queue，实际绘制由RenderQueue完成
+    // 先用物体整体的bounds做视锥剔除，再逐个mesh剔除
+    void collectDrawPackets(RenderQueue& queue, const Frustum& frustum);
+    // 常驻的opaque layer (见RenderQueue::beginResident): 不做剔除和LOD选择，structure revision变化时才调用
+    // 隐藏的物体也提交，可见性只是instance数据
+    void collectResidentPackets(RenderQueue& queue);
+    // transparent和outline仍然每帧collectDrawPackets
+    [[nodiscard]] GLboolean hasPerFramePackets() const;
+    // program是共享的，per-object的状态通过instance数据传给shader (见InstanceFlag)
+    [[nodiscard]] GLint getInstanceFlags() const;
+    [[nodiscard]] GLint getMaterialID() const;
+
+    // 加入场景的BVH，之后transform改变时自动更新，析构时移除
+    void attachSpatialIndex(DynamicBVH* bvh);
+    bool intersectRay(const QVector3D& origin, const QVector3D& direction, float maxT, float& t) const;
+    [[nodiscard]] float distanceToPoint(const QVector3D& point) const;
 
     void loadShape(ObjectType t, float width=0.0f, float height=0.0f);   // only for non-model shape
     void loadModel(const QString& mPath); // only for model
+    // 异步导入: 先作为没有mesh的占位物体加入场景，导入完成后再把mesh交给它
+    void beginAsyncLoad(const QString& mPath);
+    void setModelMeshes(QVector<std::shared_ptr<Mesh>> loadedMeshes);
+    [[nodiscard]] GLboolean isLoading() const;
 
 //    void loadShader(const QString& vertPath,
 //                    const QString& fragPath,
@@ -45,20 +67,24 @@ class GameObject {
     void setFresnel(GLboolean isFre);
 
     ObjectType getType();
-    QString getShaderName();
+    ShaderType getShadingMode();
     int getMeshCount();
     const Material& getMaterial();
 
     GLboolean getVisible();
     GLboolean getDrawOutline();
+    [[nodiscard]] float getLodBias() const;
 
     QMatrix4x4 getTransform();
     QVector3D getPosition();
     QVector3D getRotation();
     QVector3D getScale();
+    const BoundingBox& getWorldBounds();
 
     void setVisible(GLboolean visState);
     void setDrawOutline(GLboolean drawState);
+    // >0 更早切到低精度LOD，<0 更晚，单位是LOD级数
+    void setLodBias(float bias);
 
     void setTransform(QMatrix4x4 trans);
     void setPosition(QVector3D pos);
@@ -69,28 +95,52 @@ class GameObject {
     [[nodiscard]] GLuint getObjectID() const;
     static GLuint getObjectTotalNumber();
 
+    // 任何物体的可见状态改变都会增加这个版本号，GLManager用它判断场景是否需要重绘
+    static GLuint64 getSceneRevision();
+    // 改变layer、排序或者mesh集合的修改 (mesh / 贴图 / outline / 增删物体) 才增加，常驻的opaque场景需要重新提交
+    static GLuint64 getStructureRevision();
+    // 上次clear之后只有instance数据 (transform / lodBias / 着色方式 / 可见性) 变化的物体，
+    // 常驻场景只更新它们那几段 (见RenderQueue::updateResident)
+    static const std::vector<GameObject*>& getInstanceDirtyObjects();
+    static void clearInstanceDirtyObjects();
+
    public:
     QString displayName;
-    GLboolean containTransparencyTexture;
+    GLboolean containTransparencyTexture;   // diffuse贴图有半透明像素，走transparent layer
 
    private:
     void updateTransform();
+    void updateWorldBounds();
+    // bounds有效时才放进BVH，变成无效 (比如还没加载完的模型) 时移出
+    void syncSpatialProxy();
+    static void markSceneDirty();
+    static void markStructureDirty();
+    void markInstanceDirty();
 
    private:
     static GLuint gameObjectCounter;
+    static GLuint64 sceneRevision;
+    static GLuint64 structureRevision;
+    static std::vector<GameObject*> instanceDirtyObjects;
     GLuint objectID;
 
     // draw configure
     GLboolean display;
     GLboolean drawOutline;
+    GLboolean loading;
+    GLboolean alphaTested;      // diffuse贴图是AlphaMode::Masked，留在opaque layer里做alpha test
+    float lodBias;
+    GLboolean instanceDirty;    // 已经在instanceDirtyObjects里
 
     // basic info
     ObjectType type;
     QString modelPath;  // optional, only for model type
 
+    // 所有default物体共用一个program，per-object的数据在draw的时候设置
     std::shared_ptr<Shader> shader;
-    QString shaderName;
+    ShaderType shadingMode;     // default / reflection / refraction / fresnel
     Material material;
+    GLint materialID;           // material table中的位置
 
     // model: multiple, shape: single
     QVector<std::shared_ptr<Mesh>> meshes;
@@ -100,6 +150,10 @@ class GameObject {
     QVector3D rotation;
     QVector3D scale;
     QMatrix4x4 transform;
+    BoundingBox worldBounds;    // 所有mesh的world bounds的并集
+
+    DynamicBVH* spatialIndex;
+    int proxyID;
 
 };
 
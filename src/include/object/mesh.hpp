@@ -13,20 +13,30 @@
 
 #include "data_structures.hpp"
 #include "gl_configure.hpp"
+#include "object/mesh_geometry.hpp"
+#include "utils/bounding_volume.hpp"
 #include "utils/shader.hpp"
 #include "utils/texture2d.hpp"
 
 
+// 投影直径大于这个像素数时用LOD0，之后每减半降一级
+const static float LOD_FULL_DETAIL_SIZE = 384.0f;
+// 以log2为单位，在当前LOD的范围之外再留出的余量，避免在阈值附近来回切换
+// cullShader.comp的LOD选择也用这两个值
+const static float LOD_HYSTERESIS = 0.2f;
+
+// 一个Mesh = 共享的geometry + 自己的贴图和transform
 class Mesh {
    public:
-    QVector<Vertex> vertices;
-    QVector<unsigned int> indices;
     QVector<std::shared_ptr<Texture2D>> textures;
 
     Mesh(std::shared_ptr<Shader> sha,
          QVector<Vertex> vertices,
          QVector<unsigned int> indices,
          QVector<std::shared_ptr<Texture2D>> textures);
+    Mesh(std::shared_ptr<Shader> sha,
+         std::shared_ptr<MeshGeometry> geo,
+         QVector<std::shared_ptr<Texture2D>> textures);
     ~Mesh();
 
     void updateData(QVector<Vertex> vertices,
@@ -37,27 +47,46 @@ class Mesh {
     void setShader(std::shared_ptr<Shader> sha);
 
     // draw configure
-    void setDrawOutline(GLboolean drawState);
     void setTransform(QMatrix4x4 trans);
     void setMultiMesh(GLboolean isMulti);
 
-    void draw();
+    // 由RenderQueue调用: 绑定贴图并设置贴图相关的uniform (shader需要已经bind)
+    void bindTextures(Shader& sha);
+    [[nodiscard]] GLboolean hasSameTextures(const Mesh& other) const;
+    [[nodiscard]] GLuint getTextureKey() const;
+
+    [[nodiscard]] const std::shared_ptr<Shader>& getShader() const;
+    [[nodiscard]] const QMatrix4x4& getTransform() const;
+    [[nodiscard]] const std::shared_ptr<MeshGeometry>& getGeometry() const;
+    [[nodiscard]] GLuint getVAO() const;
+    [[nodiscard]] GLsizei getIndexCount() const;
+
+    // screenSize是world bounds投影到屏幕上的直径 (像素)，bias > 0 偏向更粗的LOD
+    // 带有滞后: 只有越过阈值一定距离才会切换，返回选中的LOD
+    int selectLod(float screenSize, float bias);
+    [[nodiscard]] int getCurrentLod() const;
+
+    // local bounds在上传顶点时计算，world bounds随setTransform更新
+    [[nodiscard]] const BoundingBox& getLocalBounds() const;
+    [[nodiscard]] const BoundingBox& getWorldBounds() const;
 
+    // 世界空间的射线与三角形求交 (用于picking)，t以direction的长度为单位
+    bool intersectRay(const QVector3D& origin, const QVector3D& direction, float maxT, float& t) const;
 
 
    private:
-    void setupMesh();
-    void updateMesh();
+    void updateBounds();
 
-    GLuint VAO{}, VBO{}, EBO{};
     GLFunctions_Core *glFunc;
 
     std::shared_ptr<Shader> shader;
+    std::shared_ptr<MeshGeometry> geometry;
 
     // draw configure
-    GLboolean drawOutline;
-    QMatrix4x4 transform;   // for outline
+    QMatrix4x4 transform;   // model matrix, 也用于outline
+    BoundingBox worldBounds;
     GLboolean multiMesh;
+    int currentLod;         // 上一次selectLod的结果
 };
 
 #endif  //MESH_HPP
@@ -0,0 +1,75 @@
+//
+// Created by fangl on 2023/10/12.
+//
+
+#ifndef MESH_GEOMETRY_HPP
+#define MESH_GEOMETRY_HPP
+
+#include <memory>
+#include <QVector>
+
+#include "data_structures.hpp"
+#include "gl_configure.hpp"
+#include "m_type.hpp"
+#include "render/geometry_arena.hpp"
+#include "utils/bounding_volume.hpp"
+
+
+// 一级LOD在arena EBO中的范围
+struct MeshLod {
+    GLsizei indexCount;
+    GLsizeiptr indexOffset;     // 字节，相对于整个arena EBO
+};
+
+// 顶点/索引数据，GPU上是同一格式的GeometryArena里的一段 (所有geometry共用arena的VAO)
+// 通过shared_ptr在多个Mesh之间共享，形状相同的物体只上传一份，也让RenderQueue可以把它们合并成一次instanced draw
+class MeshGeometry {
+   public:
+    // bounds无效时根据顶点计算
+    // format是GPU上的布局，CPU上始终保留完整的Vertex (拾取/BVH等用)
+    // lodIndices是LOD1..n，和LOD0一起放进同一个EBO，CPU上只保留LOD0
+    MeshGeometry(QVector<Vertex> vertices, QVector<unsigned int> indices, const BoundingBox& bounds = BoundingBox(),
+                 VertexFormat format = VertexFormat::Float,
+                 const QVector<QVector<unsigned int>>& lodIndices = QVector<QVector<unsigned int>>());
+    ~MeshGeometry();
+
+    MeshGeometry(const MeshGeometry&) = delete;
+    MeshGeometry& operator=(const MeshGeometry&) = delete;
+
+    // 原地更新 (所有共享这份geometry的Mesh都会改变)，LOD随之丢弃
+    // arena里的区间放得下时原地写入，否则重新分配一段 (留一些余量，下次update大概率不用再分配)
+    void update(QVector<Vertex> vertices, QVector<unsigned int> indices);
+
+    [[nodiscard]] const QVector<Vertex>& getVertices() const;
+    [[nodiscard]] const QVector<unsigned int>& getIndices() const;
+    [[nodiscard]] const BoundingBox& getLocalBounds() const;
+    [[nodiscard]] GLuint getVAO() const;               // arena的VAO，同一格式的geometry都一样
+    [[nodiscard]] GLint getBaseVertex() const;
+    [[nodiscard]] GLuint getGeometryID() const;        // 用于排序和合批，代替原来每个geometry独立的VAO
+    [[nodiscard]] GLsizei getIndexCount() const;      // LOD0
+    [[nodiscard]] int getLodCount() const;             // 包括LOD0，至少为1
+    [[nodiscard]] const MeshLod& getLod(int level) const;
+    [[nodiscard]] VertexFormat getVertexFormat() const;
+    // shader里 localPos = positionOffset + aPos * positionScale，Float格式时是(0,0,0)和(1,1,1)
+    [[nodiscard]] QVector3D getPositionOffset() const;
+    [[nodiscard]] QVector3D getPositionScale() const;
+
+   private:
+    // 区间不够时重新分配，headroom是额外预留的比例
+    void uploadBuffers(const QVector<QVector<unsigned int>>& lodIndices, float headroom);
+
+   private:
+    static GLuint geometryCounter;
+    GLuint geometryID;
+
+    QVector<Vertex> vertices;
+    QVector<unsigned int> indices;
+    BoundingBox localBounds;
+    VertexFormat format;
+    QVector<MeshLod> lods;
+
+    std::shared_ptr<GeometryArena> arena;
+    GeometryArena::Allocation allocation;
+};
+
+#endif  //MESH_GEOMETRY_HPP
@@ -0,0 +1,97 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef DEPTH_PYRAMID_HPP
+#define DEPTH_PYRAMID_HPP
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <QMatrix4x4>
+
+#include "gl_configure.hpp"
+#include "utils/bounding_volume.hpp"
+
+
+class Shader;
+
+// opaque pass之后从当前framebuffer的深度生成的Hi-Z (R32F，带完整mipmap)
+// 每个texel保存它覆盖区域内最远的深度，下一帧的GpuCulling用它做遮挡剔除
+// 另外把一个较小的level通过PBO异步读回CPU (几帧的延迟，不会等待GPU)，给工具查询可见性
+class DepthPyramid {
+   public:
+    DepthPyramid();
+    ~DepthPyramid();
+
+    DepthPyramid(const DepthPyramid&) = delete;
+    DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+    // 在opaque layer画完之后调用，源是当前绑定的draw framebuffer，大小取当前viewport
+    // viewProjection是这一帧的 projection * view
+    void build(const QMatrix4x4& viewProjection);
+
+    [[nodiscard]] GLuint getTexture() const;
+    [[nodiscard]] GLsizei getWidth() const;
+    [[nodiscard]] GLsizei getHeight() const;
+    [[nodiscard]] GLint getLevelCount() const;
+    [[nodiscard]] const QMatrix4x4& getViewProjection() const;
+    // 每次build加一，0表示还没有build过
+    [[nodiscard]] quint64 getBuildSerial() const;
+
+    /*========== CPU readback ==========*/
+    [[nodiscard]] bool hasReadback() const;
+    [[nodiscard]] GLsizei getReadbackWidth() const;
+    [[nodiscard]] GLsizei getReadbackHeight() const;
+    [[nodiscard]] const std::vector<GLfloat>& getReadbackDepth() const;    // 行优先，第0行在屏幕底部
+    [[nodiscard]] const QMatrix4x4& getReadbackViewProjection() const;
+    // 当前的读回数据来自第几次build
+    [[nodiscard]] quint64 getReadbackSerial() const;
+    // 用最近一次读回的数据测试，保守: 没有数据或者box跨过相机平面时返回false
+    [[nodiscard]] bool isOccluded(const BoundingBox& box) const;
+
+   private:
+    void resize(GLsizei w, GLsizei h);
+    void releaseTextures();
+    // 从depthTexture生成所有level
+    void reduce();
+    void collectReadbacks();
+    void requestReadback();
+
+   private:
+    struct Readback {
+        GLuint pbo;
+        GLsync fence;       // nullptr表示空闲
+        GLsizei width;
+        GLsizei height;
+        QMatrix4x4 viewProjection;
+        quint64 serial;
+    };
+
+    GLFunctions_Core *glFunc;
+    std::shared_ptr<Shader> shader;
+
+    GLuint depthTexture;    // 从源framebuffer blit过来的深度 (GL_DEPTH24_STENCIL8，和源一致才能blit)
+    GLuint pyramidTexture;
+    GLuint depthFBO;
+    GLuint pyramidFBO;
+    GLuint emptyVAO;        // core profile下画东西必须绑定一个VAO
+
+    GLsizei width;
+    GLsizei height;
+    GLint levelCount;
+    QMatrix4x4 viewProjection;
+    quint64 buildSerial;
+
+    // 多个PBO轮流使用，只读取已经完成的那一个
+    std::array<Readback, 3> readbacks;
+    int nextReadback;
+
+    std::vector<GLfloat> readbackDepth;
+    GLsizei readbackWidth;
+    GLsizei readbackHeight;
+    QMatrix4x4 readbackViewProjection;
+    quint64 readbackSerial;
+};
+
+#endif  //DEPTH_PYRAMID_HPP
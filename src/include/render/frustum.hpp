@@ -0,0 +1,34 @@
+//
+// Created by fangl on 2023/10/11.
+//
+
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <QMatrix4x4>
+#include <QVector4D>
+
+#include "utils/bounding_volume.hpp"
+
+
+// 从 projection * view 中提取的6个平面 (Gribb-Hartmann)，法线朝向视锥内部
+class Frustum {
+   public:
+    enum Plane { Left = 0, Right, Bottom, Top, Near, Far, PlaneCount };
+
+    Frustum() = default;
+    explicit Frustum(const QMatrix4x4& viewProjection);
+
+    void update(const QMatrix4x4& viewProjection);
+
+    // 保守测试: 返回false时一定在视锥外
+    [[nodiscard]] bool intersects(const BoundingBox& box) const;
+    [[nodiscard]] bool intersects(const BoundingSphere& sphere) const;
+
+    [[nodiscard]] const QVector4D& getPlane(Plane p) const { return planes[p]; }
+
+   private:
+    QVector4D planes[PlaneCount];
+};
+
+#endif  //FRUSTUM_HPP
@@ -0,0 +1,92 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef GEOMETRY_ARENA_HPP
+#define GEOMETRY_ARENA_HPP
+
+#include <map>
+
+#include "gl_configure.hpp"
+#include "m_type.hpp"
+
+
+// 一维区间分配器，单位是元素 (顶点或索引)
+// 空闲块按offset和大小各索引一份: 分配取能放下的最小块 (best fit)，释放时和前后相邻的空闲块合并
+class RangeAllocator {
+   public:
+    explicit RangeAllocator(GLint capacity = 0);
+
+    // 没有足够大的空闲块时返回-1
+    GLint allocate(GLint count);
+    void release(GLint offset, GLint count);
+    // 新增的[capacity, newCapacity)并入空闲块
+    void grow(GLint newCapacity);
+
+    [[nodiscard]] GLint getCapacity() const;
+    [[nodiscard]] GLint getUsed() const;
+    [[nodiscard]] int getFreeBlockCount() const;
+    [[nodiscard]] GLint getLargestFreeBlock() const;
+
+   private:
+    void addFree(GLint offset, GLint count);
+    void eraseFree(std::map<GLint, GLint>::iterator it);
+
+   private:
+    std::map<GLint, GLint> freeByOffset;        // offset -> count
+    std::multimap<GLint, GLint> freeBySize;     // count -> offset
+    GLint capacity;
+    GLint used;
+};
+
+
+// 所有同一顶点格式的MeshGeometry共用的一个VBO + EBO + VAO
+// 每个geometry只是其中的一段 (baseVertex, firstIndex)，索引是相对于baseVertex的，
+// draw的时候用glDrawElementsInstancedBaseVertex，切换geometry不需要重新绑定VAO
+// 空间不够时容量翻倍，旧内容在GPU上拷贝过去
+class GeometryArena {
+   public:
+    struct Allocation {
+        GLint baseVertex = 0;
+        GLint vertexCount = 0;     // 分配到的容量，可能大于实际使用的数量
+        GLint firstIndex = 0;
+        GLint indexCount = 0;
+    };
+
+    explicit GeometryArena(VertexFormat format);
+    ~GeometryArena();
+
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    Allocation allocate(GLint vertexCount, GLint indexCount);
+    void release(const Allocation& allocation);
+
+    // 写入allocation内的一段，经过UploadRing，写之前invalidate这段旧内容
+    void uploadVertices(const Allocation& allocation, GLint count, const void* data);
+    void uploadIndices(const Allocation& allocation, GLint first, GLint count, const unsigned int* data);
+
+    [[nodiscard]] GLuint getVAO() const;
+    [[nodiscard]] VertexFormat getFormat() const;
+    [[nodiscard]] GLsizeiptr getVertexStride() const;
+    [[nodiscard]] const RangeAllocator& getVertexRanges() const;
+    [[nodiscard]] const RangeAllocator& getIndexRanges() const;
+
+   private:
+    void growVertexBuffer(GLint required);
+    void growIndexBuffer(GLint required);
+    // 创建newBytes大小的新buffer，把旧buffer的前oldBytes拷贝过去后删除旧buffer
+    GLuint resizeBuffer(GLuint oldBuffer, GLsizeiptr oldBytes, GLsizeiptr newBytes);
+    void invalidateRange(GLuint buffer, GLintptr offset, GLsizeiptr length);
+    void setupAttributes();
+
+   private:
+    GLFunctions_Core *glFunc;
+
+    VertexFormat format;
+    GLuint VAO, VBO, EBO;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+};
+
+#endif  //GEOMETRY_ARENA_HPP
@@ -0,0 +1,155 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef GPU_CULLING_HPP
+#define GPU_CULLING_HPP
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include "gl_configure.hpp"
+#include "render/frustum.hpp"
+#include "render/instance_buffer.hpp"
+
+
+class Shader;
+
+// glMultiDrawElementsIndirect 读取的命令格式，字段顺序由GL规定
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;      // 以index为单位，不是字节
+    GLint baseVertex;
+    GLuint baseInstance;    // instance数据中的起始位置
+};
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must be 20 bytes");
+
+// 每个instance一份，对应cullShader.comp里的CullSource (12个word)
+struct CullInstance {
+    GLfloat boundsMin[3];   // world space AABB
+    GLuint command;         // LOD0对应的命令，LOD i 用 command + i
+    GLfloat boundsMax[3];
+    GLuint flags;           // CullInstanceFlag
+    GLuint lodCount;        // 和MeshGeometry::getLodCount一致，至少为1
+    GLfloat lodBias;        // GameObject::getLodBias
+    GLuint padding[2];
+};
+static_assert(sizeof(CullInstance) == 48, "CullInstance must be 48 bytes");
+
+// CullInstance::flags，和cullShader.comp的CULL_*一致
+enum CullInstanceFlag : GLuint {
+    CullBoundsValid = 1u << 0,  // 没有时bounds无效，总是可见
+    CullHidden      = 1u << 1   // GameObject::setVisible(false)，不画也不更新LOD状态
+};
+
+// GpuCulling::uploadScene里表示instance是新加入的，LOD状态从0开始
+const static GLuint CullNewInstance = 0xFFFFFFFFu;
+
+#ifdef GL_CORE_4_3
+
+// compute shader做的视锥 + Hi-Z遮挡剔除以及LOD选择 (需要GL 4.3)
+// opaque场景的instance数据、bounds和命令模板常驻在GPU上，场景结构变化时通过uploadScene重新上传，
+// 只是物体移动时用updateInstances覆盖对应的几段
+// 每帧只是把命令模板复制到command buffer (instanceCount清零)，再dispatch一次:
+// 每个线程测试一个instance并选出LOD，可见的instance按命令紧凑地写进visible buffer，并原子累加命令的instanceCount,
+// 之后直接用command buffer做glMultiDrawElementsIndirect，CPU不需要知道剔除的结果
+// 可见instance按选中LOD的三角形数量也在GPU上累加，和DepthPyramid一样通过fence异步读回，只用于统计
+class GpuCulling {
+   public:
+    GpuCulling();
+    ~GpuCulling();
+
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling& operator=(const GpuCulling&) = delete;
+
+    // 上一帧的depth pyramid (每个texel存覆盖区域内最远的深度) 以及生成它时的 projection * view
+    // texture = 0 时只做视锥剔除
+    void setDepthPyramid(GLuint texture, GLsizei width, GLsizei height, GLint levels,
+                         const QMatrix4x4& viewProjection);
+    [[nodiscard]] bool hasDepthPyramid() const;
+
+    // instances和cullInstances一一对应; commands是命令模板 (instanceCount为0)，
+    // 每条命令在visible buffer里预留 [baseInstance, baseInstance + batch大小) 的空间，visibleCount是总共预留的数量
+    // previousSlots[i]是instance i在上一次uploadScene里的位置，LOD状态在GPU上复制过来;
+    // 为CullNewInstance (或previousSlots为空) 的instance LOD状态从0开始
+    void uploadScene(const std::vector<InstanceData>& instances, const std::vector<CullInstance>& cullInstances,
+                     const std::vector<DrawElementsIndirectCommand>& commands, GLuint visibleCount,
+                     const std::vector<GLuint>& previousSlots);
+    // 只覆盖 [first, first + count) 的instance数据和剔除数据，命令模板和LOD状态不变
+    void updateInstances(GLuint first, GLuint count, const InstanceData* instances, const CullInstance* cullInstances);
+    [[nodiscard]] bool hasScene() const;
+
+    // lodScale和RenderQueue::begin的一致
+    void cull(const Frustum& frustum, const QVector3D& viewPos, GLfloat lodScale);
+
+    // 收集已经完成的三角形数量读回，不等待GPU; cull开头会调用一次
+    void collectReadbacks();
+    // 最近一次读回的、GPU剔除和LOD选择之后可见的三角形数量，比当前帧晚几帧
+    [[nodiscard]] GLuint64 getVisibleTriangleCount() const;
+
+    [[nodiscard]] GLuint getCommandBuffer() const;     // 剔除后的命令，可以直接绑定到GL_DRAW_INDIRECT_BUFFER
+    [[nodiscard]] GLuint getInstanceBuffer() const;    // 剔除后的InstanceData，按命令的baseInstance排列
+
+   private:
+    // 容量不够时重新分配 (不保留旧数据)
+    void reserve(GLuint buffer, GLsizeiptr& capacity, GLsizeiptr size);
+    void requestReadback();
+
+   private:
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;       // nullptr表示空闲
+    };
+
+    GLFunctions_Core *glFunc;
+    std::shared_ptr<Shader> shader;
+
+    // 每帧都要设置的uniform，load之后解析一次
+    GLint frustumPlanesLocation;
+    GLint instanceCountLocation;
+    GLint viewPositionLocation;
+    GLint lodScaleLocation;
+    GLint useOcclusionLocation;
+    GLint pyramidViewProjectionLocation;
+    GLint pyramidSizeLocation;
+    GLint pyramidLevelsLocation;
+
+    // 常驻的场景数据
+    GLuint sceneInstanceBuffer;
+    GLuint sceneCullBuffer;
+    GLuint lodStateBuffer;
+    GLuint previousLodStateBuffer;      // 重新上传场景时和lodStateBuffer交换，旧的LOD状态从这里复制
+    GLuint commandTemplateBuffer;
+    GLsizeiptr sceneInstanceCapacity;   // 以字节为单位
+    GLsizeiptr sceneCullCapacity;
+    GLsizeiptr lodStateCapacity;
+    GLsizeiptr previousLodStateCapacity;
+    GLsizeiptr commandTemplateCapacity;
+    GLuint sceneInstanceCount;
+    GLsizeiptr sceneCommandBytes;
+
+    // 每帧的输出
+    GLuint commandBuffer;
+    GLuint visibleBuffer;
+    GLsizeiptr commandCapacity;
+    GLsizeiptr visibleCapacity;
+    GLuint triangleCountBuffer;         // 每帧清零，可见instance累加选中LOD的三角形数量
+
+    std::array<Readback, 3> readbacks;
+    int nextReadback;
+    GLuint64 visibleTriangleCount;
+
+    GLuint pyramidTexture;
+    GLsizei pyramidWidth;
+    GLsizei pyramidHeight;
+    GLint pyramidLevels;
+    QMatrix4x4 pyramidViewProjection;
+};
+
+#endif  // GL_CORE_4_3
+
+#endif  //GPU_CULLING_HPP
@@ -0,0 +1,72 @@
+//
+// Created by fangl on 2023/10/12.
+//
+
+#ifndef INSTANCE_BUFFER_HPP
+#define INSTANCE_BUFFER_HPP
+
+#include <vector>
+
+#include "gl_configure.hpp"
+
+
+// per-instance的标志位，对应defaultShader里的INSTANCE_*
+enum InstanceFlag : GLint {
+    InstanceMultiMesh   = 1 << 0,
+    InstanceReflection  = 1 << 1,
+    InstanceRefraction  = 1 << 2,
+    InstanceFresnel     = 1 << 3,
+    InstanceOutline     = 1 << 4,
+    InstanceAlphaTest   = 1 << 5,   // 贴图只有全透明/不透明像素，丢弃alpha < 0.5的片元
+    InstancePackedNormal = 1 << 6   // VertexFormat::Packed，法线是八面体编码
+};
+
+// 每个instance的数据，对应defaultShader.vert的 location 3~6 (mat4), location 7 (ivec2) 和 location 8, 9 (vec3)
+// 顶点还原参数跟着instance走而不是uniform，这样不同geometry的draw可以放进同一次multi draw
+struct InstanceData {
+    GLfloat model[16];      // column-major, 和QMatrix4x4::constData()一致
+    GLint materialIndex;
+    GLint flags;
+    GLfloat positionOffset[3];  // localPos = positionOffset + aPos * positionScale
+    GLfloat positionScale[3];
+};
+static_assert(sizeof(InstanceData) == 96, "InstanceData must be 96 bytes");
+
+const static GLuint InstanceAttribModel = 3;   // 占用 3,4,5,6
+const static GLuint InstanceAttribData = 7;
+const static GLuint InstanceAttribPositionOffset = 8;
+const static GLuint InstanceAttribPositionScale = 9;
+
+
+// 每帧重新填充的per-instance顶点数据
+// 所有geometry的VAO共用这一个buffer，draw之前通过bindAttributes把instance属性指到这一批的起始位置
+// (GL 4.1 没有baseInstance，只能重新设置attrib pointer的offset；4.3 上绑定一次firstInstance = 0，之后用baseInstance)
+// 数据优先直接写进UploadRing，attrib pointer指向ring里的那一段；ring放不下时才用自己的VBO
+class InstanceBuffer {
+   public:
+    InstanceBuffer();
+    ~InstanceBuffer();
+
+    // ring放不下时orphan自己的VBO之后整体上传，容量不够时按2倍扩大
+    void upload(const std::vector<InstanceData>& instances);
+    // 需要先绑定目标VAO
+    void bindAttributes(GLuint firstInstance);
+    // 让之后的bindAttributes改为读取其他buffer (比如GPU剔除后写出的instance)，下一次upload会恢复
+    void setSource(GLuint buffer, GLintptr offset);
+
+    [[nodiscard]] GLsizeiptr getCapacity() const;
+    [[nodiscard]] GLuint getSourceBuffer() const;
+    [[nodiscard]] GLintptr getSourceOffset() const;
+
+   private:
+    GLFunctions_Core *glFunc;
+
+    GLuint VBO;
+    GLsizeiptr capacity;    // 以instance为单位
+
+    // 上一次upload的数据所在的buffer (ring或者VBO) 和起始字节
+    GLuint sourceBuffer;
+    GLintptr sourceOffset;
+};
+
+#endif  //INSTANCE_BUFFER_HPP
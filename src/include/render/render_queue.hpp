@@ -0,0 +1,177 @@
+//
+// Created by fangl on 2023/10/10.
+//
+
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <QVector3D>
+
+#include "gl_configure.hpp"
+#include "render/frustum.hpp"
+#include "render/gpu_culling.hpp"
+#include "render/instance_buffer.hpp"
+#include "utils/bounding_volume.hpp"
+
+
+class Shader;
+class Mesh;
+class GameObject;
+
+// 按layer依次绘制: opaque -> (skybox) -> transparent -> outline
+enum class RenderLayer : GLuint {
+    Opaque = 0,
+    Transparent = 1,
+    Outline = 2
+};
+
+struct DrawPacket {
+    GLuint64 sortKey;
+    RenderLayer layer;
+    Shader* shader;
+    GameObject* object;
+    Mesh* mesh;
+    int lod;
+    InstanceData instance;  // model matrix / material / flags, 提交时就确定
+};
+
+// program/贴图/stencil/VAO都相同的一段连续命令，只需要设置一次状态
+struct DrawBucket {
+    GLuint firstPacket;     // 用于设置状态的packet，相对layer的起始位置
+    GLuint firstCommand;
+    GLuint commandCount;
+};
+
+
+// 每帧收集所有要画的mesh，按64位的key排序后提交，减少program/texture/VAO的切换
+// 排序后相邻的、program/贴图/geometry/stencil都相同的packet合并成一条instanced draw命令,
+// per-instance的数据写进InstanceBuffer
+// program/贴图/stencil/VAO都不变的连续命令组成一个bucket: GL 4.3 上写进UploadRing后用一次glMultiDrawElementsIndirect提交,
+// 4.1 (mac) 没有baseInstance和indirect draw，退回CPU循环逐条glDrawElementsInstancedBaseVertex
+// 4.3 上opaque layer常驻在GPU上 (见beginResident)，每帧由GpuCulling (compute shader的视锥 + Hi-Z剔除和LOD选择)
+// 写出命令和instance后直接绘制，CPU每帧的工作和物体数量无关
+//
+// sort key (高位 -> 低位):
+//   opaque / outline : | layer 2 | program 10 | stencil 1 | texture 15 | geometry 12 | depth 24 |  (同状态内从近到远)
+//   transparent      : | layer 2 | ~depth 24  | program 10 | stencil 1 | texture 15 | geometry 12 | (从远到近)
+//   geometry = | vertex format 1 | geometry id 9 | lod 2 |，同一格式的geometry共用一个VAO
+// program/texture/geometry 只取低位，冲突只会影响分组，不影响正确性 (提交时还会和真实状态比较)
+class RenderQueue {
+   public:
+    RenderQueue();
+    ~RenderQueue() = default;
+
+    // lodScale = 投影矩阵的[1][1] * 视口高度 / 2，用于把bounds换算成屏幕上的像素大小
+    void begin(const QVector3D& viewPos, GLfloat farPlane, GLfloat lodScale);
+    void submit(RenderLayer layer, GameObject* object, Mesh* mesh, int lod = 0);
+    void sort();
+
+    void drawLayer(RenderLayer layer);
+
+    [[nodiscard]] int getPacketCount() const;
+    [[nodiscard]] int getStateChangeCount() const;  // 上一次drawLayer中program/texture/VAO的切换次数
+    [[nodiscard]] int getDrawCallCount() const;     // 上一次drawLayer中的draw call数量 (一次multi draw算一次)
+    [[nodiscard]] int getCommandCount() const;      // 上一次drawLayer中的instanced draw命令数量
+    // begin之后所有drawLayer实际提交的三角形数量 (按选中的LOD)
+    // 常驻的opaque layer的LOD和剔除都在GPU上，用GPU累加后异步读回的结果，比当前帧晚几帧
+    [[nodiscard]] GLuint64 getTriangleCount() const;
+
+    // bounds投影到屏幕上的直径 (像素)，相机在bounds内部时返回一个很大的值
+    [[nodiscard]] GLfloat getProjectedSize(const BoundingBox& worldBounds) const;
+
+    // 默认打开，只在GL 4.3上有效；关掉之后和4.1一样逐条提交，方便对比
+    void setMultiDrawIndirectEnabled(bool enable);
+    [[nodiscard]] bool isMultiDrawIndirectActive() const;
+
+    // GPU剔除用的视锥，每帧drawLayer之前设置
+    void setCullingFrustum(const Frustum& frustum);
+    // 默认打开，需要multi draw indirect
+    void setGpuCullingEnabled(bool enable);
+    [[nodiscard]] bool isGpuCullingActive() const;
+#ifdef GL_CORE_4_3
+    // context低于4.3时为nullptr
+    [[nodiscard]] GpuCulling* getGpuCulling() const;
+#endif
+
+    // GPU剔除打开时opaque layer不再每帧submit，而是在场景结构变化时整体重新提交一次:
+    // beginResident -> 对每个opaque mesh调用submitResident -> endResident (排序、生成命令模板并上传到GPU)
+    // 每个batch为geometry的每个LOD各生成一条命令，LOD由GPU选择; 重新提交之后还在场景里的mesh保留LOD状态
+    void beginResident();
+    void submitResident(GameObject* object, Mesh* mesh);
+    void endResident();
+    // 物体只有transform / lodBias / 着色方式 / 可见性变化时，只重新上传它在常驻场景里的instance和bounds
+    void updateResident(GameObject* object);
+    // 为true时drawLayer(Opaque)画的是常驻的场景，submit到opaque layer的packet会被忽略
+    // 关闭GPU剔除之后为false，回到每帧submit
+    [[nodiscard]] bool isOpaqueResident() const;
+
+   private:
+    // depth只影响sort key
+    [[nodiscard]] DrawPacket makePacket(RenderLayer layer, GameObject* object, Mesh* mesh, int lod, GLfloat depth) const;
+    [[nodiscard]] GLuint64 makeSortKey(RenderLayer layer, const Shader* shader, const Mesh* mesh, int lod,
+                                       GLboolean writeStencil, GLfloat depth) const;
+    // 两个packet能否放进同一次instanced draw
+    static bool canBatch(const DrawPacket& lhs, const DrawPacket& rhs, bool isOutline);
+    // 不改变program/贴图/stencil/VAO时能否放在同一个bucket里
+    static bool canShareBucket(const DrawPacket& lhs, const DrawPacket& rhs, bool isOutline);
+    // 把[first, last)合并成命令和bucket
+    void buildCommands(std::vector<DrawPacket>::const_iterator first, std::vector<DrawPacket>::const_iterator last,
+                       bool isOutline);
+    // 常驻opaque场景的命令模板、剔除数据和bucket
+    void buildResidentCommands(GLuint& visibleCount);
+    // 剔除数据中跟着物体变化的部分: bounds / 可见性 / lodBias
+    static void updateCullInstance(CullInstance& cull, const DrawPacket& packet);
+    // 按bucket设置状态并提交，packetBegin是bucket.firstPacket的基准
+    void drawBuckets(const std::vector<DrawBucket>& layerBuckets, std::vector<DrawPacket>::const_iterator packetBegin,
+                     bool isOutline, GLuint indirectBuffer, GLintptr indirectOffset);
+    // indirectBuffer = 0 时在CPU端逐条提交 (只有每帧提交的layer会这样)
+    void submitBucket(const DrawBucket& bucket, GLuint indirectBuffer, GLintptr indirectOffset);
+
+   private:
+    // 常驻场景里属于同一个物体的连续一段instance
+    struct ResidentRange {
+        GLuint first;
+        GLuint count;
+    };
+    // (GameObject::getObjectID, mesh)，物体删除之后id不会被重用
+    using ResidentKey = std::pair<GLuint, const Mesh*>;
+
+    GLFunctions_Core *glFunc;
+
+    std::vector<DrawPacket> packets;
+    std::vector<InstanceData> instances;    // 当前layer的instance数据，按packet顺序排列
+    std::unique_ptr<InstanceBuffer> instanceBuffer;
+    std::vector<DrawElementsIndirectCommand> commands;  // 当前layer的命令
+    std::vector<DrawBucket> buckets;
+    // 常驻的opaque场景，按状态排序 (不含深度)
+    std::vector<DrawPacket> residentPackets;
+    std::vector<DrawBucket> residentBuckets;
+    std::vector<DrawElementsIndirectCommand> residentCommands;  // 命令模板，instanceCount为0
+    std::vector<InstanceData> residentInstances;    // 和residentPackets一一对应，上传到GPU的那一份
+    std::vector<CullInstance> residentCull;
+    std::unordered_map<const GameObject*, std::vector<ResidentRange>> residentRanges;
+    std::map<ResidentKey, GLuint> residentSlots;    // 上一次endResident里每个mesh的位置
+    bool residentActive;
+    bool multiDrawIndirect;
+    bool gpuCullingEnabled;
+#ifdef GL_CORE_4_3
+    std::unique_ptr<GpuCulling> gpuCulling;
+#endif
+    Frustum frustum;
+
+    QVector3D viewPosition;
+    GLfloat farPlane;
+    GLfloat lodScale;
+
+    int stateChangeCount;
+    int drawCallCount;
+    int commandCount;
+    GLuint64 triangleCount;
+};
+
+#endif  //RENDER_QUEUE_HPP
@@ -0,0 +1,69 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef UPLOAD_RING_HPP
+#define UPLOAD_RING_HPP
+
+#include <deque>
+
+#include "gl_configure.hpp"
+
+
+// 所有动态数据 (顶点/索引/uniform/instance) 上传用的staging ring buffer
+// 有GL_ARB_buffer_storage时整个buffer persistent + coherent map一次，之后只做memcpy；
+// 否则 (mac的4.1) 每次用 glMapBufferRange(UNSYNCHRONIZED | INVALIDATE_RANGE) 映射要写的那一段
+// 每帧结束时插入一个fence，只有GPU用完的区间才会被覆盖，所以写入时不需要等待GPU，也不会像glBufferData那样重新分配
+class UploadRing {
+   public:
+    explicit UploadRing(GLsizeiptr size);
+    ~UploadRing();
+
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    // 写进ring，返回数据在ring buffer中的偏移 (按uniform buffer offset对齐)，放不下时返回-1
+    // 这块数据在这一帧endFrame之后、GPU用完之前不会被覆盖，可以直接当作顶点属性的数据源
+    GLintptr stream(GLsizeiptr size, const void* data);
+    // 通过ring拷贝到dstBuffer的[dstOffset, dstOffset + size)，放不下时退回glBufferSubData
+    void upload(GLuint dstBuffer, GLintptr dstOffset, GLsizeiptr size, const void* data);
+    // 一帧的最后调用，给这一帧写入的区间加上fence
+    void endFrame();
+
+    [[nodiscard]] GLuint getBufferID() const;
+    [[nodiscard]] GLsizeiptr getSize() const;
+    [[nodiscard]] bool isPersistent() const;
+    [[nodiscard]] int getStallCount() const;       // 分配时ring满了、不得不等待GPU的次数
+    [[nodiscard]] int getFallbackCount() const;    // ring放不下、直接glBufferSubData的次数
+
+   private:
+    // 返回ring中的偏移，-1表示放不下
+    GLintptr allocate(GLsizeiptr size);
+    void write(GLintptr offset, GLsizeiptr size, const void* data);
+    void retireFinishedFrames();
+    void waitOldestFrame();
+    [[nodiscard]] GLuint64 tail() const;
+
+   private:
+    struct FrameFence {
+        GLsync fence;
+        GLuint64 begin;     // 这一帧第一次分配的位置
+    };
+
+    GLFunctions_Core *glFunc;
+
+    GLuint buffer;
+    GLsizeiptr capacity;
+    GLsizeiptr alignment;
+    char* mapped;           // persistent map的地址，fallback模式下为nullptr
+
+    // 位置都是单调增加的虚拟偏移，取模capacity得到buffer中的位置
+    GLuint64 head;
+    GLuint64 frameBegin;
+    std::deque<FrameFence> inFlight;
+
+    int stallCount;
+    int fallbackCount;
+};
+
+#endif  //UPLOAD_RING_HPP
@@ -0,0 +1,39 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef ASSIMP_LOADER_HPP
+#define ASSIMP_LOADER_HPP
+
+#include <memory>
+#include <QString>
+
+#include "assimp/Importer.hpp"
+#include "assimp/postprocess.h"
+#include "assimp/scene.h"
+
+#include "model_data.hpp"
+
+
+// 通用的Assimp导入，ObjLoader处理不了的格式走这里
+// 只做CPU上的工作 (不解码贴图，不碰GL)，benchmark里也直接用它和ObjLoader对比
+class AssimpLoader {
+   public:
+    // 改变import flags会改变生成的顶点，所以也是缓存key的一部分
+    static const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+    // 读取失败时返回没有mesh的ModelData
+    static std::shared_ptr<ModelData> load(const QString& path);
+
+   private:
+    AssimpLoader() = default;
+
+    static void processNode(aiNode *node, const aiScene *scene, const QString& mDir, ModelData& data);
+    static ModelMeshData processMesh(aiMesh *mesh, const aiScene *scene, const QString& mDir);
+    static QVector<ModelTextureRef> loadMaterialTextures(aiMaterial *mat,
+                                                         aiTextureType type,
+                                                         const QString& typeName,
+                                                         const QString& mDir);
+};
+
+#endif  //ASSIMP_LOADER_HPP
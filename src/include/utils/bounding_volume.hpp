@@ -0,0 +1,51 @@
+//
+// Created by fangl on 2023/10/11.
+//
+
+#ifndef BOUNDING_VOLUME_HPP
+#define BOUNDING_VOLUME_HPP
+
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector3D>
+
+#include "data_structures.hpp"
+
+
+struct BoundingSphere {
+    QVector3D center;
+    float radius;
+
+    BoundingSphere() : center(0.0f, 0.0f, 0.0f), radius(0.0f) {}
+    BoundingSphere(QVector3D c, float r) : center(c), radius(r) {}
+};
+
+// axis aligned bounding box
+struct BoundingBox {
+    QVector3D min;
+    QVector3D max;
+    bool valid;     // 没有expand过的box是空的
+
+    BoundingBox() : min(0.0f, 0.0f, 0.0f), max(0.0f, 0.0f, 0.0f), valid(false) {}
+    BoundingBox(QVector3D mi, QVector3D ma) : min(mi), max(ma), valid(true) {}
+
+    static BoundingBox fromVertices(const QVector<Vertex>& vertices);
+
+    void expand(const QVector3D& point);
+    void expand(const BoundingBox& box);
+
+    [[nodiscard]] QVector3D center() const { return (min + max) * 0.5f; }
+    [[nodiscard]] QVector3D extents() const { return (max - min) * 0.5f; }
+    [[nodiscard]] float surfaceArea() const;
+
+    [[nodiscard]] bool contains(const BoundingBox& box) const;
+    [[nodiscard]] bool intersects(const BoundingBox& box) const;
+    // slab测试，direction不需要归一化，tNear以direction的长度为单位
+    bool intersectRay(const QVector3D& origin, const QVector3D& direction, float maxT, float& tNear) const;
+
+    // 变换之后重新求AABB (不需要变换8个顶点)
+    [[nodiscard]] BoundingBox transformed(const QMatrix4x4& mat) const;
+    [[nodiscard]] BoundingSphere toSphere() const;
+};
+
+#endif  //BOUNDING_VOLUME_HPP
@@ -43,6 +43,7 @@ class Camera
         this->movementSpeed = speed;
         this->mouseSensitivity = SENSITIVITY;
         this->zoom = ZOOM;
+        this->dirty = GL_TRUE;
 
         this->updateCameraData();
 
@@ -55,6 +56,10 @@ class Camera
     void handleMouseScroll(GLfloat yOffset);
     void handleKeyboard(CameraMove direction, GLfloat deltaTime);
 
+    // view/zoom 改变后为true，由GLManager上传之后清除
+    [[nodiscard]] GLboolean isDirty() const { return dirty; }
+    void clearDirty() { dirty = GL_FALSE; }
+
     QVector3D position;
     QVector3D worldUp;
     QVector3D front;
@@ -74,6 +79,8 @@ class Camera
    private:
     void updateCameraData();
 
+    GLboolean dirty;
+
 };
 
 
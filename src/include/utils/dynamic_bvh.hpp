@@ -0,0 +1,201 @@
+//
+// Created by fangl on 2023/10/12.
+//
+
+#ifndef DYNAMIC_BVH_HPP
+#define DYNAMIC_BVH_HPP
+
+#include <queue>
+#include <vector>
+
+#include "utils/bounding_volume.hpp"
+#include "render/frustum.hpp"
+
+
+// 动态的AABB树 (参考Box2D的b2DynamicTree)
+// 叶子存放放大过的(fat) AABB，物体小范围移动时不需要改树的结构；
+// 插入时用面积代价选择兄弟节点，之后沿父节点旋转保持平衡
+class DynamicBVH {
+   public:
+    static const int NullNode = -1;
+
+    DynamicBVH();
+    ~DynamicBVH() = default;
+
+    // box必须是valid的
+    int createProxy(const BoundingBox& box, void* userData);
+    void destroyProxy(int proxyID);
+    // bounds超出fat AABB时重新插入，返回true
+    bool moveProxy(int proxyID, const BoundingBox& box);
+
+    [[nodiscard]] void* getUserData(int proxyID) const;
+    [[nodiscard]] const BoundingBox& getFatBounds(int proxyID) const;
+
+    [[nodiscard]] int getProxyCount() const;
+    [[nodiscard]] int getHeight() const;
+    void clear();
+
+    // callback(proxyID) 返回false时停止查询
+    template<typename Callback>
+    void queryFrustum(const Frustum& frustum, Callback&& callback) const;
+
+    template<typename Callback>
+    void queryBox(const BoundingBox& box, Callback&& callback) const;
+
+    // callback(proxyID, maxDistance) 返回与物体的实际交点距离，没有相交则返回maxDistance，
+    // 返回值会作为新的maxDistance裁剪之后的遍历，返回0时立即停止
+    template<typename Callback>
+    void rayCast(const QVector3D& origin, const QVector3D& direction, float maxDistance, Callback&& callback) const;
+
+    // callback(proxyID) 返回点到物体的实际距离，返回最近的proxy，没有则返回NullNode
+    template<typename Callback>
+    int queryNearest(const QVector3D& point, float maxDistance, Callback&& callback) const;
+
+   private:
+    struct Node {
+        BoundingBox box;
+        void* userData;
+        int parent;     // 在free list里表示next
+        int child1;
+        int child2;
+        int height;     // 叶子为0，空闲节点为-1
+
+        [[nodiscard]] bool isLeaf() const { return child1 == NullNode; }
+    };
+
+    int allocateNode();
+    void freeNode(int nodeID);
+
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    int balance(int iA);
+    void refitAncestors(int index);
+
+    static float distanceSquaredToBox(const QVector3D& point, const BoundingBox& box);
+
+   private:
+    std::vector<Node> nodes;
+    int root;
+    int freeList;
+    int proxyCount;
+
+    float fatMargin;    // fat AABB向外扩张的距离
+};
+
+
+template<typename Callback>
+void DynamicBVH::queryFrustum(const Frustum& frustum, Callback&& callback) const {
+    if(root == NullNode)
+        return;
+
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root);
+    while(!stack.empty()) {
+        int nodeID = stack.back();
+        stack.pop_back();
+
+        const Node& node = nodes[nodeID];
+        if(!frustum.intersects(node.box))
+            continue;
+
+        if(node.isLeaf()) {
+            if(!callback(nodeID))
+                return;
+        } else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+template<typename Callback>
+void DynamicBVH::queryBox(const BoundingBox& box, Callback&& callback) const {
+    if(root == NullNode)
+        return;
+
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root);
+    while(!stack.empty()) {
+        int nodeID = stack.back();
+        stack.pop_back();
+
+        const Node& node = nodes[nodeID];
+        if(!node.box.intersects(box))
+            continue;
+
+        if(node.isLeaf()) {
+            if(!callback(nodeID))
+                return;
+        } else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+template<typename Callback>
+void DynamicBVH::rayCast(const QVector3D& origin, const QVector3D& direction, float maxDistance, Callback&& callback) const {
+    if(root == NullNode)
+        return;
+
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root);
+    while(!stack.empty()) {
+        int nodeID = stack.back();
+        stack.pop_back();
+
+        const Node& node = nodes[nodeID];
+        float tNear = 0.0f;
+        if(!node.box.intersectRay(origin, direction, maxDistance, tNear))
+            continue;
+
+        if(node.isLeaf()) {
+            float hit = callback(nodeID, maxDistance);
+            if(hit == 0.0f)
+                return;
+            if(hit < maxDistance)
+                maxDistance = hit;
+        } else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+template<typename Callback>
+int DynamicBVH::queryNearest(const QVector3D& point, float maxDistance, Callback&& callback) const {
+    if(root == NullNode)
+        return NullNode;
+
+    // 按到AABB的距离从近到远展开，直到最近的AABB也比当前最优解远
+    using Entry = std::pair<float, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> open;
+    open.emplace(distanceSquaredToBox(point, nodes[root].box), root);
+
+    float bestDistance = maxDistance;
+    int bestProxy = NullNode;
+    while(!open.empty()) {
+        auto [boxDistSq, nodeID] = open.top();
+        open.pop();
+        if(boxDistSq > bestDistance * bestDistance)
+            break;
+
+        const Node& node = nodes[nodeID];
+        if(node.isLeaf()) {
+            float d = callback(nodeID);
+            if(d < bestDistance) {
+                bestDistance = d;
+                bestProxy = nodeID;
+            }
+        } else {
+            open.emplace(distanceSquaredToBox(point, nodes[node.child1].box), node.child1);
+            open.emplace(distanceSquaredToBox(point, nodes[node.child2].box), node.child2);
+        }
+    }
+    return bestProxy;
+}
+
+#endif  //DYNAMIC_BVH_HPP
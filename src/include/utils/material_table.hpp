@@ -0,0 +1,75 @@
+//
+// Created by fangl on 2023/10/9.
+//
+
+#ifndef MATERIAL_TABLE_HPP
+#define MATERIAL_TABLE_HPP
+
+#include <memory>
+#include <vector>
+
+#include "data_structures.hpp"
+#include "uniform_buffer.hpp"
+
+
+// GPU端的material参数表，每个物体持有一个material id，修改参数只标记dirty，flush的时候一次性上传dirty的区间
+// GL 4.3: shader storage buffer "MaterialBuffer"，容量不够时按2倍扩大，数量没有上限
+// GL 4.1: std140 uniform block "MaterialBlock"，容量固定为MaxMaterialCount，用完之后直接报错
+// MaxMaterialCount 需要与 defaultShader.frag 里的 MAX_MATERIAL_COUNT 保持一致
+// (256 * 48 bytes = 12KB，低于规范保证的最小 GL_MAX_UNIFORM_BLOCK_SIZE 16KB)
+const static GLint MaxMaterialCount = 256;
+const static GLint DefaultMaterialID = 0;    // 没有material table时使用，所有人共享所以是只读的
+// storage buffer的绑定点和初始容量
+// 0~4 是cullShader.comp每帧绑定/解绑的，这里用规范保证的最后一个 (GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS >= 8)
+const static GLuint MaterialStorageBinding = 7;
+const static GLint MaterialStorageInitialCount = 256;
+// 使用storage buffer时给所有shader加上的define
+const static char* const MaterialStorageDefine = "MATERIAL_STORAGE_BUFFER";
+
+
+class MaterialTable {
+   public:
+    MaterialTable();
+    ~MaterialTable();
+
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    // context是4.3及以上时使用storage buffer
+    void create();
+
+    GLint allocate(const Material& mat);
+    void release(GLint id);
+    // DefaultMaterialID 和没有分配的id会被忽略
+    void update(GLint id, const Material& mat);
+
+    // 把dirty区间上传到GPU，没有修改就什么都不做
+    void flush();
+
+    [[nodiscard]] GLint getUsedCount() const;
+    [[nodiscard]] bool usesStorageBuffer() const;
+
+   private:
+    void write(GLint id, const Material& mat);
+    void markDirty(GLint id);
+    // 容量扩大一倍 (只有storage buffer可以)，之前的数据全部重新上传
+    void grow();
+
+   private:
+    GLFunctions_Core *glFunc;
+    std::unique_ptr<UniformBuffer> buffer;  // 4.1
+    GLuint storageBuffer;                   // 4.3
+    GLint capacity;
+
+    std::vector<MaterialEntryData> entries;
+    std::vector<GLint> freeIDs;
+    std::vector<bool> allocated;    // 防止同一个id被释放两次
+    GLint nextID;
+    bool defaultWriteWarned;
+
+    // [dirtyBegin, dirtyEnd)
+    GLint dirtyBegin;
+    GLint dirtyEnd;
+};
+
+#endif  //MATERIAL_TABLE_HPP
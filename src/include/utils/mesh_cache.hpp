@@ -0,0 +1,37 @@
+//
+// Created by fangl on 2023/10/15.
+//
+
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <memory>
+#include <QByteArray>
+#include <QString>
+
+#include "model_data.hpp"
+
+
+// 导入后的模型的二进制缓存，避免每次都用Assimp重新解析文本OBJ
+//
+// 文件放在 CacheLocation/mesh_cache/<源文件绝对路径的sha1>.mkmesh，布局 (本机字节序):
+//   | MeshCacheHeader | MeshCacheRecord * meshCount | MeshCacheTextureRecord * textureCount |
+//   | vertex blobs | index blobs (LOD0之后紧跟各级LOD) | string table (贴图路径, utf8) |
+// header里记录源文件内容的sha1和import flags，任意一个不一致都视为失效
+// 读取时整个文件map进内存，顶点和索引直接从映射的内存拷贝出来
+class MeshCache {
+   public:
+    // 源文件内容的sha1，读不到文件时返回空
+    static QByteArray hashSource(const QString& sourcePath);
+
+    // 缓存不存在、损坏或者已经失效时返回nullptr
+    static std::shared_ptr<ModelData> load(const QString& sourcePath, quint32 importFlags, const QByteArray& sourceHash);
+    static bool save(const QString& sourcePath, quint32 importFlags, const QByteArray& sourceHash, const ModelData& data);
+
+    static QString cacheFilePath(const QString& sourcePath);
+
+   private:
+    MeshCache() = default;
+};
+
+#endif  //MESH_CACHE_HPP
@@ -0,0 +1,46 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include <QVector>
+
+#include "data_structures.hpp"
+
+
+// post-transform cache的统计，按FIFO cache模拟
+//   ACMR: 每个三角形平均的cache miss数 (最好0.5，最差3)
+//   ATVR: cache miss数 / 顶点数 (最好1)
+struct VertexCacheStats {
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+// 导入时对索引和顶点重新排序，不改变几何:
+//   1. Tipsify (Sander et al. 2007) 重排三角形，提高post-transform cache命中率
+//   2. 以Tipsify的cluster为单位按朝外程度排序，减少overdraw，ACMR最多变差overdrawThreshold倍
+//   3. 按第一次使用的顺序重排顶点，提高vertex fetch的局部性
+class MeshOptimizer {
+   public:
+    static const int DEFAULT_CACHE_SIZE = 16;
+
+    static void optimize(QVector<Vertex>& vertices, QVector<unsigned int>& indices,
+                         VertexCacheStats* before = nullptr, VertexCacheStats* after = nullptr,
+                         int cacheSize = DEFAULT_CACHE_SIZE, float overdrawThreshold = 1.05f);
+
+    // clusters不为空时输出cluster的起始三角形 (第一个总是0)
+    static QVector<unsigned int> tipsify(const QVector<unsigned int>& indices, int vertexCount, int cacheSize,
+                                         QVector<int>* clusters = nullptr);
+    static void optimizeOverdraw(const QVector<Vertex>& vertices, QVector<unsigned int>& indices,
+                                 const QVector<int>& clusters, int cacheSize, float threshold);
+    static void optimizeVertexFetch(QVector<Vertex>& vertices, QVector<unsigned int>& indices);
+
+    static VertexCacheStats analyzeVertexCache(const QVector<unsigned int>& indices, int vertexCount, int cacheSize);
+
+   private:
+    MeshOptimizer() = default;
+};
+
+#endif  //MESH_OPTIMIZER_HPP
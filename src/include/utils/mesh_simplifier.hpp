@@ -0,0 +1,34 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef MESH_SIMPLIFIER_HPP
+#define MESH_SIMPLIFIER_HPP
+
+#include <QVector>
+
+#include "data_structures.hpp"
+
+
+// 基于quadric error metric (Garland & Heckbert 1997) 的网格简化，用来生成LOD
+// 只做 half edge collapse (顶点合并到相邻顶点上)，不产生新顶点:
+// 所有LOD共用LOD0的顶点数组，只是索引不同，可以放在同一个VBO/EBO里
+// 边界和uv/法线接缝上的顶点不会被移走，避免出现裂缝
+class MeshSimplifier {
+   public:
+    static const int MAX_LOD_COUNT = 4;             // 包括LOD0
+    static const int MIN_LOD_TRIANGLES = 2048;      // 三角形比这少的mesh不生成LOD
+
+    // 三角形数量尽量降到targetIndexCount/3以下，误差超过maxError (相对于AABB对角线) 时提前停止
+    static QVector<unsigned int> simplify(const QVector<Vertex>& vertices, const QVector<unsigned int>& indices,
+                                          int targetIndexCount, float maxError);
+
+    // LOD1..n，每一级三角形减半，减不下去时提前结束
+    static QVector<QVector<unsigned int>> generateLods(const QVector<Vertex>& vertices,
+                                                       const QVector<unsigned int>& indices);
+
+   private:
+    MeshSimplifier() = default;
+};
+
+#endif  //MESH_SIMPLIFIER_HPP
@@ -0,0 +1,42 @@
+//
+// Created by fangl on 2023/10/15.
+//
+
+#ifndef MODEL_DATA_HPP
+#define MODEL_DATA_HPP
+
+#include <memory>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+#include "data_structures.hpp"
+#include "m_type.hpp"
+#include "utils/bounding_volume.hpp"
+#include "utils/texture_decoder.hpp"
+
+
+// 模型没有法线时重新计算 (ObjLoader和AssimpLoader共用)，夹角超过这个角度 (度) 的面之间保留硬边
+const static float MODEL_NORMAL_CREASE_ANGLE = 60.0f;
+
+// 模型导入的CPU阶段的结果，不包含任何GL对象，可以在worker线程里生成
+struct ModelTextureRef {
+    QString path;
+    TextureType type;
+};
+
+struct ModelMeshData {
+    QVector<Vertex> vertices;
+    QVector<unsigned int> indices;
+    QVector<QVector<unsigned int>> lods;    // LOD1..n的索引，和LOD0共用vertices
+    QVector<ModelTextureRef> textures;
+    BoundingBox bounds;     // 模型空间，导入时计算 (或从mesh cache读出)
+};
+
+struct ModelData {
+    QString path;
+    QVector<ModelMeshData> meshes;
+    QMap<QString, std::shared_ptr<DecodedTexture>> images;  // 已经解码好的贴图 (带mip链)，key是路径
+};
+
+#endif  //MODEL_DATA_HPP
@@ -0,0 +1,72 @@
+//
+// Created by fangl on 2023/10/13.
+//
+
+#ifndef MODEL_LOADER_HPP
+#define MODEL_LOADER_HPP
+
+#include <future>
+#include <memory>
+#include <vector>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include "mesh.hpp"
+#include "resource_manager.hpp"
+
+
+// 一个模型的异步导入任务，由ModelLoader推进，只在GUI(render)线程访问
+class ModelLoadTask {
+    friend class ModelLoader;
+   public:
+    enum class State {
+        Parsing,    // worker线程: Assimp解析 + 顶点转换 + 贴图解码
+        Uploading,  // render线程: 每帧按时间片创建一部分mesh的GPU资源
+        Finished,
+        Failed,
+        Cancelled
+    };
+
+    explicit ModelLoadTask(QString mPath);
+
+    // 取消之后worker线程仍会跑完，只是结果被丢弃
+    void cancel();
+
+    [[nodiscard]] State getState() const;
+    [[nodiscard]] bool isDone() const;      // Finished / Failed / Cancelled
+    [[nodiscard]] float getProgress() const;    // 解析完成算0.5，剩下的按上传的mesh数量
+    [[nodiscard]] const QString& getPath() const;
+    [[nodiscard]] const QVector<std::shared_ptr<Mesh>>& getMeshes() const;
+
+   private:
+    QString path;
+    State state;
+
+    std::future<std::shared_ptr<ModelData>> cpuResult;
+    std::shared_ptr<ModelData> data;
+    QVector<std::shared_ptr<Mesh>> meshes;
+    int uploadedCount;
+};
+
+
+// 模型的异步导入: CPU阶段放进线程池，GPU阶段由pump()在有context的线程里按时间片执行
+class ModelLoader {
+   public:
+    ModelLoader();
+    ~ModelLoader();
+
+    // 缓存命中时返回的任务已经是Finished
+    std::shared_ptr<ModelLoadTask> load(const QString& mPath);
+
+    // 需要current context，每次调用最多花费budgetMs (至少推进一个mesh)
+    void pump(qint64 budgetMs);
+    [[nodiscard]] bool hasPendingTasks() const;
+
+   private:
+    QThreadPool threadPool;
+    std::vector<std::shared_ptr<ModelLoadTask>> tasks;
+};
+
+#endif  //MODEL_LOADER_HPP
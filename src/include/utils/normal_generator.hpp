@@ -0,0 +1,36 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef NORMAL_GENERATOR_HPP
+#define NORMAL_GENERATOR_HPP
+
+#include <QVector>
+#include <QVector4D>
+
+#include "data_structures.hpp"
+
+
+enum class NormalWeighting {
+    Area,       // 面积加权，大三角形影响大
+    Angle,      // 顶角加权，和三角形怎么切分无关
+};
+
+// 导入时重新计算平滑法线
+// 位置相同的顶点 (uv接缝处被拆开的) 一起平滑，不会在接缝处断开
+// 三角形数量足够多时按三角形区间并行，每个区间有自己的累加buffer，最后再归并
+class NormalGenerator {
+   public:
+    // 两个面的夹角超过creaseAngle (度) 时不互相平滑，需要的话会拆分顶点 (vertices和indices都可能改变)
+    // creaseAngle >= 180 时所有相邻面都参与平滑，不会拆分顶点
+    static void generate(QVector<Vertex>& vertices, QVector<unsigned int>& indices,
+                         float creaseAngle = 180.0f, NormalWeighting weighting = NormalWeighting::Angle);
+
+    // 按uv方向计算切线 (Lengyel)，xyz和法线正交，w是副切线的方向 (+1/-1)
+    static QVector<QVector4D> generateTangents(const QVector<Vertex>& vertices, const QVector<unsigned int>& indices);
+
+   private:
+    NormalGenerator() = default;
+};
+
+#endif  //NORMAL_GENERATOR_HPP
@@ -0,0 +1,29 @@
+//
+// Created by fangl on 2023/10/16.
+//
+
+#ifndef OBJ_LOADER_HPP
+#define OBJ_LOADER_HPP
+
+#include <memory>
+#include <QString>
+
+#include "model_data.hpp"
+
+
+// 专门针对OBJ/MTL的导入器，assets/models下几乎都是OBJ，不需要经过Assimp的通用场景图
+//   1. 整个文件map进内存，按行边界切成若干段，每段在线程池里独立解析 (v/vt/vn/f/usemtl)
+//   2. 合并各段的结果，负数(相对)索引和跨段的usemtl在这里修正
+//   3. 每个材质一个mesh，用开放寻址的hash表对 v/vt/vn 三元组去重，直接生成Vertex和索引
+// 输出和Assimp路径一致: 三角化，V坐标翻转 (aiProcess_FlipUVs)，没有vn时用NormalGenerator生成法线
+// 文件读不到或者内容不合法时返回nullptr，由调用方退回Assimp
+class ObjLoader {
+   public:
+    static bool canLoad(const QString& path);
+    static std::shared_ptr<ModelData> load(const QString& path);
+
+   private:
+    ObjLoader() = default;
+};
+
+#endif  //OBJ_LOADER_HPP
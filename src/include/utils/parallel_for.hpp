@@ -0,0 +1,23 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef PARALLEL_FOR_HPP
+#define PARALLEL_FOR_HPP
+
+#include <functional>
+
+
+// 导入时的数据并行 (OBJ解析、法线生成等) 共用的线程池
+// 调用线程自己也领取任务执行，所以在池子里的线程上嵌套调用也不会死锁
+class ParallelFor {
+   public:
+    // 对[0, count)的每个i执行一次job(i)，全部完成后返回
+    static void run(int count, const std::function<void(int)>& job);
+    static int threadCount();
+
+   private:
+    ParallelFor() = default;
+};
+
+#endif  //PARALLEL_FOR_HPP
@@ -5,30 +5,68 @@
 #ifndef RESOURCE_MANAGER_HPP
 #define RESOURCE_MANAGER_HPP
 
+#include <atomic>
 #include <map>
+#include <memory>
+#include <QImage>
+#include <QMap>
 #include <QString>
 
-#include "assimp/Importer.hpp"
-#include "assimp/postprocess.h"
-#include "assimp/scene.h"
-
 #include "m_type.hpp"
 #include "data_structures.hpp"
 #include "mesh.hpp"
+#include "mesh_geometry.hpp"
 #include "shader.hpp"
 #include "texture2d.hpp"
+#include "texture_decoder.hpp"
+#include "uniform_buffer.hpp"
+#include "material_table.hpp"
+#include "render/geometry_arena.hpp"
+#include "render/upload_ring.hpp"
+#include "model_data.hpp"
 
 
 class ResourceManager
 {
    public:
     static std::map<QString, std::shared_ptr<Shader>> map_Shaders;
+    // 编译好的program，按 shader文件路径 + defines 缓存，同样的组合只编译一次
+    static std::map<QString, std::shared_ptr<Shader>> map_ShaderPrograms;
     static std::map<QString, std::shared_ptr<Texture2D>> map_Textures;
-
-    static void updateProjViewViewPosMatrixInShader(QMatrix4x4 proj, QMatrix4x4 vi, QVector3D viewP);
-    static void updateRenderConfigure(GLboolean depthMode);
-    static void updateMaterialInShader(const QString& sName, const Material& mat);
-    static void updateDirectLightInShader(GLboolean enableLighting ,DirectLight dl);
+    // 按 文件路径 + 类型 + 格式 去重的贴图，只持有weak_ptr，没有使用者之后贴图随之释放
+    static std::map<QString, std::weak_ptr<Texture2D>> map_TextureCache;
+
+    // geometry缓存，只持有weak_ptr: 所有使用者都释放之后GPU buffer也随之释放
+    // key: "shape|type|参数" 或 "model|路径|修改时间|import flags"
+    struct ModelCacheEntry {
+        QVector<std::weak_ptr<MeshGeometry>> geometries;
+        QVector<QVector<std::weak_ptr<Texture2D>>> textures;   // 每个mesh的贴图
+    };
+    static std::map<QString, std::weak_ptr<MeshGeometry>> map_ShapeGeometries;
+    static std::map<QString, ModelCacheEntry> map_ModelGeometries;
+
+    // 需要在有current context之后调用 (initializeGL)
+    static void initRenderResources();
+
+    // 顶点/索引/uniform等动态数据都经过UploadRing上传，不重新分配buffer也不等待GPU
+    static UploadRing* getUploadRing();
+    static void uploadBufferData(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data);
+    // 每帧绘制完成后调用，让ring回收GPU已经用完的区间
+    static void endUploadFrame();
+    // 每种顶点格式一个arena，所有MeshGeometry都从这里分配VBO/EBO区间
+    static std::shared_ptr<GeometryArena> getGeometryArena(VertexFormat format);
+
+    // frame block: 只写入CPU端的数据，uploadFrameUniforms()时整块上传一次
+    static void updateFrameCamera(const QMatrix4x4& proj, const QMatrix4x4& vi, const QVector3D& viewP);
+    static void updateFrameRenderConfigure(GLboolean depthMode);
+    static void updateFrameDirectLight(GLboolean enableLighting, const DirectLight& dl);
+    static void uploadFrameUniforms();
+
+    // material table: 物体只持有id，修改参数只标记dirty，每帧最多上传一次dirty区间
+    static GLint allocateMaterial(const Material& mat);
+    static void releaseMaterial(GLint id);
+    static void updateMaterial(GLint id, const Material& mat);
+    static void uploadMaterials();
     static void updatePointLightInShader(PointLight pl);
     static void updateSpotLightInShader(SpotLight sl);
 
@@ -36,27 +74,76 @@ class ResourceManager
                                               const QString& vShaderFile,
                                               const QString& fShaderFile,
                                               const QString& gShaderfile = nullptr);
+    static std::shared_ptr<Shader> loadShaderProgram(const QString& vShaderFile,
+                                                     const QString& fShaderFile,
+                                                     const QString& gShaderfile = nullptr,
+                                                     const QStringList& defines = QStringList());
+    static std::shared_ptr<Shader> loadComputeShader(const QString& name, const QString& cShaderFile);
     static std::shared_ptr<Shader> getShader(const QString&  name);
     static std::shared_ptr<Texture2D> loadTexture(const QString&  name, const QString& file, GLboolean alpha = false);
     static std::shared_ptr<Texture2D> getTexture(const QString&  name);
+    // 模型导入、GameObject换贴图、loadTexture都通过这里拿贴图，同一个文件只generate一次
+    // decoded不为空时直接用已经解码好的图片 (异步导入的模型)
+    static std::shared_ptr<Texture2D> acquireTexture(const QString& file, TextureType type, GLboolean alpha = false,
+                                                     const DecodedTexture* decoded = nullptr);
+    // 批量版本: 缓存中没有的贴图先在线程池里并行解码并生成mip链，GL线程上只做上传
+    static QVector<std::shared_ptr<Texture2D>> acquireTextures(const QStringList& files, TextureType type);
+
+    struct TextureCacheStats {
+        int hits;
+        int misses;
+        int residentCount;      // 仍然存活的贴图数量
+        qint64 residentBytes;   // 估算的显存占用
+    };
+    [[nodiscard]] static TextureCacheStats getTextureCacheStats();
 
     static void clearShader();
     static void clearTextures();
 
+    // 相同参数的shape共用同一份geometry
+    static std::shared_ptr<MeshGeometry> loadShapeGeometry(ObjectType type, float width = 0.0f, float height = 0.0f);
+    // 同一个文件(且未被修改)只import一次，返回的Mesh共享geometry和贴图，但transform等各自独立
     static QVector<std::shared_ptr<Mesh>> loadModel(const QString& mPath);
+    // 模型导入拆成两步，loadModel就是两步连在一起:
+    //   importModelData: 解析(OBJ用ObjLoader，其他用Assimp) + 顶点转换 + 贴图解码，不碰GL和缓存，可以在worker线程调用
+    //   createModelMesh: 在有context的线程里创建一个mesh的GPU资源
+    static std::shared_ptr<ModelData> importModelData(const QString& mPath);
+    static std::shared_ptr<Mesh> createModelMesh(const ModelData& data, int meshIndex);
+    // 缓存中没有(或已经释放)时返回空
+    static QVector<std::shared_ptr<Mesh>> findCachedModel(const QString& mPath);
+    static void registerModelCache(const QString& mPath, const QVector<std::shared_ptr<Mesh>>& meshes);
+    static void clearGeometryCache();
+    [[nodiscard]] static int getCachedGeometryCount();     // 仍然存活的geometry数量
+    // 导入时做vertex cache/overdraw/vertex fetch优化 (MeshOptimizer)，结果会写进mesh cache
+    static void setMeshOptimizationEnabled(bool enabled);
+    [[nodiscard]] static bool isMeshOptimizationEnabled();
+    // 模型的顶点在GPU上使用VertexFormat::Packed (16字节)，shape始终是Float
+    static void setPackedModelVerticesEnabled(bool enabled);
+    [[nodiscard]] static bool isPackedModelVerticesEnabled();
 
    private:
     ResourceManager() {}
 
+    static std::unique_ptr<UploadRing> uploadRing;
+    static std::shared_ptr<GeometryArena> geometryArenas[2];    // 按VertexFormat索引
+    static std::unique_ptr<UniformBuffer> frameUniformBuffer;
+    static FrameBlockData frameBlockData;
+    static std::unique_ptr<MaterialTable> materialTable;
+
+    static int textureCacheHits;
+    static int textureCacheMisses;
+    static std::atomic<bool> meshOptimizationEnabled;
+    static bool packedModelVertices;
+
    private:
-    static QVector<std::shared_ptr<Mesh>> processNode(aiNode *node, const aiScene *scene, const QString& mDir);
-    static std::shared_ptr<Mesh> processMesh(aiMesh *mesh, const aiScene *scene, const QString& mDir);
-    static QVector<std::shared_ptr<Texture2D>> loadMaterialTextures(aiMaterial *mat,
-                                                                    aiTextureType type,
-                                                                    const QString& typeName,
-                                                                    const QString& mDir);
-
-    static void reCalculateNormal(QVector<Vertex> &vertices, const QVector<unsigned int>& indices);
+    static void decodeModelTextures(ModelData& data);
+    static void optimizeModelData(ModelData& data);
+    static void generateModelLods(ModelData& data, bool optimize);
+    static unsigned int getImportFlags();
+
+    static QString makeModelCacheKey(const QString& mPath);
+    static QString makeTextureCacheKey(const QString& file, TextureType type, GLboolean alpha);
+    static void purgeExpiredGeometries();
 
 };
 
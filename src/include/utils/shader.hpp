@@ -5,18 +5,43 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+#include <array>
+#include <QHash>
+#include <QStringList>
 #include <QOpenGLShader>
 #include <QOpenGLShaderProgram>
 
 
+// 热路径上用到的uniform，link之后一次性解析成location，
+// 每帧的set调用只需要查数组，不再做字符串的哈希和比较
+enum class UniformId : int {
+    Model = 0,
+    UseDiffuseTexture,
+    UseSpecularTexture,
+    Skybox,
+    MaterialTextureDiffuse1,
+    MaterialTextureSpecular1,
+    ScreenTexture,
+    PostProcessingType,
+
+    Count
+};
+
+const char* uniformIdToString(UniformId id);
+
+
 class Shader
 {
     friend class ResourceManager;
    public:
-    Shader() = default;
+    Shader() { uniformIdLocations.fill(-1); }
     ~Shader() = default;
 
-    bool compile(const QString& vertexSource, const QString& fragmentSource, const QString& geometrySource = nullptr);
+    // defines 会以 "#define XXX" 的形式插入到每个stage的#version之后
+    bool compile(const QString& vertexSource, const QString& fragmentSource, const QString& geometrySource = nullptr,
+                 const QStringList& defines = QStringList());
+    // 只有compute stage的program (GL 4.3)
+    bool compileCompute(const QString& computeSource, const QStringList& defines = QStringList());
 
     Shader& use(){
         shaderProgram->bind();
@@ -31,58 +56,98 @@ class Shader
         shaderProgram->bind();
     }
 
+    [[nodiscard]] GLuint getProgramID() const {
+        return shaderProgram->programId();
+    }
+
+    // -1 代表program中没有这个(active) uniform，Qt会直接忽略
+    GLint uniformLocation(const QString& name) const {
+        return uniformLocations.value(name, -1);
+    }
+
+    GLint uniformLocation(UniformId id) const {
+        return uniformIdLocations[static_cast<int>(id)];
+    }
+
+    /*============ string api (cached lookup) ============*/
     void setFloat(const QString& name, const GLfloat& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
     }
 
     void setInteger(const QString& name, const GLint& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
     }
 
     void setVector2f(const QString& name, const GLfloat& x, const GLfloat& y) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, QVector2D(x, y));
+        shaderProgram->setUniformValue(uniformLocation(name), QVector2D(x, y));
     }
 
     void setVector2f(const QString& name, const QVector2D& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
     }
 
     void setVector3f(const QString& name, const GLfloat& x, const GLfloat& y, const GLfloat& z) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, QVector3D(x, y, z));
+        shaderProgram->setUniformValue(uniformLocation(name), QVector3D(x, y, z));
     }
 
     void setVector3f(const QString& name, const QVector3D& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
     }
 
     void setVector4f(const QString& name, const GLfloat& x, const GLfloat& y, const GLfloat& z, const GLfloat& w) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, QVector4D(x, y, z, w));
+        shaderProgram->setUniformValue(uniformLocation(name), QVector4D(x, y, z, w));
     }
 
     void setVector4f(const QString& name, const QVector4D& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
     }
 
     void setMatrix4f(const QString& name, const QMatrix4x4& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
     }
 
     void setBool(const QString& name, const GLboolean& value) const {
-        GLint loc = shaderProgram->uniformLocation(name);
-        shaderProgram->setUniformValue(loc, value);
+        shaderProgram->setUniformValue(uniformLocation(name), value);
+    }
+
+    /*============ handle api (pre-resolved) ============*/
+    void setFloat(UniformId id, const GLfloat& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
+    }
+
+    void setInteger(UniformId id, const GLint& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
+    }
+
+    void setVector2f(UniformId id, const QVector2D& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
+    }
+
+    void setVector3f(UniformId id, const QVector3D& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
+    }
+
+    void setVector4f(UniformId id, const QVector4D& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
+    }
+
+    void setMatrix4f(UniformId id, const QMatrix4x4& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
+    }
+
+    void setBool(UniformId id, const GLboolean& value) const {
+        shaderProgram->setUniformValue(uniformLocation(id), value);
     }
 
+   private:
+    void cacheUniformLocations();
+    void bindUniformBlocks();
+
    private:
     std::shared_ptr<QOpenGLShaderProgram> shaderProgram;
+
+    QHash<QString, GLint> uniformLocations;
+    std::array<GLint, static_cast<int>(UniformId::Count)> uniformIdLocations;
 };
 
 #endif  //SHADER_HPP
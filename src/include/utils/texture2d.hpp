@@ -10,6 +10,7 @@
 
 #include "m_type.hpp"
 
+struct DecodedTexture;
 
 class Texture2D
 {
@@ -18,8 +19,12 @@ class Texture2D
     Texture2D();
     ~Texture2D();
     void generate(const QString& file);
+    void generate(const QImage& image);     // 图片已经在别的线程解码好
+    void generate(const DecodedTexture& decoded);   // 已经转换好格式，可能带有CPU生成的mip链
     void bind() const;
     GLuint getTextureID();
+    [[nodiscard]] qint64 getByteSize() const;   // 估算的显存占用 (包括mipmap)
+    [[nodiscard]] AlphaMode getAlphaMode() const;
 
     void setTextureFormat(QOpenGLTexture::TextureFormat format);
     void setWrapMode(QOpenGLTexture::WrapMode s, QOpenGLTexture::WrapMode t);
@@ -28,7 +33,7 @@ class Texture2D
     // 方便期间，直接裸露
     GLuint id;
     TextureType type;
-    GLboolean transparent;
+    GLboolean transparent;  // alphaMode != Opaque
     QString path;
 
    private:
@@ -39,8 +44,16 @@ class Texture2D
     QOpenGLTexture::Filter filter_max;
 
     std::shared_ptr<QOpenGLTexture> texture;
+    qint64 byteSize;
+    AlphaMode alphaMode;
 
-    static GLboolean checkTransparency(const QImage& image);
+    void setAlphaMode(AlphaMode mode);
+    void applySamplerState();
+
+   public:
+    // 纯CPU的检查，TextureDecoder会在worker线程里调用
+    // 直接按行扫描32位像素 (SSE2一次4个)，遇到半透明像素立即返回
+    static AlphaMode classifyAlpha(const QImage& image);
 };
 
 
@@ -0,0 +1,45 @@
+//
+// Created by fangl on 2023/10/14.
+//
+
+#ifndef TEXTURE_DECODER_HPP
+#define TEXTURE_DECODER_HPP
+
+#include <memory>
+#include <vector>
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "gl_configure.hpp"
+#include "m_type.hpp"
+
+
+// 在CPU上准备好的贴图: 已经转换成最终上传的格式 (RGBA8888)，可选地带上完整的mip链
+struct DecodedTexture {
+    QString path;
+    QVector<QImage> levels;     // levels[0]是原图，为空表示解码失败
+    AlphaMode alphaMode = AlphaMode::Opaque;
+
+    [[nodiscard]] bool isValid() const { return !levels.isEmpty() && !levels[0].isNull(); }
+    [[nodiscard]] bool hasMipChain() const { return levels.size() > 1; }
+};
+
+
+// 贴图解码: 全部是CPU上的工作，可以在任意线程调用，GL线程只需要最后的上传
+class TextureDecoder {
+   public:
+    // 解码 + 格式转换 + (可选)mip链
+    static std::shared_ptr<DecodedTexture> decode(const QString& path, bool generateMips);
+    // 在内部的线程池里并行解码一批贴图，阻塞直到全部完成，顺序与paths一致
+    static std::vector<std::shared_ptr<DecodedTexture>> decodeBatch(const QStringList& paths, bool generateMips);
+
+    // 2x2 box filter缩小一级 (RGBA8888)，奇数边长时最后一行/列重复使用
+    static QImage downsample(const QImage& src);
+
+   private:
+    TextureDecoder() = default;
+};
+
+#endif  //TEXTURE_DECODER_HPP
@@ -0,0 +1,39 @@
+//
+// Created by fangl on 2023/10/8.
+//
+
+#ifndef UNIFORM_BUFFER_HPP
+#define UNIFORM_BUFFER_HPP
+
+#include <QDebug>
+
+#include "gl_configure.hpp"
+
+
+// uniform block的绑定点，所有program共用
+// (GLSL 410 不支持 layout(binding = N)，在Shader link之后通过glUniformBlockBinding设置)
+const static GLuint FrameBlockBinding = 0;
+const static GLuint MaterialBlockBinding = 1;
+
+
+class UniformBuffer {
+   public:
+    UniformBuffer();
+    ~UniformBuffer();
+
+    void create(GLsizeiptr size, GLuint bindingPoint);
+    void update(GLintptr offset, GLsizeiptr size, const void* data);
+
+    [[nodiscard]] GLuint getBufferID() const;
+    [[nodiscard]] GLuint getBindingPoint() const;
+    [[nodiscard]] GLsizeiptr getSize() const;
+
+   private:
+    GLFunctions_Core *glFunc;
+
+    GLuint UBO;
+    GLuint binding;
+    GLsizeiptr bufferSize;
+};
+
+#endif  //UNIFORM_BUFFER_HPP
@@ -0,0 +1,35 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef VERTEX_PACKING_HPP
+#define VERTEX_PACKING_HPP
+
+#include <QVector>
+#include <QVector2D>
+#include <QVector3D>
+
+#include "data_structures.hpp"
+#include "utils/bounding_volume.hpp"
+
+
+// Vertex <-> PackedVertex 的转换
+// 位置: (p - bounds.min) / (bounds.max - bounds.min) 量化到unorm16，shader里用 offset + aPos * scale 还原
+// 法线: 八面体编码到两个snorm16
+// uv:   half float，[-2048, 2048]内整数部分精确，repeat的uv也够用
+class VertexPacking {
+   public:
+    static QVector<PackedVertex> pack(const QVector<Vertex>& vertices, const BoundingBox& bounds);
+
+    // 还原位置用的参数，对应shader里的positionOffset/positionScale
+    static QVector3D positionOffset(const BoundingBox& bounds);
+    static QVector3D positionScale(const BoundingBox& bounds);
+
+    static QVector2D encodeOctahedral(const QVector3D& normal);
+    static quint16 floatToHalf(float value);
+
+   private:
+    VertexPacking() = default;
+};
+
+#endif  //VERTEX_PACKING_HPP
@@ -2,31 +2,34 @@
 // Created by fangl on 2023/9/26.
 //
 
+#include <algorithm>
+#include <limits>
 #include <utility>
 
 #include "object/game_object.hpp"
 
 
 GLuint GameObject::gameObjectCounter = 0;
+GLuint64 GameObject::sceneRevision = 0;
+GLuint64 GameObject::structureRevision = 0;
+std::vector<GameObject*> GameObject::instanceDirtyObjects;
 
 GameObject::GameObject()
-    : display(GL_TRUE), drawOutline(GL_FALSE), containTransparencyTexture(GL_FALSE),
+    : display(GL_TRUE), drawOutline(GL_FALSE), loading(GL_FALSE), alphaTested(GL_FALSE),
+      lodBias(0.0f), instanceDirty(GL_FALSE), containTransparencyTexture(GL_FALSE),
       displayName("GameObject"), objectID(gameObjectCounter++),
       type(ObjectType::Cube), modelPath(""),
-      shader(), material()
+      shader(), shadingMode(ShaderType::Default), material(),
+      spatialIndex(nullptr), proxyID(DynamicBVH::NullNode)
 {
-    shaderName = "shader_" + QString::number(objectID);
-    ResourceManager::loadShader(shaderName,
-                                ":/shaders/assets/shaders/defaultShader.vert",
-                                ":/shaders/assets/shaders/defaultShader.frag");
-    shader = ResourceManager::getShader(shaderName);
-    ResourceManager::updateMaterialInShader(shaderName, material);
+    materialID = ResourceManager::allocateMaterial(material);
+    shader = ResourceManager::loadShaderProgram(":/shaders/assets/shaders/defaultShader.vert",
+                                                ":/shaders/assets/shaders/defaultShader.frag");
 
     QVector<std::shared_ptr<Texture2D>> vecTextures{};
     std::shared_ptr<Mesh> cubeMesh = std::make_shared<Mesh>(
         shader,
-        ShapeData::getUnitCubeVertices(),
-        ShapeData::getUnitCubeIndices(),
+        ResourceManager::loadShapeGeometry(ObjectType::UnitCube),
         vecTextures);
 
     meshes = QVector<std::shared_ptr<Mesh>>{cubeMesh};
@@ -42,10 +45,9 @@ GameObject::GameObject()
     for(auto& m : meshes) {
         m->setTransform(this->transform);
     }
+    updateWorldBounds();
 
-    shader->use();
-    shader->setMatrix4f("model", this->transform);
-    shader->release();
+    markStructureDirty();
 }
 
 GameObject::GameObject(ObjectType type, float width, float height, const QString& disName)
@@ -82,28 +84,72 @@ GameObject::GameObject(const QString& mPath, const QString& disName)
 
 GameObject::~GameObject() {
     meshes.clear();
+    ResourceManager::releaseMaterial(materialID);
+    if(spatialIndex != nullptr && proxyID != DynamicBVH::NullNode)
+        spatialIndex->destroyProxy(proxyID);
+    if(instanceDirty) {
+        instanceDirtyObjects.erase(std::find(instanceDirtyObjects.begin(), instanceDirtyObjects.end(), this));
+    }
+    markStructureDirty();
     // 可能要通知主界面？需要删除显示的list
 
 }
 
-void GameObject::draw() {
-    if(!display) {
+void GameObject::collectDrawPackets(RenderQueue& queue, const Frustum& frustum) {
+    if(!display || !frustum.intersects(worldBounds)) {
         return;
     }
 
-    shader->use();
-    if(meshes.size() > 1) {
-        shader->setBool("isMultiMeshModel", GL_TRUE);
-    } else {
-        shader->setBool("isMultiMeshModel", GL_FALSE);
-    }
-    shader->release();
-
+    // 只有一个mesh时物体的bounds就是mesh的bounds，不需要再测一次
+    const bool testMeshes = meshes.size() > 1;
+    RenderLayer layer = containTransparencyTexture ? RenderLayer::Transparent : RenderLayer::Opaque;
+    // 常驻的opaque layer由GPU剔除，这里只剩outline
+    const bool submitLayer = layer != RenderLayer::Opaque || !queue.isOpaqueResident();
+    if(!submitLayer && !drawOutline)
+        return;
     for(auto & m : meshes) {
-        m->draw();
+        if(testMeshes && !frustum.intersects(m->getWorldBounds()))
+            continue;
+        const int lod = m->selectLod(queue.getProjectedSize(m->getWorldBounds()), lodBias);
+        if(submitLayer)
+            queue.submit(layer, this, m.get(), lod);
+        // outline放大了1.05倍，用mesh自身的bounds测试即可 (保守)
+        if(drawOutline)
+            queue.submit(RenderLayer::Outline, this, m.get(), lod);
     }
 }
 
+void GameObject::collectResidentPackets(RenderQueue& queue) {
+    if(containTransparencyTexture)
+        return;
+    for(auto & m : meshes)
+        queue.submitResident(this, m.get());
+}
+
+GLboolean GameObject::hasPerFramePackets() const {
+    return containTransparencyTexture || drawOutline;
+}
+
+// model矩阵和贴图由RenderQueue按mesh设置
+GLint GameObject::getInstanceFlags() const {
+    GLint flags = 0;
+    if(meshes.size() > 1)
+        flags |= InstanceMultiMesh;
+    if(shadingMode == ShaderType::Reflection)
+        flags |= InstanceReflection;
+    else if(shadingMode == ShaderType::Refraction)
+        flags |= InstanceRefraction;
+    else if(shadingMode == ShaderType::Fresnel)
+        flags |= InstanceFresnel;
+    if(alphaTested && !containTransparencyTexture)
+        flags |= InstanceAlphaTest;
+    return flags;
+}
+
+GLint GameObject::getMaterialID() const {
+    return materialID;
+}
+
 void GameObject::loadShape(ObjectType t, float width, float height) {
     // width or diameter
     this->type = t;
@@ -112,33 +158,13 @@ void GameObject::loadShape(ObjectType t, float width, float height) {
 
     switch (t) {
         case ObjectType::UnitCube:
-            meshes.append(std::make_shared<Mesh>(shader, ShapeData::getUnitCubeVertices(),
-                                              ShapeData::getUnitCubeIndices(),
-                                              vecTextures));
-            break;
         case ObjectType::Cube:
-            meshes.append(std::make_shared<Mesh>(shader, ShapeData::getCubeVertices(static_cast<int>(width)),
-                                                 ShapeData::getCubeIndices(static_cast<int>(width)),
-                                                 vecTextures));
-            break;
         case ObjectType::Plane:
-            meshes.append(std::make_shared<Mesh>(shader, ShapeData::getPlaneVertices(static_cast<int>(width), static_cast<int>(height)),
-                                                 ShapeData::getPlaneIndices(static_cast<int>(width), static_cast<int>(height)),
-                                                 vecTextures));
-            break;
         case ObjectType::Quad:
-            meshes.append(std::make_shared<Mesh>(shader, ShapeData::getQuadVertices(),
-                                                 ShapeData::getQuadIndices(),
-                                                 vecTextures));
-            break;
         case ObjectType::Capsule:
-            meshes.append(std::make_shared<Mesh>(shader, ShapeData::getCapsuleVertices(static_cast<float>(width), static_cast<float>(height)),
-                                                 ShapeData::getCapsuleIndices(static_cast<float>(width), static_cast<float>(height)),
-                                                 vecTextures));
-            break;
         case ObjectType::Sphere:
-            meshes.append(std::make_shared<Mesh>(shader, ShapeData::getSphereVertices(width, static_cast<int>(height)),
-                                                 ShapeData::getSphereIndices(width, static_cast<int>(height)),
+            // 相同参数的shape共用同一份geometry，这样RenderQueue也能把它们合并成一次instanced draw
+            meshes.append(std::make_shared<Mesh>(shader, ResourceManager::loadShapeGeometry(t, width, height),
                                                  vecTextures));
             break;
         case ObjectType::Model:
@@ -148,12 +174,36 @@ void GameObject::loadShape(ObjectType t, float width, float height) {
             qFatal("TYPE WRONG!");
     }
 
+    for(auto& m : meshes) {
+        m->setTransform(transform);
+    }
+    updateWorldBounds();
+
+    markStructureDirty();
     qDebug("Load Shape Finished");
 }
 
 void GameObject::loadModel(const QString& mPath) {
+    this->modelPath = mPath;
+    setModelMeshes(ResourceManager::loadModel(mPath));
+    qDebug("Load Model Finished");
+}
+
+void GameObject::beginAsyncLoad(const QString& mPath) {
     this->type = ObjectType::Model;
-    this->meshes = ResourceManager::loadModel(mPath);
+    this->modelPath = mPath;
+    this->displayName = UtilAlgorithms::getFileNameFromPath(mPath);
+    this->loading = GL_TRUE;
+
+    meshes.clear();
+    updateWorldBounds();
+    markStructureDirty();
+}
+
+void GameObject::setModelMeshes(QVector<std::shared_ptr<Mesh>> loadedMeshes) {
+    this->type = ObjectType::Model;
+    this->loading = GL_FALSE;
+    this->meshes = std::move(loadedMeshes);
 
     for(auto & m : meshes) {
         m->setShader(shader);
@@ -166,7 +216,12 @@ void GameObject::loadModel(const QString& mPath) {
         }
     }
 
-    qDebug("Load Model Finished");
+    updateWorldBounds();
+    markStructureDirty();
+}
+
+GLboolean GameObject::isLoading() const {
+    return loading;
 }
 
 //void GameObject::loadShader(const QString& vertPath, const QString& fragPath, const QString& geoPath) {
@@ -249,10 +304,7 @@ void GameObject::loadDiffuseTexture(const QString& tPath) {
         qDebug("You must assign a Mesh to loaded a diffuse texture!");
     }
     // 这里直接覆盖掉原来的texture
-    material.texture_diffuse1 = std::make_shared<Texture2D>();
-    material.texture_diffuse1->generate(tPath);
-    material.texture_diffuse1->type = TextureType::Diffuse;
-    material.texture_diffuse1->path = tPath;
+    material.texture_diffuse1 = ResourceManager::acquireTexture(tPath, TextureType::Diffuse);
 
     // 清除原来的diffuse然后赋值
     auto& tempVec = meshes[0]->textures;
@@ -263,18 +315,18 @@ void GameObject::loadDiffuseTexture(const QString& tPath) {
 
     meshes[0]->textures.append(material.texture_diffuse1);
 
+    // 只有真正半透明的贴图才需要排序和混合，镂空的贴图用alpha test就够了
     containTransparencyTexture = GL_FALSE;
+    alphaTested = GL_FALSE;
     for(auto &t : meshes[0]->textures) {
-        if(t->transparent) {
+        if(t->type != TextureType::Diffuse)
+            continue;
+        if(t->getAlphaMode() == AlphaMode::Blended)
             containTransparencyTexture = GL_TRUE;
-            break;
-        }
+        else if(t->getAlphaMode() == AlphaMode::Masked)
+            alphaTested = GL_TRUE;
     }
-
-    shader->use();
-    shader->setBool("useDiffuseTexture", true);
-    shader->setInteger("material.texture_diffuse1", material.texture_diffuse1->getTextureID());
-    shader->release();
+    markStructureDirty();
 }
 
 void GameObject::loadSpecularTexture(const QString& tPath) {
@@ -286,10 +338,7 @@ void GameObject::loadSpecularTexture(const QString& tPath) {
         qDebug("You must assign a Mesh to loaded a specular texture!");
     }
     // 这里直接覆盖掉原来的texture
-    material.texture_specular1 = std::make_shared<Texture2D>();
-    material.texture_specular1->generate(tPath);
-    material.texture_specular1->type = TextureType::Specular;
-    material.texture_specular1->path = tPath;
+    material.texture_specular1 = ResourceManager::acquireTexture(tPath, TextureType::Specular);
 
     // 清除原来的specular然后赋值
     auto& tempVec = meshes[0]->textures;
@@ -298,14 +347,22 @@ void GameObject::loadSpecularTexture(const QString& tPath) {
                                      return tex->type == TextureType::Specular;
                                  }), tempVec.end());
     tempVec.append(material.texture_specular1);
-
-    shader->use();
-    shader->setBool("useSpecularTexture", true);
-    shader->setInteger("material.texture_specular1", material.texture_specular1->getTextureID());
-    shader->release();
+    markStructureDirty();
 }
 
 // only for shape or pure model without texture, not model
+// 贴图通过ResourceManager的缓存共享 (key包括type)，不能直接改type
+// type不对时按需要的type重新取一份；不是从文件加载的贴图无法重新获取，只能丢掉
+static std::shared_ptr<Texture2D> textureWithType(const std::shared_ptr<Texture2D>& texture, TextureType type) {
+    if(texture == nullptr || texture->type == type)
+        return texture;
+    if(texture->path.isEmpty()) {
+        qDebug() << "WARNING::GAME_OBJECT::Texture type mismatch and no source path, ignore the texture";
+        return nullptr;
+    }
+    return ResourceManager::acquireTexture(texture->path, type);
+}
+
 void GameObject::setMaterial(Material mat) {
     if(meshes.size() != 1) {
         qDebug("Multiple Model Type or Empty Shape set material");
@@ -313,86 +370,71 @@ void GameObject::setMaterial(Material mat) {
 
     QVector<std::shared_ptr<Texture2D>> texVec;
     texVec.clear();
-    if(mat.texture_diffuse1 != nullptr) {
-        mat.texture_diffuse1->type = TextureType::Diffuse;
+    mat.texture_diffuse1 = textureWithType(mat.texture_diffuse1, TextureType::Diffuse);
+    if(mat.texture_diffuse1 != nullptr)
         texVec.append(mat.texture_diffuse1);
-    }
-    if(mat.texture_specular1 != nullptr) {
-        mat.texture_specular1->type = TextureType::Specular;
+    mat.texture_specular1 = textureWithType(mat.texture_specular1, TextureType::Specular);
+    if(mat.texture_specular1 != nullptr)
         texVec.append(mat.texture_specular1);
-    }
 
     if(!texVec.isEmpty()) {
         for(auto& m : meshes) {
             m->textures = texVec;
         }
+        markStructureDirty();
     }
 
     this->material = std::move(mat);
-    ResourceManager::updateMaterialInShader(shaderName, material);
+    ResourceManager::updateMaterial(materialID, material);
+    markSceneDirty();
 }
 
 void GameObject::setAmbientColor(QVector3D col) {
     this->material.ambientColor = col;
-    shader->use();
-    shader->setVector3f("material.ambientColor", col);
-    shader->release();
+    ResourceManager::updateMaterial(materialID, material);
+    markSceneDirty();
 }
 
 void GameObject::setDiffuseColor(QVector3D col) {
     this->material.diffuseColor = col;
-    shader->use();
-    shader->setVector3f("material.diffuseColor", col);
-    shader->release();
+    ResourceManager::updateMaterial(materialID, material);
+    markSceneDirty();
 }
 
 void GameObject::setSpecularColor(QVector3D col) {
     this->material.specularColor = col;
-    shader->use();
-    shader->setVector3f("material.specularColor", col);
-    shader->release();
+    ResourceManager::updateMaterial(materialID, material);
+    markSceneDirty();
 }
 
 void GameObject::setAmbientOcclusion(float ab) {
     this->material.ambientOcclusion = ab;
-    shader->use();
-    shader->setFloat("material.ambientOcclusion", ab);
-    shader->release();
+    ResourceManager::updateMaterial(materialID, material);
+    markSceneDirty();
 }
 
+// 反射/折射/fresnel 三者互斥
 void GameObject::setReflection(GLboolean isReflec) {
-    shader->use();
-    shader->setBool("isReflection", isReflec);
-    shader->setBool("isRefraction", false);
-    shader->setBool("isFresnel", false);
-    shader->setInteger("skybox", 31);    // 31作为默认的天空盒参数？
-    shader->release();
+    shadingMode = isReflec ? ShaderType::Reflection : ShaderType::Default;
+    markInstanceDirty();
 }
 
 void GameObject::setRefraction(GLboolean isRefrac) {
-    shader->use();
-    shader->setBool("isRefraction", isRefrac);
-    shader->setBool("isReflection", false);
-    shader->setBool("isFresnel", false);
-    shader->setInteger("skybox", 31);    // 31作为默认的天空盒参数？
-    shader->release();
+    shadingMode = isRefrac ? ShaderType::Refraction : ShaderType::Default;
+    markInstanceDirty();
 }
 
 void GameObject::setFresnel(GLboolean isFre) {
-    shader->use();
-    shader->setBool("isRefraction", false);
-    shader->setBool("isReflection", false);
-    shader->setBool("isFresnel", isFre);
-    shader->setInteger("skybox", 31);    // 31作为默认的天空盒参数？
-    shader->release();
+    shadingMode = isFre ? ShaderType::Fresnel : ShaderType::Default;
+    markInstanceDirty();
 }
 
 ObjectType GameObject::getType() {
     return this->type;
 }
 
-QString GameObject::getShaderName() {
-    return this->shaderName;
+ShaderType GameObject::getShadingMode() {
+    return this->shadingMode;
 }
 
 int GameObject::getMeshCount() {
@@ -411,6 +453,10 @@ GLboolean GameObject::getDrawOutline() {
     return drawOutline;
 }
 
+float GameObject::getLodBias() const {
+    return lodBias;
+}
+
 QMatrix4x4 GameObject::getTransform() {
     return this->transform;
 }
@@ -427,16 +473,23 @@ QVector3D GameObject::getScale() {
     return this->scale;
 }
 
+const BoundingBox& GameObject::getWorldBounds() {
+    return this->worldBounds;
+}
+
 void GameObject::setVisible(GLboolean visState) {
     this->display = visState;
+    markInstanceDirty();
 }
 
 void GameObject::setDrawOutline(GLboolean drawState) {
     this->drawOutline = drawState;
-    for(auto &m : meshes) {
-        m->setTransform(transform);
-        m->setDrawOutline(drawState);
-    }
+    markStructureDirty();
+}
+
+void GameObject::setLodBias(float bias) {
+    this->lodBias = bias;
+    markInstanceDirty();
 }
 
 void GameObject::setTransform(QMatrix4x4 trans) {
@@ -445,10 +498,8 @@ void GameObject::setTransform(QMatrix4x4 trans) {
     for(auto& m : meshes) {
         m->setTransform(transform);
     }
-
-    shader->use();
-    shader->setMatrix4f("model", trans);
-    shader->release();
+    updateWorldBounds();
+    markInstanceDirty();
 }
 
 void GameObject::setPosition(QVector3D pos) {
@@ -479,10 +530,67 @@ void GameObject::updateTransform() {
     for(auto& m : meshes) {
         m->setTransform(transform);
     }
+    updateWorldBounds();
+    markInstanceDirty();
+}
+
+void GameObject::updateWorldBounds() {
+    worldBounds = BoundingBox();
+    for(auto& m : meshes) {
+        worldBounds.expand(m->getWorldBounds());
+    }
+
+    syncSpatialProxy();
+}
 
-    shader->use();
-    shader->setMatrix4f("model", transform);
-    shader->release();
+void GameObject::syncSpatialProxy() {
+    if(spatialIndex == nullptr)
+        return;
+
+    if(!worldBounds.valid) {
+        if(proxyID != DynamicBVH::NullNode)
+            spatialIndex->destroyProxy(proxyID);
+        proxyID = DynamicBVH::NullNode;
+        return;
+    }
+
+    // 还在fat AABB里面的话BVH不会改变结构
+    if(proxyID == DynamicBVH::NullNode)
+        proxyID = spatialIndex->createProxy(worldBounds, this);
+    else
+        spatialIndex->moveProxy(proxyID, worldBounds);
+}
+
+void GameObject::attachSpatialIndex(DynamicBVH* bvh) {
+    if(spatialIndex != nullptr && proxyID != DynamicBVH::NullNode)
+        spatialIndex->destroyProxy(proxyID);
+
+    spatialIndex = bvh;
+    proxyID = DynamicBVH::NullNode;
+    syncSpatialProxy();
+}
+
+bool GameObject::intersectRay(const QVector3D& origin, const QVector3D& direction, float maxT, float& t) const {
+    bool hit = false;
+    for(const auto& m : meshes) {
+        float tMesh = maxT;
+        if(m->intersectRay(origin, direction, maxT, tMesh)) {
+            maxT = tMesh;
+            hit = true;
+        }
+    }
+    if(hit)
+        t = maxT;
+    return hit;
+}
+
+float GameObject::distanceToPoint(const QVector3D& point) const {
+    if(!worldBounds.valid)
+        return std::numeric_limits<float>::max();
+    QVector3D closest(std::clamp(point.x(), worldBounds.min.x(), worldBounds.max.x()),
+                      std::clamp(point.y(), worldBounds.min.y(), worldBounds.max.y()),
+                      std::clamp(point.z(), worldBounds.min.z(), worldBounds.max.z()));
+    return point.distanceToPoint(closest);
 }
 
 GLuint GameObject::getObjectID() const {
@@ -493,4 +601,39 @@ GLuint GameObject::getObjectTotalNumber() {
     return gameObjectCounter;
 }
 
+GLuint64 GameObject::getSceneRevision() {
+    return sceneRevision;
+}
+
+GLuint64 GameObject::getStructureRevision() {
+    return structureRevision;
+}
+
+const std::vector<GameObject*>& GameObject::getInstanceDirtyObjects() {
+    return instanceDirtyObjects;
+}
+
+void GameObject::clearInstanceDirtyObjects() {
+    for(GameObject* obj : instanceDirtyObjects)
+        obj->instanceDirty = GL_FALSE;
+    instanceDirtyObjects.clear();
+}
+
+void GameObject::markSceneDirty() {
+    sceneRevision++;
+}
+
+void GameObject::markStructureDirty() {
+    structureRevision++;
+    markSceneDirty();
+}
+
+void GameObject::markInstanceDirty() {
+    if(!instanceDirty) {
+        instanceDirtyObjects.push_back(this);
+        instanceDirty = GL_TRUE;
+    }
+    markSceneDirty();
+}
+
 
@@ -2,48 +2,56 @@
 // Created by fangl on 2023/9/23.
 //
 
+#include <algorithm>
+#include <cmath>
 #include <utility>
 
 #include "object/mesh.hpp"
 
 
-Mesh::Mesh(std::shared_ptr<Shader> sha, QVector<Vertex> vertices, QVector<unsigned int> indices, QVector<std::shared_ptr<Texture2D>> textures) {
+Mesh::Mesh(std::shared_ptr<Shader> sha, QVector<Vertex> vertices, QVector<unsigned int> indices, QVector<std::shared_ptr<Texture2D>> textures)
+    : Mesh(std::move(sha),
+           std::make_shared<MeshGeometry>(std::move(vertices), std::move(indices)),
+           std::move(textures)) {
+}
+
+Mesh::Mesh(std::shared_ptr<Shader> sha, std::shared_ptr<MeshGeometry> geo, QVector<std::shared_ptr<Texture2D>> textures) {
     this->multiMesh = GL_FALSE;
+    this->currentLod = 0;
     this->shader = std::move(sha);
-    this->vertices = std::move(vertices);
-    this->indices = std::move(indices);
+    this->geometry = std::move(geo);
     this->textures = std::move(textures);
 
-    this->drawOutline = GL_FALSE;
-
     glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
     if(!glFunc)
         qFatal("Require GLFunctions_Core to setUp mesh");
 
-    setupMesh();
+    updateBounds();
 }
 
-// TODO: 这里到底要不要delete VAO等？
+// VAO等由MeshGeometry在最后一个引用释放时删除
 Mesh::~Mesh() = default;
 
 void Mesh::updateData(QVector<Vertex> vertices, QVector<unsigned int> indices, QVector<std::shared_ptr<Texture2D>> textures) {
-    this->vertices = std::move(vertices);
-    this->indices = std::move(indices);
     this->textures = std::move(textures);
 
-    updateMesh();
+    // geometry被别的mesh共享时不能原地改，另外创建一份
+    if(geometry.use_count() > 1)
+        geometry = std::make_shared<MeshGeometry>(std::move(vertices), std::move(indices), BoundingBox(),
+                                                  geometry->getVertexFormat());
+    else
+        geometry->update(std::move(vertices), std::move(indices));
+
+    updateBounds();
 }
 
 void Mesh::setShader(std::shared_ptr<Shader> sha) {
     this->shader = std::move(sha);
 }
 
-void Mesh::setDrawOutline(GLboolean drawState) {
-    this->drawOutline = drawState;
-}
-
 void Mesh::setTransform(QMatrix4x4 trans) {
     this->transform = trans;
+    updateBounds();
 }
 
 void Mesh::setMultiMesh(GLboolean isMulti) {
@@ -55,122 +63,158 @@ void Mesh::setMultiMesh(GLboolean isMulti) {
     }
 }
 
-void Mesh::draw() {
+void Mesh::bindTextures(Shader& sha) {
     GLuint diffuseNr = 1;
     GLuint specularNr = 1;
 
-    shader->use();
-
-    /*============ outline logic ============*/
-    if(drawOutline) {
-        glFunc->glStencilFunc(GL_ALWAYS, 1, 0xFF);
-        glFunc->glStencilMask(0xFF);
-    } else {
-        glFunc->glStencilMask(0x00);
-        shader->setBool("enableOutline", false);
-    }
-    /*============ outline logic ============*/
+    // program在物体之间共享，没有对应贴图时要显式关掉
+    sha.setBool(UniformId::UseDiffuseTexture, false);
+    sha.setBool(UniformId::UseSpecularTexture, false);
 
     for(int i = 0; i < textures.size(); i++) {
         // 在绑定之前激活相应的纹理单元
         glFunc->glActiveTexture(GL_TEXTURE0 + i);
         // 获取纹理序号（diffuse_textureN 中的 N）
-        QString number;
-        QString name = textureTypeToString(textures[i]->type);
-        if(name == "texture_diffuse") {
-            number = QString::number(diffuseNr++);
-            shader->setBool("useDiffuseTexture", true);
+        // 这里的material是model的material，当前仅仅有贴图
+        if(textures[i]->type == TextureType::Diffuse) {
+            sha.setBool(UniformId::UseDiffuseTexture, true);
+            if(diffuseNr == 1)
+                sha.setInteger(UniformId::MaterialTextureDiffuse1, i);
+            else
+                sha.setInteger("material.texture_diffuse" + QString::number(diffuseNr), i);
+            diffuseNr++;
         }
-        else if(name == "texture_specular") {
-            number = QString::number(specularNr++);
-            shader->setBool("useSpecularTexture", true);
+        else if(textures[i]->type == TextureType::Specular) {
+            sha.setBool(UniformId::UseSpecularTexture, true);
+            if(specularNr == 1)
+                sha.setInteger(UniformId::MaterialTextureSpecular1, i);
+            else
+                sha.setInteger("material.texture_specular" + QString::number(specularNr), i);
+            specularNr++;
         } else
             qFatal("Type of Texture is Not Support!");
 
-        // 这里的material是model的material，当前仅仅有贴图
-        shader->setInteger("material." + name + number, i);
         glFunc->glBindTexture(GL_TEXTURE_2D, textures[i]->id);
     }
+}
 
-    // 1st: 绘制网格
-    shader->setBool("enableOutline", false);
-    glFunc->glBindVertexArray(VAO);
-    glFunc->glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
-    glFunc->glBindVertexArray(0);
-
-    /*============ outline logic ============*/
-    // 2nd draw the outline
-    if(drawOutline) {
-        glFunc->glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-        glFunc->glStencilMask(0x00);
-        glFunc->glDisable(GL_DEPTH_TEST);
-
-        // 更新M矩阵
-        shader->setBool("enableOutline", true);
-        QMatrix4x4 outLineTrans = this->transform;
-        outLineTrans.scale(1.05f);
-        shader->setMatrix4f("model", outLineTrans);   // Model 要传进来
-
-        glFunc->glBindVertexArray(VAO);
-        glFunc->glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
-        glFunc->glBindVertexArray(0);
-
-        glFunc->glStencilMask(0xFF);
-        glFunc->glStencilFunc(GL_ALWAYS, 0, 0xFF);
-        glFunc->glEnable(GL_DEPTH_TEST);
-        // glFunc->glDisable(GL_STENCIL_TEST);
-    } else {
-        // TODO: 还是有outline深度绘制错误
-        glFunc->glStencilMask(0xFF);    // 如果不加这一行。outline会显示错误
+GLboolean Mesh::hasSameTextures(const Mesh& other) const {
+    if(textures.size() != other.textures.size())
+        return GL_FALSE;
+    for(int i = 0; i < textures.size(); i++) {
+        if(textures[i]->id != other.textures[i]->id || textures[i]->type != other.textures[i]->type)
+            return GL_FALSE;
     }
-    /*============ outline logic ============*/
-
-    shader->release();
+    return GL_TRUE;
 }
 
-void Mesh::setupMesh() {
-    glFunc->glGenVertexArrays(1, &VAO);
-    glFunc->glGenBuffers(1, &VBO);
-    glFunc->glGenBuffers(1, &EBO);
+// 仅用于排序分组
+GLuint Mesh::getTextureKey() const {
+    GLuint key = 0;
+    for(const auto& t : textures) {
+        key = key * 31 + t->id;
+    }
+    return key;
+}
 
-    glFunc->glBindVertexArray(VAO);
+const std::shared_ptr<Shader>& Mesh::getShader() const {
+    return shader;
+}
 
-    glFunc->glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glFunc->glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                         &vertices[0], GL_STATIC_DRAW);
+const QMatrix4x4& Mesh::getTransform() const {
+    return transform;
+}
 
-    glFunc->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glFunc->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
+const std::shared_ptr<MeshGeometry>& Mesh::getGeometry() const {
+    return geometry;
+}
 
-    // vertex position
-    glFunc->glEnableVertexAttribArray(0);
-    glFunc->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-                                  sizeof(Vertex), (void*)0);
-    // vertex normal
-    glFunc->glEnableVertexAttribArray(1);
-    glFunc->glVertexAttribPointer(1, 3, GL_FLOAT,GL_FALSE,
-                                  sizeof(Vertex), (void*)offsetof(Vertex, normal));
-    // vertex uv
-    glFunc->glEnableVertexAttribArray(2);
-    glFunc->glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-                                  sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+GLuint Mesh::getVAO() const {
+    return geometry->getVAO();
+}
 
-    glFunc->glBindVertexArray(0);
+GLsizei Mesh::getIndexCount() const {
+    return geometry->getIndexCount();
 }
 
-void Mesh::updateMesh() {
-    if(!VAO || !VBO || !EBO ) {
-        qFatal("VAO | VBO | EBO is Empty");
+int Mesh::selectLod(float screenSize, float bias) {
+    const int lodCount = geometry->getLodCount();
+    if(lodCount <= 1) {
+        currentLod = 0;
+        return currentLod;
     }
 
-    glFunc->glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glFunc->glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                         &vertices[0], GL_STATIC_DRAW);
+    const float level = std::log2(LOD_FULL_DETAIL_SIZE / std::max(screenSize, 1.0f)) + bias;
+    if(level < (float)currentLod - LOD_HYSTERESIS || level >= (float)currentLod + 1.0f + LOD_HYSTERESIS)
+        currentLod = (int)std::floor(level);
+    currentLod = qBound(0, currentLod, lodCount - 1);
+    return currentLod;
+}
+
+int Mesh::getCurrentLod() const {
+    return currentLod;
+}
 
-    glFunc->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glFunc->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                         &indices[0], GL_STATIC_DRAW);
+const BoundingBox& Mesh::getLocalBounds() const {
+    return geometry->getLocalBounds();
+}
+
+const BoundingBox& Mesh::getWorldBounds() const {
+    return worldBounds;
+}
+
+bool Mesh::intersectRay(const QVector3D& origin, const QVector3D& direction, float maxT, float& t) const {
+    float tBox = 0.0f;
+    if(!worldBounds.intersectRay(origin, direction, maxT, tBox))
+        return false;
+
+    // 把射线变换到模型空间，direction不归一化，所以t在两个空间中是一致的
+    bool invertible = false;
+    QMatrix4x4 invTransform = transform.inverted(&invertible);
+    if(!invertible)
+        return false;
+    QVector3D localOrigin = invTransform.map(origin);
+    QVector3D localDir = invTransform.mapVector(direction);
+
+    // Moller-Trumbore
+    const QVector<Vertex>& vertices = geometry->getVertices();
+    const QVector<unsigned int>& indices = geometry->getIndices();
+    bool hit = false;
+    float closest = maxT;
+    for(int i = 0; i + 2 < indices.size(); i += 3) {
+        const QVector3D& v0 = vertices[indices[i]].position;
+        const QVector3D& v1 = vertices[indices[i + 1]].position;
+        const QVector3D& v2 = vertices[indices[i + 2]].position;
+
+        QVector3D e1 = v1 - v0;
+        QVector3D e2 = v2 - v0;
+        QVector3D p = QVector3D::crossProduct(localDir, e2);
+        float det = QVector3D::dotProduct(e1, p);
+        if(std::fabs(det) < 1e-8f)
+            continue;
+        float invDet = 1.0f / det;
+
+        QVector3D s = localOrigin - v0;
+        float u = QVector3D::dotProduct(s, p) * invDet;
+        if(u < 0.0f || u > 1.0f)
+            continue;
+        QVector3D q = QVector3D::crossProduct(s, e1);
+        float v = QVector3D::dotProduct(localDir, q) * invDet;
+        if(v < 0.0f || u + v > 1.0f)
+            continue;
+
+        float tHit = QVector3D::dotProduct(e2, q) * invDet;
+        if(tHit > 0.0f && tHit < closest) {
+            closest = tHit;
+            hit = true;
+        }
+    }
+
+    if(hit)
+        t = closest;
+    return hit;
+}
 
-    qDebug("Update Mesh Success");
+void Mesh::updateBounds() {
+    worldBounds = geometry->getLocalBounds().transformed(transform);
 }
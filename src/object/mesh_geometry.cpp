@@ -0,0 +1,128 @@
+//
+// Created by fangl on 2023/10/12.
+//
+
+#include <utility>
+
+#include "object/mesh_geometry.hpp"
+#include "utils/resource_manager.hpp"
+#include "utils/vertex_packing.hpp"
+
+
+// update时区间不够，重新分配时多留的比例
+const static float DYNAMIC_GEOMETRY_HEADROOM = 0.5f;
+
+GLuint MeshGeometry::geometryCounter = 0;
+
+MeshGeometry::MeshGeometry(QVector<Vertex> vertices, QVector<unsigned int> indices, const BoundingBox& bounds,
+                           VertexFormat format, const QVector<QVector<unsigned int>>& lodIndices)
+    : geometryID(geometryCounter++), vertices(std::move(vertices)), indices(std::move(indices)),
+      localBounds(bounds), format(format) {
+    if(!localBounds.valid)
+        localBounds = BoundingBox::fromVertices(this->vertices);
+
+    arena = ResourceManager::getGeometryArena(format);
+    if(!arena)
+        qFatal("Geometry arena is not initialized");
+
+    uploadBuffers(lodIndices, 0.0f);
+}
+
+MeshGeometry::~MeshGeometry() {
+    // 区间还给arena，之后的geometry可以复用
+    arena->release(allocation);
+}
+
+void MeshGeometry::update(QVector<Vertex> newVertices, QVector<unsigned int> newIndices) {
+    this->vertices = std::move(newVertices);
+    this->indices = std::move(newIndices);
+    localBounds = BoundingBox::fromVertices(vertices);
+
+    uploadBuffers(QVector<QVector<unsigned int>>(), DYNAMIC_GEOMETRY_HEADROOM);
+    qDebug("Update Mesh Success");
+}
+
+const QVector<Vertex>& MeshGeometry::getVertices() const {
+    return vertices;
+}
+
+const QVector<unsigned int>& MeshGeometry::getIndices() const {
+    return indices;
+}
+
+const BoundingBox& MeshGeometry::getLocalBounds() const {
+    return localBounds;
+}
+
+GLuint MeshGeometry::getVAO() const {
+    return arena->getVAO();
+}
+
+GLint MeshGeometry::getBaseVertex() const {
+    return allocation.baseVertex;
+}
+
+GLuint MeshGeometry::getGeometryID() const {
+    return geometryID;
+}
+
+GLsizei MeshGeometry::getIndexCount() const {
+    return (GLsizei)indices.size();
+}
+
+int MeshGeometry::getLodCount() const {
+    return lods.size();
+}
+
+const MeshLod& MeshGeometry::getLod(int level) const {
+    return lods[qBound(0, level, lods.size() - 1)];
+}
+
+VertexFormat MeshGeometry::getVertexFormat() const {
+    return format;
+}
+
+QVector3D MeshGeometry::getPositionOffset() const {
+    if(format == VertexFormat::Packed)
+        return VertexPacking::positionOffset(localBounds);
+    return QVector3D(0.0f, 0.0f, 0.0f);
+}
+
+QVector3D MeshGeometry::getPositionScale() const {
+    if(format == VertexFormat::Packed)
+        return VertexPacking::positionScale(localBounds);
+    return QVector3D(1.0f, 1.0f, 1.0f);
+}
+
+void MeshGeometry::uploadBuffers(const QVector<QVector<unsigned int>>& lodIndices, float headroom) {
+    // EBO中的区间: | LOD0 | LOD1 | ... |
+    GLint totalIndices = indices.size();
+    for(const auto& lod : lodIndices)
+        totalIndices += lod.size();
+    const GLint vertexCount = vertices.size();
+
+    if(vertexCount > allocation.vertexCount || totalIndices > allocation.indexCount) {
+        arena->release(allocation);
+        allocation = arena->allocate((GLint)((float)vertexCount * (1.0f + headroom)),
+                                     (GLint)((float)totalIndices * (1.0f + headroom)));
+    }
+
+    if(format == VertexFormat::Packed) {
+        // 量化范围就是localBounds，update时bounds重新计算，这里一起重新打包
+        const QVector<PackedVertex> packed = VertexPacking::pack(vertices, localBounds);
+        arena->uploadVertices(allocation, packed.size(), packed.constData());
+    } else {
+        arena->uploadVertices(allocation, vertexCount, vertices.constData());
+    }
+
+    const auto indexSize = (GLsizeiptr)sizeof(unsigned int);
+    lods.clear();
+    lods.push_back(MeshLod{(GLsizei)indices.size(), (GLsizeiptr)allocation.firstIndex * indexSize});
+    arena->uploadIndices(allocation, 0, indices.size(), indices.constData());
+    GLint first = indices.size();
+    for(const auto& lod : lodIndices) {
+        lods.push_back(MeshLod{(GLsizei)lod.size(), ((GLsizeiptr)allocation.firstIndex + first) * indexSize});
+        arena->uploadIndices(allocation, first, lod.size(), lod.constData());
+        first += lod.size();
+    }
+}
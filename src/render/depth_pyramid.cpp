@@ -0,0 +1,337 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "render/depth_pyramid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "utils/resource_manager.hpp"
+#include "utils/shader.hpp"
+
+
+const static GLsizei READBACK_MAX_SIZE = 128;   // 读回CPU的level长边不超过这个值
+
+DepthPyramid::DepthPyramid()
+    : depthTexture(0), pyramidTexture(0), depthFBO(0), pyramidFBO(0), emptyVAO(0),
+      width(0), height(0), levelCount(0), buildSerial(0), readbacks(), nextReadback(0),
+      readbackWidth(0), readbackHeight(0), readbackSerial(0) {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create depth pyramid");
+
+    shader = ResourceManager::loadShader("depthPyramid",
+                                         ":/shaders/assets/shaders/depth_pyramid/depthPyramid.vert",
+                                         ":/shaders/assets/shaders/depth_pyramid/depthPyramid.frag");
+
+    glFunc->glGenFramebuffers(1, &depthFBO);
+    glFunc->glGenFramebuffers(1, &pyramidFBO);
+    glFunc->glGenVertexArrays(1, &emptyVAO);
+    for(auto& r : readbacks) {
+        glFunc->glGenBuffers(1, &r.pbo);
+        r.fence = nullptr;
+        r.width = 0;
+        r.height = 0;
+        r.serial = 0;
+    }
+}
+
+DepthPyramid::~DepthPyramid() {
+    if(QOpenGLContext::currentContext() == nullptr)
+        return;
+    releaseTextures();
+    for(auto& r : readbacks) {
+        if(r.fence != nullptr)
+            glFunc->glDeleteSync(r.fence);
+        glFunc->glDeleteBuffers(1, &r.pbo);
+    }
+    glFunc->glDeleteFramebuffers(1, &depthFBO);
+    glFunc->glDeleteFramebuffers(1, &pyramidFBO);
+    glFunc->glDeleteVertexArrays(1, &emptyVAO);
+}
+
+void DepthPyramid::build(const QMatrix4x4& vp) {
+    GLint viewport[4];
+    glFunc->glGetIntegerv(GL_VIEWPORT, viewport);
+    if(viewport[2] <= 0 || viewport[3] <= 0)
+        return;
+
+    GLint srcFramebuffer = 0;
+    glFunc->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &srcFramebuffer);
+
+    if(viewport[2] != width || viewport[3] != height)
+        resize(viewport[2], viewport[3]);
+
+    // 先收上一轮已经完成的结果，PBO空出来之后才能再读
+    collectReadbacks();
+
+    // 深度只能从renderbuffer blit到格式相同的depth texture，之后才能在shader里读
+    glFunc->glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)srcFramebuffer);
+    glFunc->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFBO);
+    glFunc->glBlitFramebuffer(viewport[0], viewport[1], viewport[0] + width, viewport[1] + height,
+                              0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    reduce();
+    viewProjection = vp;
+    buildSerial++;
+    requestReadback();
+
+    glFunc->glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)srcFramebuffer);
+    glFunc->glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+GLuint DepthPyramid::getTexture() const {
+    return pyramidTexture;
+}
+
+GLsizei DepthPyramid::getWidth() const {
+    return width;
+}
+
+GLsizei DepthPyramid::getHeight() const {
+    return height;
+}
+
+GLint DepthPyramid::getLevelCount() const {
+    return levelCount;
+}
+
+const QMatrix4x4& DepthPyramid::getViewProjection() const {
+    return viewProjection;
+}
+
+quint64 DepthPyramid::getBuildSerial() const {
+    return buildSerial;
+}
+
+bool DepthPyramid::hasReadback() const {
+    return !readbackDepth.empty();
+}
+
+GLsizei DepthPyramid::getReadbackWidth() const {
+    return readbackWidth;
+}
+
+GLsizei DepthPyramid::getReadbackHeight() const {
+    return readbackHeight;
+}
+
+const std::vector<GLfloat>& DepthPyramid::getReadbackDepth() const {
+    return readbackDepth;
+}
+
+const QMatrix4x4& DepthPyramid::getReadbackViewProjection() const {
+    return readbackViewProjection;
+}
+
+quint64 DepthPyramid::getReadbackSerial() const {
+    return readbackSerial;
+}
+
+// 和cullShader.comp里的isOccluded相同，只是读回的level一般很小，直接遍历覆盖到的所有texel
+bool DepthPyramid::isOccluded(const BoundingBox& box) const {
+    if(!box.valid || readbackDepth.empty())
+        return false;
+
+    QVector3D ndcMin(1.0f, 1.0f, 1.0f);
+    QVector3D ndcMax(-1.0f, -1.0f, -1.0f);
+    for(int i = 0; i < 8; i++) {
+        QVector3D corner((i & 1) ? box.max.x() : box.min.x(),
+                         (i & 2) ? box.max.y() : box.min.y(),
+                         (i & 4) ? box.max.z() : box.min.z());
+        QVector4D clip = readbackViewProjection * QVector4D(corner, 1.0f);
+        if(clip.w() <= 0.0f)
+            return false;
+        QVector3D ndc = clip.toVector3D() / clip.w();
+        for(int a = 0; a < 3; a++) {
+            ndcMin[a] = std::min(ndcMin[a], ndc[a]);
+            ndcMax[a] = std::max(ndcMax[a], ndc[a]);
+        }
+    }
+
+    const GLfloat nearestDepth = ndcMin.z() * 0.5f + 0.5f;
+    auto toTexel = [](GLfloat ndc, GLsizei size) {
+        GLfloat uv = std::clamp(ndc * 0.5f + 0.5f, 0.0f, 1.0f);
+        return std::min((GLsizei)(uv * (GLfloat)size), size - 1);
+    };
+    const GLsizei x0 = toTexel(ndcMin.x(), readbackWidth), x1 = toTexel(ndcMax.x(), readbackWidth);
+    const GLsizei y0 = toTexel(ndcMin.y(), readbackHeight), y1 = toTexel(ndcMax.y(), readbackHeight);
+    for(GLsizei y = y0; y <= y1; y++) {
+        for(GLsizei x = x0; x <= x1; x++) {
+            if(nearestDepth <= readbackDepth[(size_t)y * readbackWidth + x])
+                return false;
+        }
+    }
+    return true;
+}
+
+void DepthPyramid::resize(GLsizei w, GLsizei h) {
+    releaseTextures();
+    width = w;
+    height = h;
+    levelCount = (GLint)std::floor(std::log2((GLfloat)std::max(w, h))) + 1;
+
+    glFunc->glGenTextures(1, &depthTexture);
+    glFunc->glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glFunc->glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, w, h, 0,
+                         GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // 所有level都分配好，texture才是mipmap complete，texelFetch才能读其他level
+    glFunc->glGenTextures(1, &pyramidTexture);
+    glFunc->glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+    for(GLint level = 0; level < levelCount; level++) {
+        glFunc->glTexImage2D(GL_TEXTURE_2D, level, GL_R32F,
+                             std::max(1, w >> level), std::max(1, h >> level), 0, GL_RED, GL_FLOAT, nullptr);
+    }
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glFunc->glBindTexture(GL_TEXTURE_2D, 0);
+
+    glFunc->glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+    glFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    glFunc->glDrawBuffer(GL_NONE);
+    glFunc->glReadBuffer(GL_NONE);
+    if(glFunc->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        qDebug() << "ERROR::DEPTH_PYRAMID:: Depth framebuffer is not complete!";
+
+    glFunc->glBindFramebuffer(GL_FRAMEBUFFER, pyramidFBO);
+    glFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTexture, 0);
+    if(glFunc->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        qDebug() << "ERROR::DEPTH_PYRAMID:: Pyramid framebuffer is not complete!";
+    glFunc->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DepthPyramid::releaseTextures() {
+    if(depthTexture != 0)
+        glFunc->glDeleteTextures(1, &depthTexture);
+    if(pyramidTexture != 0)
+        glFunc->glDeleteTextures(1, &pyramidTexture);
+    depthTexture = 0;
+    pyramidTexture = 0;
+    width = 0;
+    height = 0;
+    levelCount = 0;
+}
+
+void DepthPyramid::reduce() {
+    // 全屏三角形需要的状态，画完恢复
+    const GLboolean blend = glFunc->glIsEnabled(GL_BLEND);
+    const GLboolean depthTest = glFunc->glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean stencilTest = glFunc->glIsEnabled(GL_STENCIL_TEST);
+    const GLboolean cullFace = glFunc->glIsEnabled(GL_CULL_FACE);
+    GLint polygonMode[2] = {GL_FILL, GL_FILL};
+    glFunc->glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glFunc->glDisable(GL_BLEND);
+    glFunc->glDisable(GL_DEPTH_TEST);
+    glFunc->glDisable(GL_STENCIL_TEST);
+    glFunc->glDisable(GL_CULL_FACE);
+    glFunc->glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    glFunc->glBindFramebuffer(GL_FRAMEBUFFER, pyramidFBO);
+    glFunc->glBindVertexArray(emptyVAO);
+    shader->use();
+    shader->setInteger("sourceDepth", 0);
+    glFunc->glActiveTexture(GL_TEXTURE0);
+
+    // level 0: 直接复制深度
+    glFunc->glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTexture, 0);
+    glFunc->glViewport(0, 0, width, height);
+    shader->setBool("copyLevel", GL_TRUE);
+    shader->setInteger("sourceLevel", 0);
+    glFunc->glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // 之后每一级读上一级，max level限制在上一级，避免读写同一个level形成feedback loop
+    // base level保持0: texelFetch/textureSize的lod是相对base level的，sourceLevel就是绝对的level
+    glFunc->glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+    shader->setBool("copyLevel", GL_FALSE);
+    for(GLint level = 1; level < levelCount; level++) {
+        glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTexture, level);
+        glFunc->glViewport(0, 0, std::max(1, width >> level), std::max(1, height >> level));
+        shader->setInteger("sourceLevel", level - 1);
+        glFunc->glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glFunc->glBindTexture(GL_TEXTURE_2D, 0);
+
+    shader->release();
+    glFunc->glBindVertexArray(0);
+
+    if(blend)
+        glFunc->glEnable(GL_BLEND);
+    if(depthTest)
+        glFunc->glEnable(GL_DEPTH_TEST);
+    if(stencilTest)
+        glFunc->glEnable(GL_STENCIL_TEST);
+    if(cullFace)
+        glFunc->glEnable(GL_CULL_FACE);
+    glFunc->glPolygonMode(GL_FRONT_AND_BACK, (GLenum)polygonMode[0]);
+}
+
+void DepthPyramid::collectReadbacks() {
+    // 从最早发出的开始，遇到还没完成的就停下，不等待GPU
+    for(size_t i = 0; i < readbacks.size(); i++) {
+        Readback& r = readbacks[(nextReadback + i) % readbacks.size()];
+        if(r.fence == nullptr)
+            continue;
+        GLenum status = glFunc->glClientWaitSync(r.fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glFunc->glDeleteSync(r.fence);
+        r.fence = nullptr;
+
+        const auto count = (size_t)r.width * (size_t)r.height;
+        glFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+        void* data = glFunc->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)(count * sizeof(GLfloat)),
+                                              GL_MAP_READ_BIT);
+        if(data) {
+            readbackDepth.resize(count);
+            std::memcpy(readbackDepth.data(), data, count * sizeof(GLfloat));
+            readbackWidth = r.width;
+            readbackHeight = r.height;
+            readbackViewProjection = r.viewProjection;
+            readbackSerial = r.serial;
+            glFunc->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+void DepthPyramid::requestReadback() {
+    Readback& r = readbacks[nextReadback];
+    if(r.fence != nullptr)  // 最早的那个还没读完，这一帧不读
+        return;
+
+    GLint level = 0;
+    while(level < levelCount - 1
+          && (std::max(1, width >> level) > READBACK_MAX_SIZE || std::max(1, height >> level) > READBACK_MAX_SIZE))
+        level++;
+    r.width = std::max(1, width >> level);
+    r.height = std::max(1, height >> level);
+    r.viewProjection = viewProjection;
+    r.serial = buildSerial;
+
+    glFunc->glBindFramebuffer(GL_READ_FRAMEBUFFER, pyramidFBO);
+    glFunc->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTexture, level);
+    glFunc->glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    // 绑定了PIXEL_PACK_BUFFER时glReadPixels只是把拷贝放进命令队列，不会等待
+    glFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+    glFunc->glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)r.width * r.height * (GLsizeiptr)sizeof(GLfloat),
+                         nullptr, GL_STREAM_READ);
+    glFunc->glReadPixels(0, 0, r.width, r.height, GL_RED, GL_FLOAT, nullptr);
+    glFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r.fence = glFunc->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    nextReadback = (nextReadback + 1) % (int)readbacks.size();
+}
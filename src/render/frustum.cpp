@@ -0,0 +1,58 @@
+//
+// Created by fangl on 2023/10/11.
+//
+
+#include "render/frustum.hpp"
+
+#include <cmath>
+
+
+Frustum::Frustum(const QMatrix4x4& viewProjection) {
+    update(viewProjection);
+}
+
+void Frustum::update(const QMatrix4x4& viewProjection) {
+    QVector4D row0 = viewProjection.row(0);
+    QVector4D row1 = viewProjection.row(1);
+    QVector4D row2 = viewProjection.row(2);
+    QVector4D row3 = viewProjection.row(3);
+
+    planes[Left]   = row3 + row0;
+    planes[Right]  = row3 - row0;
+    planes[Bottom] = row3 + row1;
+    planes[Top]    = row3 - row1;
+    planes[Near]   = row3 + row2;
+    planes[Far]    = row3 - row2;
+
+    // 归一化之后w才是真正的距离，球体测试需要
+    for(auto& p : planes) {
+        float len = p.toVector3D().length();
+        if(len > 0.0f)
+            p /= len;
+    }
+}
+
+bool Frustum::intersects(const BoundingBox& box) const {
+    if(!box.valid)
+        return false;
+
+    QVector3D c = box.center();
+    QVector3D e = box.extents();
+    for(const auto& p : planes) {
+        // box在平面法线方向上的投影半径
+        float r = e.x() * std::fabs(p.x()) + e.y() * std::fabs(p.y()) + e.z() * std::fabs(p.z());
+        float d = p.x() * c.x() + p.y() * c.y() + p.z() * c.z() + p.w();
+        if(d + r < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+bool Frustum::intersects(const BoundingSphere& sphere) const {
+    for(const auto& p : planes) {
+        float d = p.x() * sphere.center.x() + p.y() * sphere.center.y() + p.z() * sphere.center.z() + p.w();
+        if(d < -sphere.radius)
+            return false;
+    }
+    return true;
+}
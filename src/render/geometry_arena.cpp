@@ -0,0 +1,286 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "render/geometry_arena.hpp"
+
+#include <cstddef>
+#include <iterator>
+
+#include "data_structures.hpp"
+#include "utils/resource_manager.hpp"
+
+
+// 初始容量: 大约够几十个普通模型，之后按2倍扩大
+const static GLint GEOMETRY_ARENA_INITIAL_VERTICES = 64 * 1024;
+const static GLint GEOMETRY_ARENA_INITIAL_INDICES = 256 * 1024;
+
+/********* RangeAllocator *********/
+RangeAllocator::RangeAllocator(GLint capacity) : capacity(0), used(0) {
+    grow(capacity);
+}
+
+GLint RangeAllocator::allocate(GLint count) {
+    if(count <= 0)
+        return 0;
+    auto best = freeBySize.lower_bound(count);
+    if(best == freeBySize.end())
+        return -1;
+
+    const GLint offset = best->second;
+    const GLint blockSize = best->first;
+    eraseFree(freeByOffset.find(offset));
+    // 剩下的部分放回空闲块，放在后面，让分配尽量从前往后紧凑
+    if(blockSize > count) {
+        freeByOffset.emplace(offset + count, blockSize - count);
+        freeBySize.emplace(blockSize - count, offset + count);
+    }
+    used += count;
+    return offset;
+}
+
+void RangeAllocator::release(GLint offset, GLint count) {
+    if(count <= 0)
+        return;
+    used -= count;
+    addFree(offset, count);
+}
+
+void RangeAllocator::grow(GLint newCapacity) {
+    if(newCapacity <= capacity)
+        return;
+    const GLint oldCapacity = capacity;
+    capacity = newCapacity;
+    addFree(oldCapacity, newCapacity - oldCapacity);
+}
+
+GLint RangeAllocator::getCapacity() const {
+    return capacity;
+}
+
+GLint RangeAllocator::getUsed() const {
+    return used;
+}
+
+int RangeAllocator::getFreeBlockCount() const {
+    return (int)freeByOffset.size();
+}
+
+GLint RangeAllocator::getLargestFreeBlock() const {
+    return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+}
+
+void RangeAllocator::addFree(GLint offset, GLint count) {
+    // 和后一个空闲块相接
+    auto next = freeByOffset.lower_bound(offset);
+    if(next != freeByOffset.end() && offset + count == next->first) {
+        count += next->second;
+        eraseFree(next);
+    }
+    // 和前一个空闲块相接
+    auto it = freeByOffset.lower_bound(offset);
+    if(it != freeByOffset.begin()) {
+        auto prev = std::prev(it);
+        if(prev->first + prev->second == offset) {
+            offset = prev->first;
+            count += prev->second;
+            eraseFree(prev);
+        }
+    }
+    freeByOffset.emplace(offset, count);
+    freeBySize.emplace(count, offset);
+}
+
+void RangeAllocator::eraseFree(std::map<GLint, GLint>::iterator it) {
+    auto range = freeBySize.equal_range(it->second);
+    for(auto s = range.first; s != range.second; ++s) {
+        if(s->second == it->first) {
+            freeBySize.erase(s);
+            break;
+        }
+    }
+    freeByOffset.erase(it);
+}
+
+/********* GeometryArena *********/
+GeometryArena::GeometryArena(VertexFormat format)
+    : format(format), VAO(0), VBO(0), EBO(0) {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create geometry arena");
+
+    glFunc->glGenVertexArrays(1, &VAO);
+    growVertexBuffer(GEOMETRY_ARENA_INITIAL_VERTICES);
+    growIndexBuffer(GEOMETRY_ARENA_INITIAL_INDICES);
+}
+
+GeometryArena::~GeometryArena() {
+    // 程序退出时context可能已经销毁，这时buffer随context一起释放
+    if(QOpenGLContext::currentContext() == nullptr)
+        return;
+    if(VAO != 0)
+        glFunc->glDeleteVertexArrays(1, &VAO);
+    if(VBO != 0)
+        glFunc->glDeleteBuffers(1, &VBO);
+    if(EBO != 0)
+        glFunc->glDeleteBuffers(1, &EBO);
+}
+
+GeometryArena::Allocation GeometryArena::allocate(GLint vertexCount, GLint indexCount) {
+    Allocation allocation;
+    allocation.vertexCount = vertexCount;
+    allocation.indexCount = indexCount;
+
+    allocation.baseVertex = vertexRanges.allocate(vertexCount);
+    if(allocation.baseVertex < 0) {
+        growVertexBuffer(vertexCount);
+        allocation.baseVertex = vertexRanges.allocate(vertexCount);
+    }
+    allocation.firstIndex = indexRanges.allocate(indexCount);
+    if(allocation.firstIndex < 0) {
+        growIndexBuffer(indexCount);
+        allocation.firstIndex = indexRanges.allocate(indexCount);
+    }
+    return allocation;
+}
+
+void GeometryArena::release(const Allocation& allocation) {
+    vertexRanges.release(allocation.baseVertex, allocation.vertexCount);
+    indexRanges.release(allocation.firstIndex, allocation.indexCount);
+}
+
+void GeometryArena::uploadVertices(const Allocation& allocation, GLint count, const void* data) {
+    if(count <= 0)
+        return;
+    if(count > allocation.vertexCount) {
+        qDebug() << "ERROR::GEOMETRY_ARENA::UPLOAD_VERTICES out of range:" << count << ">" << allocation.vertexCount;
+        return;
+    }
+    const GLintptr offset = (GLintptr)allocation.baseVertex * getVertexStride();
+    const GLsizeiptr bytes = (GLsizeiptr)count * getVertexStride();
+    invalidateRange(VBO, offset, bytes);
+    ResourceManager::uploadBufferData(VBO, offset, bytes, data);
+}
+
+void GeometryArena::uploadIndices(const Allocation& allocation, GLint first, GLint count, const unsigned int* data) {
+    if(count <= 0)
+        return;
+    if(first + count > allocation.indexCount) {
+        qDebug() << "ERROR::GEOMETRY_ARENA::UPLOAD_INDICES out of range:" << first << "+" << count << ">"
+                 << allocation.indexCount;
+        return;
+    }
+    const GLintptr offset = ((GLintptr)allocation.firstIndex + first) * (GLintptr)sizeof(unsigned int);
+    const GLsizeiptr bytes = (GLsizeiptr)count * (GLsizeiptr)sizeof(unsigned int);
+    invalidateRange(EBO, offset, bytes);
+    ResourceManager::uploadBufferData(EBO, offset, bytes, data);
+}
+
+GLuint GeometryArena::getVAO() const {
+    return VAO;
+}
+
+VertexFormat GeometryArena::getFormat() const {
+    return format;
+}
+
+GLsizeiptr GeometryArena::getVertexStride() const {
+    return format == VertexFormat::Packed ? (GLsizeiptr)sizeof(PackedVertex) : (GLsizeiptr)sizeof(Vertex);
+}
+
+const RangeAllocator& GeometryArena::getVertexRanges() const {
+    return vertexRanges;
+}
+
+const RangeAllocator& GeometryArena::getIndexRanges() const {
+    return indexRanges;
+}
+
+void GeometryArena::growVertexBuffer(GLint required) {
+    const GLint oldCapacity = vertexRanges.getCapacity();
+    const GLint newCapacity = qMax(oldCapacity * 2, oldCapacity + required);
+    VBO = resizeBuffer(VBO, oldCapacity * getVertexStride(), newCapacity * getVertexStride());
+    vertexRanges.grow(newCapacity);
+    // attrib pointer记录的是设置时绑定的VBO，换了buffer要重新设置
+    setupAttributes();
+    if(oldCapacity > 0)
+        qDebug() << "Geometry arena: vertex capacity" << oldCapacity << "->" << newCapacity;
+}
+
+void GeometryArena::growIndexBuffer(GLint required) {
+    const GLint oldCapacity = indexRanges.getCapacity();
+    const GLint newCapacity = qMax(oldCapacity * 2, oldCapacity + required);
+    const auto indexSize = (GLsizeiptr)sizeof(unsigned int);
+    EBO = resizeBuffer(EBO, oldCapacity * indexSize, newCapacity * indexSize);
+    indexRanges.grow(newCapacity);
+    // EBO绑定是VAO的状态
+    glFunc->glBindVertexArray(VAO);
+    glFunc->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glFunc->glBindVertexArray(0);
+    if(oldCapacity > 0)
+        qDebug() << "Geometry arena: index capacity" << oldCapacity << "->" << newCapacity;
+}
+
+GLuint GeometryArena::resizeBuffer(GLuint oldBuffer, GLsizeiptr oldBytes, GLsizeiptr newBytes) {
+    GLuint newBuffer = 0;
+    glFunc->glGenBuffers(1, &newBuffer);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glFunc->glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+    if(oldBuffer != 0) {
+        // 之前提交的上传都在这次拷贝之前执行，不会丢数据
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+        if(oldBytes > 0)
+            glFunc->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glFunc->glDeleteBuffers(1, &oldBuffer);
+    }
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return newBuffer;
+}
+
+void GeometryArena::invalidateRange(GLuint buffer, GLintptr offset, GLsizeiptr length) {
+#if defined(GL_CORE_4_3)
+    // 告诉driver这段旧内容不要了，正在读这块buffer的draw不需要等待
+    glFunc->glInvalidateBufferSubData(buffer, offset, length);
+#else
+    Q_UNUSED(buffer);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+}
+
+void GeometryArena::setupAttributes() {
+    glFunc->glBindVertexArray(VAO);
+    glFunc->glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    if(format == VertexFormat::Packed) {
+        // 都是normalized属性，shader看到的是[0,1]的位置和[-1,1]的八面体坐标，再自己还原
+        glFunc->glEnableVertexAttribArray(0);
+        glFunc->glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+                                      sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+        glFunc->glEnableVertexAttribArray(1);
+        glFunc->glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE,
+                                      sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+        glFunc->glEnableVertexAttribArray(2);
+        glFunc->glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE,
+                                      sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoord));
+    } else {
+        // vertex position
+        glFunc->glEnableVertexAttribArray(0);
+        glFunc->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
+                                      sizeof(Vertex), (void*)0);
+        // vertex normal
+        glFunc->glEnableVertexAttribArray(1);
+        glFunc->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
+                                      sizeof(Vertex), (void*)offsetof(Vertex, normal));
+        // vertex uv
+        glFunc->glEnableVertexAttribArray(2);
+        glFunc->glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
+                                      sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+    }
+
+    // location 3~7 是per-instance数据，由InstanceBuffer在draw之前设置
+
+    glFunc->glBindVertexArray(0);
+    glFunc->glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
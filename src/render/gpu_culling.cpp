@@ -0,0 +1,295 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "render/gpu_culling.hpp"
+
+#ifdef GL_CORE_4_3
+
+#include <utility>
+
+#include "object/mesh.hpp"
+#include "utils/resource_manager.hpp"
+#include "utils/shader.hpp"
+
+
+const static GLuint CULL_WORKGROUP_SIZE = 64;     // 和cullShader.comp的local_size_x一致
+const static GLsizeiptr CULL_BUFFER_INITIAL_SIZE = 64 * 1024;
+
+// SSBO绑定点，和cullShader.comp一致
+const static GLuint CullInstanceSourceBinding = 0;
+const static GLuint CullDataSourceBinding = 1;
+const static GLuint CullCommandBinding = 2;
+const static GLuint CullVisibleBinding = 3;
+const static GLuint CullLodStateBinding = 4;
+const static GLuint CullTriangleCountBinding = 5;
+
+GpuCulling::GpuCulling()
+    : sceneInstanceBuffer(0), sceneCullBuffer(0), lodStateBuffer(0), previousLodStateBuffer(0), commandTemplateBuffer(0),
+      sceneInstanceCapacity(0), sceneCullCapacity(0), lodStateCapacity(0), previousLodStateCapacity(0),
+      commandTemplateCapacity(0), sceneInstanceCount(0), sceneCommandBytes(0),
+      commandBuffer(0), visibleBuffer(0), commandCapacity(0), visibleCapacity(0), triangleCountBuffer(0),
+      readbacks(), nextReadback(0), visibleTriangleCount(0),
+      pyramidTexture(0), pyramidWidth(0), pyramidHeight(0), pyramidLevels(0) {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create gpu culling");
+
+    shader = ResourceManager::loadComputeShader("cullShader", ":/shaders/assets/shaders/cullShader.comp");
+
+    frustumPlanesLocation = shader->uniformLocation("frustumPlanes");
+    instanceCountLocation = shader->uniformLocation("instanceCount");
+    viewPositionLocation = shader->uniformLocation("viewPosition");
+    lodScaleLocation = shader->uniformLocation("lodScale");
+    useOcclusionLocation = shader->uniformLocation("useOcclusion");
+    pyramidViewProjectionLocation = shader->uniformLocation("pyramidViewProjection");
+    pyramidSizeLocation = shader->uniformLocation("pyramidSize");
+    pyramidLevelsLocation = shader->uniformLocation("pyramidLevels");
+
+    // 不会改变的uniform只设置一次
+    shader->use();
+    shader->setInteger("depthPyramid", 0);
+    shader->setFloat("lodFullDetailSize", LOD_FULL_DETAIL_SIZE);
+    shader->setFloat("lodHysteresis", LOD_HYSTERESIS);
+    shader->release();
+
+    glFunc->glGenBuffers(1, &sceneInstanceBuffer);
+    glFunc->glGenBuffers(1, &sceneCullBuffer);
+    glFunc->glGenBuffers(1, &lodStateBuffer);
+    glFunc->glGenBuffers(1, &previousLodStateBuffer);
+    glFunc->glGenBuffers(1, &commandTemplateBuffer);
+    glFunc->glGenBuffers(1, &commandBuffer);
+    glFunc->glGenBuffers(1, &visibleBuffer);
+
+    glFunc->glGenBuffers(1, &triangleCountBuffer);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, triangleCountBuffer);
+    glFunc->glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    for(auto& r : readbacks) {
+        glFunc->glGenBuffers(1, &r.buffer);
+        glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, r.buffer);
+        glFunc->glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ);
+        r.fence = nullptr;
+    }
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GpuCulling::~GpuCulling() {
+    if(QOpenGLContext::currentContext() == nullptr)
+        return;
+    for(GLuint buffer : { sceneInstanceBuffer, sceneCullBuffer, lodStateBuffer, previousLodStateBuffer,
+                          commandTemplateBuffer, commandBuffer, visibleBuffer, triangleCountBuffer }) {
+        if(buffer != 0)
+            glFunc->glDeleteBuffers(1, &buffer);
+    }
+    for(auto& r : readbacks) {
+        if(r.fence != nullptr)
+            glFunc->glDeleteSync(r.fence);
+        glFunc->glDeleteBuffers(1, &r.buffer);
+    }
+}
+
+void GpuCulling::setDepthPyramid(GLuint texture, GLsizei width, GLsizei height, GLint levels,
+                                 const QMatrix4x4& viewProjection) {
+    pyramidTexture = texture;
+    pyramidWidth = width;
+    pyramidHeight = height;
+    pyramidLevels = levels;
+    pyramidViewProjection = viewProjection;
+}
+
+bool GpuCulling::hasDepthPyramid() const {
+    return pyramidTexture != 0 && pyramidLevels > 0;
+}
+
+void GpuCulling::uploadScene(const std::vector<InstanceData>& instances, const std::vector<CullInstance>& cullInstances,
+                             const std::vector<DrawElementsIndirectCommand>& commands, GLuint visibleCount,
+                             const std::vector<GLuint>& previousSlots) {
+    Q_ASSERT(instances.size() == cullInstances.size());
+    Q_ASSERT(previousSlots.empty() || previousSlots.size() == instances.size());
+    const GLuint previousInstanceCount = sceneInstanceCount;
+    sceneInstanceCount = (GLuint)instances.size();
+    sceneCommandBytes = (GLsizeiptr)(commands.size() * sizeof(DrawElementsIndirectCommand));
+    if(sceneInstanceCount == 0 || commands.empty()) {
+        sceneInstanceCount = 0;
+        return;
+    }
+
+    const auto instanceBytes = (GLsizeiptr)(instances.size() * sizeof(InstanceData));
+    const auto cullBytes = (GLsizeiptr)(cullInstances.size() * sizeof(CullInstance));
+    const auto lodStateBytes = (GLsizeiptr)(sceneInstanceCount * sizeof(GLuint));
+    reserve(sceneInstanceBuffer, sceneInstanceCapacity, instanceBytes);
+    reserve(sceneCullBuffer, sceneCullCapacity, cullBytes);
+    reserve(commandTemplateBuffer, commandTemplateCapacity, sceneCommandBytes);
+    reserve(commandBuffer, commandCapacity, sceneCommandBytes);
+    reserve(visibleBuffer, visibleCapacity, (GLsizeiptr)(visibleCount * sizeof(InstanceData)));
+
+    ResourceManager::uploadBufferData(sceneInstanceBuffer, 0, instanceBytes, instances.data());
+    ResourceManager::uploadBufferData(sceneCullBuffer, 0, cullBytes, cullInstances.data());
+    ResourceManager::uploadBufferData(commandTemplateBuffer, 0, sceneCommandBytes, commands.data());
+
+    // 旧的LOD状态留在previousLodStateBuffer里，新的先清零，再把还在场景里的instance的状态按段复制过来
+    // 排序是稳定的，大部分instance在新旧场景里都是连续的一段，复制的次数和变化的地方数量有关
+    std::swap(lodStateBuffer, previousLodStateBuffer);
+    std::swap(lodStateCapacity, previousLodStateCapacity);
+    reserve(lodStateBuffer, lodStateCapacity, lodStateBytes);
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, previousLodStateBuffer);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, lodStateBuffer);
+    glFunc->glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32UI, 0, lodStateBytes, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                                 nullptr);
+    for(GLuint i = 0; i < (GLuint)previousSlots.size();) {
+        const GLuint source = previousSlots[i];
+        if(source == CullNewInstance || source >= previousInstanceCount) {
+            i++;
+            continue;
+        }
+        GLuint count = 1;
+        while(i + count < (GLuint)previousSlots.size() && previousSlots[i + count] == source + count
+              && source + count < previousInstanceCount)
+            count++;
+        glFunc->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    (GLintptr)(source * sizeof(GLuint)), (GLintptr)(i * sizeof(GLuint)),
+                                    (GLsizeiptr)(count * sizeof(GLuint)));
+        i += count;
+    }
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuCulling::updateInstances(GLuint first, GLuint count, const InstanceData* instances,
+                                 const CullInstance* cullInstances) {
+    if(count == 0 || first + count > sceneInstanceCount)
+        return;
+    ResourceManager::uploadBufferData(sceneInstanceBuffer, (GLintptr)(first * sizeof(InstanceData)),
+                                      (GLsizeiptr)(count * sizeof(InstanceData)), instances);
+    ResourceManager::uploadBufferData(sceneCullBuffer, (GLintptr)(first * sizeof(CullInstance)),
+                                      (GLsizeiptr)(count * sizeof(CullInstance)), cullInstances);
+}
+
+bool GpuCulling::hasScene() const {
+    return sceneInstanceCount > 0;
+}
+
+void GpuCulling::cull(const Frustum& frustum, const QVector3D& viewPos, GLfloat lodScale) {
+    collectReadbacks();
+    if(sceneInstanceCount == 0) {
+        visibleTriangleCount = 0;
+        return;
+    }
+
+    // 命令模板的instanceCount都是0，GPU上复制一份就完成了重置，GPU按可见的instance重新累加
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, commandTemplateBuffer);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+    glFunc->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sceneCommandBytes);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, triangleCountBuffer);
+    glFunc->glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    GLfloat planes[Frustum::PlaneCount * 4];
+    for(int i = 0; i < Frustum::PlaneCount; i++) {
+        const QVector4D& plane = frustum.getPlane((Frustum::Plane)i);
+        for(int c = 0; c < 4; c++)
+            planes[i * 4 + c] = plane[c];
+    }
+
+    shader->use();
+    glFunc->glUniform4fv(frustumPlanesLocation, Frustum::PlaneCount, planes);
+    glFunc->glUniform1i(instanceCountLocation, (GLint)sceneInstanceCount);
+    glFunc->glUniform3f(viewPositionLocation, viewPos.x(), viewPos.y(), viewPos.z());
+    glFunc->glUniform1f(lodScaleLocation, lodScale);
+
+    const bool useOcclusion = hasDepthPyramid();
+    glFunc->glUniform1i(useOcclusionLocation, useOcclusion ? 1 : 0);
+    if(useOcclusion) {
+        glFunc->glUniformMatrix4fv(pyramidViewProjectionLocation, 1, GL_FALSE, pyramidViewProjection.constData());
+        glFunc->glUniform2f(pyramidSizeLocation, (GLfloat)pyramidWidth, (GLfloat)pyramidHeight);
+        glFunc->glUniform1i(pyramidLevelsLocation, pyramidLevels);
+        glFunc->glActiveTexture(GL_TEXTURE0);
+        glFunc->glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+    }
+
+    glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CullInstanceSourceBinding, sceneInstanceBuffer);
+    glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CullDataSourceBinding, sceneCullBuffer);
+    glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CullCommandBinding, commandBuffer);
+    glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CullVisibleBinding, visibleBuffer);
+    glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CullLodStateBinding, lodStateBuffer);
+    glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CullTriangleCountBinding, triangleCountBuffer);
+
+    const GLuint groups = (sceneInstanceCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE;
+    glFunc->glDispatchCompute(groups, 1, 1);
+    // 之后的draw从command buffer读命令、从visible buffer读instance属性，
+    // 三角形数量和LOD状态之后由glCopyBufferSubData读取
+    glFunc->glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    for(GLuint binding = CullInstanceSourceBinding; binding <= CullTriangleCountBinding; binding++)
+        glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    if(useOcclusion)
+        glFunc->glBindTexture(GL_TEXTURE_2D, 0);
+    shader->release();
+
+    requestReadback();
+}
+
+void GpuCulling::collectReadbacks() {
+    // 从最早发出的开始，遇到还没完成的就停下，不等待GPU
+    for(size_t i = 0; i < readbacks.size(); i++) {
+        Readback& r = readbacks[(nextReadback + i) % readbacks.size()];
+        if(r.fence == nullptr)
+            continue;
+        GLenum status = glFunc->glClientWaitSync(r.fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glFunc->glDeleteSync(r.fence);
+        r.fence = nullptr;
+
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, r.buffer);
+        void* data = glFunc->glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+        if(data) {
+            visibleTriangleCount = *static_cast<const GLuint*>(data);
+            glFunc->glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+}
+
+void GpuCulling::requestReadback() {
+    Readback& r = readbacks[nextReadback];
+    if(r.fence != nullptr)  // 最早的那个还没读完，这一帧不读
+        return;
+
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, triangleCountBuffer);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, r.buffer);
+    glFunc->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    r.fence = glFunc->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    nextReadback = (nextReadback + 1) % (int)readbacks.size();
+}
+
+GLuint64 GpuCulling::getVisibleTriangleCount() const {
+    return visibleTriangleCount;
+}
+
+GLuint GpuCulling::getCommandBuffer() const {
+    return commandBuffer;
+}
+
+GLuint GpuCulling::getInstanceBuffer() const {
+    return visibleBuffer;
+}
+
+void GpuCulling::reserve(GLuint buffer, GLsizeiptr& capacity, GLsizeiptr size) {
+    if(size <= capacity)
+        return;
+    if(capacity == 0)
+        capacity = CULL_BUFFER_INITIAL_SIZE;
+    while(capacity < size)
+        capacity *= 2;
+
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glFunc->glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+#endif  // GL_CORE_4_3
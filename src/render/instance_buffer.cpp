@@ -0,0 +1,106 @@
+//
+// Created by fangl on 2023/10/12.
+//
+
+#include "render/instance_buffer.hpp"
+
+#include <cstddef>
+
+#include "utils/resource_manager.hpp"
+
+
+const static GLsizeiptr INSTANCE_BUFFER_INITIAL_CAPACITY = 256;
+
+InstanceBuffer::InstanceBuffer() : VBO(0), capacity(0), sourceBuffer(0), sourceOffset(0) {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create instance buffer");
+
+    glFunc->glGenBuffers(1, &VBO);
+}
+
+InstanceBuffer::~InstanceBuffer() {
+    if(VBO != 0 && QOpenGLContext::currentContext() != nullptr)
+        glFunc->glDeleteBuffers(1, &VBO);
+}
+
+void InstanceBuffer::upload(const std::vector<InstanceData>& instances) {
+    if(instances.empty())
+        return;
+
+    auto count = (GLsizeiptr)instances.size();
+    const GLsizeiptr bytes = count * (GLsizeiptr)sizeof(InstanceData);
+    UploadRing* ring = ResourceManager::getUploadRing();
+    const GLintptr offset = ring ? ring->stream(bytes, instances.data()) : -1;
+    if(offset >= 0) {
+        sourceBuffer = ring->getBufferID();
+        sourceOffset = offset;
+        return;
+    }
+
+    if(count > capacity) {
+        if(capacity == 0)
+            capacity = INSTANCE_BUFFER_INITIAL_CAPACITY;
+        while(capacity < count)
+            capacity *= 2;
+    }
+
+    glFunc->glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    // 先orphan，避免等待上一帧还在使用这块buffer的draw
+    glFunc->glBufferData(GL_ARRAY_BUFFER, capacity * (GLsizeiptr)sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+    glFunc->glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+    glFunc->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    sourceBuffer = VBO;
+    sourceOffset = 0;
+}
+
+void InstanceBuffer::bindAttributes(GLuint firstInstance) {
+    const auto stride = (GLsizei)sizeof(InstanceData);
+    const size_t base = (size_t)sourceOffset + (size_t)firstInstance * sizeof(InstanceData);
+
+    glFunc->glBindBuffer(GL_ARRAY_BUFFER, sourceBuffer);
+
+    // mat4 占4个location，每个location一列
+    for(GLuint col = 0; col < 4; col++) {
+        GLuint location = InstanceAttribModel + col;
+        glFunc->glEnableVertexAttribArray(location);
+        glFunc->glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride,
+                                      (void*)(base + offsetof(InstanceData, model) + col * 4 * sizeof(GLfloat)));
+        glFunc->glVertexAttribDivisor(location, 1);
+    }
+
+    // material index和flags是整数，需要用IPointer
+    glFunc->glEnableVertexAttribArray(InstanceAttribData);
+    glFunc->glVertexAttribIPointer(InstanceAttribData, 2, GL_INT, stride,
+                                   (void*)(base + offsetof(InstanceData, materialIndex)));
+    glFunc->glVertexAttribDivisor(InstanceAttribData, 1);
+
+    glFunc->glEnableVertexAttribArray(InstanceAttribPositionOffset);
+    glFunc->glVertexAttribPointer(InstanceAttribPositionOffset, 3, GL_FLOAT, GL_FALSE, stride,
+                                  (void*)(base + offsetof(InstanceData, positionOffset)));
+    glFunc->glVertexAttribDivisor(InstanceAttribPositionOffset, 1);
+
+    glFunc->glEnableVertexAttribArray(InstanceAttribPositionScale);
+    glFunc->glVertexAttribPointer(InstanceAttribPositionScale, 3, GL_FLOAT, GL_FALSE, stride,
+                                  (void*)(base + offsetof(InstanceData, positionScale)));
+    glFunc->glVertexAttribDivisor(InstanceAttribPositionScale, 1);
+
+    glFunc->glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstanceBuffer::setSource(GLuint buffer, GLintptr offset) {
+    sourceBuffer = buffer;
+    sourceOffset = offset;
+}
+
+GLsizeiptr InstanceBuffer::getCapacity() const {
+    return capacity;
+}
+
+GLuint InstanceBuffer::getSourceBuffer() const {
+    return sourceBuffer;
+}
+
+GLintptr InstanceBuffer::getSourceOffset() const {
+    return sourceOffset;
+}
@@ -0,0 +1,563 @@
+//
+// Created by fangl on 2023/10/10.
+//
+
+#include "render/render_queue.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "object/game_object.hpp"
+#include "object/mesh.hpp"
+#include "utils/resource_manager.hpp"
+#include "utils/shader.hpp"
+
+
+const static int SORT_KEY_LAYER_SHIFT = 62;
+const static GLuint64 SORT_KEY_DEPTH_MAX = (1u << 24) - 1;
+
+RenderQueue::RenderQueue()
+    : residentActive(false),
+      multiDrawIndirect(true), gpuCullingEnabled(true), farPlane(1.0f), lodScale(1.0f),
+      stateChangeCount(0), drawCallCount(0), commandCount(0), triangleCount(0) {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create render queue");
+
+    instanceBuffer = std::make_unique<InstanceBuffer>();
+#ifdef GL_CORE_4_3
+    // 实际拿到的context可能低于请求的4.3，这时只能在CPU端逐条提交
+    const QSurfaceFormat format = QOpenGLContext::currentContext()->format();
+    if(format.majorVersion() > 4 || (format.majorVersion() == 4 && format.minorVersion() >= 3))
+        gpuCulling = std::make_unique<GpuCulling>();
+#endif
+}
+
+void RenderQueue::begin(const QVector3D& viewPos, GLfloat farP, GLfloat scale) {
+    packets.clear();
+    viewPosition = viewPos;
+    farPlane = farP;
+    lodScale = scale;
+    triangleCount = 0;
+}
+
+GLfloat RenderQueue::getProjectedSize(const BoundingBox& worldBounds) const {
+    if(!worldBounds.valid)
+        return 0.0f;
+    const BoundingSphere sphere = worldBounds.toSphere();
+    const GLfloat distance = viewPosition.distanceToPoint(sphere.center);
+    if(distance <= sphere.radius)
+        return std::numeric_limits<GLfloat>::max();
+    return 2.0f * sphere.radius * lodScale / distance;
+}
+
+void RenderQueue::submit(RenderLayer layer, GameObject* object, Mesh* mesh, int lod) {
+    if(layer == RenderLayer::Opaque && isOpaqueResident())
+        return;
+    const BoundingBox& bounds = mesh->getWorldBounds();
+    GLfloat depth = viewPosition.distanceToPoint(bounds.valid ? bounds.center() : object->getPosition());
+    packets.push_back(makePacket(layer, object, mesh, lod, depth));
+}
+
+void RenderQueue::beginResident() {
+    residentPackets.clear();
+    residentActive = false;
+}
+
+void RenderQueue::submitResident(GameObject* object, Mesh* mesh) {
+    // 常驻的packet只按状态排序，LOD由GPU每帧选择
+    residentPackets.push_back(makePacket(RenderLayer::Opaque, object, mesh, 0, 0.0f));
+}
+
+void RenderQueue::endResident() {
+#ifdef GL_CORE_4_3
+    if(gpuCulling == nullptr)
+        return;
+
+    // 稳定排序: 场景没怎么变的时候mesh的相对顺序不变，LOD状态可以整段复制
+    std::stable_sort(residentPackets.begin(), residentPackets.end(),
+                     [](const DrawPacket& lhs, const DrawPacket& rhs) {
+                         return lhs.sortKey < rhs.sortKey;
+                     });
+
+    GLuint visibleCount = 0;
+    buildResidentCommands(visibleCount);
+
+    // 记录每个物体占用的instance，并找出每个mesh在上一次上传里的位置
+    std::vector<GLuint> previousSlots(residentPackets.size(), CullNewInstance);
+    std::map<ResidentKey, GLuint> currentSlots;
+    residentRanges.clear();
+    for(GLuint i = 0; i < (GLuint)residentPackets.size(); i++) {
+        const DrawPacket& p = residentPackets[i];
+        const ResidentKey key(p.object->getObjectID(), p.mesh);
+        auto previous = residentSlots.find(key);
+        if(previous != residentSlots.end())
+            previousSlots[i] = previous->second;
+        currentSlots.emplace(key, i);
+
+        std::vector<ResidentRange>& ranges = residentRanges[p.object];
+        if(!ranges.empty() && ranges.back().first + ranges.back().count == i)
+            ranges.back().count++;
+        else
+            ranges.push_back({ i, 1 });
+    }
+    residentSlots = std::move(currentSlots);
+
+    gpuCulling->uploadScene(residentInstances, residentCull, residentCommands, visibleCount, previousSlots);
+    residentActive = true;
+#endif
+}
+
+void RenderQueue::updateResident(GameObject* object) {
+#ifdef GL_CORE_4_3
+    auto it = residentRanges.find(object);
+    if(gpuCulling == nullptr || it == residentRanges.end())
+        return;
+
+    for(const ResidentRange& range : it->second) {
+        for(GLuint i = range.first; i < range.first + range.count; i++) {
+            DrawPacket& p = residentPackets[i];
+            // 排序和命令不受影响，只有instance数据和剔除数据需要更新
+            p.instance = makePacket(RenderLayer::Opaque, p.object, p.mesh, 0, 0.0f).instance;
+            residentInstances[i] = p.instance;
+            updateCullInstance(residentCull[i], p);
+        }
+        gpuCulling->updateInstances(range.first, range.count, residentInstances.data() + range.first,
+                                    residentCull.data() + range.first);
+    }
+#else
+    Q_UNUSED(object);
+#endif
+}
+
+bool RenderQueue::isOpaqueResident() const {
+    return residentActive && isGpuCullingActive();
+}
+
+DrawPacket RenderQueue::makePacket(RenderLayer layer, GameObject* object, Mesh* mesh, int lod, GLfloat depth) const {
+    Shader* shader = mesh->getShader().get();
+    // outline layer不写stencil，只有前两个layer需要区分
+    GLboolean writeStencil = (layer != RenderLayer::Outline && object->getDrawOutline()) ? GL_TRUE : GL_FALSE;
+
+    DrawPacket packet{};
+    packet.sortKey = makeSortKey(layer, shader, mesh, lod, writeStencil, depth);
+    packet.layer = layer;
+    packet.shader = shader;
+    packet.object = object;
+    packet.mesh = mesh;
+    packet.lod = lod;
+
+    QMatrix4x4 model = mesh->getTransform();
+    packet.instance.flags = object->getInstanceFlags();
+    if(layer == RenderLayer::Outline) {
+        model.scale(1.05f);
+        // 描边是纯色的，不能按diffuse贴图的alpha丢弃片元
+        packet.instance.flags &= ~InstanceAlphaTest;
+        packet.instance.flags |= InstanceOutline;
+    }
+    std::copy(model.constData(), model.constData() + 16, packet.instance.model);
+    packet.instance.materialIndex = object->getMaterialID();
+
+    const MeshGeometry* geometry = mesh->getGeometry().get();
+    if(geometry->getVertexFormat() == VertexFormat::Packed)
+        packet.instance.flags |= InstancePackedNormal;
+    const QVector3D positionOffset = geometry->getPositionOffset();
+    const QVector3D positionScale = geometry->getPositionScale();
+    for(int i = 0; i < 3; i++) {
+        packet.instance.positionOffset[i] = positionOffset[i];
+        packet.instance.positionScale[i] = positionScale[i];
+    }
+    return packet;
+}
+
+void RenderQueue::sort() {
+    std::sort(packets.begin(), packets.end(),
+              [](const DrawPacket& lhs, const DrawPacket& rhs) {
+                  return lhs.sortKey < rhs.sortKey;
+              });
+}
+
+void RenderQueue::drawLayer(RenderLayer layer) {
+    stateChangeCount = 0;
+    drawCallCount = 0;
+    commandCount = 0;
+
+#ifdef GL_CORE_4_3
+    if(layer == RenderLayer::Opaque && isOpaqueResident()) {
+        if(!gpuCulling->hasScene())
+            return;
+        // 常驻的场景: 剔除和LOD选择都在GPU上，GPU写出的命令和instance直接拿来画
+        gpuCulling->cull(frustum, viewPosition, lodScale);
+        instanceBuffer->setSource(gpuCulling->getInstanceBuffer(), 0);
+        commandCount = (int)residentCommands.size();
+        triangleCount += gpuCulling->getVisibleTriangleCount();
+
+        glFunc->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulling->getCommandBuffer());
+        drawBuckets(residentBuckets, residentPackets.cbegin(), false, gpuCulling->getCommandBuffer(), 0);
+        glFunc->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+#endif
+
+    // 已经按key排好序，layer在最高位，所以同一个layer是连续的一段
+    GLuint64 layerBegin = (GLuint64)layer << SORT_KEY_LAYER_SHIFT;
+    GLuint64 layerEnd = ((GLuint64)layer + 1) << SORT_KEY_LAYER_SHIFT;
+    auto first = std::lower_bound(packets.cbegin(), packets.cend(), layerBegin,
+                                  [](const DrawPacket& p, GLuint64 key) { return p.sortKey < key; });
+    auto last = std::lower_bound(first, packets.cend(), layerEnd,
+                                 [](const DrawPacket& p, GLuint64 key) { return p.sortKey < key; });
+    if(first == last)
+        return;
+
+    // 整个layer的instance数据一次上传，每个batch只是其中连续的一段
+    instances.clear();
+    for(auto it = first; it != last; ++it)
+        instances.push_back(it->instance);
+    instanceBuffer->upload(instances);
+
+    const bool isOutline = (layer == RenderLayer::Outline);
+    buildCommands(first, last, isOutline);
+
+    GLuint indirectBuffer = 0;
+    GLintptr indirectOffset = 0;
+#ifdef GL_CORE_4_3
+    if(isMultiDrawIndirectActive()) {
+        // 整个layer的命令一次写进ring，每个bucket只是其中连续的一段
+        UploadRing* ring = ResourceManager::getUploadRing();
+        const auto bytes = (GLsizeiptr)(commands.size() * sizeof(DrawElementsIndirectCommand));
+        const GLintptr offset = ring ? ring->stream(bytes, commands.data()) : -1;
+        if(offset >= 0) {
+            indirectBuffer = ring->getBufferID();
+            indirectOffset = offset;
+            glFunc->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        }
+    }
+#endif
+
+    drawBuckets(buckets, first, isOutline, indirectBuffer, indirectOffset);
+
+#ifdef GL_CORE_4_3
+    if(indirectBuffer != 0)
+        glFunc->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#endif
+}
+
+void RenderQueue::drawBuckets(const std::vector<DrawBucket>& layerBuckets,
+                              std::vector<DrawPacket>::const_iterator packetBegin, bool isOutline,
+                              GLuint indirectBuffer, GLintptr indirectOffset) {
+    // 有baseInstance时instance属性只需要在切换VAO时指向layer的起始位置
+    const bool useBaseInstance = isMultiDrawIndirectActive();
+
+    if(isOutline) {
+        // 只在之前写入了stencil的区域之外画放大的mesh
+        glFunc->glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+        glFunc->glStencilMask(0x00);
+        glFunc->glDisable(GL_DEPTH_TEST);
+    }
+
+    Shader* currentShader = nullptr;
+    const Mesh* currentTextureMesh = nullptr;
+    GLuint currentVAO = 0;
+    int currentStencilWrite = -1;
+
+    for(const DrawBucket& bucket : layerBuckets) {
+        const DrawPacket& p = *(packetBegin + bucket.firstPacket);
+
+        if(p.shader != currentShader) {
+            p.shader->bind();
+            currentShader = p.shader;
+            currentTextureMesh = nullptr;
+            stateChangeCount++;
+        }
+
+        if(!isOutline) {
+            // 需要outline的物体把自己的区域写进stencil
+            int stencilWrite = p.object->getDrawOutline() ? 1 : 0;
+            if(stencilWrite != currentStencilWrite) {
+                if(stencilWrite) {
+                    glFunc->glStencilFunc(GL_ALWAYS, 1, 0xFF);
+                    glFunc->glStencilMask(0xFF);
+                } else {
+                    glFunc->glStencilMask(0x00);
+                }
+                currentStencilWrite = stencilWrite;
+            }
+
+            if(currentTextureMesh == nullptr || !p.mesh->hasSameTextures(*currentTextureMesh)) {
+                p.mesh->bindTextures(*p.shader);
+                currentTextureMesh = p.mesh;
+                stateChangeCount++;
+            }
+        }
+
+        if(p.mesh->getVAO() != currentVAO) {
+            currentVAO = p.mesh->getVAO();
+            glFunc->glBindVertexArray(currentVAO);
+            if(useBaseInstance)
+                instanceBuffer->bindAttributes(0);
+            stateChangeCount++;
+        }
+
+        submitBucket(bucket, indirectBuffer, indirectOffset);
+    }
+
+    glFunc->glBindVertexArray(0);
+    if(currentShader)
+        currentShader->release();
+
+    // stencil mask需要恢复，不然下一帧的glClear清不掉stencil，outline会显示错误
+    glFunc->glStencilMask(0xFF);
+    if(isOutline) {
+        glFunc->glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glFunc->glEnable(GL_DEPTH_TEST);
+    }
+}
+
+int RenderQueue::getPacketCount() const {
+    return (int)packets.size();
+}
+
+int RenderQueue::getStateChangeCount() const {
+    return stateChangeCount;
+}
+
+int RenderQueue::getDrawCallCount() const {
+    return drawCallCount;
+}
+
+int RenderQueue::getCommandCount() const {
+    return commandCount;
+}
+
+void RenderQueue::setMultiDrawIndirectEnabled(bool enable) {
+    multiDrawIndirect = enable;
+}
+
+bool RenderQueue::isMultiDrawIndirectActive() const {
+#ifdef GL_CORE_4_3
+    return multiDrawIndirect && gpuCulling != nullptr;
+#else
+    return false;
+#endif
+}
+
+void RenderQueue::setCullingFrustum(const Frustum& f) {
+    frustum = f;
+}
+
+void RenderQueue::setGpuCullingEnabled(bool enable) {
+    gpuCullingEnabled = enable;
+}
+
+bool RenderQueue::isGpuCullingActive() const {
+    return gpuCullingEnabled && isMultiDrawIndirectActive();
+}
+
+#ifdef GL_CORE_4_3
+GpuCulling* RenderQueue::getGpuCulling() const {
+    return gpuCulling.get();
+}
+#endif
+
+GLuint64 RenderQueue::getTriangleCount() const {
+    return triangleCount;
+}
+
+bool RenderQueue::canBatch(const DrawPacket& lhs, const DrawPacket& rhs, bool isOutline) {
+    if(lhs.shader != rhs.shader || lhs.mesh->getGeometry() != rhs.mesh->getGeometry() || lhs.lod != rhs.lod)
+        return false;
+    // outline只输出纯色，不需要关心贴图和stencil写入
+    if(isOutline)
+        return true;
+    return lhs.object->getDrawOutline() == rhs.object->getDrawOutline()
+           && lhs.mesh->hasSameTextures(*rhs.mesh);
+}
+
+bool RenderQueue::canShareBucket(const DrawPacket& lhs, const DrawPacket& rhs, bool isOutline) {
+    if(lhs.shader != rhs.shader || lhs.mesh->getVAO() != rhs.mesh->getVAO())
+        return false;
+    if(isOutline)
+        return true;
+    return lhs.object->getDrawOutline() == rhs.object->getDrawOutline()
+           && lhs.mesh->hasSameTextures(*rhs.mesh);
+}
+
+GLuint64 RenderQueue::makeSortKey(RenderLayer layer, const Shader* shader, const Mesh* mesh, int lod,
+                                  GLboolean writeStencil, GLfloat depth) const {
+    GLfloat normalizedDepth = std::clamp(depth / farPlane, 0.0f, 1.0f);
+    auto depthBits = (GLuint64)(normalizedDepth * (GLfloat)SORT_KEY_DEPTH_MAX);
+
+    GLuint64 programBits = shader->getProgramID() & 0x3FF;
+    GLuint64 stencilBits = writeStencil ? 1 : 0;
+    GLuint64 textureBits = mesh->getTextureKey() & 0x7FFF;
+    // 最高位是顶点格式 (同一格式的geometry共用arena的VAO)，同一个geometry的不同LOD相邻但分开成不同的batch
+    const MeshGeometry* geometry = mesh->getGeometry().get();
+    GLuint64 formatBit = geometry->getVertexFormat() == VertexFormat::Packed ? 1 : 0;
+    GLuint64 geometryBits = (formatBit << 11) | ((((GLuint64)geometry->getGeometryID() << 2) | ((GLuint64)lod & 0x3)) & 0x7FF);
+
+    GLuint64 key = (GLuint64)layer << SORT_KEY_LAYER_SHIFT;
+    if(layer == RenderLayer::Transparent) {
+        key |= (SORT_KEY_DEPTH_MAX - depthBits) << 38;
+        key |= programBits << 28;
+        key |= stencilBits << 27;
+        key |= textureBits << 12;
+        key |= geometryBits;
+    } else {
+        key |= programBits << 52;
+        key |= stencilBits << 51;
+        key |= textureBits << 36;
+        key |= geometryBits << 24;
+        key |= depthBits;
+    }
+    return key;
+}
+
+void RenderQueue::buildCommands(std::vector<DrawPacket>::const_iterator first,
+                                std::vector<DrawPacket>::const_iterator last, bool isOutline) {
+    commands.clear();
+    buckets.clear();
+
+    for(auto batchBegin = first; batchBegin != last;) {
+        auto batchEnd = batchBegin + 1;
+        while(batchEnd != last && canBatch(*batchBegin, *batchEnd, isOutline))
+            ++batchEnd;
+
+        const DrawPacket& p = *batchBegin;
+        if(buckets.empty() || !canShareBucket(*(first + buckets.back().firstPacket), p, isOutline)) {
+            DrawBucket bucket{};
+            bucket.firstPacket = (GLuint)(batchBegin - first);
+            bucket.firstCommand = (GLuint)commands.size();
+            bucket.commandCount = 0;
+            buckets.push_back(bucket);
+        }
+
+        // 同一个arena里的geometry共用VAO，只是命令里的firstIndex/baseVertex不同
+        const MeshGeometry* geometry = p.mesh->getGeometry().get();
+        const MeshLod& lod = geometry->getLod(p.lod);
+        DrawElementsIndirectCommand command{};
+        command.count = (GLuint)lod.indexCount;
+        command.instanceCount = (GLuint)(batchEnd - batchBegin);
+        command.firstIndex = (GLuint)(lod.indexOffset / sizeof(GLuint));
+        command.baseVertex = geometry->getBaseVertex();
+        command.baseInstance = (GLuint)(batchBegin - first);
+
+        commands.push_back(command);
+        buckets.back().commandCount++;
+        commandCount++;
+        triangleCount += (GLuint64)(lod.indexCount / 3) * (GLuint64)(batchEnd - batchBegin);
+
+        batchBegin = batchEnd;
+    }
+}
+
+void RenderQueue::buildResidentCommands(GLuint& visibleCount) {
+    residentCommands.clear();
+    residentBuckets.clear();
+    residentInstances.clear();
+    residentCull.clear();
+    visibleCount = 0;
+
+    const auto first = residentPackets.cbegin();
+    const auto last = residentPackets.cend();
+    for(auto batchBegin = first; batchBegin != last;) {
+        auto batchEnd = batchBegin + 1;
+        while(batchEnd != last && canBatch(*batchBegin, *batchEnd, false))
+            ++batchEnd;
+
+        const DrawPacket& p = *batchBegin;
+        if(residentBuckets.empty() || !canShareBucket(*(first + residentBuckets.back().firstPacket), p, false)) {
+            DrawBucket bucket{};
+            bucket.firstPacket = (GLuint)(batchBegin - first);
+            bucket.firstCommand = (GLuint)residentCommands.size();
+            bucket.commandCount = 0;
+            residentBuckets.push_back(bucket);
+        }
+
+        // 每个LOD一条命令，都在visible buffer里预留整个batch的空间，GPU选中哪个LOD就写进哪一段
+        const MeshGeometry* geometry = p.mesh->getGeometry().get();
+        const auto batchSize = (GLuint)(batchEnd - batchBegin);
+        const auto firstCommand = (GLuint)residentCommands.size();
+        const int lodCount = geometry->getLodCount();
+        for(int l = 0; l < lodCount; l++) {
+            const MeshLod& lod = geometry->getLod(l);
+            DrawElementsIndirectCommand command{};
+            command.count = (GLuint)lod.indexCount;
+            command.instanceCount = 0;
+            command.firstIndex = (GLuint)(lod.indexOffset / sizeof(GLuint));
+            command.baseVertex = geometry->getBaseVertex();
+            command.baseInstance = visibleCount;
+            visibleCount += batchSize;
+
+            residentCommands.push_back(command);
+            residentBuckets.back().commandCount++;
+        }
+
+        for(auto it = batchBegin; it != batchEnd; ++it) {
+            residentInstances.push_back(it->instance);
+
+            CullInstance cull{};
+            cull.command = firstCommand;
+            cull.lodCount = (GLuint)lodCount;
+            updateCullInstance(cull, *it);
+            residentCull.push_back(cull);
+        }
+
+        batchBegin = batchEnd;
+    }
+}
+
+void RenderQueue::updateCullInstance(CullInstance& cull, const DrawPacket& packet) {
+    const BoundingBox& bounds = packet.mesh->getWorldBounds();
+    for(int i = 0; i < 3; i++) {
+        cull.boundsMin[i] = bounds.min[i];
+        cull.boundsMax[i] = bounds.max[i];
+    }
+    cull.flags = 0;
+    if(bounds.valid)
+        cull.flags |= CullBoundsValid;
+    if(!packet.object->getVisible())
+        cull.flags |= CullHidden;
+    cull.lodBias = packet.object->getLodBias();
+}
+
+void RenderQueue::submitBucket(const DrawBucket& bucket, GLuint indirectBuffer, GLintptr indirectOffset) {
+#ifdef GL_CORE_4_3
+    if(indirectBuffer != 0) {
+        const GLintptr offset = indirectOffset + (GLintptr)(bucket.firstCommand * sizeof(DrawElementsIndirectCommand));
+        glFunc->glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset,
+                                            (GLsizei)bucket.commandCount, 0);
+        drawCallCount++;
+        return;
+    }
+#else
+    Q_UNUSED(indirectBuffer);
+    Q_UNUSED(indirectOffset);
+#endif
+
+    // 常驻的场景总是走indirect，这里的bucket都来自每帧的commands
+    const DrawElementsIndirectCommand* bucketCommands = commands.data() + bucket.firstCommand;
+#ifdef GL_CORE_4_3
+    if(isMultiDrawIndirectActive()) {
+        // ring放不下命令时逐条画，instance属性已经按baseInstance绑好
+        for(GLuint i = 0; i < bucket.commandCount; i++) {
+            const DrawElementsIndirectCommand& c = bucketCommands[i];
+            glFunc->glDrawElementsInstancedBaseVertexBaseInstance(
+                    GL_TRIANGLES, (GLsizei)c.count, GL_UNSIGNED_INT,
+                    (void*)((size_t)c.firstIndex * sizeof(GLuint)), (GLsizei)c.instanceCount,
+                    c.baseVertex, c.baseInstance);
+            drawCallCount++;
+        }
+        return;
+    }
+#endif
+
+    // 没有baseInstance，每条命令之前把instance属性指到这一批的起始位置
+    for(GLuint i = 0; i < bucket.commandCount; i++) {
+        const DrawElementsIndirectCommand& c = bucketCommands[i];
+        instanceBuffer->bindAttributes(c.baseInstance);
+        glFunc->glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)c.count, GL_UNSIGNED_INT,
+                                                  (void*)((size_t)c.firstIndex * sizeof(GLuint)),
+                                                  (GLsizei)c.instanceCount, c.baseVertex);
+        drawCallCount++;
+    }
+}
@@ -0,0 +1,190 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "render/upload_ring.hpp"
+
+#include <cstring>
+#include <QDebug>
+
+
+// 等待单个fence的超时 (纳秒)，超时只是再等一轮
+const static GLuint64 UPLOAD_RING_WAIT_TIMEOUT = 100000000;
+// 超过ring一半的数据直接上传，否则一次大上传就会把其他帧的数据都挤出去
+const static GLsizeiptr UPLOAD_RING_MAX_FRACTION = 2;
+const static GLint UPLOAD_RING_MIN_ALIGNMENT = 16;
+
+UploadRing::UploadRing(GLsizeiptr size)
+    : buffer(0), capacity(size), alignment(UPLOAD_RING_MIN_ALIGNMENT), mapped(nullptr),
+      head(0), frameBegin(0), stallCount(0), fallbackCount(0) {
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    glFunc = context->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create upload ring");
+
+    // stream出去的区间可能会被绑定成uniform buffer，按它的要求对齐
+    GLint uniformAlignment = 0;
+    glFunc->glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    alignment = qMax(uniformAlignment, UPLOAD_RING_MIN_ALIGNMENT);
+
+    glFunc->glGenBuffers(1, &buffer);
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+
+#if defined(GL_CORE_4_3)
+    // glBufferStorage是4.4的函数，GLFunctions_Core里没有，从context里取
+    auto bufferStorage = context->hasExtension("GL_ARB_buffer_storage")
+                         ? reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(context->getProcAddress("glBufferStorage"))
+                         : nullptr;
+    if(bufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_COPY_READ_BUFFER, capacity, nullptr, flags);
+        mapped = static_cast<char*>(glFunc->glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags));
+    }
+#endif
+    if(!mapped)
+        glFunc->glBufferData(GL_COPY_READ_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    qDebug() << "Upload ring:" << capacity / 1024 << "KB," << (mapped ? "persistent mapped" : "map range fallback");
+}
+
+UploadRing::~UploadRing() {
+    // 程序退出时context可能已经销毁，这时buffer随context一起释放
+    if(QOpenGLContext::currentContext() == nullptr)
+        return;
+    for(const auto& f : inFlight)
+        glFunc->glDeleteSync(f.fence);
+    if(buffer != 0) {
+        if(mapped) {
+            glFunc->glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glFunc->glUnmapBuffer(GL_COPY_READ_BUFFER);
+            glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glFunc->glDeleteBuffers(1, &buffer);
+    }
+}
+
+GLintptr UploadRing::stream(GLsizeiptr size, const void* data) {
+    if(size <= 0)
+        return -1;
+    const GLintptr offset = allocate(size);
+    if(offset < 0)
+        return -1;
+    write(offset, size, data);
+    return offset;
+}
+
+void UploadRing::upload(GLuint dstBuffer, GLintptr dstOffset, GLsizeiptr size, const void* data) {
+    if(size <= 0)
+        return;
+
+    const GLintptr offset = stream(size, data);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, dstBuffer);
+    if(offset >= 0) {
+        // 拷贝在GPU上按命令顺序执行，之前读dstBuffer的draw不会被破坏
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glFunc->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, dstOffset, size);
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    } else {
+        glFunc->glBufferSubData(GL_COPY_WRITE_BUFFER, dstOffset, size, data);
+        fallbackCount++;
+    }
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void UploadRing::endFrame() {
+    if(head != frameBegin) {
+        inFlight.push_back(FrameFence{glFunc->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frameBegin});
+        frameBegin = head;
+    }
+    retireFinishedFrames();
+}
+
+GLuint UploadRing::getBufferID() const {
+    return buffer;
+}
+
+GLsizeiptr UploadRing::getSize() const {
+    return capacity;
+}
+
+bool UploadRing::isPersistent() const {
+    return mapped != nullptr;
+}
+
+int UploadRing::getStallCount() const {
+    return stallCount;
+}
+
+int UploadRing::getFallbackCount() const {
+    return fallbackCount;
+}
+
+GLintptr UploadRing::allocate(GLsizeiptr size) {
+    size = (size + alignment - 1) / alignment * alignment;
+    if(size > capacity / UPLOAD_RING_MAX_FRACTION)
+        return -1;
+
+    // 一次分配不跨过buffer末尾，剩下的尾巴直接跳过
+    GLuint64 start = head;
+    const GLuint64 position = start % (GLuint64)capacity;
+    if(position + (GLuint64)size > (GLuint64)capacity)
+        start += (GLuint64)capacity - position;
+
+    retireFinishedFrames();
+    while(start + (GLuint64)size - tail() > (GLuint64)capacity) {
+        // 这一帧自己就写满了ring，不能等自己的fence
+        if(inFlight.empty())
+            return -1;
+        waitOldestFrame();
+    }
+
+    head = start + (GLuint64)size;
+    return (GLintptr)(start % (GLuint64)capacity);
+}
+
+void UploadRing::write(GLintptr offset, GLsizeiptr size, const void* data) {
+    if(mapped) {
+        // coherent map: 之后提交的GL命令都能看到这次写入
+        std::memcpy(mapped + offset, data, size);
+        return;
+    }
+
+    // 这段区间已经由fence保证GPU不再使用，不需要同步
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    void* ptr = glFunc->glMapBufferRange(GL_COPY_READ_BUFFER, offset, size,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if(ptr) {
+        std::memcpy(ptr, data, size);
+        glFunc->glUnmapBuffer(GL_COPY_READ_BUFFER);
+    } else {
+        glFunc->glBufferSubData(GL_COPY_READ_BUFFER, offset, size, data);
+    }
+    glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void UploadRing::retireFinishedFrames() {
+    while(!inFlight.empty()) {
+        const GLenum status = glFunc->glClientWaitSync(inFlight.front().fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return;
+        glFunc->glDeleteSync(inFlight.front().fence);
+        inFlight.pop_front();
+    }
+}
+
+void UploadRing::waitOldestFrame() {
+    stallCount++;
+    const GLsync fence = inFlight.front().fence;
+    GLenum status = glFunc->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UPLOAD_RING_WAIT_TIMEOUT);
+    while(status == GL_TIMEOUT_EXPIRED)
+        status = glFunc->glClientWaitSync(fence, 0, UPLOAD_RING_WAIT_TIMEOUT);
+    if(status == GL_WAIT_FAILED)
+        qDebug() << "ERROR::UPLOAD_RING::glClientWaitSync failed";
+    glFunc->glDeleteSync(fence);
+    inFlight.pop_front();
+}
+
+GLuint64 UploadRing::tail() const {
+    return inFlight.empty() ? frameBegin : inFlight.front().begin;
+}
@@ -21,6 +21,36 @@ MainWindow::MainWindow(QWidget* parent)
     initLayout();
     connectConfigure();
 
+    // 在视口中左键点选物体，同步到列表
+    glManager->setObjectPickedCallback([this](int id) {
+        auto item = getItemById(objectList, id);
+        if(item != nullptr) {
+            objectList->setCurrentItem(item);
+            onObjectItemSelect(item);
+        }
+    });
+
+    // 异步导入的模型: 列表里先显示loading，完成后替换成名字，失败则移除
+    glManager->setModelLoadCallback([this](int id, float progress) {
+        auto item = getItemById(objectList, id);
+        if(item == nullptr)
+            return;
+
+        if(progress < 0.0f) {
+            objectList->takeItem(objectList->row(item));
+            delete item;
+            if(currentObjectID == id)
+                currentObjectID = -1;
+            return;
+        }
+
+        auto temp = glManager->getTargetGameObject(id);
+        if(progress >= 1.0f)
+            item->setText(temp->displayName);
+        else
+            item->setText(temp->displayName + QString(" (loading %1%)").arg(static_cast<int>(progress * 100)));
+    });
+
     timer = new QTimer(this);
     connect(timer, &QTimer::timeout, this, &MainWindow::updateGLManager);
     timer->start(10);
@@ -426,7 +456,9 @@ void MainWindow::connectConfigure() {
 
 /************ slot functions ************/
 void MainWindow::updateGLManager() {
-    glManager->update();
+    // 场景静止的时候不重绘
+    if(glManager->needsRepaint())
+        glManager->update();
 }
 
 void MainWindow::onLoadGameObjectUnitCube() {
@@ -545,13 +577,14 @@ void MainWindow::onLoadModel() {
     );
 
     if (!filePath.isEmpty()) {
-        int id = glManager->addObject(filePath);
+        // 导入在后台进行，不会卡住界面
+        int id = glManager->addObjectAsync(filePath);
         if(id == -1) {
             return;
         }
 
         auto temp = glManager->getTargetGameObject(id);
-        auto *item = new QListWidgetItem(temp->displayName, objectList);
+        auto *item = new QListWidgetItem(temp->displayName + " (loading)", objectList);
         item->setData(objectDataBaseIdRole, static_cast<qulonglong>(id));  // 存储ID
         objectList->addItem(item);
     }
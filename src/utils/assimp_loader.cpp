@@ -0,0 +1,122 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "utils/assimp_loader.hpp"
+
+#include <QDebug>
+
+#include "utils/normal_generator.hpp"
+
+
+std::shared_ptr<ModelData> AssimpLoader::load(const QString& path) {
+    auto data = std::make_shared<ModelData>();
+    data->path = path;
+
+    Assimp::Importer import;
+    const aiScene *scene = import.ReadFile(path.toStdString(), IMPORT_FLAGS);
+
+    if(!scene || !scene->mRootNode) {
+        qCritical() << "ERROR::ASSIMP::" << import.GetErrorString() << Qt::endl;
+        return data;
+    } else if (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) {
+        qDebug() << "WARNING::ASSIMP::" << "Scene Flags Incomplete";
+    }
+
+    QString modelDirectory = path.left(path.lastIndexOf('/'));
+    qDebug() << "Model Directory: " + modelDirectory;
+
+    processNode(scene->mRootNode, scene, modelDirectory, *data);
+    return data;
+}
+
+void AssimpLoader::processNode(aiNode *node, const aiScene *scene, const QString& mDir, ModelData& data) {
+    for(unsigned int i = 0; i < node->mNumMeshes; i++) {
+        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
+        data.meshes.push_back(processMesh(mesh, scene, mDir));
+    }
+
+    for(unsigned int i = 0; i < node->mNumChildren; i++) {
+        processNode(node->mChildren[i], scene, mDir, data);
+    }
+}
+
+ModelMeshData AssimpLoader::processMesh(aiMesh *mesh, const aiScene *scene, const QString& mDir) {
+    bool haveNormal = false;
+    ModelMeshData meshData;
+    QVector<Vertex>& vertices = meshData.vertices;
+    QVector<unsigned int>& indices = meshData.indices;
+    QVector<ModelTextureRef>& textures = meshData.textures;
+
+    for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
+        QVector3D vector;
+        Vertex vertex;
+        // 处理顶点位置、法线和纹理坐标
+        vector.setX(mesh->mVertices[i].x);
+        vector.setY(mesh->mVertices[i].y);
+        vector.setZ(mesh->mVertices[i].z);
+        vertex.position = vector;
+
+        // 处理索引
+        if(mesh->mNormals != nullptr) {
+            haveNormal = true;
+            vector.setX(mesh->mNormals[i].x);
+            vector.setY(mesh->mNormals[i].y);
+            vector.setZ(mesh->mNormals[i].z);
+            vertex.normal = vector;
+        }
+
+        if(mesh->mTextureCoords[0]) {
+            QVector2D vec;
+            vec.setX(mesh->mTextureCoords[0][i].x);
+            vec.setY(mesh->mTextureCoords[0][i].y);
+            vertex.texCoord = vec;
+        } else {
+            vertex.texCoord = QVector2D(0.0f, 0.0f);
+        }
+
+        vertices.push_back(vertex);
+    }
+
+    for(unsigned int i = 0; i < mesh->mNumFaces; i++) {
+        aiFace face = mesh->mFaces[i];
+        for(unsigned int j = 0; j < face.mNumIndices; j++)
+            indices.push_back(face.mIndices[j]);
+    }
+
+    // if we have no normal there
+    if(mesh->mNormals == nullptr) {
+        NormalGenerator::generate(vertices, indices, MODEL_NORMAL_CREASE_ANGLE);
+    }
+
+    // 处理材质
+    if(mesh->mMaterialIndex >= 0) {
+        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+        QVector<ModelTextureRef> diffuseMaps = loadMaterialTextures(material,
+                                                                               aiTextureType_DIFFUSE,
+                                                                               "texture_diffuse", mDir);
+        textures.append(diffuseMaps);
+        QVector<ModelTextureRef> specularMaps = loadMaterialTextures(material,
+                                                                                aiTextureType_SPECULAR,
+                                                                                "texture_specular", mDir);
+        textures.append(specularMaps);
+    } else {
+        qDebug() << "Current Model Has No Texture";
+    }
+
+    meshData.bounds = BoundingBox::fromVertices(vertices);
+    return meshData;
+}
+
+QVector<ModelTextureRef> AssimpLoader::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const QString& typeName, const QString& modelDirectory) {
+    QVector<ModelTextureRef> textures;
+    for(unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
+        aiString str;
+        mat->GetTexture(type, i, &str);
+        QString qStr = modelDirectory + "/" + QString::fromUtf8(str.C_Str());
+        qDebug() << "Load " << typeName << " : " << qStr;
+
+        textures.push_back(ModelTextureRef{qStr, stringToTextureType(typeName)});
+    }
+    return textures;
+}
@@ -0,0 +1,108 @@
+//
+// Created by fangl on 2023/10/11.
+//
+
+#include "utils/bounding_volume.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+BoundingBox BoundingBox::fromVertices(const QVector<Vertex>& vertices) {
+    BoundingBox box;
+    for(const auto& v : vertices) {
+        box.expand(v.position);
+    }
+    return box;
+}
+
+void BoundingBox::expand(const QVector3D& point) {
+    if(!valid) {
+        min = point;
+        max = point;
+        valid = true;
+        return;
+    }
+    min = QVector3D(std::min(min.x(), point.x()), std::min(min.y(), point.y()), std::min(min.z(), point.z()));
+    max = QVector3D(std::max(max.x(), point.x()), std::max(max.y(), point.y()), std::max(max.z(), point.z()));
+}
+
+void BoundingBox::expand(const BoundingBox& box) {
+    if(!box.valid)
+        return;
+    expand(box.min);
+    expand(box.max);
+}
+
+float BoundingBox::surfaceArea() const {
+    if(!valid)
+        return 0.0f;
+    QVector3D d = max - min;
+    return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+bool BoundingBox::contains(const BoundingBox& box) const {
+    return valid && box.valid &&
+           min.x() <= box.min.x() && min.y() <= box.min.y() && min.z() <= box.min.z() &&
+           max.x() >= box.max.x() && max.y() >= box.max.y() && max.z() >= box.max.z();
+}
+
+bool BoundingBox::intersects(const BoundingBox& box) const {
+    return valid && box.valid &&
+           min.x() <= box.max.x() && max.x() >= box.min.x() &&
+           min.y() <= box.max.y() && max.y() >= box.min.y() &&
+           min.z() <= box.max.z() && max.z() >= box.min.z();
+}
+
+bool BoundingBox::intersectRay(const QVector3D& origin, const QVector3D& direction, float maxT, float& tNear) const {
+    if(!valid)
+        return false;
+
+    float tMin = 0.0f;
+    float tMax = maxT;
+    for(int axis = 0; axis < 3; axis++) {
+        float o = origin[axis];
+        float d = direction[axis];
+        if(std::fabs(d) < 1e-8f) {
+            // 与该轴平行，起点必须在slab内
+            if(o < min[axis] || o > max[axis])
+                return false;
+            continue;
+        }
+        float invD = 1.0f / d;
+        float t0 = (min[axis] - o) * invD;
+        float t1 = (max[axis] - o) * invD;
+        if(t0 > t1)
+            std::swap(t0, t1);
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if(tMin > tMax)
+            return false;
+    }
+    tNear = tMin;
+    return true;
+}
+
+// Arvo: 新的中心 = M * 中心, 新的半长 = |M的3x3部分| * 半长
+BoundingBox BoundingBox::transformed(const QMatrix4x4& mat) const {
+    if(!valid)
+        return {};
+
+    QVector3D c = mat.map(center());
+    QVector3D e = extents();
+
+    QVector3D newExtents;
+    for(int row = 0; row < 3; row++) {
+        newExtents[row] = std::fabs(mat(row, 0)) * e.x() +
+                          std::fabs(mat(row, 1)) * e.y() +
+                          std::fabs(mat(row, 2)) * e.z();
+    }
+
+    return {c - newExtents, c + newExtents};
+}
+
+BoundingSphere BoundingBox::toSphere() const {
+    if(!valid)
+        return {};
+    return {center(), extents().length()};
+}
@@ -12,6 +12,10 @@ QMatrix4x4 Camera::getViewMatrix() const {
 
 void Camera::handleKeyboard(CameraMove direction, GLfloat deltaTime) {
     GLfloat velocity = this->movementSpeed * deltaTime;
+    if(velocity == 0.0f)
+        return;
+    this->dirty = GL_TRUE;
+
     if (direction == CameraMove::FORWARD)
         this->position += this->front * velocity;
     if (direction == CameraMove::BACKWARD)
@@ -45,12 +49,16 @@ void Camera::handleMouseMovement(GLfloat xOffset, GLfloat yOffset, GLboolean con
 
 void Camera::handleMouseScroll(GLfloat yOffset)
 {
+    GLfloat lastZoom = this->zoom;
     if (this->zoom >= 1.0f && this->zoom <= 45.0f)
         this->zoom -= yOffset;
     if (this->zoom > 45.0f)
         this->zoom = 45.0f;
     if (this->zoom < 1.0f)
         this->zoom = 1.0f;
+
+    if(this->zoom != lastZoom)
+        this->dirty = GL_TRUE;
 }
 
 void Camera::updateCameraData()
@@ -65,4 +73,5 @@ void Camera::updateCameraData()
     this->front = front3.normalized();
     this->right = QVector3D::crossProduct(this->front, this->worldUp).normalized();
     this->up = QVector3D::crossProduct(this->right, this->front).normalized();
+    this->dirty = GL_TRUE;
 }
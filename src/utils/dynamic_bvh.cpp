@@ -0,0 +1,282 @@
+//
+// Created by fangl on 2023/10/12.
+//
+
+#include "utils/dynamic_bvh.hpp"
+
+#include <algorithm>
+
+
+DynamicBVH::DynamicBVH()
+    : root(NullNode), freeList(NullNode), proxyCount(0), fatMargin(0.1f) {
+}
+
+int DynamicBVH::createProxy(const BoundingBox& box, void* userData) {
+    // 空的box放大之后会变成原点附近的一个有效box，查询结果就错了
+    Q_ASSERT_X(box.valid, "DynamicBVH::createProxy", "bounds must be valid");
+    if(!box.valid)
+        return NullNode;
+
+    int proxyID = allocateNode();
+
+    QVector3D margin(fatMargin, fatMargin, fatMargin);
+    nodes[proxyID].box = BoundingBox(box.min - margin, box.max + margin);
+    nodes[proxyID].userData = userData;
+    nodes[proxyID].height = 0;
+
+    insertLeaf(proxyID);
+    proxyCount++;
+    return proxyID;
+}
+
+void DynamicBVH::destroyProxy(int proxyID) {
+    if(proxyID < 0 || proxyID >= (int)nodes.size() || !nodes[proxyID].isLeaf() || nodes[proxyID].height != 0)
+        return;
+
+    removeLeaf(proxyID);
+    freeNode(proxyID);
+    proxyCount--;
+}
+
+bool DynamicBVH::moveProxy(int proxyID, const BoundingBox& box) {
+    if(nodes[proxyID].box.contains(box))
+        return false;
+
+    removeLeaf(proxyID);
+
+    QVector3D margin(fatMargin, fatMargin, fatMargin);
+    nodes[proxyID].box = BoundingBox(box.min - margin, box.max + margin);
+
+    insertLeaf(proxyID);
+    return true;
+}
+
+void* DynamicBVH::getUserData(int proxyID) const {
+    return nodes[proxyID].userData;
+}
+
+const BoundingBox& DynamicBVH::getFatBounds(int proxyID) const {
+    return nodes[proxyID].box;
+}
+
+int DynamicBVH::getProxyCount() const {
+    return proxyCount;
+}
+
+int DynamicBVH::getHeight() const {
+    return root == NullNode ? 0 : nodes[root].height;
+}
+
+void DynamicBVH::clear() {
+    nodes.clear();
+    root = NullNode;
+    freeList = NullNode;
+    proxyCount = 0;
+}
+
+int DynamicBVH::allocateNode() {
+    if(freeList == NullNode) {
+        nodes.push_back(Node{});
+        nodes.back().parent = NullNode;
+        nodes.back().height = -1;
+        freeList = (int)nodes.size() - 1;
+        nodes[freeList].parent = NullNode;
+    }
+
+    int nodeID = freeList;
+    freeList = nodes[nodeID].parent;
+
+    Node& node = nodes[nodeID];
+    node.box = BoundingBox();
+    node.userData = nullptr;
+    node.parent = NullNode;
+    node.child1 = NullNode;
+    node.child2 = NullNode;
+    node.height = 0;
+    return nodeID;
+}
+
+void DynamicBVH::freeNode(int nodeID) {
+    nodes[nodeID].parent = freeList;
+    nodes[nodeID].child1 = NullNode;
+    nodes[nodeID].child2 = NullNode;
+    nodes[nodeID].height = -1;
+    freeList = nodeID;
+}
+
+void DynamicBVH::insertLeaf(int leaf) {
+    if(root == NullNode) {
+        root = leaf;
+        nodes[root].parent = NullNode;
+        return;
+    }
+
+    // 1. 找到最合适的兄弟节点 (面积代价，向下贪心)
+    const BoundingBox leafBox = nodes[leaf].box;
+    int index = root;
+    while(!nodes[index].isLeaf()) {
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+
+        float area = nodes[index].box.surfaceArea();
+        BoundingBox combined = nodes[index].box;
+        combined.expand(leafBox);
+        float combinedArea = combined.surfaceArea();
+
+        // 在这里新建父节点的代价
+        float cost = 2.0f * combinedArea;
+        // 继续往下需要额外承担的代价
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        auto childCost = [&](int child) {
+            BoundingBox b = nodes[child].box;
+            b.expand(leafBox);
+            if(nodes[child].isLeaf())
+                return b.surfaceArea() + inheritanceCost;
+            return (b.surfaceArea() - nodes[child].box.surfaceArea()) + inheritanceCost;
+        };
+        float cost1 = childCost(child1);
+        float cost2 = childCost(child2);
+
+        if(cost < cost1 && cost < cost2)
+            break;
+
+        index = (cost1 < cost2) ? child1 : child2;
+    }
+    int sibling = index;
+
+    // 2. 新建父节点
+    int oldParent = nodes[sibling].parent;
+    int newParent = allocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].box = leafBox;
+    nodes[newParent].box.expand(nodes[sibling].box);
+    nodes[newParent].height = nodes[sibling].height + 1;
+    nodes[newParent].child1 = sibling;
+    nodes[newParent].child2 = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if(oldParent != NullNode) {
+        if(nodes[oldParent].child1 == sibling)
+            nodes[oldParent].child1 = newParent;
+        else
+            nodes[oldParent].child2 = newParent;
+    } else {
+        root = newParent;
+    }
+
+    // 3. 向上修正bounds和高度
+    refitAncestors(nodes[leaf].parent);
+}
+
+void DynamicBVH::removeLeaf(int leaf) {
+    if(leaf == root) {
+        root = NullNode;
+        return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+    if(grandParent != NullNode) {
+        // 用兄弟节点替换父节点
+        if(nodes[grandParent].child1 == parent)
+            nodes[grandParent].child1 = sibling;
+        else
+            nodes[grandParent].child2 = sibling;
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+
+        refitAncestors(grandParent);
+    } else {
+        root = sibling;
+        nodes[sibling].parent = NullNode;
+        freeNode(parent);
+    }
+}
+
+void DynamicBVH::refitAncestors(int index) {
+    while(index != NullNode) {
+        index = balance(index);
+
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+
+        nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        nodes[index].box = nodes[child1].box;
+        nodes[index].box.expand(nodes[child2].box);
+
+        index = nodes[index].parent;
+    }
+}
+
+// 如果A不平衡，做一次左旋或者右旋，返回新的子树根
+int DynamicBVH::balance(int iA) {
+    Node* A = &nodes[iA];
+    if(A->isLeaf() || A->height < 2)
+        return iA;
+
+    int iB = A->child1;
+    int iC = A->child2;
+    Node* B = &nodes[iB];
+    Node* C = &nodes[iC];
+
+    int diff = C->height - B->height;
+
+    auto rotate = [&](int iUp, int iStay, Node* up, Node* stay, bool upIsChild2) {
+        // up 被提升到A的位置
+        int iF = up->child1;
+        int iG = up->child2;
+        Node* F = &nodes[iF];
+        Node* G = &nodes[iG];
+
+        up->child1 = iA;
+        up->parent = A->parent;
+        A->parent = iUp;
+
+        if(up->parent != NullNode) {
+            if(nodes[up->parent].child1 == iA)
+                nodes[up->parent].child1 = iUp;
+            else
+                nodes[up->parent].child2 = iUp;
+        } else {
+            root = iUp;
+        }
+
+        // 较高的孙子节点留在up下面，较矮的给A
+        int iHigh = (F->height > G->height) ? iF : iG;
+        int iLow  = (F->height > G->height) ? iG : iF;
+        up->child2 = iHigh;
+        if(upIsChild2)
+            A->child2 = iLow;
+        else
+            A->child1 = iLow;
+        nodes[iLow].parent = iA;
+
+        A->box = stay->box;
+        A->box.expand(nodes[iLow].box);
+        up->box = A->box;
+        up->box.expand(nodes[iHigh].box);
+
+        A->height = 1 + std::max(stay->height, nodes[iLow].height);
+        up->height = 1 + std::max(A->height, nodes[iHigh].height);
+        return iUp;
+    };
+
+    if(diff > 1) {      // C 太高，提升C
+        return rotate(iC, iB, C, B, true);
+    }
+    if(diff < -1) {     // B 太高，提升B
+        return rotate(iB, iC, B, C, false);
+    }
+    return iA;
+}
+
+float DynamicBVH::distanceSquaredToBox(const QVector3D& point, const BoundingBox& box) {
+    float dx = std::max({box.min.x() - point.x(), 0.0f, point.x() - box.max.x()});
+    float dy = std::max({box.min.y() - point.y(), 0.0f, point.y() - box.max.y()});
+    float dz = std::max({box.min.z() - point.z(), 0.0f, point.z() - box.max.z()});
+    return dx * dx + dy * dy + dz * dz;
+}
@@ -0,0 +1,173 @@
+//
+// Created by fangl on 2023/10/9.
+//
+
+#include "utils/material_table.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "utils/resource_manager.hpp"
+
+
+MaterialTable::MaterialTable()
+    : glFunc(nullptr), storageBuffer(0), capacity(MaxMaterialCount), nextID(0), defaultWriteWarned(false),
+      dirtyBegin(std::numeric_limits<GLint>::max()), dirtyEnd(0) {
+    entries.resize(capacity);
+    allocated.assign(capacity, false);
+}
+
+MaterialTable::~MaterialTable() {
+    if(storageBuffer != 0 && QOpenGLContext::currentContext() != nullptr)
+        glFunc->glDeleteBuffers(1, &storageBuffer);
+}
+
+void MaterialTable::create() {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create material table");
+
+    buffer.reset();
+    if(storageBuffer != 0) {
+        glFunc->glDeleteBuffers(1, &storageBuffer);
+        storageBuffer = 0;
+    }
+
+    capacity = MaxMaterialCount;
+#ifdef GL_CORE_4_3
+    // 实际拿到的context可能低于请求的4.3，这时只能用固定大小的uniform block
+    const QSurfaceFormat format = QOpenGLContext::currentContext()->format();
+    if(format.majorVersion() > 4 || (format.majorVersion() == 4 && format.minorVersion() >= 3)) {
+        capacity = MaterialStorageInitialCount;
+        glFunc->glGenBuffers(1, &storageBuffer);
+        glFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, storageBuffer);
+        glFunc->glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * (GLsizeiptr)sizeof(MaterialEntryData),
+                             nullptr, GL_DYNAMIC_DRAW);
+        glFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MaterialStorageBinding, storageBuffer);
+    }
+#endif
+    if(storageBuffer == 0) {
+        buffer = std::make_unique<UniformBuffer>();
+        buffer->create(sizeof(MaterialEntryData) * MaxMaterialCount, MaterialBlockBinding);
+    }
+
+    entries.assign(capacity, MaterialEntryData());
+    allocated.assign(capacity, false);
+    freeIDs.clear();
+    nextID = 0;
+    defaultWriteWarned = false;
+
+    // 0号作为默认material，永远不会被释放
+    allocate(Material());
+    flush();
+}
+
+GLint MaterialTable::allocate(const Material& mat) {
+    GLint id;
+    if(!freeIDs.empty()) {
+        id = freeIDs.back();
+        freeIDs.pop_back();
+    } else {
+        if(nextID >= capacity)
+            grow();
+        id = nextID++;
+    }
+
+    allocated[id] = true;
+    write(id, mat);
+    return id;
+}
+
+void MaterialTable::release(GLint id) {
+    if(id == DefaultMaterialID || id < 0 || id >= nextID || !allocated[id])
+        return;
+    allocated[id] = false;
+    freeIDs.push_back(id);
+}
+
+void MaterialTable::update(GLint id, const Material& mat) {
+    if(id < 0 || id >= nextID || !allocated[id])
+        return;
+    // 没有material table时所有物体都共用默认material，改了会影响所有这些物体
+    if(id == DefaultMaterialID) {
+        if(!defaultWriteWarned) {
+            qDebug() << "WARNING::MATERIAL_TABLE::Default material is read-only, ignore the update";
+            defaultWriteWarned = true;
+        }
+        return;
+    }
+
+    write(id, mat);
+}
+
+void MaterialTable::write(GLint id, const Material& mat) {
+    MaterialEntryData& entry = entries[id];
+    entry.ambientColor[0] = mat.ambientColor.x();
+    entry.ambientColor[1] = mat.ambientColor.y();
+    entry.ambientColor[2] = mat.ambientColor.z();
+    entry.shininess = mat.shininess;
+    entry.diffuseColor[0] = mat.diffuseColor.x();
+    entry.diffuseColor[1] = mat.diffuseColor.y();
+    entry.diffuseColor[2] = mat.diffuseColor.z();
+    entry.ambientOcclusion = mat.ambientOcclusion;
+    entry.specularColor[0] = mat.specularColor.x();
+    entry.specularColor[1] = mat.specularColor.y();
+    entry.specularColor[2] = mat.specularColor.z();
+
+    markDirty(id);
+}
+
+void MaterialTable::flush() {
+    if(dirtyBegin >= dirtyEnd)
+        return;
+
+    const GLintptr offset = dirtyBegin * (GLintptr)sizeof(MaterialEntryData);
+    const GLsizeiptr size = (dirtyEnd - dirtyBegin) * (GLsizeiptr)sizeof(MaterialEntryData);
+    if(storageBuffer != 0)
+        ResourceManager::uploadBufferData(storageBuffer, offset, size, &entries[dirtyBegin]);
+    else if(buffer)
+        buffer->update(offset, size, &entries[dirtyBegin]);
+    else
+        return;
+
+    dirtyBegin = std::numeric_limits<GLint>::max();
+    dirtyEnd = 0;
+}
+
+void MaterialTable::grow() {
+    if(storageBuffer == 0) {
+        // 4.1的uniform block大小是写死在shader里的，不能悄悄地让多个物体共用同一个material
+        qFatal("ERROR::MATERIAL_TABLE::Material table is full (%d materials), "
+               "the uniform block fallback can not grow", (int)MaxMaterialCount);
+    }
+
+#ifdef GL_CORE_4_3
+    capacity *= 2;
+    entries.resize(capacity);
+    allocated.resize(capacity, false);
+
+    // glBufferData重新分配之后绑定点仍然指向同一个buffer对象
+    glFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, storageBuffer);
+    glFunc->glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * (GLsizeiptr)sizeof(MaterialEntryData),
+                         nullptr, GL_DYNAMIC_DRAW);
+    glFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if(nextID > 0) {
+        markDirty(0);
+        markDirty(nextID - 1);
+    }
+#endif
+}
+
+GLint MaterialTable::getUsedCount() const {
+    return nextID - (GLint)freeIDs.size();
+}
+
+bool MaterialTable::usesStorageBuffer() const {
+    return storageBuffer != 0;
+}
+
+void MaterialTable::markDirty(GLint id) {
+    dirtyBegin = std::min(dirtyBegin, id);
+    dirtyEnd = std::max(dirtyEnd, id + 1);
+}
@@ -0,0 +1,268 @@
+//
+// Created by fangl on 2023/10/15.
+//
+
+#include "utils/mesh_cache.hpp"
+
+#include <cstring>
+#include <type_traits>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "utils/mesh_simplifier.hpp"
+
+
+const static char MESH_CACHE_MAGIC[4] = {'M', 'K', 'M', 'C'};
+const static quint32 MESH_CACHE_VERSION = 4;   // 布局或Vertex改变时需要增加 (2: 加入LOD, 3: 重新生成的法线, 4: OBJ也用NormalGenerator)
+const static int MESH_CACHE_MAX_LODS = MeshSimplifier::MAX_LOD_COUNT - 1;
+const static int MESH_CACHE_HASH_SIZE = 20;     // sha1
+
+struct MeshCacheHeader {
+    char magic[4];
+    quint32 version;
+    quint32 importFlags;
+    quint32 meshCount;
+    quint64 stringTableOffset;
+    quint64 stringTableSize;
+    quint8 sourceHash[MESH_CACHE_HASH_SIZE];
+    quint32 textureCount;
+};
+static_assert(sizeof(MeshCacheHeader) == 56, "MeshCacheHeader layout changed");
+
+struct MeshCacheRecord {
+    quint32 vertexCount;
+    quint32 indexCount;
+    quint32 firstTexture;   // 在texture record数组中的起始位置
+    quint32 textureCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    quint64 vertexOffset;
+    quint64 indexOffset;
+    quint32 lodCount;       // 不包括LOD0
+    quint32 lodIndexCount[MESH_CACHE_MAX_LODS];
+};
+static_assert(sizeof(MeshCacheRecord) == 72, "MeshCacheRecord layout changed");
+
+struct MeshCacheTextureRecord {
+    qint32 type;            // TextureType
+    quint32 pathOffset;     // 相对于string table
+    quint32 pathSize;
+    quint32 padding;
+};
+static_assert(sizeof(MeshCacheTextureRecord) == 16, "MeshCacheTextureRecord layout changed");
+
+// 顶点直接按内存布局写入文件
+static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex layout changed, bump MESH_CACHE_VERSION");
+static_assert(std::is_trivially_copyable<Vertex>::value, "Vertex must be trivially copyable");
+
+static bool inRange(quint64 offset, quint64 bytes, quint64 fileSize) {
+    return offset <= fileSize && bytes <= fileSize - offset;
+}
+
+QByteArray MeshCache::hashSource(const QString& sourcePath) {
+    QFile file(sourcePath);
+    if(!file.open(QIODevice::ReadOnly))
+        return {};
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if(!hash.addData(&file))
+        return {};
+    return hash.result();
+}
+
+QString MeshCache::cacheFilePath(const QString& sourcePath) {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/mesh_cache";
+    QByteArray pathHash = QCryptographicHash::hash(QFileInfo(sourcePath).absoluteFilePath().toUtf8(),
+                                                   QCryptographicHash::Sha1);
+    return dir + "/" + QString::fromLatin1(pathHash.toHex()) + ".mkmesh";
+}
+
+std::shared_ptr<ModelData> MeshCache::load(const QString& sourcePath, quint32 importFlags, const QByteArray& sourceHash) {
+    if(sourceHash.size() != MESH_CACHE_HASH_SIZE)
+        return nullptr;
+
+    QFile file(cacheFilePath(sourcePath));
+    if(!file.open(QIODevice::ReadOnly))
+        return nullptr;
+
+    const auto fileSize = (quint64)file.size();
+    if(fileSize < sizeof(MeshCacheHeader))
+        return nullptr;
+
+    uchar* mapped = file.map(0, (qint64)fileSize);
+    if(mapped == nullptr)
+        return nullptr;
+
+    std::shared_ptr<ModelData> data;
+    do {
+        MeshCacheHeader header{};
+        memcpy(&header, mapped, sizeof(header));
+        if(memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0
+           || header.version != MESH_CACHE_VERSION
+           || header.importFlags != importFlags
+           || memcmp(header.sourceHash, sourceHash.constData(), MESH_CACHE_HASH_SIZE) != 0)
+            break;
+
+        const quint64 recordsOffset = sizeof(MeshCacheHeader);
+        const quint64 texturesOffset = recordsOffset + (quint64)header.meshCount * sizeof(MeshCacheRecord);
+        if(!inRange(recordsOffset, (quint64)header.meshCount * sizeof(MeshCacheRecord), fileSize)
+           || !inRange(texturesOffset, (quint64)header.textureCount * sizeof(MeshCacheTextureRecord), fileSize)
+           || !inRange(header.stringTableOffset, header.stringTableSize, fileSize))
+            break;
+
+        const auto* records = reinterpret_cast<const MeshCacheRecord*>(mapped + recordsOffset);
+        const auto* textureRecords = reinterpret_cast<const MeshCacheTextureRecord*>(mapped + texturesOffset);
+        const auto* strings = reinterpret_cast<const char*>(mapped + header.stringTableOffset);
+
+        auto result = std::make_shared<ModelData>();
+        result->path = sourcePath;
+        result->meshes.resize((int)header.meshCount);
+
+        bool corrupted = false;
+        for(quint32 i = 0; i < header.meshCount && !corrupted; i++) {
+            const MeshCacheRecord& r = records[i];
+            quint64 totalIndexCount = r.indexCount;
+            for(quint32 l = 0; l < r.lodCount && l < (quint32)MESH_CACHE_MAX_LODS; l++)
+                totalIndexCount += r.lodIndexCount[l];
+            const quint64 vertexBytes = (quint64)r.vertexCount * sizeof(Vertex);
+            const quint64 indexBytes = totalIndexCount * sizeof(unsigned int);
+            if(!inRange(r.vertexOffset, vertexBytes, fileSize) || !inRange(r.indexOffset, indexBytes, fileSize)
+               || (quint64)r.firstTexture + r.textureCount > header.textureCount
+               || r.lodCount > (quint32)MESH_CACHE_MAX_LODS) {
+                corrupted = true;
+                break;
+            }
+
+            ModelMeshData& mesh = result->meshes[(int)i];
+            mesh.vertices.resize((int)r.vertexCount);
+            memcpy(mesh.vertices.data(), mapped + r.vertexOffset, vertexBytes);
+            mesh.indices.resize((int)r.indexCount);
+            memcpy(mesh.indices.data(), mapped + r.indexOffset, (size_t)r.indexCount * sizeof(unsigned int));
+            quint64 lodOffset = r.indexOffset + (quint64)r.indexCount * sizeof(unsigned int);
+            for(quint32 l = 0; l < r.lodCount; l++) {
+                QVector<unsigned int> lod((int)r.lodIndexCount[l]);
+                memcpy(lod.data(), mapped + lodOffset, (size_t)r.lodIndexCount[l] * sizeof(unsigned int));
+                lodOffset += (quint64)r.lodIndexCount[l] * sizeof(unsigned int);
+                mesh.lods.push_back(lod);
+            }
+            mesh.bounds = BoundingBox(QVector3D(r.boundsMin[0], r.boundsMin[1], r.boundsMin[2]),
+                                      QVector3D(r.boundsMax[0], r.boundsMax[1], r.boundsMax[2]));
+
+            for(quint32 t = r.firstTexture; t < r.firstTexture + r.textureCount; t++) {
+                const MeshCacheTextureRecord& tr = textureRecords[t];
+                if(!inRange(tr.pathOffset, tr.pathSize, header.stringTableSize)) {
+                    corrupted = true;
+                    break;
+                }
+                mesh.textures.push_back(ModelTextureRef{QString::fromUtf8(strings + tr.pathOffset, (int)tr.pathSize),
+                                                        static_cast<TextureType>(tr.type)});
+            }
+        }
+
+        if(!corrupted)
+            data = result;
+    } while(false);
+
+    file.unmap(mapped);
+    if(data)
+        qDebug() << "Mesh Cache Hit: " + sourcePath;
+    return data;
+}
+
+bool MeshCache::save(const QString& sourcePath, quint32 importFlags, const QByteArray& sourceHash, const ModelData& data) {
+    if(sourceHash.size() != MESH_CACHE_HASH_SIZE)
+        return false;
+
+    // 先算出各段的位置
+    quint32 textureCount = 0;
+    for(const auto& m : data.meshes)
+        textureCount += (quint32)m.textures.size();
+
+    quint64 offset = sizeof(MeshCacheHeader)
+                     + (quint64)data.meshes.size() * sizeof(MeshCacheRecord)
+                     + (quint64)textureCount * sizeof(MeshCacheTextureRecord);
+
+    QVector<MeshCacheRecord> records;
+    QVector<MeshCacheTextureRecord> textureRecords;
+    QByteArray stringTable;
+    for(const auto& m : data.meshes) {
+        MeshCacheRecord r{};
+        r.vertexCount = (quint32)m.vertices.size();
+        r.indexCount = (quint32)m.indices.size();
+        r.firstTexture = (quint32)textureRecords.size();
+        r.textureCount = (quint32)m.textures.size();
+        BoundingBox bounds = m.bounds.valid ? m.bounds : BoundingBox::fromVertices(m.vertices);
+        for(int k = 0; k < 3; k++) {
+            r.boundsMin[k] = bounds.min[k];
+            r.boundsMax[k] = bounds.max[k];
+        }
+        r.lodCount = (quint32)qMin(m.lods.size(), MESH_CACHE_MAX_LODS);
+        for(quint32 l = 0; l < r.lodCount; l++)
+            r.lodIndexCount[l] = (quint32)m.lods[(int)l].size();
+        r.vertexOffset = offset;
+        offset += (quint64)r.vertexCount * sizeof(Vertex);
+        records.push_back(r);
+
+        for(const auto& t : m.textures) {
+            QByteArray utf8 = t.path.toUtf8();
+            MeshCacheTextureRecord tr{};
+            tr.type = static_cast<qint32>(t.type);
+            tr.pathOffset = (quint32)stringTable.size();
+            tr.pathSize = (quint32)utf8.size();
+            textureRecords.push_back(tr);
+            stringTable += utf8;
+        }
+    }
+    for(auto& r : records) {
+        r.indexOffset = offset;
+        offset += (quint64)r.indexCount * sizeof(unsigned int);
+        for(quint32 l = 0; l < r.lodCount; l++)
+            offset += (quint64)r.lodIndexCount[l] * sizeof(unsigned int);
+    }
+
+    MeshCacheHeader header{};
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.importFlags = importFlags;
+    header.meshCount = (quint32)data.meshes.size();
+    header.stringTableOffset = offset;
+    header.stringTableSize = (quint64)stringTable.size();
+    memcpy(header.sourceHash, sourceHash.constData(), MESH_CACHE_HASH_SIZE);
+    header.textureCount = textureCount;
+
+    const QString cachePath = cacheFilePath(sourcePath);
+    QDir().mkpath(QFileInfo(cachePath).absolutePath());
+
+    // QSaveFile写完才替换，两个线程同时导入同一个模型也不会读到写了一半的文件
+    QSaveFile file(cachePath);
+    if(!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "ERROR::MESH_CACHE::Fail to open" << cachePath;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.constData()), (qint64)records.size() * (qint64)sizeof(MeshCacheRecord));
+    file.write(reinterpret_cast<const char*>(textureRecords.constData()),
+               (qint64)textureRecords.size() * (qint64)sizeof(MeshCacheTextureRecord));
+    for(const auto& m : data.meshes)
+        file.write(reinterpret_cast<const char*>(m.vertices.constData()), (qint64)m.vertices.size() * (qint64)sizeof(Vertex));
+    for(int i = 0; i < data.meshes.size(); i++) {
+        const ModelMeshData& m = data.meshes[i];
+        file.write(reinterpret_cast<const char*>(m.indices.constData()), (qint64)m.indices.size() * (qint64)sizeof(unsigned int));
+        for(quint32 l = 0; l < records[i].lodCount; l++) {
+            const QVector<unsigned int>& lod = m.lods[(int)l];
+            file.write(reinterpret_cast<const char*>(lod.constData()), (qint64)lod.size() * (qint64)sizeof(unsigned int));
+        }
+    }
+    file.write(stringTable);
+
+    if(!file.commit()) {
+        qDebug() << "ERROR::MESH_CACHE::Fail to write" << cachePath;
+        return false;
+    }
+    return true;
+}
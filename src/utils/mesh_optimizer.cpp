@@ -0,0 +1,252 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "utils/mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <vector>
+
+
+// soft boundary之间至少这么多三角形，太碎的cluster会让cache频繁冷启动
+const static int OVERDRAW_MIN_CLUSTER_SIZE = 64;
+
+void MeshOptimizer::optimize(QVector<Vertex>& vertices, QVector<unsigned int>& indices,
+                             VertexCacheStats* before, VertexCacheStats* after,
+                             int cacheSize, float overdrawThreshold) {
+    if(before)
+        *before = analyzeVertexCache(indices, vertices.size(), cacheSize);
+    if(indices.size() < 3 || indices.size() % 3 != 0) {
+        if(after)
+            *after = analyzeVertexCache(indices, vertices.size(), cacheSize);
+        return;
+    }
+
+    QVector<int> clusters;
+    indices = tipsify(indices, vertices.size(), cacheSize, &clusters);
+    optimizeOverdraw(vertices, indices, clusters, cacheSize, overdrawThreshold);
+    optimizeVertexFetch(vertices, indices);
+
+    if(after)
+        *after = analyzeVertexCache(indices, vertices.size(), cacheSize);
+}
+
+QVector<unsigned int> MeshOptimizer::tipsify(const QVector<unsigned int>& indices, int vertexCount, int cacheSize,
+                                             QVector<int>* clusters) {
+    const int triangleCount = indices.size() / 3;
+
+    // 顶点 -> 使用它的三角形 (CSR)
+    std::vector<int> liveTriangles(vertexCount, 0);
+    for(unsigned int v : indices)
+        liveTriangles[v]++;
+    std::vector<int> adjacencyOffset(vertexCount + 1, 0);
+    for(int v = 0; v < vertexCount; v++)
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+    std::vector<int> adjacency(indices.size());
+    {
+        std::vector<int> cursor(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for(int t = 0; t < triangleCount; t++) {
+            for(int k = 0; k < 3; k++)
+                adjacency[cursor[indices[t * 3 + k]]++] = t;
+        }
+    }
+
+    std::vector<int> cacheTime(vertexCount, 0);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<int> deadEnd;           // 最近用过、可能还有剩余三角形的顶点
+    std::vector<int> candidates;
+    int timeStamp = cacheSize + 1;
+    int cursor = 0;                     // 按顺序扫描还有剩余三角形的顶点
+
+    QVector<unsigned int> result;
+    result.reserve(indices.size());
+    if(clusters) {
+        clusters->clear();
+        clusters->push_back(0);
+    }
+
+    auto skipDeadEnd = [&]() -> int {
+        while(!deadEnd.empty()) {
+            const int d = deadEnd.back();
+            deadEnd.pop_back();
+            if(liveTriangles[d] > 0)
+                return d;
+        }
+        while(cursor < vertexCount) {
+            if(liveTriangles[cursor] > 0)
+                return cursor;
+            cursor++;
+        }
+        return -1;
+    };
+
+    int fanning = vertexCount > 0 ? 0 : -1;
+    while(fanning >= 0) {
+        candidates.clear();
+        for(int i = adjacencyOffset[fanning]; i < adjacencyOffset[fanning + 1]; i++) {
+            const int t = adjacency[i];
+            if(emitted[t])
+                continue;
+            for(int k = 0; k < 3; k++) {
+                const unsigned int v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnd.push_back((int)v);
+                candidates.push_back((int)v);
+                liveTriangles[v]--;
+                if(timeStamp - cacheTime[v] > cacheSize)
+                    cacheTime[v] = timeStamp++;
+            }
+            emitted[t] = 1;
+        }
+
+        // 选下一个扇形中心: 仍在cache里、并且把它剩下的三角形画完后还不会被挤出cache的顶点中最老的那个
+        int next = -1;
+        int bestPriority = -1;
+        for(int v : candidates) {
+            if(liveTriangles[v] <= 0)
+                continue;
+            int priority = 0;
+            if(timeStamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = timeStamp - cacheTime[v];
+            if(priority > bestPriority) {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+        if(next < 0) {
+            // dead end，cache的局部性在这里断开，作为overdraw排序的hard boundary
+            next = skipDeadEnd();
+            if(clusters && next >= 0 && result.size() / 3 > clusters->last())
+                clusters->push_back(result.size() / 3);
+        }
+        fanning = next;
+    }
+    return result;
+}
+
+void MeshOptimizer::optimizeOverdraw(const QVector<Vertex>& vertices, QVector<unsigned int>& indices,
+                                     const QVector<int>& clusters, int cacheSize, float threshold) {
+    const int triangleCount = indices.size() / 3;
+    if(triangleCount == 0 || clusters.isEmpty())
+        return;
+    const float baseAcmr = analyzeVertexCache(indices, vertices.size(), cacheSize).acmr;
+    const float targetAcmr = baseAcmr * threshold;
+
+    // 在hard boundary之间再切soft boundary: 从冷cache开始累计的ACMR降到目标以下时就可以断开
+    std::vector<int> boundaries;
+    {
+        std::vector<int> cacheTime(vertices.size(), -cacheSize - 1);
+        QVector<int> hard = clusters;
+        hard.push_back(triangleCount);
+        int time = 0;
+        for(int c = 0; c + 1 < hard.size(); c++) {
+            int start = hard[c];
+            int misses = 0;
+            boundaries.push_back(start);
+            for(int t = hard[c]; t < hard[c + 1]; t++) {
+                for(int k = 0; k < 3; k++) {
+                    const unsigned int v = indices[t * 3 + k];
+                    if(time - cacheTime[v] > cacheSize) {
+                        cacheTime[v] = time++;
+                        misses++;
+                    }
+                }
+                const int clusterSize = t + 1 - start;
+                if(clusterSize >= OVERDRAW_MIN_CLUSTER_SIZE && t + 1 < hard[c + 1]
+                   && (float)misses / (float)clusterSize <= targetAcmr) {
+                    start = t + 1;
+                    boundaries.push_back(start);
+                    misses = 0;
+                    // 下一个cluster按冷cache计算
+                    time += cacheSize;
+                }
+            }
+            time += cacheSize;
+        }
+    }
+    boundaries.push_back(triangleCount);
+    const int clusterCount = (int)boundaries.size() - 1;
+    if(clusterCount < 2)
+        return;
+
+    // 按面积加权的cluster中心和法线，朝外的cluster先画 (能挡住更多后面的像素)
+    QVector3D meshCenter(0.0f, 0.0f, 0.0f);
+    float meshArea = 0.0f;
+    std::vector<QVector3D> clusterCenter(clusterCount, QVector3D(0.0f, 0.0f, 0.0f));
+    std::vector<QVector3D> clusterNormal(clusterCount, QVector3D(0.0f, 0.0f, 0.0f));
+    std::vector<float> clusterArea(clusterCount, 0.0f);
+    for(int c = 0; c < clusterCount; c++) {
+        for(int t = boundaries[c]; t < boundaries[c + 1]; t++) {
+            const QVector3D& p0 = vertices[indices[t * 3]].position;
+            const QVector3D& p1 = vertices[indices[t * 3 + 1]].position;
+            const QVector3D& p2 = vertices[indices[t * 3 + 2]].position;
+            const QVector3D normal = QVector3D::crossProduct(p1 - p0, p2 - p0);
+            const float area = normal.length();
+            const QVector3D center = (p0 + p1 + p2) / 3.0f;
+            clusterCenter[c] += center * area;
+            clusterNormal[c] += normal;
+            clusterArea[c] += area;
+        }
+        meshCenter += clusterCenter[c];
+        meshArea += clusterArea[c];
+    }
+    if(meshArea <= 0.0f)
+        return;
+    meshCenter /= meshArea;
+
+    std::vector<float> sortKey(clusterCount);
+    std::vector<int> order(clusterCount);
+    for(int c = 0; c < clusterCount; c++) {
+        const QVector3D center = clusterArea[c] > 0.0f ? clusterCenter[c] / clusterArea[c] : meshCenter;
+        sortKey[c] = QVector3D::dotProduct(center - meshCenter, clusterNormal[c].normalized());
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&sortKey](int a, int b) { return sortKey[a] > sortKey[b]; });
+
+    QVector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for(int c : order) {
+        for(int i = boundaries[c] * 3; i < boundaries[c + 1] * 3; i++)
+            sorted.push_back(indices[i]);
+    }
+
+    // cluster边界处cache冷启动，整体ACMR超出阈值时放弃overdraw排序
+    if(analyzeVertexCache(sorted, vertices.size(), cacheSize).acmr <= targetAcmr)
+        indices = sorted;
+}
+
+void MeshOptimizer::optimizeVertexFetch(QVector<Vertex>& vertices, QVector<unsigned int>& indices) {
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    QVector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+
+    for(auto& index : indices) {
+        if(remap[index] == unused) {
+            remap[index] = (unsigned int)reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    // 没有被任何三角形引用的顶点直接丢掉
+    vertices = reordered;
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const QVector<unsigned int>& indices, int vertexCount, int cacheSize) {
+    VertexCacheStats stats;
+    if(indices.isEmpty() || vertexCount == 0)
+        return stats;
+
+    // FIFO: 记录每个顶点进入cache时的miss计数，相差cacheSize以内就还在cache里
+    std::vector<int> cacheTime(vertexCount, -cacheSize - 1);
+    int misses = 0;
+    for(unsigned int v : indices) {
+        if(misses - cacheTime[v] > cacheSize) {
+            cacheTime[v] = misses;
+            misses++;
+        }
+    }
+    stats.acmr = (float)misses / (float)(indices.size() / 3);
+    stats.atvr = (float)misses / (float)vertexCount;
+    return stats;
+}
@@ -0,0 +1,301 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "utils/mesh_simplifier.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/bounding_volume.hpp"
+
+
+// LOD1..3允许的误差，相对于AABB对角线
+const static float LOD_MAX_ERROR[MeshSimplifier::MAX_LOD_COUNT - 1] = {0.01f, 0.02f, 0.04f};
+// 一级LOD至少要减掉这么多三角形才保留，否则说明大部分顶点都被锁住了
+const static float LOD_MIN_REDUCTION = 0.8f;
+
+namespace {
+
+// 对称4x4矩阵，只存上三角: a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+struct Quadric {
+    double m[10] = {};
+
+    void addPlane(double a, double b, double c, double d) {
+        m[0] += a * a; m[1] += a * b; m[2] += a * c; m[3] += a * d;
+        m[4] += b * b; m[5] += b * c; m[6] += b * d;
+        m[7] += c * c; m[8] += c * d;
+        m[9] += d * d;
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        for(int i = 0; i < 10; i++)
+            m[i] += other.m[i];
+        return *this;
+    }
+
+    // v^T Q v, v = (x, y, z, 1)
+    [[nodiscard]] double evaluate(const QVector3D& p) const {
+        const double x = p.x(), y = p.y(), z = p.z();
+        return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x
+               + m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y
+               + m[7] * z * z + 2.0 * m[8] * z
+               + m[9];
+    }
+};
+
+struct Collapse {
+    double cost;
+    unsigned int from;
+    unsigned int to;
+    unsigned int stamp;     // from的版本号，不一致说明周围已经变过，这条记录作废
+
+    bool operator<(const Collapse& other) const {
+        return cost > other.cost;   // priority_queue是大顶堆，反过来得到最小代价
+    }
+};
+
+struct PositionKey {
+    quint32 bits[3];
+
+    bool operator==(const PositionKey& other) const {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey& key) const {
+        return (size_t)(key.bits[0] * 73856093u ^ key.bits[1] * 19349663u ^ key.bits[2] * 83492791u);
+    }
+};
+
+}  // namespace
+
+QVector<unsigned int> MeshSimplifier::simplify(const QVector<Vertex>& vertices, const QVector<unsigned int>& indices,
+                                               int targetIndexCount, float maxError) {
+    const int vertexCount = vertices.size();
+    const int triangleCount = indices.size() / 3;
+    if(indices.size() <= targetIndexCount || triangleCount == 0)
+        return indices;
+
+    // 位置相同的顶点 (uv/法线接缝处被拆开的) 归为同一个position
+    std::vector<unsigned int> positionOf(vertexCount);
+    std::vector<int> wedgeCount;
+    {
+        std::unordered_map<PositionKey, unsigned int, PositionKeyHash> positionIds;
+        positionIds.reserve(vertexCount);
+        for(int v = 0; v < vertexCount; v++) {
+            PositionKey key{};
+            for(int k = 0; k < 3; k++) {
+                const float f = vertices[v].position[k];
+                std::memcpy(&key.bits[k], &f, sizeof(float));
+            }
+            auto it = positionIds.emplace(key, (unsigned int)wedgeCount.size()).first;
+            if(it->second == wedgeCount.size())
+                wedgeCount.push_back(0);
+            positionOf[v] = it->second;
+            wedgeCount[it->second]++;
+        }
+    }
+    const int positionCount = (int)wedgeCount.size();
+
+    // 只被一个三角形使用的边是边界，边界和接缝上的顶点锁住不动
+    std::vector<char> locked(vertexCount, 0);
+    {
+        std::unordered_map<quint64, int> edgeUse;
+        edgeUse.reserve(indices.size());
+        for(int t = 0; t < triangleCount; t++) {
+            for(int k = 0; k < 3; k++) {
+                quint64 a = positionOf[indices[t * 3 + k]];
+                quint64 b = positionOf[indices[t * 3 + (k + 1) % 3]];
+                if(a > b)
+                    std::swap(a, b);
+                edgeUse[(a << 32) | b]++;
+            }
+        }
+        std::vector<char> boundaryPosition(positionCount, 0);
+        for(const auto& e : edgeUse) {
+            if(e.second == 1) {
+                boundaryPosition[e.first >> 32] = 1;
+                boundaryPosition[e.first & 0xFFFFFFFFu] = 1;
+            }
+        }
+        for(int v = 0; v < vertexCount; v++)
+            locked[v] = boundaryPosition[positionOf[v]] || wedgeCount[positionOf[v]] > 1;
+    }
+
+    // 每个position的quadric = 周围三角形平面的距离平方和
+    std::vector<Quadric> quadrics(positionCount);
+    for(int t = 0; t < triangleCount; t++) {
+        const QVector3D& p0 = vertices[indices[t * 3]].position;
+        const QVector3D& p1 = vertices[indices[t * 3 + 1]].position;
+        const QVector3D& p2 = vertices[indices[t * 3 + 2]].position;
+        QVector3D n = QVector3D::crossProduct(p1 - p0, p2 - p0);
+        if(n.lengthSquared() <= 0.0f)
+            continue;
+        n.normalize();
+        const double d = -QVector3D::dotProduct(n, p0);
+        for(int k = 0; k < 3; k++)
+            quadrics[positionOf[indices[t * 3 + k]]].addPlane(n.x(), n.y(), n.z(), d);
+    }
+
+    std::vector<unsigned int> triangles(indices.begin(), indices.end());
+    std::vector<char> triangleAlive(triangleCount, 1);
+    std::vector<std::vector<int>> vertexTriangles(vertexCount);
+    for(int t = 0; t < triangleCount; t++) {
+        for(int k = 0; k < 3; k++)
+            vertexTriangles[triangles[t * 3 + k]].push_back(t);
+    }
+
+    std::vector<char> removed(vertexCount, 0);
+    std::vector<unsigned int> stamp(vertexCount, 0);
+    std::vector<unsigned int> visitMark(vertexCount, 0);
+    unsigned int visitFrame = 0;
+    std::priority_queue<Collapse> heap;
+
+    // 在u的邻居中找合并代价最小的
+    auto pushBestCollapse = [&](unsigned int u) {
+        if(locked[u] || removed[u])
+            return;
+        Collapse best{std::numeric_limits<double>::max(), u, u, stamp[u]};
+        for(int t : vertexTriangles[u]) {
+            if(!triangleAlive[t])
+                continue;
+            for(int k = 0; k < 3; k++) {
+                const unsigned int w = triangles[t * 3 + k];
+                if(w == u)
+                    continue;
+                Quadric q = quadrics[positionOf[u]];
+                q += quadrics[positionOf[w]];
+                const double cost = q.evaluate(vertices[w].position);
+                if(cost < best.cost) {
+                    best.cost = cost;
+                    best.to = w;
+                }
+            }
+        }
+        if(best.to != u)
+            heap.push(best);
+    };
+
+    // u移到w的位置后，剩下的三角形不能翻面
+    auto flipsTriangle = [&](unsigned int u, unsigned int w) {
+        const QVector3D& target = vertices[w].position;
+        for(int t : vertexTriangles[u]) {
+            if(!triangleAlive[t])
+                continue;
+            const unsigned int* tri = &triangles[t * 3];
+            if(tri[0] == w || tri[1] == w || tri[2] == w)
+                continue;   // 这个三角形会退化并被删除
+            QVector3D before[3], after[3];
+            for(int k = 0; k < 3; k++) {
+                before[k] = vertices[tri[k]].position;
+                after[k] = tri[k] == u ? target : before[k];
+            }
+            const QVector3D n0 = QVector3D::crossProduct(before[1] - before[0], before[2] - before[0]);
+            const QVector3D n1 = QVector3D::crossProduct(after[1] - after[0], after[2] - after[0]);
+            if(QVector3D::dotProduct(n0, n1) <= 0.25f * n0.length() * n1.length())
+                return true;
+        }
+        return false;
+    };
+
+    for(int v = 0; v < vertexCount; v++)
+        pushBestCollapse((unsigned int)v);
+
+    BoundingBox bounds = BoundingBox::fromVertices(vertices);
+    const double errorLimit = std::pow((double)maxError * (bounds.max - bounds.min).length(), 2.0);
+
+    int liveTriangles = triangleCount;
+    while(!heap.empty() && liveTriangles * 3 > targetIndexCount) {
+        const Collapse c = heap.top();
+        heap.pop();
+        if(c.cost > errorLimit)
+            break;
+        const unsigned int u = c.from;
+        const unsigned int w = c.to;
+        if(removed[u] || c.stamp != stamp[u])
+            continue;
+        if(removed[w]) {
+            stamp[u]++;
+            pushBestCollapse(u);
+            continue;
+        }
+        if(flipsTriangle(u, w))
+            continue;
+
+        // u合并到w: 同时包含u和w的三角形退化删除，其余的三角形改为引用w
+        for(int t : vertexTriangles[u]) {
+            if(!triangleAlive[t])
+                continue;
+            unsigned int* tri = &triangles[t * 3];
+            if(tri[0] == w || tri[1] == w || tri[2] == w) {
+                triangleAlive[t] = 0;
+                liveTriangles--;
+                continue;
+            }
+            for(int k = 0; k < 3; k++) {
+                if(tri[k] == u)
+                    tri[k] = w;
+            }
+            vertexTriangles[w].push_back(t);
+        }
+        removed[u] = 1;
+        std::vector<int>().swap(vertexTriangles[u]);
+        quadrics[positionOf[w]] += quadrics[positionOf[u]];
+
+        // w周围的顶点代价都变了 (顺便清掉w列表里已经删除的三角形)
+        std::vector<int>& wTriangles = vertexTriangles[w];
+        size_t alive = 0;
+        for(int t : wTriangles) {
+            if(triangleAlive[t])
+                wTriangles[alive++] = t;
+        }
+        wTriangles.resize(alive);
+        visitFrame++;
+        for(int t : wTriangles) {
+            for(int k = 0; k < 3; k++) {
+                const unsigned int x = triangles[t * 3 + k];
+                if(visitMark[x] == visitFrame)
+                    continue;
+                visitMark[x] = visitFrame;
+                stamp[x]++;
+                pushBestCollapse(x);
+            }
+        }
+    }
+
+    QVector<unsigned int> result;
+    result.reserve(liveTriangles * 3);
+    for(int t = 0; t < triangleCount; t++) {
+        if(!triangleAlive[t])
+            continue;
+        result.push_back(triangles[t * 3]);
+        result.push_back(triangles[t * 3 + 1]);
+        result.push_back(triangles[t * 3 + 2]);
+    }
+    return result;
+}
+
+QVector<QVector<unsigned int>> MeshSimplifier::generateLods(const QVector<Vertex>& vertices,
+                                                            const QVector<unsigned int>& indices) {
+    QVector<QVector<unsigned int>> lods;
+    if(indices.size() / 3 < MIN_LOD_TRIANGLES)
+        return lods;
+
+    // 每一级从上一级继续简化，比每次都从LOD0开始快很多
+    QVector<unsigned int> previous = indices;
+    for(int level = 1; level < MAX_LOD_COUNT; level++) {
+        const int target = (previous.size() / 3 / 2) * 3;
+        QVector<unsigned int> lod = simplify(vertices, previous, target, LOD_MAX_ERROR[level - 1]);
+        if(lod.isEmpty() || (float)lod.size() > (float)previous.size() * LOD_MIN_REDUCTION)
+            break;
+        lods.push_back(lod);
+        previous = lod;
+    }
+    return lods;
+}
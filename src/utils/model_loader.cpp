@@ -0,0 +1,140 @@
+//
+// Created by fangl on 2023/10/13.
+//
+
+#include "utils/model_loader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <QElapsedTimer>
+
+
+ModelLoadTask::ModelLoadTask(QString mPath)
+    : path(std::move(mPath)), state(State::Parsing), uploadedCount(0) {
+}
+
+void ModelLoadTask::cancel() {
+    if(isDone())
+        return;
+    state = State::Cancelled;
+    data.reset();
+    meshes.clear();
+}
+
+ModelLoadTask::State ModelLoadTask::getState() const {
+    return state;
+}
+
+bool ModelLoadTask::isDone() const {
+    return state == State::Finished || state == State::Failed || state == State::Cancelled;
+}
+
+float ModelLoadTask::getProgress() const {
+    switch (state) {
+        case State::Parsing:
+            return 0.0f;
+        case State::Uploading:
+            return 0.5f + 0.5f * (float)uploadedCount / (float)std::max(1, (int)data->meshes.size());
+        case State::Finished:
+            return 1.0f;
+        default:
+            return -1.0f;
+    }
+}
+
+const QString& ModelLoadTask::getPath() const {
+    return path;
+}
+
+const QVector<std::shared_ptr<Mesh>>& ModelLoadTask::getMeshes() const {
+    return meshes;
+}
+
+
+ModelLoader::ModelLoader() {
+    // 留一个核给GUI线程
+    threadPool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+ModelLoader::~ModelLoader() {
+    threadPool.clear();
+    threadPool.waitForDone();
+}
+
+std::shared_ptr<ModelLoadTask> ModelLoader::load(const QString& mPath) {
+    auto task = std::make_shared<ModelLoadTask>(mPath);
+
+    // 已经有物体在用这个模型时不需要再导入
+    QVector<std::shared_ptr<Mesh>> cached = ResourceManager::findCachedModel(mPath);
+    if(!cached.isEmpty()) {
+        task->meshes = cached;
+        task->state = ModelLoadTask::State::Finished;
+        return task;
+    }
+
+    auto promise = std::make_shared<std::promise<std::shared_ptr<ModelData>>>();
+    task->cpuResult = promise->get_future();
+    threadPool.start([promise, mPath]() {
+        try {
+            promise->set_value(ResourceManager::importModelData(mPath));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+
+    tasks.push_back(task);
+    return task;
+}
+
+void ModelLoader::pump(qint64 budgetMs) {
+    QElapsedTimer timer;
+    timer.start();
+
+    for(auto& task : tasks) {
+        if(task->state == ModelLoadTask::State::Parsing) {
+            if(task->cpuResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                continue;
+
+            try {
+                task->data = task->cpuResult.get();
+            } catch (...) {
+                task->data = nullptr;
+            }
+
+            if(!task->data || task->data->meshes.isEmpty()) {
+                qDebug() << "ERROR::MODEL_LOADER::Fail to import model:" << task->path;
+                task->state = ModelLoadTask::State::Failed;
+                task->data.reset();
+                continue;
+            }
+            task->state = ModelLoadTask::State::Uploading;
+        }
+
+        if(task->state != ModelLoadTask::State::Uploading)
+            continue;
+
+        // 每次至少上传一个mesh，保证即使超时也能往前走
+        do {
+            task->meshes.push_back(ResourceManager::createModelMesh(*task->data, task->uploadedCount));
+            task->uploadedCount++;
+        } while(task->uploadedCount < task->data->meshes.size() && timer.elapsed() < budgetMs);
+
+        if(task->uploadedCount == task->data->meshes.size()) {
+            ResourceManager::registerModelCache(task->path, task->meshes);
+            task->data.reset();     // 解码好的图片不再需要
+            task->state = ModelLoadTask::State::Finished;
+        }
+
+        if(timer.elapsed() >= budgetMs)
+            break;
+    }
+
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+                               [](const std::shared_ptr<ModelLoadTask>& t) { return t->isDone(); }),
+                tasks.end());
+}
+
+bool ModelLoader::hasPendingTasks() const {
+    return !tasks.empty();
+}
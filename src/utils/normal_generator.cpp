@@ -0,0 +1,297 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "utils/normal_generator.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "utils/parallel_for.hpp"
+
+
+// 每个线程至少分到这么多三角形，小mesh单线程更快
+const static int NORMAL_MIN_CHUNK_TRIANGLES = 16384;
+// 同一个顶点的两个角算出的法线点积低于这个值时拆成两个顶点
+const static float NORMAL_SPLIT_DOT = 0.9999f;
+// 退化 (面积为0) 的地方没有法线可用
+const static QVector3D NORMAL_FALLBACK = QVector3D(0.0f, 1.0f, 0.0f);
+
+namespace {
+
+// 位置完全相同 (按bit比较) 的顶点映射到同一个id，返回id的数量
+// 开放寻址，比unordered_map快很多，大mesh上这一步原本比法线计算本身还慢
+int weldPositions(const QVector<Vertex>& vertices, std::vector<unsigned int>& positionOf) {
+    const int vertexCount = vertices.size();
+    size_t capacity = 16;
+    while(capacity < (size_t)vertexCount * 2)
+        capacity *= 2;
+    const size_t mask = capacity - 1;
+    std::vector<int> firstVertex(capacity, -1);  // 每个位置第一次出现的顶点
+    positionOf.resize(vertexCount);
+
+    int positionCount = 0;
+    for(int v = 0; v < vertexCount; v++) {
+        quint32 bits[3];
+        for(int k = 0; k < 3; k++) {
+            // +0.0f把-0变成0，否则两者比较相等但hash不同，不会焊接在一起
+            const float f = vertices[v].position[k] + 0.0f;
+            std::memcpy(&bits[k], &f, sizeof(float));
+        }
+        quint64 h = ((quint64)bits[0] * 0x9E3779B97F4A7C15ull) ^ ((quint64)bits[1] * 0xC2B2AE3D27D4EB4Full)
+                    ^ ((quint64)bits[2] * 0x165667B19E3779F9ull);
+        h ^= h >> 29;
+        size_t slot = (size_t)h & mask;
+        while(true) {
+            const int other = firstVertex[slot];
+            if(other < 0) {
+                firstVertex[slot] = v;
+                positionOf[v] = (unsigned int)positionCount++;
+                break;
+            }
+            if(vertices[other].position.x() == vertices[v].position.x()
+               && vertices[other].position.y() == vertices[v].position.y()
+               && vertices[other].position.z() == vertices[v].position.z()) {
+                positionOf[v] = positionOf[other];
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+    return positionCount;
+}
+
+int chunkCountFor(int triangleCount) {
+    return qBound(1, triangleCount / NORMAL_MIN_CHUNK_TRIANGLES, ParallelFor::threadCount());
+}
+
+// 把[0, total)平均分成chunkCount段，返回第i段的起点
+int chunkBegin(int i, int chunkCount, int total) {
+    return (int)((qint64)total * i / chunkCount);
+}
+
+// 三角形三个角对法线的贡献，退化三角形返回false
+bool cornerContributions(const QVector3D& p0, const QVector3D& p1, const QVector3D& p2,
+                         NormalWeighting weighting, QVector3D contribution[3]) {
+    // 叉积的长度是面积的两倍
+    const QVector3D n = QVector3D::crossProduct(p1 - p0, p2 - p0);
+    const float length = n.length();
+    if(length <= 0.0f)
+        return false;
+
+    if(weighting == NormalWeighting::Area) {
+        contribution[0] = contribution[1] = contribution[2] = n;
+        return true;
+    }
+
+    const QVector3D unit = n / length;
+    const QVector3D p[3] = {p0, p1, p2};
+    for(int k = 0; k < 3; k++) {
+        const QVector3D a = (p[(k + 1) % 3] - p[k]).normalized();
+        const QVector3D b = (p[(k + 2) % 3] - p[k]).normalized();
+        contribution[k] = unit * std::acos(qBound(-1.0f, QVector3D::dotProduct(a, b), 1.0f));
+    }
+    return true;
+}
+
+// 按三角形区间并行累加: 每段写自己的buffer (elementCount * width)，最后按元素区间并行归并到第一个buffer
+template<typename Accumulate>
+std::vector<QVector3D> accumulateParallel(int triangleCount, int elementCount, int width, const Accumulate& perTriangle) {
+    const int chunkCount = chunkCountFor(triangleCount);
+    std::vector<std::vector<QVector3D>> buffers(chunkCount);
+    ParallelFor::run(chunkCount, [&](int i) {
+        std::vector<QVector3D>& buffer = buffers[i];
+        buffer.assign((size_t)elementCount * width, QVector3D(0.0f, 0.0f, 0.0f));
+        const int end = chunkBegin(i + 1, chunkCount, triangleCount);
+        for(int t = chunkBegin(i, chunkCount, triangleCount); t < end; t++)
+            perTriangle(t, buffer.data());
+    });
+
+    if(chunkCount > 1) {
+        const int total = elementCount * width;
+        ParallelFor::run(chunkCount, [&](int i) {
+            const int end = chunkBegin(i + 1, chunkCount, total);
+            for(int e = chunkBegin(i, chunkCount, total); e < end; e++) {
+                for(int b = 1; b < chunkCount; b++)
+                    buffers[0][e] += buffers[b][e];
+            }
+        });
+    }
+    return std::move(buffers[0]);
+}
+
+// 把[0, count)切成几段并行
+template<typename Job>
+void forEachParallel(int count, const Job& job) {
+    const int chunkCount = chunkCountFor(count);
+    ParallelFor::run(chunkCount, [&](int i) {
+        const int end = chunkBegin(i + 1, chunkCount, count);
+        for(int j = chunkBegin(i, chunkCount, count); j < end; j++)
+            job(j);
+    });
+}
+
+QVector3D normalizedOrFallback(const QVector3D& n) {
+    return n.lengthSquared() > 0.0f ? n.normalized() : NORMAL_FALLBACK;
+}
+
+}  // namespace
+
+void NormalGenerator::generate(QVector<Vertex>& vertices, QVector<unsigned int>& indices,
+                               float creaseAngle, NormalWeighting weighting) {
+    const int triangleCount = indices.size() / 3;
+    if(vertices.isEmpty() || triangleCount == 0)
+        return;
+
+    std::vector<unsigned int> positionOf;
+    const int positionCount = weldPositions(vertices, positionOf);
+    const Vertex* vertexData = vertices.constData();
+    const unsigned int* indexData = indices.constData();
+
+    // 不分割: 直接把每个角的贡献累加到位置上
+    if(creaseAngle >= 180.0f) {
+        std::vector<QVector3D> accumulated = accumulateParallel(
+            triangleCount, positionCount, 1, [&](int t, QVector3D* buffer) {
+                const unsigned int* tri = indexData + t * 3;
+                QVector3D contribution[3];
+                if(!cornerContributions(vertexData[tri[0]].position, vertexData[tri[1]].position,
+                                        vertexData[tri[2]].position, weighting, contribution))
+                    return;
+                for(int k = 0; k < 3; k++)
+                    buffer[positionOf[tri[k]]] += contribution[k];
+            });
+
+        Vertex* out = vertices.data();
+        forEachParallel(vertices.size(), [&](int v) {
+            out[v].normal = normalizedOrFallback(accumulated[positionOf[v]]);
+        });
+        return;
+    }
+
+    // 分割: 每个角只平滑和自己所在面夹角不超过creaseAngle的面
+    const float cosCrease = std::cos(qDegreesToRadians(qMax(creaseAngle, 0.0f)));
+    const int cornerCount = triangleCount * 3;
+    std::vector<QVector3D> faceNormals(triangleCount);
+    std::vector<QVector3D> contributions(cornerCount);
+    forEachParallel(triangleCount, [&](int t) {
+        const unsigned int* tri = indexData + t * 3;
+        const QVector3D& p0 = vertexData[tri[0]].position;
+        const QVector3D& p1 = vertexData[tri[1]].position;
+        const QVector3D& p2 = vertexData[tri[2]].position;
+        if(!cornerContributions(p0, p1, p2, weighting, &contributions[t * 3])) {
+            faceNormals[t] = QVector3D(0.0f, 0.0f, 0.0f);
+            contributions[t * 3] = contributions[t * 3 + 1] = contributions[t * 3 + 2] = QVector3D(0.0f, 0.0f, 0.0f);
+            return;
+        }
+        faceNormals[t] = QVector3D::crossProduct(p1 - p0, p2 - p0).normalized();
+    });
+
+    // 位置 -> 使用它的角 (CSR)
+    std::vector<int> cornerOffset(positionCount + 1, 0);
+    for(int c = 0; c < cornerCount; c++)
+        cornerOffset[positionOf[indexData[c]] + 1]++;
+    for(int p = 0; p < positionCount; p++)
+        cornerOffset[p + 1] += cornerOffset[p];
+    std::vector<int> positionCorners(cornerCount);
+    {
+        std::vector<int> cursor(cornerOffset.begin(), cornerOffset.end() - 1);
+        for(int c = 0; c < cornerCount; c++)
+            positionCorners[cursor[positionOf[indexData[c]]]++] = c;
+    }
+
+    std::vector<QVector3D> cornerNormals(cornerCount);
+    forEachParallel(cornerCount, [&](int c) {
+        const QVector3D& faceNormal = faceNormals[c / 3];
+        const unsigned int p = positionOf[indexData[c]];
+        // 退化的面没有方向，和周围所有面一起平滑
+        const bool degenerate = faceNormal.isNull();
+        QVector3D sum(0.0f, 0.0f, 0.0f);
+        for(int i = cornerOffset[p]; i < cornerOffset[p + 1]; i++) {
+            const int other = positionCorners[i];
+            if(other == c || degenerate || QVector3D::dotProduct(faceNormal, faceNormals[other / 3]) >= cosCrease)
+                sum += contributions[other];
+        }
+        cornerNormals[c] = normalizedOrFallback(sum);
+    });
+
+    // 同一个顶点的各个角法线不同时拆出新顶点，拆出的副本串成链表，法线相同的角共用一个副本
+    const int originalCount = vertices.size();
+    std::vector<int> nextCopy(originalCount, -1);
+    std::vector<char> assigned(originalCount, 0);
+    for(int c = 0; c < cornerCount; c++) {
+        const unsigned int v = indices[c];
+        const QVector3D& normal = cornerNormals[c];
+        if(!assigned[v]) {
+            vertices[v].normal = normal;
+            assigned[v] = 1;
+            continue;
+        }
+        int copy = (int)v;
+        int last = copy;
+        while(copy >= 0 && QVector3D::dotProduct(vertices[copy].normal, normal) < NORMAL_SPLIT_DOT) {
+            last = copy;
+            copy = nextCopy[copy];
+        }
+        if(copy < 0) {
+            Vertex split = vertices[v];
+            split.normal = normal;
+            copy = vertices.size();
+            vertices.push_back(split);
+            nextCopy.push_back(-1);
+            nextCopy[last] = copy;
+        }
+        indices[c] = (unsigned int)copy;
+    }
+}
+
+QVector<QVector4D> NormalGenerator::generateTangents(const QVector<Vertex>& vertices,
+                                                     const QVector<unsigned int>& indices) {
+    const int vertexCount = vertices.size();
+    QVector<QVector4D> tangents(vertexCount, QVector4D(1.0f, 0.0f, 0.0f, 1.0f));
+    const int triangleCount = indices.size() / 3;
+    if(vertexCount == 0 || triangleCount == 0)
+        return tangents;
+
+    // 每个顶点两项: 切线和副切线
+    const Vertex* vertexData = vertices.constData();
+    const unsigned int* indexData = indices.constData();
+    std::vector<QVector3D> accumulated = accumulateParallel(
+        triangleCount, vertexCount, 2, [&](int t, QVector3D* buffer) {
+            const unsigned int* tri = indexData + t * 3;
+            const Vertex& v0 = vertexData[tri[0]];
+            const Vertex& v1 = vertexData[tri[1]];
+            const Vertex& v2 = vertexData[tri[2]];
+            const QVector3D e1 = v1.position - v0.position;
+            const QVector3D e2 = v2.position - v0.position;
+            const QVector2D d1 = v1.texCoord - v0.texCoord;
+            const QVector2D d2 = v2.texCoord - v0.texCoord;
+            const float det = d1.x() * d2.y() - d2.x() * d1.y();
+            if(std::fabs(det) <= 1e-12f)
+                return;
+            // 不除以面积，大三角形权重更大
+            const QVector3D tangent = (e1 * d2.y() - e2 * d1.y()) / det;
+            const QVector3D bitangent = (e2 * d1.x() - e1 * d2.x()) / det;
+            for(int k = 0; k < 3; k++) {
+                buffer[tri[k] * 2] += tangent;
+                buffer[tri[k] * 2 + 1] += bitangent;
+            }
+        });
+
+    QVector4D* out = tangents.data();
+    forEachParallel(vertexCount, [&](int v) {
+        const QVector3D& n = vertexData[v].normal;
+        const QVector3D& t = accumulated[v * 2];
+        // Gram-Schmidt，uv退化时随便取一个和法线垂直的方向
+        QVector3D tangent = t - n * QVector3D::dotProduct(n, t);
+        if(tangent.lengthSquared() <= 1e-12f) {
+            const QVector3D axis = std::fabs(n.x()) < 0.9f ? QVector3D(1.0f, 0.0f, 0.0f) : QVector3D(0.0f, 1.0f, 0.0f);
+            tangent = QVector3D::crossProduct(axis, n);
+        }
+        tangent.normalize();
+        const float handedness = QVector3D::dotProduct(QVector3D::crossProduct(n, tangent), accumulated[v * 2 + 1]) < 0.0f
+                                 ? -1.0f : 1.0f;
+        out[v] = QVector4D(tangent, handedness);
+    });
+    return tangents;
+}
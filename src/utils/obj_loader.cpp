@@ -0,0 +1,614 @@
+//
+// Created by fangl on 2023/10/16.
+//
+
+#include "utils/obj_loader.hpp"
+
+#include <cstring>
+#include <vector>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QThread>
+
+#include "utils/normal_generator.hpp"
+#include "utils/parallel_for.hpp"
+
+
+// 小于这个大小的段不值得再切，bunny这种几百KB的文件只用一个线程
+const static qint64 OBJ_MIN_CHUNK_SIZE = 256 * 1024;
+
+namespace {
+
+struct ObjCorner {
+    int v;
+    int vt;     // -1表示没有
+    int vn;     // -1表示没有
+};
+
+// 负数索引在段内只能解析成相对本段起点的值，合并时再加上前面各段的数量
+enum ObjRelativeBits : quint8 {
+    RelativeV = 1,
+    RelativeVT = 2,
+    RelativeVN = 4
+};
+
+struct ObjFace {
+    int firstCorner;
+    int cornerCount;
+    int material;       // 段内materialNames的下标，-1表示沿用上一段最后的材质
+};
+
+struct ObjChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    bool failed = false;
+
+    std::vector<float> positions;   // xyz
+    std::vector<float> texCoords;   // uv
+    std::vector<float> normals;     // xyz
+    std::vector<ObjCorner> corners;
+    std::vector<quint8> relative;   // 每个corner一个ObjRelativeBits
+    std::vector<ObjFace> faces;
+    QVector<QByteArray> materialNames;
+    QVector<QByteArray> materialLibs;
+};
+
+struct ObjMeshBuild {
+    QByteArray material;
+    std::vector<ObjCorner> corners;     // 已经三角化，每3个一个三角形
+    ModelMeshData data;
+};
+
+// 以(v, vt, vn)为key的开放寻址hash表 (线性探测)，value是输出顶点的下标
+class ObjVertexMap {
+   public:
+    explicit ObjVertexMap(size_t expected) {
+        size_t capacity = 64;
+        while(capacity < expected * 2)
+            capacity <<= 1;
+        keys.assign(capacity, ObjCorner{-1, -1, -1});
+        values.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    // 已经存在时返回之前的下标，否则插入newIndex
+    unsigned int findOrInsert(const ObjCorner& key, unsigned int newIndex, bool& inserted) {
+        if((count + 1) * 2 > keys.size())
+            grow();
+
+        size_t slot = hash(key) & mask;
+        while(true) {
+            ObjCorner& k = keys[slot];
+            if(k.v < 0) {
+                k = key;
+                values[slot] = newIndex;
+                count++;
+                inserted = true;
+                return newIndex;
+            }
+            if(k.v == key.v && k.vt == key.vt && k.vn == key.vn) {
+                inserted = false;
+                return values[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+   private:
+    static size_t hash(const ObjCorner& key) {
+        quint64 h = (quint64)(quint32)key.v * 0x9E3779B97F4A7C15ull;
+        h ^= ((quint64)(quint32)key.vt + 0x7F4A7C15ull) * 0xC2B2AE3D27D4EB4Full;
+        h ^= ((quint64)(quint32)key.vn + 0x27D4EB4Full) * 0x165667B19E3779F9ull;
+        return (size_t)(h ^ (h >> 29));
+    }
+
+    void grow() {
+        std::vector<ObjCorner> oldKeys;
+        std::vector<unsigned int> oldValues;
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+
+        keys.assign(oldKeys.size() * 2, ObjCorner{-1, -1, -1});
+        values.resize(oldKeys.size() * 2);
+        mask = keys.size() - 1;
+        for(size_t i = 0; i < oldKeys.size(); i++) {
+            if(oldKeys[i].v < 0)
+                continue;
+            size_t slot = hash(oldKeys[i]) & mask;
+            while(keys[slot].v >= 0)
+                slot = (slot + 1) & mask;
+            keys[slot] = oldKeys[i];
+            values[slot] = oldValues[i];
+        }
+    }
+
+    std::vector<ObjCorner> keys;
+    std::vector<unsigned int> values;
+    size_t mask = 0;
+    size_t count = 0;
+};
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char* skipSpaces(const char* p, const char* end) {
+    while(p < end && isSpace(*p))
+        p++;
+    return p;
+}
+
+// 比strtof快很多，不处理inf/nan (OBJ里不会出现)
+// 尾数最多保留19位有效数字，再乘10的幂，精度对顶点数据足够
+const char* parseFloat(const char* p, const char* end, float& out) {
+    const static double POW10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    p = skipSpaces(p, end);
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+    for(; p < end && isDigit(*p); p++) {
+        anyDigit = true;
+        if(digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if(mantissa != 0)
+                digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if(p < end && *p == '.') {
+        for(p++; p < end && isDigit(*p); p++) {
+            anyDigit = true;
+            if(digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if(mantissa != 0)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+    if(!anyDigit)
+        return nullptr;
+
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool expNegative = false;
+        if(p < end && (*p == '-' || *p == '+')) {
+            expNegative = *p == '-';
+            p++;
+        }
+        if(p >= end || !isDigit(*p))
+            return nullptr;
+        int e = 0;
+        for(; p < end && isDigit(*p); p++) {
+            if(e < 10000)
+                e = e * 10 + (*p - '0');
+        }
+        exponent += expNegative ? -e : e;
+    }
+
+    double value = (double)mantissa;
+    if(mantissa != 0) {
+        while(exponent > 22) {
+            value *= 1e22;
+            exponent -= 22;
+        }
+        while(exponent < -22) {
+            value /= 1e22;
+            exponent += 22;
+        }
+        value = exponent >= 0 ? value * POW10[exponent] : value / POW10[-exponent];
+    }
+    out = (float)(negative ? -value : value);
+    return p;
+}
+
+const char* parseInt(const char* p, const char* end, int& out) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if(p >= end || !isDigit(*p))
+        return nullptr;
+    int value = 0;
+    for(; p < end && isDigit(*p); p++)
+        value = value * 10 + (*p - '0');
+    out = negative ? -value : value;
+    return p;
+}
+
+// OBJ索引从1开始，负数表示从当前位置往前数
+// 正数直接转成从0开始的全局下标，负数先转成本段内的下标并标记为相对
+inline bool resolveIndex(int raw, int localCount, int& out, quint8& relative, quint8 bit) {
+    if(raw > 0) {
+        out = raw - 1;
+    } else if(raw < 0) {
+        out = localCount + raw;
+        relative |= bit;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 支持 v, v/vt, v//vn, v/vt/vn
+const char* parseCorner(const char* p, const char* end, ObjChunk& chunk, ObjCorner& corner, quint8& relative) {
+    int raw = 0;
+    corner = ObjCorner{-1, -1, -1};
+    relative = 0;
+
+    p = parseInt(p, end, raw);
+    if(!p || !resolveIndex(raw, (int)chunk.positions.size() / 3, corner.v, relative, RelativeV))
+        return nullptr;
+
+    if(p < end && *p == '/') {
+        p++;
+        if(p < end && *p != '/') {
+            p = parseInt(p, end, raw);
+            if(!p || !resolveIndex(raw, (int)chunk.texCoords.size() / 2, corner.vt, relative, RelativeVT))
+                return nullptr;
+        }
+        if(p < end && *p == '/') {
+            p++;
+            p = parseInt(p, end, raw);
+            if(!p || !resolveIndex(raw, (int)chunk.normals.size() / 3, corner.vn, relative, RelativeVN))
+                return nullptr;
+        }
+    }
+    if(p < end && !isSpace(*p))
+        return nullptr;
+    return p;
+}
+
+bool parseFloats(const char* p, const char* end, std::vector<float>& out, int required, int optional) {
+    float value = 0.0f;
+    for(int i = 0; i < required; i++) {
+        p = parseFloat(p, end, value);
+        if(!p)
+            return false;
+        out.push_back(value);
+    }
+    // vt的第二个分量是可选的，多出来的分量(vt的w、v后面的顶点色)忽略
+    for(int i = 0; i < optional; i++) {
+        const char* next = parseFloat(p, end, value);
+        out.push_back(next ? value : 0.0f);
+        if(next)
+            p = next;
+    }
+    return true;
+}
+
+QByteArray parseName(const char* p, const char* end) {
+    p = skipSpaces(p, end);
+    const char* last = end;
+    while(last > p && isSpace(last[-1]))
+        last--;
+    return QByteArray(p, (int)(last - p));
+}
+
+inline bool startsWithKeyword(const char* p, const char* end, const char* keyword, size_t length) {
+    return (size_t)(end - p) > length && std::memcmp(p, keyword, length) == 0 && isSpace(p[length]);
+}
+
+void parseChunk(ObjChunk& chunk) {
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+
+    while(p < end) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+        if(!lineEnd)
+            lineEnd = end;
+        const char* line = skipSpaces(p, lineEnd);
+        p = lineEnd + 1;
+        if(line >= lineEnd)
+            continue;
+
+        bool ok = true;
+        if(line[0] == 'v' && line + 1 < lineEnd) {
+            if(isSpace(line[1]))
+                ok = parseFloats(line + 1, lineEnd, chunk.positions, 3, 0);
+            else if(line[1] == 't' && line + 2 < lineEnd && isSpace(line[2]))
+                ok = parseFloats(line + 2, lineEnd, chunk.texCoords, 1, 1);
+            else if(line[1] == 'n' && line + 2 < lineEnd && isSpace(line[2]))
+                ok = parseFloats(line + 2, lineEnd, chunk.normals, 3, 0);
+        } else if(line[0] == 'f' && line + 1 < lineEnd && isSpace(line[1])) {
+            ObjFace face{(int)chunk.corners.size(), 0, chunk.materialNames.size() - 1};
+            const char* c = skipSpaces(line + 1, lineEnd);
+            while(c < lineEnd) {
+                ObjCorner corner;
+                quint8 relative;
+                c = parseCorner(c, lineEnd, chunk, corner, relative);
+                if(!c) {
+                    ok = false;
+                    break;
+                }
+                chunk.corners.push_back(corner);
+                chunk.relative.push_back(relative);
+                face.cornerCount++;
+                c = skipSpaces(c, lineEnd);
+            }
+            if(ok && face.cornerCount >= 3) {
+                chunk.faces.push_back(face);
+            } else if(ok) {
+                // 少于三个点的面直接丢弃
+                chunk.corners.resize(face.firstCorner);
+                chunk.relative.resize(face.firstCorner);
+            }
+        } else if(startsWithKeyword(line, lineEnd, "usemtl", 6)) {
+            chunk.materialNames.push_back(parseName(line + 6, lineEnd));
+        } else if(startsWithKeyword(line, lineEnd, "mtllib", 6)) {
+            chunk.materialLibs.push_back(parseName(line + 6, lineEnd));
+        }
+        // 其余的 (#, o, g, s, l, p ...) 不影响输出
+
+        if(!ok) {
+            qDebug() << "ERROR::OBJ_LOADER::Malformed line:" << QByteArray(line, (int)(lineEnd - line));
+            chunk.failed = true;
+            return;
+        }
+    }
+}
+
+// 只取map_Kd和map_Ks，和Assimp路径里loadMaterialTextures读取的两类一致
+QMap<QByteArray, QVector<ModelTextureRef>> parseMaterialLibrary(const QString& mtlPath, const QString& modelDirectory) {
+    QMap<QByteArray, QVector<ModelTextureRef>> materials;
+    QFile file(mtlPath);
+    if(!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "WARNING::OBJ_LOADER::Fail to open material library:" << mtlPath;
+        return materials;
+    }
+
+    QVector<ModelTextureRef> diffuse;
+    QVector<ModelTextureRef> specular;
+    QByteArray current;
+    bool haveCurrent = false;
+    auto flush = [&]() {
+        if(haveCurrent)
+            materials.insert(current, diffuse + specular);
+        diffuse.clear();
+        specular.clear();
+    };
+
+    const QByteArray content = file.readAll();
+    const char* p = content.constData();
+    const char* end = p + content.size();
+    while(p < end) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+        if(!lineEnd)
+            lineEnd = end;
+        const char* line = skipSpaces(p, lineEnd);
+        p = lineEnd + 1;
+
+        if(startsWithKeyword(line, lineEnd, "newmtl", 6)) {
+            flush();
+            current = parseName(line + 6, lineEnd);
+            haveCurrent = true;
+        } else if(startsWithKeyword(line, lineEnd, "map_Kd", 6) || startsWithKeyword(line, lineEnd, "map_Ks", 6)) {
+            // 贴图选项 (-bm 0.5 之类) 在文件名前面，取最后一个token
+            const char* last = lineEnd;
+            while(last > line && isSpace(last[-1]))
+                last--;
+            const char* first = last;
+            while(first > line + 6 && !isSpace(first[-1]))
+                first--;
+            if(first == last)
+                continue;
+
+            const QString texturePath = modelDirectory + "/" + QString::fromUtf8(QByteArray(first, (int)(last - first)));
+            if(line[5] == 'd')
+                diffuse.push_back(ModelTextureRef{texturePath, stringToTextureType("texture_diffuse")});
+            else
+                specular.push_back(ModelTextureRef{texturePath, stringToTextureType("texture_specular")});
+        }
+    }
+    flush();
+    return materials;
+}
+
+// 顶点和索引，缺少vn时和Assimp路径一样交给NormalGenerator重新生成整个mesh的法线
+void buildMesh(ObjMeshBuild& mesh,
+               const std::vector<float>& positions,
+               const std::vector<float>& texCoords,
+               const std::vector<float>& normals) {
+    QVector<Vertex>& vertices = mesh.data.vertices;
+    QVector<unsigned int>& indices = mesh.data.indices;
+    indices.reserve((int)mesh.corners.size());
+
+    ObjVertexMap vertexMap(mesh.corners.size() / 4);
+    bool needNormals = false;
+
+    for(const ObjCorner& c : mesh.corners) {
+        bool inserted = false;
+        const unsigned int index = vertexMap.findOrInsert(c, (unsigned int)vertices.size(), inserted);
+        if(inserted) {
+            Vertex vertex;
+            vertex.position = QVector3D(positions[c.v * 3], positions[c.v * 3 + 1], positions[c.v * 3 + 2]);
+            if(c.vn >= 0)
+                vertex.normal = QVector3D(normals[c.vn * 3], normals[c.vn * 3 + 1], normals[c.vn * 3 + 2]);
+            if(c.vt >= 0)
+                vertex.texCoord = QVector2D(texCoords[c.vt * 2], 1.0f - texCoords[c.vt * 2 + 1]);
+            vertices.push_back(vertex);
+            needNormals |= c.vn < 0;
+        }
+        indices.push_back(index);
+    }
+
+    std::vector<ObjCorner>().swap(mesh.corners);
+    // 位置相同的顶点一起平滑，超过折痕角时会拆分顶点
+    if(needNormals)
+        NormalGenerator::generate(vertices, indices, MODEL_NORMAL_CREASE_ANGLE);
+
+    mesh.data.bounds = BoundingBox::fromVertices(vertices);
+}
+
+}  // namespace
+
+bool ObjLoader::canLoad(const QString& path) {
+    return QFileInfo(path).suffix().compare("obj", Qt::CaseInsensitive) == 0;
+}
+
+std::shared_ptr<ModelData> ObjLoader::load(const QString& path) {
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "ERROR::OBJ_LOADER::Fail to open:" << path;
+        return nullptr;
+    }
+    const qint64 fileSize = file.size();
+    if(fileSize <= 0)
+        return nullptr;
+
+    uchar* mapped = file.map(0, fileSize);
+    if(!mapped) {
+        qDebug() << "ERROR::OBJ_LOADER::Fail to map:" << path;
+        return nullptr;
+    }
+    const char* begin = (const char*)mapped;
+    const char* end = begin + fileSize;
+
+    // 按行边界切段，每段独立解析
+    int chunkCount = (int)qBound<qint64>(1, fileSize / OBJ_MIN_CHUNK_SIZE, QThread::idealThreadCount());
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char* chunkBegin = begin;
+    for(int i = 0; i < chunkCount; i++) {
+        const char* chunkEnd = end;
+        if(i + 1 < chunkCount) {
+            chunkEnd = begin + fileSize * (i + 1) / chunkCount;
+            if(chunkEnd < chunkBegin)
+                chunkEnd = chunkBegin;
+            const char* newline = (const char*)std::memchr(chunkEnd, '\n', end - chunkEnd);
+            chunkEnd = newline ? newline + 1 : end;
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+    ParallelFor::run(chunkCount, [&chunks](int i) { parseChunk(chunks[i]); });
+
+    for(const auto& chunk : chunks) {
+        if(chunk.failed) {
+            file.unmap(mapped);
+            return nullptr;
+        }
+    }
+
+    // 合并顶点属性，同时修正相对索引
+    std::vector<float> positions;
+    std::vector<float> texCoords;
+    std::vector<float> normals;
+    std::vector<ObjMeshBuild> meshes;
+    QMap<QByteArray, int> meshOfMaterial;
+    QVector<QByteArray> materialLibs;
+    int currentMesh = -1;
+
+    for(auto& chunk : chunks) {
+        const int vBase = (int)positions.size() / 3;
+        const int vtBase = (int)texCoords.size() / 2;
+        const int vnBase = (int)normals.size() / 3;
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        const int vCount = (int)positions.size() / 3;
+        const int vtCount = (int)texCoords.size() / 2;
+        const int vnCount = (int)normals.size() / 3;
+
+        for(const auto& lib : chunk.materialLibs) {
+            if(!materialLibs.contains(lib))
+                materialLibs.push_back(lib);
+        }
+
+        // 段内每个usemtl对应的mesh
+        QVector<int> chunkMeshes;
+        for(const auto& name : chunk.materialNames) {
+            if(!meshOfMaterial.contains(name)) {
+                meshOfMaterial.insert(name, (int)meshes.size());
+                meshes.emplace_back();
+                meshes.back().material = name;
+            }
+            chunkMeshes.push_back(meshOfMaterial.value(name));
+        }
+
+        for(const ObjFace& face : chunk.faces) {
+            if(face.material >= 0)
+                currentMesh = chunkMeshes[face.material];
+            if(currentMesh < 0) {
+                // usemtl之前的面，对应Assimp的默认材质
+                currentMesh = (int)meshes.size();
+                meshes.emplace_back();
+            }
+
+            ObjCorner* corners = chunk.corners.data() + face.firstCorner;
+            const quint8* relative = chunk.relative.data() + face.firstCorner;
+            for(int i = 0; i < face.cornerCount; i++) {
+                ObjCorner& c = corners[i];
+                if(relative[i] & RelativeV)
+                    c.v += vBase;
+                if(relative[i] & RelativeVT)
+                    c.vt += vtBase;
+                if(relative[i] & RelativeVN)
+                    c.vn += vnBase;
+
+                if(c.v < 0 || c.v >= vCount) {
+                    qDebug() << "ERROR::OBJ_LOADER::Vertex index out of range:" << path;
+                    file.unmap(mapped);
+                    return nullptr;
+                }
+                // 引用了不存在的vt/vn (bunny等模型的面写了vn索引但没有vn数据) 当作没有
+                if(c.vt >= vtCount || c.vt < -1)
+                    c.vt = -1;
+                if(c.vn >= vnCount || c.vn < -1)
+                    c.vn = -1;
+            }
+
+            // 多边形按扇形三角化
+            std::vector<ObjCorner>& out = meshes[currentMesh].corners;
+            for(int i = 1; i + 1 < face.cornerCount; i++) {
+                out.push_back(corners[0]);
+                out.push_back(corners[i]);
+                out.push_back(corners[i + 1]);
+            }
+        }
+        // 段内的数据已经拷走，尽早释放
+        chunk = ObjChunk();
+    }
+    file.unmap(mapped);
+    chunks.clear();
+
+    // 每个mesh的去重和法线生成互不相关，并行做
+    ParallelFor::run((int)meshes.size(), [&](int i) { buildMesh(meshes[i], positions, texCoords, normals); });
+
+    const QString modelDirectory = path.left(path.lastIndexOf('/'));
+    QMap<QByteArray, QVector<ModelTextureRef>> materialTextures;
+    for(const auto& lib : materialLibs) {
+        const auto textures = parseMaterialLibrary(modelDirectory + "/" + QString::fromUtf8(lib), modelDirectory);
+        for(const auto& name : textures.keys())
+            materialTextures.insert(name, textures.value(name));
+    }
+
+    auto data = std::make_shared<ModelData>();
+    data->path = path;
+    for(auto& mesh : meshes) {
+        if(mesh.data.indices.isEmpty())
+            continue;
+        mesh.data.textures = materialTextures.value(mesh.material);
+        data->meshes.push_back(std::move(mesh.data));
+    }
+    qDebug() << "ObjLoader:" << path << "meshes:" << data->meshes.size() << "chunks:" << chunkCount;
+    return data;
+}
@@ -0,0 +1,72 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "utils/parallel_for.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <QThreadPool>
+
+
+namespace {
+
+// run()本身通常跑在ModelLoader的线程池里，这里用单独的池子避免互相等待
+QThreadPool& workerThreadPool() {
+    static QThreadPool pool;
+    return pool;
+}
+
+struct ParallelState {
+    std::atomic<int> next{0};
+    int count = 0;
+    int finished = 0;
+    const std::function<void(int)>* job = nullptr;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+// 不停领取下一个下标，领完就返回
+// 排队太久的helper启动时任务已经被领完，直接退出，不会再碰job
+void drain(ParallelState& state) {
+    int completed = 0;
+    for(int i = state.next++; i < state.count; i = state.next++) {
+        (*state.job)(i);
+        completed++;
+    }
+    if(completed == 0)
+        return;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.finished += completed;
+    if(state.finished == state.count)
+        state.done.notify_all();
+}
+
+}  // namespace
+
+void ParallelFor::run(int count, const std::function<void(int)>& job) {
+    if(count <= 0)
+        return;
+    if(count == 1) {
+        job(0);
+        return;
+    }
+
+    auto state = std::make_shared<ParallelState>();
+    state->count = count;
+    state->job = &job;
+    const int helpers = std::min(count - 1, threadCount());
+    for(int i = 0; i < helpers; i++)
+        workerThreadPool().start([state]() { drain(*state); });
+
+    drain(*state);
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state]() { return state->finished == state->count; });
+}
+
+int ParallelFor::threadCount() {
+    return workerThreadPool().maxThreadCount();
+}
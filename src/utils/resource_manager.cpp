@@ -4,73 +4,137 @@
 
 #include "utils/resource_manager.hpp"
 
+#include <cstring>
+#include <QDateTime>
+#include <QFileInfo>
+
+#include "shape_data.hpp"
+#include "utils/assimp_loader.hpp"
+#include "utils/mesh_cache.hpp"
+#include "utils/mesh_optimizer.hpp"
+#include "utils/mesh_simplifier.hpp"
+#include "utils/obj_loader.hpp"
+
+// 开启MeshOptimizer时在缓存用的flags里加上这一位 (优化是自己做的，不会传给Assimp)
+const static unsigned int MODEL_OPTIMIZED_FLAG = aiProcess_ImproveCacheLocality;
+// 能放下几帧的instance/uniform数据和中等大小mesh的上传，更大的直接glBufferSubData
+const static GLsizeiptr UPLOAD_RING_SIZE = 8 * 1024 * 1024;
+
 
 // Global variables to store Shaders and Textures
 std::map<QString, std::shared_ptr<Shader>> ResourceManager::map_Shaders;
+std::map<QString, std::shared_ptr<Shader>> ResourceManager::map_ShaderPrograms;
 std::map<QString, std::shared_ptr<Texture2D>> ResourceManager::map_Textures;
+std::map<QString, std::weak_ptr<Texture2D>> ResourceManager::map_TextureCache;
+int ResourceManager::textureCacheHits = 0;
+int ResourceManager::textureCacheMisses = 0;
+std::atomic<bool> ResourceManager::meshOptimizationEnabled{true};
+bool ResourceManager::packedModelVertices = true;
+std::map<QString, std::weak_ptr<MeshGeometry>> ResourceManager::map_ShapeGeometries;
+std::map<QString, ResourceManager::ModelCacheEntry> ResourceManager::map_ModelGeometries;
+
+std::unique_ptr<UploadRing> ResourceManager::uploadRing;
+std::shared_ptr<GeometryArena> ResourceManager::geometryArenas[2];
+std::unique_ptr<UniformBuffer> ResourceManager::frameUniformBuffer;
+FrameBlockData ResourceManager::frameBlockData;
+std::unique_ptr<MaterialTable> ResourceManager::materialTable;
+
+void ResourceManager::initRenderResources() {
+    // 其他buffer的上传都要经过它，最先创建
+    uploadRing = std::make_unique<UploadRing>(UPLOAD_RING_SIZE);
+    geometryArenas[(int)VertexFormat::Float] = std::make_shared<GeometryArena>(VertexFormat::Float);
+    geometryArenas[(int)VertexFormat::Packed] = std::make_shared<GeometryArena>(VertexFormat::Packed);
+
+    frameBlockData = FrameBlockData();
+    frameUniformBuffer = std::make_unique<UniformBuffer>();
+    frameUniformBuffer->create(sizeof(FrameBlockData), FrameBlockBinding);
+
+    materialTable = std::make_unique<MaterialTable>();
+    materialTable->create();
+}
 
-void ResourceManager::updateProjViewViewPosMatrixInShader(QMatrix4x4 proj, QMatrix4x4 vi, QVector3D viewP) {
-    for(const auto& sha : map_Shaders) {
-        sha.second->use();
-        sha.second->setMatrix4f("projection", proj);
-        sha.second->setMatrix4f("view", vi);
-        sha.second->setVector3f("viewPos", viewP);
-        sha.second->release();
-    }
+UploadRing* ResourceManager::getUploadRing() {
+    return uploadRing.get();
 }
 
-void ResourceManager::updateRenderConfigure(GLboolean depthMode) {
-    for(const auto& sha : map_Shaders) {
-        sha.second->use();
-        sha.second->setBool("enableDepthMode", depthMode);
-        sha.second->release();
+void ResourceManager::uploadBufferData(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data) {
+    if(uploadRing) {
+        uploadRing->upload(buffer, offset, size, data);
+        return;
     }
+    auto glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glFunc->glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    glFunc->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 }
 
-// 在GameObject里执行
-void ResourceManager::updateMaterialInShader(const QString& sName, const Material& mat) {
-    if(map_Shaders.find(sName) == map_Shaders.end()) {
-        qFatal("Set Material Failed! No Target Shader Exists");
-    }
+void ResourceManager::endUploadFrame() {
+    if(uploadRing)
+        uploadRing->endFrame();
+}
+
+std::shared_ptr<GeometryArena> ResourceManager::getGeometryArena(VertexFormat format) {
+    return geometryArenas[(int)format];
+}
+
+void ResourceManager::updateFrameCamera(const QMatrix4x4& proj, const QMatrix4x4& vi, const QVector3D& viewP) {
+    // QMatrix4x4::constData() 是列主序，与GLSL一致
+    memcpy(frameBlockData.projection, proj.constData(), sizeof(frameBlockData.projection));
+    memcpy(frameBlockData.view, vi.constData(), sizeof(frameBlockData.view));
+    frameBlockData.viewPos[0] = viewP.x();
+    frameBlockData.viewPos[1] = viewP.y();
+    frameBlockData.viewPos[2] = viewP.z();
+}
 
-    const auto& tempShader = map_Shaders[sName];
-    tempShader->use();
+void ResourceManager::updateFrameRenderConfigure(GLboolean depthMode) {
+    frameBlockData.enableDepthMode = depthMode ? 1 : 0;
+}
 
-    // -1 代表没有该textures
-    if(mat.texture_diffuse1 != nullptr) {
-        tempShader->setInteger("material.texture_diffuse1", mat.texture_diffuse1->getTextureID());
-        tempShader->setBool("useDiffuseTexture", true);
-    } else {
-        tempShader->setBool("useDiffuseTexture", false);
+void ResourceManager::updateFrameDirectLight(GLboolean enableLighting, const DirectLight& dl) {
+    auto copyVec3 = [](GLfloat* dst, const QVector3D& src) {
+        dst[0] = src.x();
+        dst[1] = src.y();
+        dst[2] = src.z();
+    };
+
+    frameBlockData.useLight = enableLighting ? 1 : 0;
+    copyVec3(frameBlockData.lightDirection, dl.direction);
+    copyVec3(frameBlockData.lightAmbientColor, dl.ambientColor);
+    copyVec3(frameBlockData.lightDiffuseColor, dl.diffuseColor);
+    copyVec3(frameBlockData.lightSpecularColor, dl.specularColor);
+    frameBlockData.lightIntensity = dl.intensity;
+}
+
+void ResourceManager::uploadFrameUniforms() {
+    if(!frameUniformBuffer) {
+        qDebug() << "ERROR::RESOURCE_MANAGER::Frame uniform buffer is not initialized";
+        return;
     }
+    frameUniformBuffer->update(0, sizeof(FrameBlockData), &frameBlockData);
+}
 
-    if(mat.texture_specular1 != nullptr) {
-        tempShader->setInteger("material.texture_specular1", mat.texture_specular1->getTextureID());
-        tempShader->setBool("useSpecularTexture", true);
-    } else {
-        tempShader->setBool("useSpecularTexture", false);
+// texture的开关和sampler仍然由Mesh::draw根据自己的textures设置
+GLint ResourceManager::allocateMaterial(const Material& mat) {
+    if(!materialTable) {
+        qDebug() << "ERROR::RESOURCE_MANAGER::Material table is not initialized";
+        return DefaultMaterialID;
     }
+    return materialTable->allocate(mat);
+}
 
-    tempShader->setFloat("material.shininess" ,mat.shininess);
-    tempShader->setVector3f("material.ambientColor", mat.ambientColor);
-    tempShader->setVector3f("material.diffuseColor", mat.diffuseColor);
-    tempShader->setVector3f("material.specularColor", mat.specularColor);
-    tempShader->setFloat("material.ambientOcclusion", mat.ambientOcclusion);
+void ResourceManager::releaseMaterial(GLint id) {
+    if(materialTable)
+        materialTable->release(id);
+}
 
-    tempShader->release();
+void ResourceManager::updateMaterial(GLint id, const Material& mat) {
+    if(materialTable)
+        materialTable->update(id, mat);
 }
 
-void ResourceManager::updateDirectLightInShader(GLboolean enableLighting,DirectLight dl) {
-    for(const auto& sha : map_Shaders) {
-        sha.second->use();
-        sha.second->setBool("useLight", enableLighting);
-        sha.second->setVector3f("directLight.direction", dl.direction);
-        sha.second->setVector3f("directLight.ambientColor", dl.ambientColor);
-        sha.second->setVector3f("directLight.diffuseColor", dl.diffuseColor);
-        sha.second->setVector3f("directLight.specularColor", dl.specularColor);
-        sha.second->setFloat("directLight.intensity", dl.intensity);
-        sha.second->release();
-    }
+void ResourceManager::uploadMaterials() {
+    if(materialTable)
+        materialTable->flush();
 }
 
 void ResourceManager::updatePointLightInShader(PointLight pl) {
@@ -102,19 +166,56 @@ std::shared_ptr<Shader> ResourceManager::loadShader(const QString& name,
                                           const QString& vShaderFile,
                                           const QString& fShaderFile,
                                           const QString& gShaderfile) {
+    std::shared_ptr<Shader> shader = loadShaderProgram(vShaderFile, fShaderFile, gShaderfile);
+
+    qDebug() << "Successfully Loaded Shader : " << name;
+    map_Shaders[name] = shader;
+    return map_Shaders[name];
+}
+
+std::shared_ptr<Shader> ResourceManager::loadShaderProgram(const QString& vShaderFile,
+                                                           const QString& fShaderFile,
+                                                           const QString& gShaderfile,
+                                                           const QStringList& defines) {
+    // defines排序后作为key的一部分，顺序不同的同一组define共用一个program
+    QStringList sortedDefines = defines;
+    // material表用storage buffer时所有program都要按SSBO声明
+    if(materialTable && materialTable->usesStorageBuffer() && !sortedDefines.contains(MaterialStorageDefine))
+        sortedDefines << MaterialStorageDefine;
+    sortedDefines.sort();
+    QString key = vShaderFile + "|" + fShaderFile + "|" +
+                  (gShaderfile == nullptr ? QString() : gShaderfile) + "|" +
+                  sortedDefines.join(";");
+
+    auto it = map_ShaderPrograms.find(key);
+    if(it != map_ShaderPrograms.end())
+        return it->second;
+
     std::shared_ptr<Shader> shader = std::make_shared<Shader>();
     bool isCompiledSuccess = shader->compile(vShaderFile,
                           fShaderFile,
-                          gShaderfile == nullptr ? nullptr : gShaderfile);
+                          gShaderfile == nullptr ? nullptr : gShaderfile,
+                          sortedDefines);
 
-    if(isCompiledSuccess) {
-        qDebug() << "Successfully Loaded Shader : " << name;
-        map_Shaders[name] = shader;
-        return map_Shaders[name];
-    } else {
-        qDebug() << "Fail Loaded Shader : " << name;
+    if(!isCompiledSuccess) {
+        qDebug() << "Fail Loaded Shader Program : " << key;
+        qFatal("WRONG SHADER LOADED!");
+    }
+
+    map_ShaderPrograms[key] = shader;
+    return shader;
+}
+
+std::shared_ptr<Shader> ResourceManager::loadComputeShader(const QString& name, const QString& cShaderFile) {
+    std::shared_ptr<Shader> shader = std::make_shared<Shader>();
+    if(!shader->compileCompute(cShaderFile)) {
+        qDebug() << "Fail Loaded Compute Shader : " << cShaderFile;
         qFatal("WRONG SHADER LOADED!");
     }
+
+    qDebug() << "Successfully Loaded Shader : " << name;
+    map_Shaders[name] = shader;
+    return map_Shaders[name];
 }
 
 std::shared_ptr<Shader> ResourceManager::getShader(const QString& name){
@@ -128,179 +229,368 @@ std::shared_ptr<Shader> ResourceManager::getShader(const QString& name){
 }
 
 std::shared_ptr<Texture2D> ResourceManager::loadTexture(const QString& name, const QString& file, GLboolean alpha){
-    std::shared_ptr<Texture2D> texture = std::make_shared<Texture2D>();
+    std::shared_ptr<Texture2D> texture = acquireTexture(file, TextureType::UNKNOWN, alpha);
+    map_Textures[name] = texture;
 
+    return texture;
+}
+
+std::shared_ptr<Texture2D> ResourceManager::acquireTexture(const QString& file, TextureType type, GLboolean alpha, const DecodedTexture* decoded) {
+    const QString key = makeTextureCacheKey(file, type, alpha);
+
+    auto it = map_TextureCache.find(key);
+    if(it != map_TextureCache.end()) {
+        if(auto texture = it->second.lock()) {
+            textureCacheHits++;
+            return texture;
+        }
+    }
+    textureCacheMisses++;
+
+    std::shared_ptr<Texture2D> texture = std::make_shared<Texture2D>();
     if(alpha){
         texture->internal_format = QOpenGLTexture::RGBAFormat;
         texture->wrap_s = QOpenGLTexture::ClampToBorder;
         texture->wrap_t = QOpenGLTexture::ClampToBorder;
     }
-
-    texture->generate(file);
-    map_Textures[name] = texture;
+    if(decoded != nullptr && decoded->isValid())
+        texture->generate(*decoded);
+    else
+        texture->generate(file);
+    texture->type = type;
+    texture->path = file;
+
+    // 顺便清掉已经释放的条目
+    for(auto iter = map_TextureCache.begin(); iter != map_TextureCache.end();) {
+        if(iter->second.expired())
+            iter = map_TextureCache.erase(iter);
+        else
+            ++iter;
+    }
+    map_TextureCache[key] = texture;
 
     return texture;
 }
 
+QVector<std::shared_ptr<Texture2D>> ResourceManager::acquireTextures(const QStringList& files, TextureType type) {
+    // 先找出需要解码的文件 (去掉重复的和已经在缓存里的)
+    QStringList missing;
+    for(const auto& file : files) {
+        auto it = map_TextureCache.find(makeTextureCacheKey(file, type, GL_FALSE));
+        bool cached = it != map_TextureCache.end() && !it->second.expired();
+        if(!cached && !missing.contains(file))
+            missing.push_back(file);
+    }
+
+    std::vector<std::shared_ptr<DecodedTexture>> decoded = TextureDecoder::decodeBatch(missing, true);
+
+    QVector<std::shared_ptr<Texture2D>> textures;
+    for(const auto& file : files) {
+        int index = missing.indexOf(file);
+        textures.push_back(acquireTexture(file, type, GL_FALSE, index >= 0 ? decoded[index].get() : nullptr));
+    }
+    return textures;
+}
+
+// type和alpha会改变贴图对象本身的状态，不同的组合不能共用
+QString ResourceManager::makeTextureCacheKey(const QString& file, TextureType type, GLboolean alpha) {
+    return QString("%1|%2|%3").arg(file).arg(static_cast<int>(type)).arg(alpha ? 1 : 0);
+}
+
+ResourceManager::TextureCacheStats ResourceManager::getTextureCacheStats() {
+    TextureCacheStats stats{textureCacheHits, textureCacheMisses, 0, 0};
+    for(const auto& item : map_TextureCache) {
+        if(auto texture = item.second.lock()) {
+            stats.residentCount++;
+            stats.residentBytes += texture->getByteSize();
+        }
+    }
+    return stats;
+}
+
 std::shared_ptr<Texture2D> ResourceManager::getTexture(const QString& name){
     return map_Textures[name];
 }
 
 void ResourceManager::clearShader(){
     map_Shaders.clear();
+    map_ShaderPrograms.clear();
 }
 
 void ResourceManager::clearTextures() {
     map_Textures.clear();
+    map_TextureCache.clear();
 }
 
-QVector<std::shared_ptr<Mesh>> ResourceManager::loadModel(const QString& mPath) {
-    QVector<std::shared_ptr<Mesh>> meshes;
+std::shared_ptr<MeshGeometry> ResourceManager::loadShapeGeometry(ObjectType type, float width, float height) {
+    // 参数按各个shape实际使用的精度归一化，避免 1.0 和 1.2 的Cube被当成不同的geometry
+    QString key;
+    switch (type) {
+        case ObjectType::UnitCube:
+        case ObjectType::Quad:
+            key = QString("shape|%1").arg(static_cast<int>(type));
+            break;
+        case ObjectType::Cube:
+            key = QString("shape|%1|%2").arg(static_cast<int>(type)).arg(static_cast<int>(width));
+            break;
+        case ObjectType::Plane:
+            key = QString("shape|%1|%2|%3").arg(static_cast<int>(type))
+                      .arg(static_cast<int>(width)).arg(static_cast<int>(height));
+            break;
+        case ObjectType::Capsule:
+            key = QString("shape|%1|%2|%3").arg(static_cast<int>(type)).arg(width).arg(height);
+            break;
+        case ObjectType::Sphere:
+            key = QString("shape|%1|%2|%3").arg(static_cast<int>(type)).arg(width).arg(static_cast<int>(height));
+            break;
+        default:
+            qDebug() << "ERROR::RESOURCE_MANAGER::loadShapeGeometry: not a shape type";
+            return nullptr;
+    }
 
-    Assimp::Importer import;
-    const aiScene *scene = import.ReadFile(mPath.toStdString(), aiProcess_Triangulate | aiProcess_FlipUVs);
+    auto it = map_ShapeGeometries.find(key);
+    if(it != map_ShapeGeometries.end()) {
+        if(auto geometry = it->second.lock())
+            return geometry;
+    }
 
-    if(!scene || !scene->mRootNode) {
-        qCritical() << "ERROR::ASSIMP::" << import.GetErrorString() << Qt::endl;
-    } else if (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) {
-        qDebug() << "WARNING::ASSIMP::" << "Scene Flags Incomplete";
+    std::shared_ptr<MeshGeometry> geometry;
+    switch (type) {
+        case ObjectType::UnitCube:
+            geometry = std::make_shared<MeshGeometry>(ShapeData::getUnitCubeVertices(),
+                                                      ShapeData::getUnitCubeIndices());
+            break;
+        case ObjectType::Cube:
+            geometry = std::make_shared<MeshGeometry>(ShapeData::getCubeVertices(static_cast<int>(width)),
+                                                      ShapeData::getCubeIndices(static_cast<int>(width)));
+            break;
+        case ObjectType::Plane:
+            geometry = std::make_shared<MeshGeometry>(ShapeData::getPlaneVertices(static_cast<int>(width), static_cast<int>(height)),
+                                                      ShapeData::getPlaneIndices(static_cast<int>(width), static_cast<int>(height)));
+            break;
+        case ObjectType::Quad:
+            geometry = std::make_shared<MeshGeometry>(ShapeData::getQuadVertices(),
+                                                      ShapeData::getQuadIndices());
+            break;
+        case ObjectType::Capsule:
+            geometry = std::make_shared<MeshGeometry>(ShapeData::getCapsuleVertices(width, height),
+                                                      ShapeData::getCapsuleIndices(width, height));
+            break;
+        case ObjectType::Sphere:
+            geometry = std::make_shared<MeshGeometry>(ShapeData::getSphereVertices(width, static_cast<int>(height)),
+                                                      ShapeData::getSphereIndices(width, static_cast<int>(height)));
+            break;
+        default:
+            break;
     }
 
-    QString modelDirectory = mPath.left(mPath.lastIndexOf('/'));
-    qDebug() << "Model Directory: " + modelDirectory;
+    purgeExpiredGeometries();
+    map_ShapeGeometries[key] = geometry;
+    return geometry;
+}
 
-    if(scene->mRootNode)
-        meshes.append(processNode(scene->mRootNode, scene, modelDirectory));
-    else
-        qCritical("ERROR::ASSIMP::Scene Root Node is null.");
+QVector<std::shared_ptr<Mesh>> ResourceManager::loadModel(const QString& mPath) {
+    QVector<std::shared_ptr<Mesh>> meshes = findCachedModel(mPath);
+    if(!meshes.isEmpty())
+        return meshes;
+
+    std::shared_ptr<ModelData> data = importModelData(mPath);
+    for(int i = 0; i < data->meshes.size(); i++)
+        meshes.push_back(createModelMesh(*data, i));
 
+    registerModelCache(mPath, meshes);
     return meshes;
 }
 
-QVector<std::shared_ptr<Mesh>> ResourceManager::processNode(aiNode *node, const aiScene *scene, const QString& mDir) {
+QVector<std::shared_ptr<Mesh>> ResourceManager::findCachedModel(const QString& mPath) {
     QVector<std::shared_ptr<Mesh>> meshes;
 
-    for(unsigned int i = 0; i < node->mNumMeshes; i++) {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene, mDir));
-    }
-
-    for(unsigned int i = 0; i < node->mNumChildren; i++) {
-        auto childMeshes = processNode(node->mChildren[i], scene, mDir);
-        meshes.append(childMeshes);
+    // 缓存命中: 只要还有物体在用这个模型，就直接复用geometry和贴图
+    auto cached = map_ModelGeometries.find(makeModelCacheKey(mPath));
+    if(cached == map_ModelGeometries.end())
+        return meshes;
+
+    const ModelCacheEntry& entry = cached->second;
+    for(int i = 0; i < entry.geometries.size(); i++) {
+        auto geometry = entry.geometries[i].lock();
+        if(!geometry)
+            return {};
+        QVector<std::shared_ptr<Texture2D>> textures;
+        for(const auto& weakTexture : entry.textures[i]) {
+            auto texture = weakTexture.lock();
+            if(!texture)
+                return {};
+            textures.push_back(texture);
+        }
+        meshes.push_back(std::make_shared<Mesh>(nullptr, geometry, textures));
     }
 
+    qDebug() << "Model Cache Hit: " + mPath;
     return meshes;
 }
 
-std::shared_ptr<Mesh> ResourceManager::processMesh(aiMesh *mesh, const aiScene *scene, const QString& mDir) {
-    bool haveNormal = false;
-    QVector<Vertex> vertices;
-    QVector<unsigned int> indices;
-    QVector<std::shared_ptr<Texture2D>> textures;
+void ResourceManager::registerModelCache(const QString& mPath, const QVector<std::shared_ptr<Mesh>>& meshes) {
+    if(meshes.isEmpty())
+        return;
+
+    ModelCacheEntry entry;
+    for(const auto& m : meshes) {
+        entry.geometries.push_back(m->getGeometry());
+        QVector<std::weak_ptr<Texture2D>> textures;
+        for(const auto& t : m->textures)
+            textures.push_back(t);
+        entry.textures.push_back(textures);
+    }
+    purgeExpiredGeometries();
+    map_ModelGeometries[makeModelCacheKey(mPath)] = entry;
+}
 
-    for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
-        QVector3D vector;
-        Vertex vertex;
-        // 处理顶点位置、法线和纹理坐标
-        vector.setX(mesh->mVertices[i].x);
-        vector.setY(mesh->mVertices[i].y);
-        vector.setZ(mesh->mVertices[i].z);
-        vertex.position = vector;
-
-        // 处理索引
-        if(mesh->mNormals != nullptr) {
-            haveNormal = true;
-            vector.setX(mesh->mNormals[i].x);
-            vector.setY(mesh->mNormals[i].y);
-            vector.setZ(mesh->mNormals[i].z);
-            vertex.normal = vector;
-        }
+// 只做CPU上的工作，不碰GL和任何缓存，可以在worker线程里调用
+std::shared_ptr<ModelData> ResourceManager::importModelData(const QString& mPath) {
+    // 源文件内容和import flags都没变时直接读二进制缓存，跳过Assimp
+    const QByteArray sourceHash = MeshCache::hashSource(mPath);
+    const unsigned int importFlags = getImportFlags();
+    std::shared_ptr<ModelData> data = MeshCache::load(mPath, importFlags, sourceHash);
+    if(!data) {
+        // OBJ走专门的并行解析器，解析失败或者其他格式退回Assimp
+        if(ObjLoader::canLoad(mPath))
+            data = ObjLoader::load(mPath);
+        if(!data)
+            data = AssimpLoader::load(mPath);
+        if(importFlags & MODEL_OPTIMIZED_FLAG)
+            optimizeModelData(*data);
+        generateModelLods(*data, importFlags & MODEL_OPTIMIZED_FLAG);
+        if(!data->meshes.isEmpty())
+            MeshCache::save(mPath, importFlags, sourceHash, *data);
+    }
 
-        if(mesh->mTextureCoords[0]) {
-            QVector2D vec;
-            vec.setX(mesh->mTextureCoords[0][i].x);
-            vec.setY(mesh->mTextureCoords[0][i].y);
-            vertex.texCoord = vec;
-        } else {
-            vertex.texCoord = QVector2D(0.0f, 0.0f);
-        }
+    decodeModelTextures(*data);
+    return data;
+}
 
-        vertices.push_back(vertex);
+void ResourceManager::optimizeModelData(ModelData& data) {
+    for(auto& mesh : data.meshes) {
+        VertexCacheStats before, after;
+        MeshOptimizer::optimize(mesh.vertices, mesh.indices, &before, &after);
+        qDebug() << "MeshOptimizer:" << mesh.vertices.size() << "vertices,"
+                 << "ACMR" << before.acmr << "->" << after.acmr
+                 << "ATVR" << before.atvr << "->" << after.atvr;
     }
+}
 
-    for(unsigned int i = 0; i < mesh->mNumFaces; i++) {
-        aiFace face = mesh->mFaces[i];
-        for(unsigned int j = 0; j < face.mNumIndices; j++)
-            indices.push_back(face.mIndices[j]);
+// LOD直接引用LOD0的顶点，所以要在vertex fetch重排之后生成
+void ResourceManager::generateModelLods(ModelData& data, bool optimize) {
+    for(auto& mesh : data.meshes) {
+        mesh.lods = MeshSimplifier::generateLods(mesh.vertices, mesh.indices);
+        if(mesh.lods.isEmpty())
+            continue;
+
+        QString counts = QString::number(mesh.indices.size() / 3);
+        for(auto& lod : mesh.lods) {
+            if(optimize)
+                lod = MeshOptimizer::tipsify(lod, mesh.vertices.size(), MeshOptimizer::DEFAULT_CACHE_SIZE);
+            counts += " / " + QString::number(lod.size() / 3);
+        }
+        qDebug() << "Generate LODs (triangles):" << counts;
     }
+}
 
-    // if we have no normal there
-    if(mesh->mNormals == nullptr) {
-        reCalculateNormal(vertices, indices);
-    }
+unsigned int ResourceManager::getImportFlags() {
+    return meshOptimizationEnabled ? (AssimpLoader::IMPORT_FLAGS | MODEL_OPTIMIZED_FLAG) : AssimpLoader::IMPORT_FLAGS;
+}
 
-    // 处理材质
-    if(mesh->mMaterialIndex >= 0) {
-        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-        QVector<std::shared_ptr<Texture2D>> diffuseMaps = loadMaterialTextures(material,
-                                                                               aiTextureType_DIFFUSE,
-                                                                               "texture_diffuse", mDir);
-        textures.append(diffuseMaps);
-        QVector<std::shared_ptr<Texture2D>> specularMaps = loadMaterialTextures(material,
-                                                                                aiTextureType_SPECULAR,
-                                                                                "texture_specular", mDir);
-        textures.append(specularMaps);
-    } else {
-        qDebug() << "Current Model Has No Texture";
-    }
+void ResourceManager::setMeshOptimizationEnabled(bool enabled) {
+    meshOptimizationEnabled = enabled;
+}
 
-    return std::make_shared<Mesh>(nullptr, vertices, indices, textures);
+bool ResourceManager::isMeshOptimizationEnabled() {
+    return meshOptimizationEnabled;
 }
 
-QVector<std::shared_ptr<Texture2D>> ResourceManager::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const QString& typeName, const QString& modelDirectory) {
-    QVector<std::shared_ptr<Texture2D>> textures;
-    for(unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
-        aiString str;
-        mat->GetTexture(type, i, &str);
-        QString qStr = modelDirectory + "/" + QString::fromUtf8(str.C_Str());
-        qDebug() << "Load " << typeName << " : " << qStr;
-
-        std::shared_ptr<Texture2D> texture = std::make_shared<Texture2D>();
-        texture->generate(qStr);
-        texture->type = stringToTextureType(typeName);
-        texture->path = qStr;
-
-        textures.push_back(texture);
-    }
-    return textures;
+void ResourceManager::setPackedModelVerticesEnabled(bool enabled) {
+    packedModelVertices = enabled;
+}
+
+bool ResourceManager::isPackedModelVerticesEnabled() {
+    return packedModelVertices;
 }
 
-void ResourceManager::reCalculateNormal(QVector<Vertex> &vertices, const QVector<unsigned int>& indices) {
-    for(auto &v : vertices) {
-        v.normal = QVector3D(0.0f,0.0f,0.0f);
+// 贴图也在worker线程里并行解码并生成mip链，GL线程只需要上传
+void ResourceManager::decodeModelTextures(ModelData& data) {
+    QStringList texturePaths;
+    for(const auto& m : data.meshes) {
+        for(const auto& t : m.textures) {
+            if(!texturePaths.contains(t.path))
+                texturePaths.push_back(t.path);
+        }
     }
+    std::vector<std::shared_ptr<DecodedTexture>> decoded = TextureDecoder::decodeBatch(texturePaths, true);
+    for(int i = 0; i < texturePaths.size(); i++)
+        data.images.insert(texturePaths[i], decoded[i]);
+}
 
-    for(int i = 0; i < indices.size(); i += 3) {
-        int index1 = indices[i];
-        int index2 = indices[i+1];
-        int index3 = indices[i+2];
+std::shared_ptr<Mesh> ResourceManager::createModelMesh(const ModelData& data, int meshIndex) {
+    const ModelMeshData& meshData = data.meshes[meshIndex];
 
-        QVector3D p1 = vertices[index1].position;
-        QVector3D p2 = vertices[index2].position;
-        QVector3D p3 = vertices[index3].position;
+    QVector<std::shared_ptr<Texture2D>> textures;
+    for(const auto& t : meshData.textures) {
+        // nanosuit之类的模型多个mesh会引用同一张贴图
+        textures.push_back(acquireTexture(t.path, t.type, GL_FALSE, data.images.value(t.path).get()));
+    }
 
-        QVector3D edge1 = p2 - p1;
-        QVector3D edge2 = p3 - p1;
+    auto geometry = std::make_shared<MeshGeometry>(meshData.vertices, meshData.indices, meshData.bounds,
+                                                   packedModelVertices ? VertexFormat::Packed : VertexFormat::Float,
+                                                   meshData.lods);
+    return std::make_shared<Mesh>(nullptr, geometry, textures);
+}
 
-        QVector3D faceNormal = QVector3D::crossProduct(edge1, edge2);
+void ResourceManager::clearGeometryCache() {
+    map_ShapeGeometries.clear();
+    map_ModelGeometries.clear();
+}
 
-        vertices[index1].normal += faceNormal;
-        vertices[index1].normal += faceNormal;
-        vertices[index1].normal += faceNormal;
+int ResourceManager::getCachedGeometryCount() {
+    int count = 0;
+    for(const auto& item : map_ShapeGeometries) {
+        if(!item.second.expired())
+            count++;
     }
+    for(const auto& item : map_ModelGeometries) {
+        for(const auto& g : item.second.geometries) {
+            if(!g.expired())
+                count++;
+        }
+    }
+    return count;
+}
+
+QString ResourceManager::makeModelCacheKey(const QString& mPath) {
+    QFileInfo info(mPath);
+    return QString("model|%1|%2|%3|%4").arg(info.absoluteFilePath())
+                                        .arg(info.lastModified().toMSecsSinceEpoch())
+                                        .arg(getImportFlags())
+                                        .arg(packedModelVertices ? "packed" : "float");
+}
 
-    for(auto &v : vertices) {
-        v.normal.normalize();
+// 插入新条目时顺便清掉已经没人使用的条目
+void ResourceManager::purgeExpiredGeometries() {
+    for(auto it = map_ShapeGeometries.begin(); it != map_ShapeGeometries.end();) {
+        if(it->second.expired())
+            it = map_ShapeGeometries.erase(it);
+        else
+            ++it;
+    }
+    for(auto it = map_ModelGeometries.begin(); it != map_ModelGeometries.end();) {
+        bool expired = true;
+        for(const auto& g : it->second.geometries) {
+            if(!g.expired()) {
+                expired = false;
+                break;
+            }
+        }
+        if(expired)
+            it = map_ModelGeometries.erase(it);
+        else
+            ++it;
     }
 }
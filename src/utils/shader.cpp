@@ -4,9 +4,86 @@
 
 #include "utils/shader.hpp"
 
-bool Shader::compile(const QString& vertexSource, const QString& fragmentSource, const QString& geometrySource) {
+#include <QFile>
+
+#include "gl_configure.hpp"
+#include "utils/material_table.hpp"
+#include "utils/uniform_buffer.hpp"
+
+
+// 与UniformId一一对应
+static const char* const uniformIdNames[] = {
+    "model",
+    "useDiffuseTexture",
+    "useSpecularTexture",
+    "skybox",
+    "material.texture_diffuse1",
+    "material.texture_specular1",
+    "screenTexture",
+    "postProcessingType",
+};
+static_assert(sizeof(uniformIdNames) / sizeof(uniformIdNames[0]) == static_cast<int>(UniformId::Count),
+              "uniformIdNames must match UniformId");
+
+// 所有program共用的uniform block以及对应的绑定点
+static const struct {
+    const char* name;
+    GLuint binding;
+} uniformBlockBindings[] = {
+    { "FrameBlock", FrameBlockBinding },
+    { "MaterialBlock", MaterialBlockBinding },
+};
+
+#ifdef GL_CORE_4_3
+// 所有program共用的shader storage block以及对应的绑定点
+static const struct {
+    const char* name;
+    GLuint binding;
+} storageBlockBindings[] = {
+    { "MaterialBuffer", MaterialStorageBinding },
+};
+#endif
+
+const char* uniformIdToString(UniformId id) {
+    return uniformIdNames[static_cast<int>(id)];
+}
+
+// 没有defines时直接用Qt读文件，否则读出源码后把define插到#version那一行之后
+static bool compileShaderStage(QOpenGLShader& stage, const QString& sourceFile, const QStringList& defines) {
+    if(defines.isEmpty())
+        return stage.compileSourceFile(sourceFile);
+
+    QFile file(sourceFile);
+    if(!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "ERROR::SHADER::Unable to open file" << sourceFile;
+        return false;
+    }
+    QByteArray source = file.readAll();
+
+    QByteArray defineBlock;
+    for(const auto& d : defines) {
+        defineBlock += "#define " + d.toLatin1() + "\n";
+    }
+
+    int versionPos = source.indexOf("#version");
+    if(versionPos < 0) {
+        source.prepend(defineBlock);
+    } else {
+        int lineEnd = source.indexOf('\n', versionPos);
+        if(lineEnd < 0) {
+            source.append('\n');
+            lineEnd = source.size() - 1;
+        }
+        source.insert(lineEnd + 1, defineBlock);
+    }
+
+    return stage.compileSourceCode(source);
+}
+
+bool Shader::compile(const QString& vertexSource, const QString& fragmentSource, const QString& geometrySource,
+                     const QStringList& defines) {
     QOpenGLShader vertexShader(QOpenGLShader::Vertex);
-    bool success = vertexShader.compileSourceFile(vertexSource);
+    bool success = compileShaderStage(vertexShader, vertexSource, defines);
     if(!success){
         qDebug() << "ERROR::SHADER::VERTEX::COMPILATION_FAILED" << Qt::endl;
         qDebug() << vertexShader.log() << Qt::endl;
@@ -14,7 +91,7 @@ bool Shader::compile(const QString& vertexSource, const QString& fragmentSource,
     }
     
     QOpenGLShader fragmentShader(QOpenGLShader::Fragment);
-    success  = fragmentShader.compileSourceFile(fragmentSource);
+    success  = compileShaderStage(fragmentShader, fragmentSource, defines);
     if(!success){
         qDebug() << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED" << Qt::endl;
         qDebug() << fragmentShader.log() << Qt::endl;
@@ -23,7 +100,7 @@ bool Shader::compile(const QString& vertexSource, const QString& fragmentSource,
 
     QOpenGLShader geometryShader(QOpenGLShader::Geometry);
     if(geometrySource != nullptr){
-        success  = geometryShader.compileSourceFile(geometrySource);
+        success  = compileShaderStage(geometryShader, geometrySource, defines);
         if(!success){
             qDebug() << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED" << Qt::endl;
             qDebug() << geometryShader.log() << Qt::endl;
@@ -43,6 +120,102 @@ bool Shader::compile(const QString& vertexSource, const QString& fragmentSource,
         return false;
     }
 
+    cacheUniformLocations();
+    bindUniformBlocks();
+
+    return true;
+}
+
+bool Shader::compileCompute(const QString& computeSource, const QStringList& defines) {
+    QOpenGLShader computeShader(QOpenGLShader::Compute);
+    bool success = compileShaderStage(computeShader, computeSource, defines);
+    if(!success){
+        qDebug() << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED" << Qt::endl;
+        qDebug() << computeShader.log() << Qt::endl;
+        return false;
+    }
+
+    shaderProgram = std::make_shared<QOpenGLShaderProgram>();
+    shaderProgram->addShader(&computeShader);
+    success = shaderProgram->link();
+    if(!success){
+        qDebug() << "ERROR::SHADER::PROGRAM::LINKING_FAILED" << Qt::endl;
+        qDebug() << shaderProgram->log() << Qt::endl;
+        return false;
+    }
+
+    cacheUniformLocations();
+    bindUniformBlocks();
+
     return true;
 }
 
+void Shader::cacheUniformLocations() {
+    auto glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    GLuint program = shaderProgram->programId();
+
+    uniformLocations.clear();
+    uniformIdLocations.fill(-1);
+
+    GLint uniformCount = 0;
+    GLint maxNameLength = 0;
+    glFunc->glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glFunc->glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    QByteArray nameBuffer(maxNameLength + 1, '\0');
+    for(GLint i = 0; i < uniformCount; i++) {
+        GLsizei nameLength = 0;
+        GLint arraySize = 0;
+        GLenum type = 0;
+        glFunc->glGetActiveUniform(program, i, (GLsizei)nameBuffer.size(), &nameLength,
+                                   &arraySize, &type, nameBuffer.data());
+
+        GLint location = glFunc->glGetUniformLocation(program, nameBuffer.constData());
+        if(location == -1)  // uniform block里的成员没有location
+            continue;
+
+        QString name = QString::fromLatin1(nameBuffer.constData(), nameLength);
+        uniformLocations.insert(name, location);
+
+        // 数组: "name[0]" 同时登记 "name" 以及其余的元素
+        if(name.endsWith("[0]")) {
+            QString baseName = name.left(name.size() - 3);
+            uniformLocations.insert(baseName, location);
+            for(GLint e = 1; e < arraySize; e++) {
+                QString elementName = baseName + "[" + QString::number(e) + "]";
+                uniformLocations.insert(elementName,
+                                        glFunc->glGetUniformLocation(program, elementName.toLatin1().constData()));
+            }
+        }
+    }
+
+    for(int i = 0; i < static_cast<int>(UniformId::Count); i++) {
+        uniformIdLocations[i] = uniformLocations.value(uniformIdNames[i], -1);
+    }
+}
+
+
+void Shader::bindUniformBlocks() {
+    auto glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    GLuint program = shaderProgram->programId();
+
+    for(const auto& block : uniformBlockBindings) {
+        GLuint blockIndex = glFunc->glGetUniformBlockIndex(program, block.name);
+        if(blockIndex == GL_INVALID_INDEX)  // 这个program没有用到该block
+            continue;
+        glFunc->glUniformBlockBinding(program, blockIndex, block.binding);
+    }
+
+#ifdef GL_CORE_4_3
+    // GLSL 410 的buffer block也不能写binding，同样在link之后设置 (只有4.3的context才有这个函数)
+    const QSurfaceFormat format = QOpenGLContext::currentContext()->format();
+    if(format.majorVersion() < 4 || (format.majorVersion() == 4 && format.minorVersion() < 3))
+        return;
+    for(const auto& block : storageBlockBindings) {
+        GLuint blockIndex = glFunc->glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, block.name);
+        if(blockIndex == GL_INVALID_INDEX)
+            continue;
+        glFunc->glShaderStorageBlockBinding(program, blockIndex, block.binding);
+    }
+#endif
+}
@@ -4,8 +4,15 @@
 
 #include "utils/texture2d.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE2D_SSE2 1
+#endif
+
+#include "utils/texture_decoder.hpp"
+
 Texture2D::Texture2D()
-    : texture(nullptr), id(0), type(TextureType::UNKNOWN), transparent(GL_FALSE),
+    : texture(nullptr), byteSize(0), alphaMode(AlphaMode::Opaque), id(0), type(TextureType::UNKNOWN), transparent(GL_FALSE),
       path(""),
       internal_format(QOpenGLTexture::RGBAFormat),
       wrap_s(QOpenGLTexture::Repeat), wrap_t(QOpenGLTexture::Repeat),
@@ -15,20 +22,62 @@ Texture2D::Texture2D()
 Texture2D::~Texture2D() = default;
 
 void Texture2D::generate(const QString &file) {
+    generate(QImage(file));
+}
+
+void Texture2D::generate(const QImage& image) {
     texture = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
     texture->setFormat(internal_format);
 
     // 透明的话，用clampToEdge
-    QImage image = QImage(file);
-    GLboolean isTransparency = checkTransparency(image);
-    if(isTransparency) {
+    setAlphaMode(classifyAlpha(image));
+
+    texture->setData(image, QOpenGLTexture::GenerateMipMaps);
+    // QOpenGLTexture按RGBA8上传，完整的mip链大约多出1/3
+    byteSize = (qint64)image.width() * image.height() * 4 * 4 / 3;
+
+    applySamplerState();
+}
+
+void Texture2D::generate(const DecodedTexture& decoded) {
+    if(!decoded.isValid()) {
+        qDebug() << "ERROR::TEXTURE2D::Decoded texture is empty:" << decoded.path;
+        return;
+    }
+    if(!decoded.hasMipChain()) {
+        generate(decoded.levels[0]);
+        return;
+    }
+
+    texture = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    setAlphaMode(decoded.alphaMode);
+
+    // mip链已经在CPU上生成好了 (RGBA8888)，这里只剩逐级上传
+    const QImage& base = decoded.levels[0];
+    texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    texture->setSize(base.width(), base.height());
+    texture->setMipLevels(decoded.levels.size());
+    texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+
+    byteSize = 0;
+    for(int level = 0; level < decoded.levels.size(); level++) {
+        texture->setData(level, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, decoded.levels[level].constBits());
+        byteSize += decoded.levels[level].sizeInBytes();
+    }
+
+    applySamplerState();
+}
+
+void Texture2D::setAlphaMode(AlphaMode mode) {
+    alphaMode = mode;
+    if(mode != AlphaMode::Opaque) {
         wrap_s = QOpenGLTexture::ClampToEdge;
         wrap_t = QOpenGLTexture::ClampToEdge;
         transparent = GL_TRUE;
     }
+}
 
-    texture->setData(image, QOpenGLTexture::GenerateMipMaps);
-
+void Texture2D::applySamplerState() {
     texture->setWrapMode(QOpenGLTexture::DirectionS, wrap_s);
     texture->setWrapMode(QOpenGLTexture::DirectionT, wrap_t);
 
@@ -38,6 +87,14 @@ void Texture2D::generate(const QString &file) {
     this->id = texture->textureId();
 }
 
+qint64 Texture2D::getByteSize() const {
+    return byteSize;
+}
+
+AlphaMode Texture2D::getAlphaMode() const {
+    return alphaMode;
+}
+
 void Texture2D::bind() const {
     texture->bind();
 }
@@ -70,21 +127,57 @@ void Texture2D::setFilter(QOpenGLTexture::Filter min, QOpenGLTexture::Filter max
     texture->setMagnificationFilter(filter_max);
 }
 
-GLboolean Texture2D::checkTransparency(const QImage& image) {
-    if (image.hasAlphaChannel()) {
-        int width = image.width();
-        int height = image.height();
-
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                QColor pixelColor = image.pixelColor(x, y);
+AlphaMode Texture2D::classifyAlpha(const QImage& image) {
+    if(image.isNull() || !image.hasAlphaChannel())
+        return AlphaMode::Opaque;
+
+    // 这几种格式的像素按uint32读时alpha都在最高字节 (RGBA8888只在小端成立)，其余格式先转换
+    QImage argb;
+    const QImage* source = &image;
+    const QImage::Format format = image.format();
+    const bool alphaInHighByte = format == QImage::Format_ARGB32 || format == QImage::Format_ARGB32_Premultiplied
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+                                 || format == QImage::Format_RGBA8888 || format == QImage::Format_RGBA8888_Premultiplied
+#endif
+                                 ;
+    if(!alphaInHighByte) {
+        argb = image.convertToFormat(QImage::Format_ARGB32);
+        source = &argb;
+    }
 
-                if (pixelColor.alpha() < 255) {
-                    return true; // 图像包含至少一个半透明或透明像素
-                }
-            }
+    const int width = source->width();
+    const int height = source->height();
+    bool hasZero = false;
+
+#ifdef TEXTURE2D_SSE2
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+#endif
+
+    for(int y = 0; y < height; y++) {
+        const auto* row = reinterpret_cast<const quint32*>(source->constScanLine(y));
+        int x = 0;
+#ifdef TEXTURE2D_SSE2
+        for(; x + 4 <= width; x += 4) {
+            __m128i alpha = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), alphaMask);
+            int opaqueBits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(alpha, alphaMask)));
+            if(opaqueBits == 0xF)
+                continue;
+            int zeroBits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(alpha, zero)));
+            if((opaqueBits | zeroBits) != 0xF)
+                return AlphaMode::Blended;
+            hasZero = true;
+        }
+#endif
+        for(; x < width; x++) {
+            quint32 alpha = row[x] >> 24;
+            if(alpha == 0xFF)
+                continue;
+            if(alpha != 0)
+                return AlphaMode::Blended;
+            hasZero = true;
         }
     }
 
-    return false; // 图像没有透明度或所有像素都是不透明的
-}
\ No newline at end of file
+    return hasZero ? AlphaMode::Masked : AlphaMode::Opaque;
+}
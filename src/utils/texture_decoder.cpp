@@ -0,0 +1,103 @@
+//
+// Created by fangl on 2023/10/14.
+//
+
+#include "utils/texture_decoder.hpp"
+
+#include <algorithm>
+#include <future>
+#include <QThreadPool>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_DECODER_SSE2 1
+#endif
+
+#include "utils/texture2d.hpp"
+
+
+// 和模型导入的线程池分开，避免导入任务在等待解码时占满同一个池子
+static QThreadPool& decoderThreadPool() {
+    static QThreadPool pool;
+    return pool;
+}
+
+std::shared_ptr<DecodedTexture> TextureDecoder::decode(const QString& path, bool generateMips) {
+    auto result = std::make_shared<DecodedTexture>();
+    result->path = path;
+
+    QImage image(path);
+    if(image.isNull()) {
+        qDebug() << "ERROR::TEXTURE_DECODER::Fail to decode:" << path;
+        return result;
+    }
+
+    // QOpenGLTexture::setData最终也会转成RGBA8888，这里提前在worker线程里做掉
+    image = image.convertToFormat(QImage::Format_RGBA8888);
+    result->alphaMode = Texture2D::classifyAlpha(image);
+    result->levels.push_back(image);
+
+    if(generateMips) {
+        while(result->levels.last().width() > 1 || result->levels.last().height() > 1)
+            result->levels.push_back(downsample(result->levels.last()));
+    }
+    return result;
+}
+
+std::vector<std::shared_ptr<DecodedTexture>> TextureDecoder::decodeBatch(const QStringList& paths, bool generateMips) {
+    std::vector<std::future<std::shared_ptr<DecodedTexture>>> pending;
+    pending.reserve(paths.size());
+
+    for(const auto& path : paths) {
+        auto promise = std::make_shared<std::promise<std::shared_ptr<DecodedTexture>>>();
+        pending.push_back(promise->get_future());
+        decoderThreadPool().start([promise, path, generateMips]() {
+            promise->set_value(decode(path, generateMips));
+        });
+    }
+
+    std::vector<std::shared_ptr<DecodedTexture>> results;
+    results.reserve(pending.size());
+    for(auto& f : pending)
+        results.push_back(f.get());
+    return results;
+}
+
+QImage TextureDecoder::downsample(const QImage& src) {
+    const int srcW = src.width();
+    const int srcH = src.height();
+    const int dstW = std::max(1, srcW / 2);
+    const int dstH = std::max(1, srcH / 2);
+    QImage dst(dstW, dstH, QImage::Format_RGBA8888);
+
+    for(int y = 0; y < dstH; y++) {
+        const uchar* row0 = src.constScanLine(std::min(2 * y, srcH - 1));
+        const uchar* row1 = src.constScanLine(std::min(2 * y + 1, srcH - 1));
+        uchar* out = dst.scanLine(y);
+
+        int x = 0;
+#ifdef TEXTURE_DECODER_SSE2
+        // 一次处理4个目标像素 (8个源像素)，先上下两行平均，再把相邻的两个像素平均
+        for(; 2 * x + 8 <= srcW && x + 4 <= dstW; x += 4) {
+            __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+            __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x + 16));
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x + 16));
+            __m128 v0 = _mm_castsi128_ps(_mm_avg_epu8(a0, b0));
+            __m128 v1 = _mm_castsi128_ps(_mm_avg_epu8(a1, b1));
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * x), _mm_avg_epu8(even, odd));
+        }
+#endif
+        for(; x < dstW; x++) {
+            const int x0 = std::min(2 * x, srcW - 1) * 4;
+            const int x1 = std::min(2 * x + 1, srcW - 1) * 4;
+            for(int c = 0; c < 4; c++) {
+                int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                out[4 * x + c] = static_cast<uchar>((sum + 2) / 4);
+            }
+        }
+    }
+    return dst;
+}
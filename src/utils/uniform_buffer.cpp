@@ -0,0 +1,56 @@
+//
+// Created by fangl on 2023/10/8.
+//
+
+#include "utils/uniform_buffer.hpp"
+#include "utils/resource_manager.hpp"
+
+
+UniformBuffer::UniformBuffer() : UBO(0), binding(0), bufferSize(0) {
+    glFunc = QOpenGLContext::currentContext()->versionFunctions<GLFunctions_Core>();
+    if(!glFunc)
+        qFatal("Require GLFunctions_Core to create uniform buffer");
+}
+
+UniformBuffer::~UniformBuffer() {
+    // 程序退出时context可能已经销毁，这时buffer随context一起释放
+    if(UBO != 0 && QOpenGLContext::currentContext() != nullptr)
+        glFunc->glDeleteBuffers(1, &UBO);
+}
+
+void UniformBuffer::create(GLsizeiptr size, GLuint bindingPoint) {
+    if(UBO != 0)
+        glFunc->glDeleteBuffers(1, &UBO);
+
+    bufferSize = size;
+    binding = bindingPoint;
+
+    glFunc->glGenBuffers(1, &UBO);
+    glFunc->glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glFunc->glBufferData(GL_UNIFORM_BUFFER, bufferSize, nullptr, GL_DYNAMIC_DRAW);
+    glFunc->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // 绑定到固定的绑定点，之后所有program的同名block都从这里读
+    glFunc->glBindBufferBase(GL_UNIFORM_BUFFER, binding, UBO);
+}
+
+void UniformBuffer::update(GLintptr offset, GLsizeiptr size, const void* data) {
+    if(offset + size > bufferSize) {
+        qDebug() << "ERROR::UNIFORM_BUFFER::UPDATE out of range:" << offset << "+" << size << ">" << bufferSize;
+        return;
+    }
+
+    ResourceManager::uploadBufferData(UBO, offset, size, data);
+}
+
+GLuint UniformBuffer::getBufferID() const {
+    return UBO;
+}
+
+GLuint UniformBuffer::getBindingPoint() const {
+    return binding;
+}
+
+GLsizeiptr UniformBuffer::getSize() const {
+    return bufferSize;
+}
@@ -0,0 +1,84 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include "utils/vertex_packing.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <QtGlobal>
+
+
+QVector<PackedVertex> VertexPacking::pack(const QVector<Vertex>& vertices, const BoundingBox& bounds) {
+    const QVector3D offset = positionOffset(bounds);
+    const QVector3D scale = positionScale(bounds);
+    QVector3D invScale;
+    for(int axis = 0; axis < 3; axis++)
+        invScale[axis] = scale[axis] > 0.0f ? 65535.0f / scale[axis] : 0.0f;
+
+    QVector<PackedVertex> packed(vertices.size());
+    for(int i = 0; i < vertices.size(); i++) {
+        const Vertex& v = vertices[i];
+        PackedVertex& p = packed[i];
+
+        for(int axis = 0; axis < 3; axis++) {
+            const float q = (v.position[axis] - offset[axis]) * invScale[axis];
+            p.position[axis] = (quint16)qBound(0.0f, std::round(q), 65535.0f);
+        }
+        p.position[3] = 0;
+
+        const QVector2D n = encodeOctahedral(v.normal);
+        p.normal[0] = (qint16)std::round(qBound(-1.0f, n.x(), 1.0f) * 32767.0f);
+        p.normal[1] = (qint16)std::round(qBound(-1.0f, n.y(), 1.0f) * 32767.0f);
+
+        p.texCoord[0] = floatToHalf(v.texCoord.x());
+        p.texCoord[1] = floatToHalf(v.texCoord.y());
+    }
+    return packed;
+}
+
+QVector3D VertexPacking::positionOffset(const BoundingBox& bounds) {
+    return bounds.valid ? bounds.min : QVector3D(0.0f, 0.0f, 0.0f);
+}
+
+QVector3D VertexPacking::positionScale(const BoundingBox& bounds) {
+    return bounds.valid ? bounds.max - bounds.min : QVector3D(0.0f, 0.0f, 0.0f);
+}
+
+// 先投影到 |x|+|y|+|z| = 1 的八面体上，下半部分沿对角线折到上面
+QVector2D VertexPacking::encodeOctahedral(const QVector3D& normal) {
+    const float l1 = std::fabs(normal.x()) + std::fabs(normal.y()) + std::fabs(normal.z());
+    if(l1 <= 0.0f)
+        return QVector2D(0.0f, 0.0f);
+
+    float x = normal.x() / l1;
+    float y = normal.y() / l1;
+    if(normal.z() < 0.0f) {
+        const float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    return QVector2D(x, y);
+}
+
+// round to nearest even，超出范围的变成inf
+quint16 VertexPacking::floatToHalf(float value) {
+    quint32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const quint32 sign = (bits >> 16) & 0x8000u;
+    const quint32 absBits = bits & 0x7FFFFFFFu;
+
+    if(absBits >= 0x7F800000u)                  // inf / nan
+        return (quint16)(sign | 0x7C00u | (absBits > 0x7F800000u ? 0x200u : 0u));
+    if(absBits >= 0x477FF000u)                  // >= 65520, 舍入后超过half的最大值
+        return (quint16)(sign | 0x7C00u);
+    if(absBits < 0x38800000u) {                 // < 2^-14, 结果是非规格化数
+        float magnitude;
+        std::memcpy(&magnitude, &absBits, sizeof(magnitude));
+        return (quint16)(sign | (quint32)std::nearbyint(magnitude * 16777216.0f));     // 单位是2^-24
+    }
+    // 指数的bias从127换成15，低13位按round to nearest even舍入
+    const quint32 rounded = absBits - 0x38000000u + 0xFFFu + ((absBits >> 13) & 1u);
+    return (quint16)(sign | (rounded >> 13));
+}
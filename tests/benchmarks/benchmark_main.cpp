@@ -0,0 +1,31 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <cstdio>
+
+#include "benchmark_registry.hpp"
+
+
+int main(int argc, char* argv[]) {
+    auto& benchmarks = benchmark::registry();
+    bool passed = true;
+    if(argc <= 1) {
+        for(auto& item : benchmarks) {
+            std::printf("===== %s =====\n", item.first.c_str());
+            passed = item.second() && passed;
+        }
+        return passed ? 0 : 1;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        auto it = benchmarks.find(argv[i]);
+        if(it == benchmarks.end()) {
+            std::printf("Unknown benchmark: %s\n", argv[i]);
+            return 1;
+        }
+        std::printf("===== %s =====\n", it->first.c_str());
+        passed = it->second() && passed;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef BENCHMARK_REGISTRY_HPP
+#define BENCHMARK_REGISTRY_HPP
+
+#include <functional>
+#include <map>
+#include <string>
+
+
+// 每个benchmark文件用 REGISTER_BENCHMARK 登记自己，mikann_benchmarks [name...] 只跑指定的几个
+// 返回false表示和参考实现的结果对不上 (只比较速度没有意义)
+namespace benchmark {
+
+inline std::map<std::string, std::function<bool()>>& registry() {
+    static std::map<std::string, std::function<bool()>> benchmarks;
+    return benchmarks;
+}
+
+struct Registrar {
+    Registrar(const char* name, std::function<bool()> func) {
+        registry()[name] = std::move(func);
+    }
+};
+
+}   // namespace benchmark
+
+#define REGISTER_BENCHMARK(name, func) \
+    static benchmark::Registrar benchmarkRegistrar_##func(name, func)
+
+#endif  //BENCHMARK_REGISTRY_HPP
@@ -0,0 +1,90 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "utils/dynamic_bvh.hpp"
+#include "benchmark_registry.hpp"
+#include "../test_common.hpp"
+
+
+namespace {
+
+// 物体密度固定，proxy越多场景越大
+std::vector<BoundingBox> makeBoxes(std::mt19937& rng, int count) {
+    float worldSize = 10.0f * std::cbrt((float)count);
+    std::uniform_real_distribution<float> pos(-worldSize, worldSize);
+    std::uniform_real_distribution<float> size(0.2f, 2.0f);
+
+    std::vector<BoundingBox> boxes;
+    boxes.reserve(count);
+    for(int i = 0; i < count; i++) {
+        QVector3D min(pos(rng), pos(rng), pos(rng));
+        boxes.emplace_back(min, min + QVector3D(size(rng), size(rng), size(rng)));
+    }
+    return boxes;
+}
+
+bool runBVHBenchmark(int count) {
+    std::mt19937 rng(42);
+    std::vector<BoundingBox> boxes = makeBoxes(rng, count);
+    std::vector<int> ids(count);
+
+    DynamicBVH bvh;
+    double insertMs = test::measureMs(3, [&]() {
+        bvh.clear();
+        for(int i = 0; i < count; i++)
+            ids[i] = bvh.createProxy(boxes[i], nullptr);
+    });
+
+    // 大部分物体每帧只移动一点，只有少数需要重新插入
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    int reinserted = 0;
+    double moveMs = test::measureMs(3, [&]() {
+        for(int i = 0; i < count; i++) {
+            QVector3D delta(jitter(rng), jitter(rng), jitter(rng));
+            boxes[i] = BoundingBox(boxes[i].min + delta, boxes[i].max + delta);
+            if(bvh.moveProxy(ids[i], boxes[i]))
+                reinserted++;
+        }
+    });
+
+    QMatrix4x4 viewProjection;
+    viewProjection.perspective(60.0f, 16.0f / 9.0f, 0.1f, 200.0f);
+    viewProjection.lookAt(QVector3D(0.0f, 0.0f, 0.0f), QVector3D(1.0f, 0.2f, 0.5f), QVector3D(0.0f, 1.0f, 0.0f));
+    Frustum frustum(viewProjection);
+
+    int bvhVisible = 0;
+    double queryMs = test::measureMs(10, [&]() {
+        bvhVisible = 0;
+        bvh.queryFrustum(frustum, [&](int) { bvhVisible++; return true; });
+    });
+
+    int bruteVisible = 0;
+    double bruteMs = test::measureMs(10, [&]() {
+        bruteVisible = 0;
+        for(const BoundingBox& box : boxes)
+            bruteVisible += frustum.intersects(box) ? 1 : 0;
+    });
+
+    std::printf("%6d proxies  height %2d | insert %8.3f ms | move %8.3f ms (%d reinserted) | "
+                "frustum bvh %7.3f ms (%d) | brute force %7.3f ms (%d)\n",
+                count, bvh.getHeight(), insertMs, moveMs, reinserted / 3,
+                queryMs, bvhVisible, bruteMs, bruteVisible);
+    // fat AABB比实际bounds大，BVH的结果只会多不会少
+    return bvhVisible >= bruteVisible;
+}
+
+bool dynamicBVHBenchmark() {
+    bool passed = true;
+    for(int count : {10000, 25000, 50000})
+        passed = runBVHBenchmark(count) && passed;
+    return passed;
+}
+
+}   // namespace
+
+REGISTER_BENCHMARK("bvh", dynamicBVHBenchmark);
@@ -0,0 +1,155 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSet>
+
+#include "utils/assimp_loader.hpp"
+#include "utils/obj_loader.hpp"
+#include "benchmark_registry.hpp"
+#include "../test_common.hpp"
+
+
+namespace {
+
+// 两个导入器的mesh划分不一样 (Assimp按o/g分，ObjLoader按材质分)，顶点去重也不一样，
+// 所以把所有三角形展开成 (position, normal, uv) 后排序再逐个比较
+struct Corner {
+    std::array<float, 8> v;     // position, normal, uv
+
+    bool operator<(const Corner& other) const { return v < other.v; }
+    bool operator==(const Corner& other) const { return v == other.v; }
+};
+
+struct Triangle {
+    std::array<Corner, 3> corners;
+
+    bool operator<(const Triangle& other) const { return corners < other.corners; }
+};
+
+Corner makeCorner(const Vertex& vertex) {
+    // 只用位置和uv排序，法线是生成的，允许有误差
+    const float quantum = 1e-4f;
+    auto q = [quantum](float x) { return std::round(x / quantum) * quantum; };
+    return Corner{{q(vertex.position.x()), q(vertex.position.y()), q(vertex.position.z()),
+                   0.0f, 0.0f, 0.0f,
+                   q(vertex.texCoord.x()), q(vertex.texCoord.y())}};
+}
+
+struct FlatModel {
+    std::vector<Triangle> triangles;
+    std::vector<std::array<QVector3D, 3>> normals;     // 和triangles一一对应
+    QSet<QString> textures;
+    int vertexCount = 0;
+};
+
+FlatModel flatten(const ModelData& data) {
+    struct Entry {
+        Triangle triangle;
+        std::array<QVector3D, 3> normals;
+    };
+    std::vector<Entry> entries;
+
+    FlatModel model;
+    for(const ModelMeshData& mesh : data.meshes) {
+        model.vertexCount += mesh.vertices.size();
+        for(const ModelTextureRef& texture : mesh.textures)
+            model.textures.insert(QFileInfo(texture.path).canonicalFilePath());
+        for(int i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            Entry entry;
+            for(int c = 0; c < 3; c++) {
+                const Vertex& vertex = mesh.vertices[(int)mesh.indices[i + c]];
+                entry.triangle.corners[c] = makeCorner(vertex);
+                entry.normals[c] = vertex.normal;
+            }
+            // 旋转到最小的顶点在前，保持绕序
+            int first = (int)(std::min_element(entry.triangle.corners.begin(), entry.triangle.corners.end()) -
+                              entry.triangle.corners.begin());
+            std::rotate(entry.triangle.corners.begin(), entry.triangle.corners.begin() + first, entry.triangle.corners.end());
+            std::rotate(entry.normals.begin(), entry.normals.begin() + first, entry.normals.end());
+            entries.push_back(entry);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.triangle < b.triangle; });
+    for(const Entry& entry : entries) {
+        model.triangles.push_back(entry.triangle);
+        model.normals.push_back(entry.normals);
+    }
+    return model;
+}
+
+// 三角形 (位置+uv) 和贴图必须完全一致，法线夹角不超过约2.5度
+bool compareModels(const ModelData& objData, const ModelData& assimpData) {
+    FlatModel obj = flatten(objData);
+    FlatModel assimp = flatten(assimpData);
+
+    if(obj.triangles.size() != assimp.triangles.size()) {
+        std::printf("    triangle count differs: ObjLoader %d, Assimp %d\n",
+                    (int)obj.triangles.size(), (int)assimp.triangles.size());
+        return false;
+    }
+    if(obj.textures != assimp.textures) {
+        std::printf("    texture sets differ: ObjLoader %d, Assimp %d\n", obj.textures.size(), assimp.textures.size());
+        return false;
+    }
+
+    int triangleMismatch = 0;
+    int normalMismatch = 0;
+    for(size_t i = 0; i < obj.triangles.size(); i++) {
+        if(obj.triangles[i].corners != assimp.triangles[i].corners) {
+            triangleMismatch++;
+            continue;
+        }
+        for(int c = 0; c < 3; c++) {
+            if(QVector3D::dotProduct(obj.normals[i][c], assimp.normals[i][c]) < 0.999f)
+                normalMismatch++;
+        }
+    }
+    if(triangleMismatch != 0 || normalMismatch != 0) {
+        std::printf("    %d of %d triangles differ, %d normals differ\n",
+                    triangleMismatch, (int)obj.triangles.size(), normalMismatch);
+        return false;
+    }
+    std::printf("    parity ok: %d triangles, vertices ObjLoader %d / Assimp %d\n",
+                (int)obj.triangles.size(), obj.vertexCount, assimp.vertexCount);
+    return true;
+}
+
+bool modelLoaderBenchmark() {
+    const QString root = QStringLiteral(MIKANN_SOURCE_DIR) + "/assets/models";
+    QStringList files;
+    QDirIterator it(root, {"*.obj"}, QDir::Files, QDirIterator::Subdirectories);
+    while(it.hasNext())
+        files << it.next();
+    files.sort();
+
+    bool passed = !files.isEmpty();
+    for(const QString& file : files) {
+        std::shared_ptr<ModelData> objData;
+        std::shared_ptr<ModelData> assimpData;
+        double objMs = test::measureMs(3, [&]() { objData = ObjLoader::load(file); });
+        double assimpMs = test::measureMs(3, [&]() { assimpData = AssimpLoader::load(file); });
+
+        std::printf("%-16s | ObjLoader %9.2f ms | Assimp %9.2f ms | x%5.2f\n",
+                    qPrintable(QFileInfo(file).fileName()), objMs, assimpMs, assimpMs / std::max(objMs, 1e-6));
+        if(!objData) {
+            std::printf("    ObjLoader failed\n");
+            passed = false;
+            continue;
+        }
+        passed = compareModels(*objData, *assimpData) && passed;
+    }
+    return passed;
+}
+
+}   // namespace
+
+REGISTER_BENCHMARK("models", modelLoaderBenchmark);
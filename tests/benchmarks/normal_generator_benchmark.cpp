@@ -0,0 +1,86 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <QDirIterator>
+#include <QFileInfo>
+
+#include "utils/normal_generator.hpp"
+#include "utils/obj_loader.hpp"
+#include "utils/parallel_for.hpp"
+#include "benchmark_registry.hpp"
+#include "../test_common.hpp"
+
+
+namespace {
+
+struct NamedMesh {
+    QString name;
+    ModelMeshData mesh;
+};
+
+// assets/models里三角形最多的几个mesh
+std::vector<NamedMesh> collectLargestMeshes(int count) {
+    std::vector<NamedMesh> meshes;
+    QDirIterator it(QStringLiteral(MIKANN_SOURCE_DIR) + "/assets/models", {"*.obj"}, QDir::Files,
+                    QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        const QString file = it.next();
+        std::shared_ptr<ModelData> data = ObjLoader::load(file);
+        if(!data)
+            continue;
+        for(int i = 0; i < data->meshes.size(); i++)
+            meshes.push_back({QFileInfo(file).baseName() + "#" + QString::number(i), data->meshes[i]});
+    }
+    std::sort(meshes.begin(), meshes.end(), [](const NamedMesh& a, const NamedMesh& b) {
+        return a.mesh.indices.size() > b.mesh.indices.size();
+    });
+    if((int)meshes.size() > count)
+        meshes.resize(count);
+    return meshes;
+}
+
+bool normalGeneratorBenchmark() {
+    std::vector<NamedMesh> meshes = collectLargestMeshes(3);
+    std::printf("%d worker threads\n", ParallelFor::threadCount());
+
+    for(const NamedMesh& named : meshes) {
+        const ModelMeshData& mesh = named.mesh;
+        std::printf("%-16s %8d triangles %8d vertices\n",
+                    qPrintable(named.name), mesh.indices.size() / 3, mesh.vertices.size());
+
+        struct Config {
+            const char* name;
+            float creaseAngle;
+            NormalWeighting weighting;
+        };
+        const Config configs[] = {
+            {"area,   smooth", 180.0f, NormalWeighting::Area},
+            {"angle,  smooth", 180.0f, NormalWeighting::Angle},
+            {"angle,  crease", MODEL_NORMAL_CREASE_ANGLE, NormalWeighting::Angle},
+        };
+        for(const Config& config : configs) {
+            int vertexCount = 0;
+            double ms = test::measureMs(3, [&]() {
+                QVector<Vertex> vertices = mesh.vertices;
+                QVector<unsigned int> indices = mesh.indices;
+                NormalGenerator::generate(vertices, indices, config.creaseAngle, config.weighting);
+                vertexCount = vertices.size();
+            });
+            std::printf("    %s %9.2f ms (%d vertices after split)\n", config.name, ms, vertexCount);
+        }
+
+        double tangentMs = test::measureMs(3, [&]() {
+            NormalGenerator::generateTangents(mesh.vertices, mesh.indices);
+        });
+        std::printf("    tangents       %9.2f ms\n", tangentMs);
+    }
+    return !meshes.empty();
+}
+
+}   // namespace
+
+REGISTER_BENCHMARK("normals", normalGeneratorBenchmark);
@@ -0,0 +1,103 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <QColor>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImage>
+
+#include "utils/texture2d.hpp"
+#include "benchmark_registry.hpp"
+#include "../test_common.hpp"
+
+
+namespace {
+
+// 原来的Texture2D::checkTransparency，逐像素pixelColor
+bool pixelColorTransparent(const QImage& image) {
+    if(!image.hasAlphaChannel())
+        return false;
+    for(int y = 0; y < image.height(); y++) {
+        for(int x = 0; x < image.width(); x++) {
+            if(image.pixelColor(x, y).alpha() < 255)
+                return true;
+        }
+    }
+    return false;
+}
+
+// 同样用pixelColor求出完整的分类，作为classifyAlpha的参考结果
+AlphaMode pixelColorClassify(const QImage& image) {
+    if(!image.hasAlphaChannel())
+        return AlphaMode::Opaque;
+    bool hasZero = false;
+    for(int y = 0; y < image.height(); y++) {
+        for(int x = 0; x < image.width(); x++) {
+            int alpha = image.pixelColor(x, y).alpha();
+            if(alpha == 0)
+                hasZero = true;
+            else if(alpha < 255)
+                return AlphaMode::Blended;
+        }
+    }
+    return hasZero ? AlphaMode::Masked : AlphaMode::Opaque;
+}
+
+const char* alphaModeName(AlphaMode mode) {
+    switch(mode) {
+        case AlphaMode::Opaque: return "Opaque";
+        case AlphaMode::Masked: return "Masked";
+        default: return "Blended";
+    }
+}
+
+QStringList collectImages() {
+    const QString root = QStringLiteral(MIKANN_SOURCE_DIR) + "/assets/";
+    QStringList files;
+    QDirIterator atlases(root + "models", {"*-atlas.*"}, QDir::Files, QDirIterator::Subdirectories);
+    while(atlases.hasNext())
+        files << atlases.next();
+    QDirIterator textures(root + "textures", {"*.png"}, QDir::Files);
+    while(textures.hasNext())
+        files << textures.next();
+    files.sort();
+    return files;
+}
+
+bool textureAlphaBenchmark() {
+    bool passed = true;
+    for(const QString& file : collectImages()) {
+        QImage loaded(file);
+        if(loaded.isNull()) {
+            std::printf("Failed to load %s\n", qPrintable(file));
+            passed = false;
+            continue;
+        }
+
+        // jpg没有alpha通道会直接返回，转成ARGB32之后两边都要扫描完整张图 (全不透明是最坏情况)
+        const QImage variants[] = {loaded, loaded.convertToFormat(QImage::Format_ARGB32)};
+        for(const QImage& image : variants) {
+            AlphaMode mode = AlphaMode::Opaque;
+            bool transparent = false;
+            double classifyMs = test::measureMs(5, [&]() { mode = Texture2D::classifyAlpha(image); });
+            double pixelColorMs = test::measureMs(2, [&]() { transparent = pixelColorTransparent(image); });
+
+            AlphaMode expected = pixelColorClassify(image);
+            bool match = mode == expected && transparent == (mode != AlphaMode::Opaque);
+            passed = passed && match;
+
+            std::printf("%-32s %4dx%-4d fmt %2d | classifyAlpha %8.3f ms | pixelColor %9.3f ms | x%6.1f | %s%s\n",
+                        qPrintable(QFileInfo(file).fileName()), image.width(), image.height(), (int)image.format(),
+                        classifyMs, pixelColorMs, pixelColorMs / std::max(classifyMs, 1e-6),
+                        alphaModeName(mode), match ? "" : " MISMATCH");
+        }
+    }
+    return passed;
+}
+
+}   // namespace
+
+REGISTER_BENCHMARK("alpha", textureAlphaBenchmark);
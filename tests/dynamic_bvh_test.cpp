@@ -0,0 +1,203 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "utils/dynamic_bvh.hpp"
+#include "test_common.hpp"
+
+
+// 每个proxy的实际bounds，BVH里存的是放大过的fat AABB
+struct Proxy {
+    int id;
+    BoundingBox box;
+};
+
+static BoundingBox randomBox(std::mt19937& rng, float worldSize) {
+    std::uniform_real_distribution<float> pos(-worldSize, worldSize);
+    std::uniform_real_distribution<float> size(0.1f, 3.0f);
+    QVector3D min(pos(rng), pos(rng), pos(rng));
+    return BoundingBox(min, min + QVector3D(size(rng), size(rng), size(rng)));
+}
+
+static float distanceToBox(const QVector3D& p, const BoundingBox& box) {
+    float sq = 0.0f;
+    for(int i = 0; i < 3; i++) {
+        float d = std::max(std::max(box.min[i] - p[i], 0.0f), p[i] - box.max[i]);
+        sq += d * d;
+    }
+    return std::sqrt(sq);
+}
+
+// BVH的查询结果必须和暴力遍历所有fat AABB的结果完全一致
+static void checkQueries(const DynamicBVH& bvh, const std::vector<Proxy>& proxies, std::mt19937& rng) {
+    CHECK(bvh.getProxyCount() == (int)proxies.size());
+    for(const Proxy& p : proxies)
+        CHECK(bvh.getFatBounds(p.id).contains(p.box));
+
+    for(int q = 0; q < 20; q++) {
+        BoundingBox query = randomBox(rng, 50.0f);
+        query.max += QVector3D(10.0f, 10.0f, 10.0f);
+
+        std::set<int> expected;
+        for(const Proxy& p : proxies) {
+            if(bvh.getFatBounds(p.id).intersects(query))
+                expected.insert(p.id);
+        }
+        std::set<int> found;
+        bvh.queryBox(query, [&](int id) { found.insert(id); return true; });
+        CHECK(found == expected);
+    }
+
+    for(int q = 0; q < 10; q++) {
+        std::uniform_real_distribution<float> pos(-60.0f, 60.0f);
+        QMatrix4x4 viewProjection;
+        viewProjection.perspective(60.0f, 1.5f, 0.1f, 80.0f);
+        viewProjection.lookAt(QVector3D(pos(rng), pos(rng), pos(rng)), QVector3D(pos(rng), pos(rng), pos(rng)),
+                              QVector3D(0.0f, 1.0f, 0.0f));
+        Frustum frustum(viewProjection);
+
+        std::set<int> expected;
+        for(const Proxy& p : proxies) {
+            if(frustum.intersects(bvh.getFatBounds(p.id)))
+                expected.insert(p.id);
+        }
+        std::set<int> found;
+        bvh.queryFrustum(frustum, [&](int id) { found.insert(id); return true; });
+        CHECK(found == expected);
+    }
+
+    for(int q = 0; q < 20; q++) {
+        std::uniform_real_distribution<float> pos(-60.0f, 60.0f);
+        QVector3D origin(pos(rng), pos(rng), pos(rng));
+        QVector3D direction = (QVector3D(pos(rng), pos(rng), pos(rng)) - origin).normalized();
+        const float maxDistance = 200.0f;
+
+        float expected = maxDistance;
+        for(const Proxy& p : proxies) {
+            float t = 0.0f;
+            if(p.box.intersectRay(origin, direction, expected, t))
+                expected = std::min(expected, t);
+        }
+
+        // callback用实际bounds求交，和拾取物体时用mesh求交一样
+        float found = maxDistance;
+        bvh.rayCast(origin, direction, maxDistance, [&](int id, float maxT) {
+            const Proxy& p = *std::find_if(proxies.begin(), proxies.end(), [id](const Proxy& x) { return x.id == id; });
+            float t = 0.0f;
+            if(p.box.intersectRay(origin, direction, maxT, t) && t < maxT) {
+                found = std::min(found, t);
+                return t;
+            }
+            return maxT;
+        });
+        CHECK_NEAR(found, expected, 1e-4f);
+    }
+
+    for(int q = 0; q < 20; q++) {
+        std::uniform_real_distribution<float> pos(-60.0f, 60.0f);
+        QVector3D point(pos(rng), pos(rng), pos(rng));
+        const float maxDistance = std::numeric_limits<float>::max();
+
+        float expected = maxDistance;
+        for(const Proxy& p : proxies)
+            expected = std::min(expected, distanceToBox(point, p.box));
+
+        int nearest = bvh.queryNearest(point, maxDistance, [&](int id) {
+            const Proxy& p = *std::find_if(proxies.begin(), proxies.end(), [id](const Proxy& x) { return x.id == id; });
+            return distanceToBox(point, p.box);
+        });
+        if(proxies.empty()) {
+            CHECK(nearest == DynamicBVH::NullNode);
+            continue;
+        }
+        CHECK(nearest != DynamicBVH::NullNode);
+        if(nearest != DynamicBVH::NullNode) {
+            const Proxy& p = *std::find_if(proxies.begin(), proxies.end(), [&](const Proxy& x) { return x.id == nearest; });
+            CHECK_NEAR(distanceToBox(point, p.box), expected, 1e-4f);
+        }
+    }
+}
+
+static void testInsertMoveRemove() {
+    std::mt19937 rng(1234);
+    DynamicBVH bvh;
+    std::vector<Proxy> proxies;
+
+    for(int i = 0; i < 2000; i++) {
+        BoundingBox box = randomBox(rng, 50.0f);
+        int id = bvh.createProxy(box, nullptr);
+        CHECK(id != DynamicBVH::NullNode);
+        proxies.push_back({id, box});
+    }
+    checkQueries(bvh, proxies, rng);
+    // 平衡之后的高度应该是log级别
+    CHECK(bvh.getHeight() < 40);
+
+    // 还在fat AABB里的移动不改变结构，超出时才重新插入
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    std::uniform_real_distribution<float> jump(-20.0f, 20.0f);
+    for(int round = 0; round < 5; round++) {
+        for(auto& p : proxies) {
+            bool far = (rng() % 4) == 0;
+            QVector3D delta = far ? QVector3D(jump(rng), jump(rng), jump(rng))
+                                  : QVector3D(jitter(rng), jitter(rng), jitter(rng));
+            p.box = BoundingBox(p.box.min + delta, p.box.max + delta);
+            bool expected = !bvh.getFatBounds(p.id).contains(p.box);
+            CHECK(bvh.moveProxy(p.id, p.box) == expected);
+        }
+        checkQueries(bvh, proxies, rng);
+    }
+
+    // 删除一半之后再插入，free list里的节点会被复用
+    std::shuffle(proxies.begin(), proxies.end(), rng);
+    for(size_t i = 0; i < proxies.size() / 2; i++)
+        bvh.destroyProxy(proxies[i].id);
+    proxies.erase(proxies.begin(), proxies.begin() + (long)(proxies.size() / 2));
+    checkQueries(bvh, proxies, rng);
+
+    for(int i = 0; i < 500; i++) {
+        BoundingBox box = randomBox(rng, 50.0f);
+        proxies.push_back({bvh.createProxy(box, nullptr), box});
+    }
+    checkQueries(bvh, proxies, rng);
+
+    for(const Proxy& p : proxies)
+        bvh.destroyProxy(p.id);
+    proxies.clear();
+    CHECK(bvh.getProxyCount() == 0);
+    CHECK(bvh.getHeight() == 0);
+    checkQueries(bvh, proxies, rng);
+}
+
+static void testUserData() {
+    DynamicBVH bvh;
+    int values[3] = {1, 2, 3};
+    int ids[3];
+    for(int i = 0; i < 3; i++) {
+        QVector3D min((float)i * 10.0f, 0.0f, 0.0f);
+        ids[i] = bvh.createProxy(BoundingBox(min, min + QVector3D(1.0f, 1.0f, 1.0f)), &values[i]);
+    }
+    for(int i = 0; i < 3; i++)
+        CHECK(bvh.getUserData(ids[i]) == &values[i]);
+
+    // callback返回false时停止
+    int visited = 0;
+    bvh.queryBox(BoundingBox(QVector3D(-100.0f, -100.0f, -100.0f), QVector3D(100.0f, 100.0f, 100.0f)),
+                 [&](int) { visited++; return false; });
+    CHECK(visited == 1);
+
+    bvh.clear();
+    CHECK(bvh.getProxyCount() == 0);
+}
+
+int main() {
+    testInsertMoveRemove();
+    testUserData();
+    return test::finishTests("dynamic_bvh_test");
+}
@@ -0,0 +1,315 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+#include "object/mesh.hpp"
+#include "render/frustum.hpp"
+#include "render/gpu_culling.hpp"
+#include "test_common.hpp"
+
+
+// 需要4.3 core context: ctest里用llvmpipe在没有GPU的机器上运行 (见CMakeLists.txt)
+// 拿不到context时返回 SKIP_RETURN_CODE
+const static int SKIP_RETURN_CODE = 77;
+
+#ifdef GL_CORE_4_3
+
+namespace {
+
+const GLfloat VIEWPORT_HEIGHT = 768.0f;
+
+struct TestInstance {
+    QVector3D center;
+    bool valid;
+    int batch;
+    bool hidden;
+};
+
+// 和Mesh::selectLod一致，state是上一次选中的LOD
+int referenceLod(const BoundingBox& bounds, const QVector3D& viewPos, GLfloat lodScale, int lodCount, int& state) {
+    if(lodCount <= 1) {
+        state = 0;
+        return 0;
+    }
+    GLfloat screenSize = 0.0f;
+    if(bounds.valid) {
+        const BoundingSphere sphere = bounds.toSphere();
+        const GLfloat distance = viewPos.distanceToPoint(sphere.center);
+        screenSize = distance <= sphere.radius ? 3.4e38f : 2.0f * sphere.radius * lodScale / distance;
+    }
+    const float level = std::log2(LOD_FULL_DETAIL_SIZE / std::max(screenSize, 1.0f));
+    if(level < (float)state - LOD_HYSTERESIS || level >= (float)state + 1.0f + LOD_HYSTERESIS)
+        state = (int)std::floor(level);
+    state = std::clamp(state, 0, lodCount - 1);
+    return state;
+}
+
+class Scene {
+   public:
+    explicit Scene(GLFunctions_Core* f) : glFunc(f) {
+        // batch 0: 3个LOD，不同距离 / 相机后面 / 视锥外
+        add({ 0.0f, 0.0f, -2.0f }, true, 0);
+        add({ 0.0f, 0.0f, -9.0f }, true, 0);
+        add({ 0.0f, 0.0f, -30.0f }, true, 0);
+        add({ 0.0f, 0.0f, 20.0f }, true, 0);
+        add({ 100.0f, 0.0f, -10.0f }, true, 0);
+        // batch 1: 只有LOD0，bounds无效的instance总是可见，远平面之外
+        add({ 1.0f, 0.0f, -5.0f }, true, 1);
+        add({ 0.0f, 0.0f, 0.0f }, false, 1);
+        add({ 0.0f, 0.0f, -2000.0f }, true, 1);
+
+        const int lodCounts[2] = { 3, 1 };
+        GLuint reserved = 0;
+        for(int b = 0; b < 2; b++) {
+            const auto batchSize = (GLuint)std::count_if(instances.begin(), instances.end(),
+                                                         [b](const TestInstance& t) { return t.batch == b; });
+            batchCommand[b] = (GLuint)commands.size();
+            for(int l = 0; l < lodCounts[b]; l++) {
+                DrawElementsIndirectCommand command{};
+                command.count = 36;
+                command.firstIndex = (GLuint)commands.size() * 36;
+                command.baseInstance = reserved;
+                reserved += batchSize;
+                commands.push_back(command);
+            }
+        }
+        visibleCount = reserved;
+
+        for(size_t i = 0; i < instances.size(); i++) {
+            const TestInstance& t = instances[i];
+            InstanceData data{};
+            data.materialIndex = (GLint)i;     // 用来在输出里认出instance
+            sceneInstances.push_back(data);
+
+            CullInstance cull{};
+            cull.command = batchCommand[t.batch];
+            cull.lodCount = (GLuint)lodCounts[t.batch];
+            cull.lodBias = 0.0f;
+            sceneCull.push_back(cull);
+            refreshCull(i);
+        }
+        lodStates.assign(instances.size(), 0);
+    }
+
+    // instances[i]修改之后重新生成bounds和flags
+    void refreshCull(size_t i) {
+        const BoundingBox box = bounds(i);
+        CullInstance& cull = sceneCull[i];
+        for(int a = 0; a < 3; a++) {
+            cull.boundsMin[a] = box.min[a];
+            cull.boundsMax[a] = box.max[a];
+        }
+        cull.flags = 0;
+        if(instances[i].valid)
+            cull.flags |= CullBoundsValid;
+        if(instances[i].hidden)
+            cull.flags |= CullHidden;
+    }
+
+    void resetLodState(size_t i) {
+        lodStates[i] = 0;
+    }
+
+    [[nodiscard]] BoundingBox bounds(size_t i) const {
+        if(!instances[i].valid)
+            return {};
+        const QVector3D half(0.5f, 0.5f, 0.5f);
+        return { instances[i].center - half, instances[i].center + half };
+    }
+
+    // 每条命令应该包含的instance (按materialIndex排序)
+    std::vector<std::vector<GLint>> expected(const QMatrix4x4& viewProjection, const QVector3D& viewPos,
+                                             GLfloat lodScale, bool occludeAll) {
+        const Frustum frustum(viewProjection);
+        std::vector<std::vector<GLint>> result(commands.size());
+        for(size_t i = 0; i < instances.size(); i++) {
+            const BoundingBox box = bounds(i);
+            if(instances[i].hidden || (box.valid && !frustum.intersects(box)))
+                continue;
+            const int lod = referenceLod(box, viewPos, lodScale, (int)sceneCull[i].lodCount, lodStates[i]);
+            if(box.valid && occludeAll)
+                continue;
+            result[sceneCull[i].command + lod].push_back((GLint)i);
+        }
+        return result;
+    }
+
+    // 读回GPU的输出
+    std::vector<std::vector<GLint>> readBack(const GpuCulling& culling) const {
+        std::vector<DrawElementsIndirectCommand> culled(commands.size());
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, culling.getCommandBuffer());
+        glFunc->glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)(culled.size() * sizeof(DrawElementsIndirectCommand)),
+                                   culled.data());
+        std::vector<InstanceData> visible(visibleCount);
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, culling.getInstanceBuffer());
+        glFunc->glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)(visible.size() * sizeof(InstanceData)),
+                                   visible.data());
+        glFunc->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        std::vector<std::vector<GLint>> result(commands.size());
+        for(size_t c = 0; c < culled.size(); c++) {
+            // 命令里除了instanceCount以外都要保持模板的值
+            CHECK(culled[c].count == commands[c].count);
+            CHECK(culled[c].firstIndex == commands[c].firstIndex);
+            CHECK(culled[c].baseInstance == commands[c].baseInstance);
+            for(GLuint k = 0; k < culled[c].instanceCount; k++)
+                result[c].push_back(visible[culled[c].baseInstance + k].materialIndex);
+            std::sort(result[c].begin(), result[c].end());
+        }
+        return result;
+    }
+
+    void finish() const {
+        glFunc->glFinish();
+    }
+
+   private:
+    void add(const QVector3D& center, bool valid, int batch) {
+        instances.push_back({ center, valid, batch, false });
+    }
+
+   public:
+    std::vector<TestInstance> instances;
+    std::vector<InstanceData> sceneInstances;
+    std::vector<CullInstance> sceneCull;
+    std::vector<DrawElementsIndirectCommand> commands;
+    GLuint visibleCount = 0;
+    GLuint batchCommand[2] = { 0, 0 };
+
+   private:
+    GLFunctions_Core* glFunc;
+    std::vector<int> lodStates;     // CPU参考的LOD状态
+};
+
+void checkFrame(Scene& scene, GpuCulling& culling, const QVector3D& viewPos, const QVector3D& target,
+                bool occludeAll, const char* name) {
+    QMatrix4x4 projection;
+    projection.perspective(60.0f, 1.0f, 0.1f, 1000.0f);
+    QMatrix4x4 view;
+    view.lookAt(viewPos, target, QVector3D(0.0f, 1.0f, 0.0f));
+    const QMatrix4x4 viewProjection = projection * view;
+    const GLfloat lodScale = projection(1, 1) * VIEWPORT_HEIGHT * 0.5f;
+
+    culling.cull(Frustum(viewProjection), viewPos, lodScale);
+    const auto gpu = scene.readBack(culling);
+    const auto cpu = scene.expected(viewProjection, viewPos, lodScale, occludeAll);
+    GLuint64 triangles = 0;
+    for(size_t c = 0; c < cpu.size(); c++) {
+        if(gpu[c] != cpu[c]) {
+            std::printf("[%s] command %zu: gpu %zu instance(s), expected %zu\n", name, c, gpu[c].size(), cpu[c].size());
+            test::failureCount()++;
+        }
+        triangles += (GLuint64)cpu[c].size() * (scene.commands[c].count / 3);
+    }
+
+    // 等这一帧的读回完成，正常绘制时不会等待
+    scene.finish();
+    culling.collectReadbacks();
+    if(culling.getVisibleTriangleCount() != triangles) {
+        std::printf("[%s] visible triangles: gpu %llu, expected %llu\n", name,
+                    (unsigned long long)culling.getVisibleTriangleCount(), (unsigned long long)triangles);
+        test::failureCount()++;
+    }
+}
+
+void testCulling(GLFunctions_Core* glFunc) {
+    Scene scene(glFunc);
+    GpuCulling culling;
+    culling.uploadScene(scene.sceneInstances, scene.sceneCull, scene.commands, scene.visibleCount, {});
+    CHECK(culling.hasScene());
+
+    const QVector3D origin(0.0f, 0.0f, 0.0f);
+    const QVector3D forward(0.0f, 0.0f, -1.0f);
+    checkFrame(scene, culling, origin, forward, false, "frustum");
+    // 同一个视角再来一次: 命令每帧重置，LOD状态保持
+    checkFrame(scene, culling, origin, forward, false, "repeat");
+    // 往前走: 9米处的instance进入LOD0和LOD1之间的hysteresis区间，应该保持LOD1
+    const QVector3D closer(0.0f, 0.0f, -3.4f);
+    const QVector3D closerTarget(0.0f, 0.0f, -4.4f);
+    checkFrame(scene, culling, closer, closerTarget, false, "hysteresis");
+
+    // 重新上传场景: 保留LOD状态的instance继续停在LOD1，标记为新加入的instance 1重新从LOD0开始
+    std::vector<GLuint> previousSlots(scene.instances.size());
+    for(size_t i = 0; i < previousSlots.size(); i++)
+        previousSlots[i] = (GLuint)i;
+    previousSlots[1] = CullNewInstance;
+    scene.resetLodState(1);
+    culling.uploadScene(scene.sceneInstances, scene.sceneCull, scene.commands, scene.visibleCount, previousSlots);
+    checkFrame(scene, culling, closer, closerTarget, false, "reupload");
+
+    // 只更新部分instance: 把视锥外的instance 4移进来，隐藏instance 5
+    scene.instances[4].center = QVector3D(0.5f, 0.0f, -12.0f);
+    scene.refreshCull(4);
+    scene.instances[5].hidden = true;
+    scene.refreshCull(5);
+    culling.updateInstances(4, 2, &scene.sceneInstances[4], &scene.sceneCull[4]);
+    checkFrame(scene, culling, closer, closerTarget, false, "update");
+
+    // 整个pyramid的深度都是0 (最近)，bounds有效的instance全部被遮挡
+    GLuint pyramid = 0;
+    const std::vector<GLfloat> zeros(4 * 4, 0.0f);
+    glFunc->glGenTextures(1, &pyramid);
+    glFunc->glBindTexture(GL_TEXTURE_2D, pyramid);
+    glFunc->glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 4, 4, 0, GL_RED, GL_FLOAT, zeros.data());
+    glFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glFunc->glBindTexture(GL_TEXTURE_2D, 0);
+
+    QMatrix4x4 projection;
+    projection.perspective(60.0f, 1.0f, 0.1f, 1000.0f);
+    QMatrix4x4 view;
+    view.lookAt(origin, forward, QVector3D(0.0f, 1.0f, 0.0f));
+    culling.setDepthPyramid(pyramid, 4, 4, 1, projection * view);
+    checkFrame(scene, culling, origin, forward, true, "occlusion");
+
+    culling.setDepthPyramid(0, 0, 0, 0, QMatrix4x4());
+    glFunc->glDeleteTextures(1, &pyramid);
+}
+
+}   // namespace
+
+#endif  // GL_CORE_4_3
+
+int main(int argc, char* argv[]) {
+#ifdef GL_CORE_4_3
+    QGuiApplication app(argc, argv);
+
+    QSurfaceFormat format;
+    format.setVersion(4, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+    if(!context.create() || !context.makeCurrent(&surface)) {
+        std::printf("[gpu_culling_test] skipped: unable to create an OpenGL context\n");
+        return SKIP_RETURN_CODE;
+    }
+
+    const QSurfaceFormat actual = context.format();
+    auto glFunc = context.versionFunctions<GLFunctions_Core>();
+    if(actual.majorVersion() < 4 || (actual.majorVersion() == 4 && actual.minorVersion() < 3) || !glFunc) {
+        std::printf("[gpu_culling_test] skipped: OpenGL %d.%d, require 4.3\n", actual.majorVersion(), actual.minorVersion());
+        return SKIP_RETURN_CODE;
+    }
+
+    testCulling(glFunc);
+
+    context.doneCurrent();
+    return test::finishTests("gpu_culling_test");
+#else
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+    std::printf("[gpu_culling_test] skipped: built without GL 4.3\n");
+    return SKIP_RETURN_CODE;
+#endif
+}
@@ -0,0 +1,201 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "utils/normal_generator.hpp"
+#include "test_common.hpp"
+
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+// uv球，经线接缝和两极的顶点都是位置相同、uv不同的副本
+void makeSphere(int segments, int rings, QVector<Vertex>& vertices, QVector<unsigned int>& indices) {
+    vertices.clear();
+    indices.clear();
+    for(int r = 0; r <= rings; r++) {
+        const float phi = PI * (float)r / (float)rings;
+        for(int s = 0; s <= segments; s++) {
+            const float theta = 2.0f * PI * (float)(s % segments) / (float)segments;
+            QVector3D position(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+            if(r == 0 || r == rings)
+                position = QVector3D(0.0f, r == 0 ? 1.0f : -1.0f, 0.0f);
+            vertices.push_back(Vertex(position, QVector3D(), QVector2D((float)s / (float)segments, (float)r / (float)rings)));
+        }
+    }
+    for(int r = 0; r < rings; r++) {
+        for(int s = 0; s < segments; s++) {
+            const unsigned int a = r * (segments + 1) + s;
+            const unsigned int b = a + segments + 1;
+            indices << a << a + 1 << b;
+            indices << a + 1 << b + 1 << b;
+        }
+    }
+}
+
+// 8个共用顶点的立方体
+void makeCube(QVector<Vertex>& vertices, QVector<unsigned int>& indices) {
+    vertices.clear();
+    for(int i = 0; i < 8; i++) {
+        QVector3D position((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+        vertices.push_back(Vertex(position, QVector3D(), QVector2D(0.0f, 0.0f)));
+    }
+    // 每个面两个三角形，逆时针朝外
+    const unsigned int faces[6][4] = {
+        {0, 4, 6, 2}, {1, 3, 7, 5},     // -x, +x
+        {0, 1, 5, 4}, {2, 6, 7, 3},     // -y, +y
+        {0, 2, 3, 1}, {4, 5, 7, 6},     // -z, +z
+    };
+    indices.clear();
+    for(const auto& f : faces)
+        indices << f[0] << f[1] << f[2] << f[0] << f[2] << f[3];
+}
+
+// 直接按定义的串行实现: 每个顶点累加所有位置相同的角的贡献
+QVector<QVector3D> referenceNormals(const QVector<Vertex>& vertices, const QVector<unsigned int>& indices,
+                                    NormalWeighting weighting) {
+    using Key = std::tuple<float, float, float>;
+    std::map<Key, QVector3D> accumulated;
+    for(int t = 0; t + 2 < indices.size(); t += 3) {
+        const QVector3D p[3] = {vertices[(int)indices[t]].position, vertices[(int)indices[t + 1]].position,
+                                vertices[(int)indices[t + 2]].position};
+        const QVector3D n = QVector3D::crossProduct(p[1] - p[0], p[2] - p[0]);
+        if(n.length() <= 0.0f)
+            continue;
+        for(int k = 0; k < 3; k++) {
+            QVector3D contribution = n;
+            if(weighting == NormalWeighting::Angle) {
+                const QVector3D a = (p[(k + 1) % 3] - p[k]).normalized();
+                const QVector3D b = (p[(k + 2) % 3] - p[k]).normalized();
+                contribution = n.normalized() * std::acos(qBound(-1.0f, QVector3D::dotProduct(a, b), 1.0f));
+            }
+            accumulated[Key(p[k].x(), p[k].y(), p[k].z())] += contribution;
+        }
+    }
+
+    QVector<QVector3D> normals;
+    for(const Vertex& v : vertices)
+        normals.push_back(accumulated[Key(v.position.x(), v.position.y(), v.position.z())].normalized());
+    return normals;
+}
+
+int countMismatches(const QVector<Vertex>& vertices, const QVector<QVector3D>& expected, float minDot) {
+    int mismatches = 0;
+    for(int i = 0; i < vertices.size(); i++) {
+        if(QVector3D::dotProduct(vertices[i].normal, expected[i]) < minDot)
+            mismatches++;
+    }
+    return mismatches;
+}
+
+void testSmoothMatchesReference() {
+    // 三角形数量超过一个线程的最小分段，多线程时会走并行累加
+    QVector<Vertex> vertices;
+    QVector<unsigned int> indices;
+    makeSphere(256, 128, vertices, indices);
+
+    for(NormalWeighting weighting : {NormalWeighting::Area, NormalWeighting::Angle}) {
+        QVector<Vertex> generated = vertices;
+        QVector<unsigned int> generatedIndices = indices;
+        NormalGenerator::generate(generated, generatedIndices, 180.0f, weighting);
+
+        CHECK(generated.size() == vertices.size());
+        CHECK(generatedIndices == indices);
+        CHECK(countMismatches(generated, referenceNormals(vertices, indices, weighting), 0.9999f) == 0);
+
+        // 接缝处的副本和两极必须得到同一个法线 (这里就是球面的法线)
+        int offSphere = 0;
+        for(const Vertex& v : generated) {
+            if(QVector3D::dotProduct(v.normal, v.position.normalized()) < 0.999f)
+                offSphere++;
+        }
+        CHECK(offSphere == 0);
+    }
+}
+
+void testCreaseOnSmoothMesh() {
+    // 相邻面的夹角远小于折痕角，结果和不分割时一样，也不会多出顶点
+    QVector<Vertex> vertices;
+    QVector<unsigned int> indices;
+    makeSphere(64, 32, vertices, indices);
+
+    QVector<Vertex> generated = vertices;
+    QVector<unsigned int> generatedIndices = indices;
+    NormalGenerator::generate(generated, generatedIndices, 60.0f, NormalWeighting::Angle);
+    CHECK(generated.size() == vertices.size());
+    CHECK(countMismatches(generated, referenceNormals(vertices, indices, NormalWeighting::Angle), 0.9999f) == 0);
+}
+
+void testCubeSplitsAtCreases() {
+    QVector<Vertex> vertices;
+    QVector<unsigned int> indices;
+    makeCube(vertices, indices);
+    const QVector<unsigned int> original = indices;
+
+    NormalGenerator::generate(vertices, indices, 60.0f);
+    CHECK(vertices.size() == 24);
+    CHECK(indices.size() == 36);
+    for(int t = 0; t < indices.size(); t += 3) {
+        const QVector3D& p0 = vertices[(int)indices[t]].position;
+        const QVector3D& p1 = vertices[(int)indices[t + 1]].position;
+        const QVector3D& p2 = vertices[(int)indices[t + 2]].position;
+        const QVector3D faceNormal = QVector3D::crossProduct(p1 - p0, p2 - p0).normalized();
+        for(int k = 0; k < 3; k++) {
+            CHECK_NEAR(QVector3D::dotProduct(vertices[(int)indices[t + k]].normal, faceNormal), 1.0f, 1e-5f);
+            // 拆分出的顶点位置不变
+            CHECK(vertices[(int)indices[t + k]].position == vertices[(int)original[t + k]].position);
+        }
+    }
+
+    // 不分割时角点的法线是三个面的平均 (按顶角加权三个面的权重相同)
+    makeCube(vertices, indices);
+    NormalGenerator::generate(vertices, indices, 180.0f, NormalWeighting::Angle);
+    CHECK(vertices.size() == 8);
+    for(const Vertex& v : vertices)
+        CHECK_NEAR(QVector3D::dotProduct(v.normal, v.position.normalized()), 1.0f, 1e-5f);
+}
+
+void testTangents() {
+    QVector<Vertex> vertices;
+    QVector<unsigned int> indices;
+    makeSphere(64, 32, vertices, indices);
+    NormalGenerator::generate(vertices, indices, 180.0f);
+
+    QVector<QVector4D> tangents = NormalGenerator::generateTangents(vertices, indices);
+    CHECK(tangents.size() == vertices.size());
+    for(int i = 0; i < tangents.size(); i++) {
+        const QVector3D t = tangents[i].toVector3D();
+        CHECK_NEAR(t.length(), 1.0f, 1e-4f);
+        CHECK_NEAR(QVector3D::dotProduct(t, vertices[i].normal), 0.0f, 1e-4f);
+        CHECK(tangents[i].w() == 1.0f || tangents[i].w() == -1.0f);
+    }
+
+    // xy平面上的四边形，u沿+x，v沿+y: 切线是+x，副切线和n x t同向
+    QVector<Vertex> quad;
+    quad.push_back(Vertex(QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 0.0f, 1.0f), QVector2D(0.0f, 0.0f)));
+    quad.push_back(Vertex(QVector3D(1.0f, 0.0f, 0.0f), QVector3D(0.0f, 0.0f, 1.0f), QVector2D(1.0f, 0.0f)));
+    quad.push_back(Vertex(QVector3D(1.0f, 1.0f, 0.0f), QVector3D(0.0f, 0.0f, 1.0f), QVector2D(1.0f, 1.0f)));
+    quad.push_back(Vertex(QVector3D(0.0f, 1.0f, 0.0f), QVector3D(0.0f, 0.0f, 1.0f), QVector2D(0.0f, 1.0f)));
+    QVector<unsigned int> quadIndices;
+    quadIndices << 0 << 1 << 2 << 0 << 2 << 3;
+    for(const QVector4D& t : NormalGenerator::generateTangents(quad, quadIndices)) {
+        CHECK_NEAR(t.x(), 1.0f, 1e-5f);
+        CHECK_NEAR(t.w(), 1.0f, 1e-5f);
+    }
+}
+
+}   // namespace
+
+int main() {
+    testSmoothMatchesReference();
+    testCreaseOnSmoothMesh();
+    testCubeSplitsAtCreases();
+    testTangents();
+    return test::finishTests("normal_generator_test");
+}
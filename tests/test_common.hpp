@@ -0,0 +1,63 @@
+//
+// Created by fangl on 2023/10/17.
+//
+
+#ifndef TEST_COMMON_HPP
+#define TEST_COMMON_HPP
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+
+// 不依赖测试框架的最小工具: CHECK失败时打印位置并计数，main最后返回 finishTests()
+namespace test {
+
+inline int& failureCount() {
+    static int count = 0;
+    return count;
+}
+
+inline int finishTests(const char* name) {
+    if(failureCount() == 0)
+        std::printf("[%s] all checks passed\n", name);
+    else
+        std::printf("[%s] %d check(s) failed\n", name, failureCount());
+    return failureCount() == 0 ? 0 : 1;
+}
+
+// 执行repeat次，返回最快一次的毫秒数
+template<typename Func>
+double measureMs(int repeat, Func&& func) {
+    double best = 0.0;
+    for(int i = 0; i < repeat; i++) {
+        auto begin = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+        if(i == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+}   // namespace test
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);     \
+            test::failureCount()++;                                                  \
+        }                                                                            \
+    } while(0)
+
+#define CHECK_NEAR(a, b, eps)                                                        \
+    do {                                                                             \
+        if(std::fabs((double)(a) - (double)(b)) > (double)(eps)) {                   \
+            std::printf("%s:%d: CHECK_NEAR failed: %s = %g, %s = %g\n",              \
+                        __FILE__, __LINE__, #a, (double)(a), #b, (double)(b));       \
+            test::failureCount()++;                                                  \
+        }                                                                            \
+    } while(0)
+
+#endif  //TEST_COMMON_HPP